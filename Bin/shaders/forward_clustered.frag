@@ -23,7 +23,13 @@ struct lightData_t
 {
 	vec3 position;
 	float radius;
-	vec4 color;
+	vec3 color;
+	uint type;
+	vec3 direction;
+	float halfLength;
+	float spotCosOuter;
+	float spotCosInner;
+	vec2 pad;
 };
 
 layout(std430, binding = 0) buffer offsetList
@@ -33,6 +39,8 @@ layout(std430, binding = 0) buffer offsetList
 
 layout(std430, binding = 1) buffer itemList
 {
+	uint itemFormat;
+	uint itemCount;
 	uint itemData[];
 };
 
@@ -58,6 +66,15 @@ float MipLevel(vec2 uv, vec2 tex_size)
 	return miplevel;
 }
 
+// NOTE: 16 bit items are packed in pairs, the first in the low half.
+uint GetClusterItem(uint Index)
+{
+	if (itemFormat == CLUSTER_ITEM_FORMAT_U16)
+		return (itemData[Index >> 1] >> ((Index & 1u) * 16u)) & 0xFFFFu;
+
+	return itemData[Index];
+}
+
 float Attenuation(vec3 LightToVert, float Radius)
 {
 	float distance = length(LightToVert);
@@ -68,6 +85,28 @@ float Attenuation(vec3 LightToVert, float Radius)
 	return falloff;
 }
 
+// Vector from the surface to the light, capsules light from their closest point. ConeAtt fades spot lights
+// out between their inner and outer cone.
+vec3 GetLightVector(lightData_t Light, vec3 WS, out float ConeAtt)
+{
+	vec3 lightPos = Light.position;
+	ConeAtt = 1.0;
+
+	if (Light.type == LIGHT_TYPE_CAPSULE)
+	{
+		vec3 segStart = Light.position - Light.direction * Light.halfLength;
+		float t = clamp(dot(WS - segStart, Light.direction), 0.0, 2.0 * Light.halfLength);
+		lightPos = segStart + Light.direction * t;
+	}
+
+	vec3 lightToVert = lightPos - WS;
+
+	if (Light.type == LIGHT_TYPE_SPOT)
+		ConeAtt = smoothstep(Light.spotCosOuter, Light.spotCosInner, dot(normalize(-lightToVert), Light.direction));
+
+	return lightToVert;
+}
+
 void main()
 {	
 	//-------------------------------------------------------------------------------------------------
@@ -86,18 +125,18 @@ void main()
 	float eyeZ = (1.0 / gl_FragCoord.w);
 
 	vec3 cellPos = gl_FragCoord.xyz;
-	cellPos.x /= (screenSize.x / 16.0);
-	cellPos.y /= (screenSize.y / 8.0);
-	cellPos.z = (log(eyeZ / CLUSTER_NEAR_PLANE) / log(CLUSTER_FAR_PLANE / CLUSTER_NEAR_PLANE)) * 24.0 + 1.0f;
+	cellPos.x /= (screenSize.x / float(CLUSTER_GRID_X));
+	cellPos.y /= (screenSize.y / float(CLUSTER_GRID_Y));
+	cellPos.z = (log(eyeZ / CLUSTER_NEAR_PLANE) / log(CLUSTER_FAR_PLANE / CLUSTER_NEAR_PLANE)) * float(CLUSTER_GRID_Z) + 1.0f;
 	
 	int cellX = int(cellPos.x);
 	int cellY = int(cellPos.y);
 	int cellZ = int(cellPos.z);
 
 	// NOTE: Probably don't have to clamp X and Y due to view frustum always being within cluster frustum.
-	cellZ = clamp(cellZ, 1, 24);
+	cellZ = clamp(cellZ, 1, CLUSTER_GRID_Z - 1);
 
-	cellData_t cell = cellData[(cellZ * (16 * 8)) + (cellY * 16) + (cellX)];
+	cellData_t cell = cellData[(cellZ * (CLUSTER_GRID_X * CLUSTER_GRID_Y)) + (cellY * CLUSTER_GRID_X) + (cellX)];
 
 	vec3 lightColor = vec3(0, 0, 0);
 
@@ -107,10 +146,11 @@ void main()
 #else
 	for (int i = 0; i < cell.lightCount; ++i)
 	{
-		uint lightOffset = itemData[cell.itemOffset + i];
+		uint lightOffset = GetClusterItem(cell.itemOffset + i);
 		lightData_t light = lightData[lightOffset];
-		vec3 lightToVert = light.position.xyz - inWS.xyz;
-		float att = Attenuation(lightToVert, light.radius);
+		float coneAtt;
+		vec3 lightToVert = GetLightVector(light, inWS.xyz, coneAtt);
+		float att = Attenuation(lightToVert, light.radius) * coneAtt;
 
 	#if 1
 
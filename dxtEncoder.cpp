@@ -0,0 +1,688 @@
+#include "dxtEncoder.h"
+
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define DXT_ENABLE_SSE4
+#define DXT_ENABLE_AVX2
+#else
+#if defined(__SSE4_1__)
+#define DXT_ENABLE_SSE4
+#endif
+#if defined(__AVX2__)
+#define DXT_ENABLE_AVX2
+#endif
+#endif
+
+#if defined(DXT_ENABLE_SSE4) || defined(DXT_ENABLE_AVX2)
+#include <immintrin.h>
+#endif
+
+//-----------------------------------------------------------------------------------------------------------
+// Lanes.
+//-----------------------------------------------------------------------------------------------------------
+// NOTE: The encoder is written once against these lane types, every lane compresses its own block.
+// All operations are vertical so the scalar, SSE4 and AVX2 paths produce identical blocks.
+struct vsDxtLanes1
+{
+	typedef i32 V;
+	typedef f32 F;
+	enum { count = 1 };
+
+	static __forceinline V Set(i32 A) { return A; }
+	static __forceinline V Add(V A, V B) { return A + B; }
+	static __forceinline V Sub(V A, V B) { return A - B; }
+	static __forceinline V Mul(V A, V B) { return A * B; }
+	static __forceinline V Min(V A, V B) { return A < B ? A : B; }
+	static __forceinline V Max(V A, V B) { return A > B ? A : B; }
+	static __forceinline V And(V A, V B) { return A & B; }
+	static __forceinline V Or(V A, V B) { return A | B; }
+	static __forceinline V Xor(V A, V B) { return A ^ B; }
+	static __forceinline V Shl(V A, i32 N) { return (V)((u32)A << N); }
+	static __forceinline V Shr(V A, i32 N) { return (V)((u32)A >> N); }
+	static __forceinline V CmpGt(V A, V B) { return A > B ? -1 : 0; }
+	static __forceinline V CmpEq(V A, V B) { return A == B ? -1 : 0; }
+	static __forceinline V Select(V Mask, V A, V B) { return (Mask & A) | (~Mask & B); }
+	static __forceinline void Store(i32* Dst, V A) { Dst[0] = A; }
+
+	static __forceinline F FSet(f32 A) { return A; }
+	static __forceinline F FAdd(F A, F B) { return A + B; }
+	static __forceinline F FMul(F A, F B) { return A * B; }
+	static __forceinline F FDiv(F A, F B) { return A / B; }
+	static __forceinline F FMin(F A, F B) { return A < B ? A : B; }
+	static __forceinline F FMax(F A, F B) { return A > B ? A : B; }
+	static __forceinline F ToFloat(V A) { return (f32)A; }
+	static __forceinline V ToInt(F A) { return (i32)A; }
+
+	static __forceinline void LoadPixels(u8** Blocks, i32 RowStride, V* Pixels)
+	{
+		for (i32 r = 0; r < 4; ++r)
+			memcpy(&Pixels[r * 4], Blocks[0] + r * RowStride, 16);
+	}
+};
+
+#ifdef DXT_ENABLE_SSE4
+struct vsDxtLanes4
+{
+	typedef __m128i V;
+	typedef __m128 F;
+	enum { count = 4 };
+
+	static __forceinline V Set(i32 A) { return _mm_set1_epi32(A); }
+	static __forceinline V Add(V A, V B) { return _mm_add_epi32(A, B); }
+	static __forceinline V Sub(V A, V B) { return _mm_sub_epi32(A, B); }
+	static __forceinline V Mul(V A, V B) { return _mm_mullo_epi32(A, B); }
+	static __forceinline V Min(V A, V B) { return _mm_min_epi32(A, B); }
+	static __forceinline V Max(V A, V B) { return _mm_max_epi32(A, B); }
+	static __forceinline V And(V A, V B) { return _mm_and_si128(A, B); }
+	static __forceinline V Or(V A, V B) { return _mm_or_si128(A, B); }
+	static __forceinline V Xor(V A, V B) { return _mm_xor_si128(A, B); }
+	static __forceinline V Shl(V A, i32 N) { return _mm_sll_epi32(A, _mm_cvtsi32_si128(N)); }
+	static __forceinline V Shr(V A, i32 N) { return _mm_srl_epi32(A, _mm_cvtsi32_si128(N)); }
+	static __forceinline V CmpGt(V A, V B) { return _mm_cmpgt_epi32(A, B); }
+	static __forceinline V CmpEq(V A, V B) { return _mm_cmpeq_epi32(A, B); }
+	static __forceinline V Select(V Mask, V A, V B) { return _mm_blendv_epi8(B, A, Mask); }
+	static __forceinline void Store(i32* Dst, V A) { _mm_storeu_si128((__m128i*)Dst, A); }
+
+	static __forceinline F FSet(f32 A) { return _mm_set1_ps(A); }
+	static __forceinline F FAdd(F A, F B) { return _mm_add_ps(A, B); }
+	static __forceinline F FMul(F A, F B) { return _mm_mul_ps(A, B); }
+	static __forceinline F FDiv(F A, F B) { return _mm_div_ps(A, B); }
+	static __forceinline F FMin(F A, F B) { return _mm_min_ps(A, B); }
+	static __forceinline F FMax(F A, F B) { return _mm_max_ps(A, B); }
+	static __forceinline F ToFloat(V A) { return _mm_cvtepi32_ps(A); }
+	static __forceinline V ToInt(F A) { return _mm_cvttps_epi32(A); }
+
+	static __forceinline void LoadPixels(u8** Blocks, i32 RowStride, V* Pixels)
+	{
+		// Transpose each block row so a register holds the same pixel of 4 blocks.
+		for (i32 r = 0; r < 4; ++r)
+		{
+			V a = _mm_loadu_si128((__m128i*)(Blocks[0] + r * RowStride));
+			V b = _mm_loadu_si128((__m128i*)(Blocks[1] + r * RowStride));
+			V c = _mm_loadu_si128((__m128i*)(Blocks[2] + r * RowStride));
+			V d = _mm_loadu_si128((__m128i*)(Blocks[3] + r * RowStride));
+
+			V t0 = _mm_unpacklo_epi32(a, b);
+			V t1 = _mm_unpacklo_epi32(c, d);
+			V t2 = _mm_unpackhi_epi32(a, b);
+			V t3 = _mm_unpackhi_epi32(c, d);
+
+			Pixels[r * 4 + 0] = _mm_unpacklo_epi64(t0, t1);
+			Pixels[r * 4 + 1] = _mm_unpackhi_epi64(t0, t1);
+			Pixels[r * 4 + 2] = _mm_unpacklo_epi64(t2, t3);
+			Pixels[r * 4 + 3] = _mm_unpackhi_epi64(t2, t3);
+		}
+	}
+};
+#endif
+
+#ifdef DXT_ENABLE_AVX2
+struct vsDxtLanes8
+{
+	typedef __m256i V;
+	typedef __m256 F;
+	enum { count = 8 };
+
+	static __forceinline V Set(i32 A) { return _mm256_set1_epi32(A); }
+	static __forceinline V Add(V A, V B) { return _mm256_add_epi32(A, B); }
+	static __forceinline V Sub(V A, V B) { return _mm256_sub_epi32(A, B); }
+	static __forceinline V Mul(V A, V B) { return _mm256_mullo_epi32(A, B); }
+	static __forceinline V Min(V A, V B) { return _mm256_min_epi32(A, B); }
+	static __forceinline V Max(V A, V B) { return _mm256_max_epi32(A, B); }
+	static __forceinline V And(V A, V B) { return _mm256_and_si256(A, B); }
+	static __forceinline V Or(V A, V B) { return _mm256_or_si256(A, B); }
+	static __forceinline V Xor(V A, V B) { return _mm256_xor_si256(A, B); }
+	static __forceinline V Shl(V A, i32 N) { return _mm256_sll_epi32(A, _mm_cvtsi32_si128(N)); }
+	static __forceinline V Shr(V A, i32 N) { return _mm256_srl_epi32(A, _mm_cvtsi32_si128(N)); }
+	static __forceinline V CmpGt(V A, V B) { return _mm256_cmpgt_epi32(A, B); }
+	static __forceinline V CmpEq(V A, V B) { return _mm256_cmpeq_epi32(A, B); }
+	static __forceinline V Select(V Mask, V A, V B) { return _mm256_blendv_epi8(B, A, Mask); }
+	static __forceinline void Store(i32* Dst, V A) { _mm256_storeu_si256((__m256i*)Dst, A); }
+
+	static __forceinline F FSet(f32 A) { return _mm256_set1_ps(A); }
+	static __forceinline F FAdd(F A, F B) { return _mm256_add_ps(A, B); }
+	static __forceinline F FMul(F A, F B) { return _mm256_mul_ps(A, B); }
+	static __forceinline F FDiv(F A, F B) { return _mm256_div_ps(A, B); }
+	static __forceinline F FMin(F A, F B) { return _mm256_min_ps(A, B); }
+	static __forceinline F FMax(F A, F B) { return _mm256_max_ps(A, B); }
+	static __forceinline F ToFloat(V A) { return _mm256_cvtepi32_ps(A); }
+	static __forceinline V ToInt(F A) { return _mm256_cvttps_epi32(A); }
+
+	static __forceinline V LoadPair(u8* Lo, u8* Hi)
+	{
+		return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((__m128i*)Lo)), _mm_loadu_si128((__m128i*)Hi), 1);
+	}
+
+	static __forceinline void LoadPixels(u8** Blocks, i32 RowStride, V* Pixels)
+	{
+		// Blocks 0-3 go in the low half and 4-7 in the high half, unpacks then transpose within each half.
+		for (i32 r = 0; r < 4; ++r)
+		{
+			i32 o = r * RowStride;
+			V a = LoadPair(Blocks[0] + o, Blocks[4] + o);
+			V b = LoadPair(Blocks[1] + o, Blocks[5] + o);
+			V c = LoadPair(Blocks[2] + o, Blocks[6] + o);
+			V d = LoadPair(Blocks[3] + o, Blocks[7] + o);
+
+			V t0 = _mm256_unpacklo_epi32(a, b);
+			V t1 = _mm256_unpacklo_epi32(c, d);
+			V t2 = _mm256_unpackhi_epi32(a, b);
+			V t3 = _mm256_unpackhi_epi32(c, d);
+
+			Pixels[r * 4 + 0] = _mm256_unpacklo_epi64(t0, t1);
+			Pixels[r * 4 + 1] = _mm256_unpackhi_epi64(t0, t1);
+			Pixels[r * 4 + 2] = _mm256_unpacklo_epi64(t2, t3);
+			Pixels[r * 4 + 3] = _mm256_unpackhi_epi64(t2, t3);
+		}
+	}
+};
+#endif
+
+//-----------------------------------------------------------------------------------------------------------
+// Block encoder.
+//-----------------------------------------------------------------------------------------------------------
+template <typename L>
+__forceinline typename L::V DxtQuantize(typename L::V X, i32 Scale)
+{
+	// Rounded X * Scale / 255.
+	typename L::V t = L::Add(L::Mul(X, L::Set(Scale)), L::Set(128));
+	return L::Shr(L::Add(t, L::Shr(t, 8)), 8);
+}
+
+template <typename L>
+struct vsDxtEndpoints
+{
+	typename L::V r5[2];
+	typename L::V g6[2];
+	typename L::V b5[2];
+};
+
+// Orders the endpoints, then picks indices by projecting each pixel onto the quantized endpoint axis.
+// Positions are 0 at color1 through 3 at color0 and feed the least squares refit.
+template <typename L>
+__forceinline void DxtMatchColors(typename L::V* R, typename L::V* G, typename L::V* B, vsDxtEndpoints<L>* Ends, typename L::V* Color0, typename L::V* Color1, typename L::V* ColorBits, typename L::V* Positions)
+{
+	typedef typename L::V V;
+
+	V zero = L::Set(0);
+	V one = L::Set(1);
+	V two = L::Set(2);
+	V three = L::Set(3);
+	V four = L::Set(4);
+
+	V color0 = L::Or(L::Or(L::Shl(Ends->r5[0], 11), L::Shl(Ends->g6[0], 5)), Ends->b5[0]);
+	V color1 = L::Or(L::Or(L::Shl(Ends->r5[1], 11), L::Shl(Ends->g6[1], 5)), Ends->b5[1]);
+
+	// Keep color0 > color1 so the block also decodes correctly as four colour DXT1.
+	V swap = L::CmpGt(color1, color0);
+	V t;
+	t = L::Select(swap, color1, color0); color1 = L::Select(swap, color0, color1); color0 = t;
+	t = L::Select(swap, Ends->r5[1], Ends->r5[0]); Ends->r5[1] = L::Select(swap, Ends->r5[0], Ends->r5[1]); Ends->r5[0] = t;
+	t = L::Select(swap, Ends->g6[1], Ends->g6[0]); Ends->g6[1] = L::Select(swap, Ends->g6[0], Ends->g6[1]); Ends->g6[0] = t;
+	t = L::Select(swap, Ends->b5[1], Ends->b5[0]); Ends->b5[1] = L::Select(swap, Ends->b5[0], Ends->b5[1]); Ends->b5[0] = t;
+
+	V e0R = L::Or(L::Shl(Ends->r5[0], 3), L::Shr(Ends->r5[0], 2));
+	V e0G = L::Or(L::Shl(Ends->g6[0], 2), L::Shr(Ends->g6[0], 4));
+	V e0B = L::Or(L::Shl(Ends->b5[0], 3), L::Shr(Ends->b5[0], 2));
+	V e1R = L::Or(L::Shl(Ends->r5[1], 3), L::Shr(Ends->r5[1], 2));
+	V e1G = L::Or(L::Shl(Ends->g6[1], 2), L::Shr(Ends->g6[1], 4));
+	V e1B = L::Or(L::Shl(Ends->b5[1], 3), L::Shr(Ends->b5[1], 2));
+
+	V dirR = L::Sub(e0R, e1R);
+	V dirG = L::Sub(e0G, e1G);
+	V dirB = L::Sub(e0B, e1B);
+	V len2 = L::Add(L::Add(L::Mul(dirR, dirR), L::Mul(dirG, dirG)), L::Mul(dirB, dirB));
+	V stop1 = len2;
+	V stop3 = L::Mul(len2, three);
+	V stop5 = L::Mul(len2, L::Set(5));
+	V six = L::Set(6);
+	V colorBits = zero;
+
+	for (i32 i = 0; i < 16; ++i)
+	{
+		V dot = L::Add(L::Add(L::Mul(L::Sub(R[i], e1R), dirR), L::Mul(L::Sub(G[i], e1G), dirG)), L::Mul(L::Sub(B[i], e1B), dirB));
+		V dot6 = L::Mul(dot, six);
+
+		V j = L::Sub(L::Sub(L::Sub(zero, L::CmpGt(dot6, stop1)), L::CmpGt(dot6, stop3)), L::CmpGt(dot6, stop5));
+		V idx = L::And(L::Sub(four, j), three);
+		idx = L::Xor(idx, L::And(L::CmpGt(two, idx), one));
+
+		Positions[i] = j;
+		colorBits = L::Or(colorBits, L::Shl(idx, i * 2));
+	}
+
+	*Color0 = color0;
+	*Color1 = color1;
+	*ColorBits = L::Select(L::CmpEq(color0, color1), zero, colorBits);
+}
+
+template <typename L>
+__forceinline typename L::V DxtSolveEndpoint(typename L::V NumA, typename L::V NumB, typename L::F Scale, i32 Max)
+{
+	typename L::F v = L::FAdd(L::FMul(L::ToFloat(L::Sub(NumA, NumB)), Scale), L::FSet(0.5f));
+	v = L::FMin(L::FMax(v, L::FSet(0.0f)), L::FSet((f32)Max));
+	return L::ToInt(v);
+}
+
+// NOTE: Bounding box endpoints with an inset and a diagonal picked from the colour covariance, refined once by
+// a least squares fit against the chosen indices. Alpha uses the exact range in 8 value mode.
+template <typename L>
+__forceinline void DxtEncodeBlocks(u8** Blocks, i32 RowStride, vsDxtPixelOrder Order, u8** Output)
+{
+	typedef typename L::V V;
+	typedef typename L::F F;
+
+	V pixels[16];
+	L::LoadPixels(Blocks, RowStride, pixels);
+
+	V zero = L::Set(0);
+	V one = L::Set(1);
+	V two = L::Set(2);
+	V three = L::Set(3);
+	V mask8 = L::Set(255);
+	i32 rShift = (Order == DXT_PIXEL_RGBA) ? 0 : 16;
+	i32 bShift = 16 - rShift;
+
+	V r[16], g[16], b[16], a[16];
+
+	for (i32 i = 0; i < 16; ++i)
+	{
+		r[i] = L::And(L::Shr(pixels[i], rShift), mask8);
+		g[i] = L::And(L::Shr(pixels[i], 8), mask8);
+		b[i] = L::And(L::Shr(pixels[i], bShift), mask8);
+		a[i] = L::Shr(pixels[i], 24);
+	}
+
+	V minR = r[0], minG = g[0], minB = b[0], minA = a[0];
+	V maxR = r[0], maxG = g[0], maxB = b[0], maxA = a[0];
+
+	for (i32 i = 1; i < 16; ++i)
+	{
+		minR = L::Min(minR, r[i]); maxR = L::Max(maxR, r[i]);
+		minG = L::Min(minG, g[i]); maxG = L::Max(maxG, g[i]);
+		minB = L::Min(minB, b[i]); maxB = L::Max(maxB, b[i]);
+		minA = L::Min(minA, a[i]); maxA = L::Max(maxA, a[i]);
+	}
+
+	// Flip red and blue against green when they are anti-correlated.
+	V centerR = L::Add(minR, maxR);
+	V centerG = L::Add(minG, maxG);
+	V centerB = L::Add(minB, maxB);
+	V covRG = zero;
+	V covBG = zero;
+
+	for (i32 i = 0; i < 16; ++i)
+	{
+		V tG = L::Sub(L::Shl(g[i], 1), centerG);
+		covRG = L::Add(covRG, L::Mul(L::Sub(L::Shl(r[i], 1), centerR), tG));
+		covBG = L::Add(covBG, L::Mul(L::Sub(L::Shl(b[i], 1), centerB), tG));
+	}
+
+	V insetR = L::Shr(L::Sub(maxR, minR), 4);
+	V insetG = L::Shr(L::Sub(maxG, minG), 4);
+	V insetB = L::Shr(L::Sub(maxB, minB), 4);
+	minR = L::Add(minR, insetR); maxR = L::Sub(maxR, insetR);
+	minG = L::Add(minG, insetG); maxG = L::Sub(maxG, insetG);
+	minB = L::Add(minB, insetB); maxB = L::Sub(maxB, insetB);
+
+	V flipR = L::CmpGt(zero, covRG);
+	V flipB = L::CmpGt(zero, covBG);
+
+	vsDxtEndpoints<L> ends;
+	ends.r5[0] = DxtQuantize<L>(L::Select(flipR, minR, maxR), 31);
+	ends.r5[1] = DxtQuantize<L>(L::Select(flipR, maxR, minR), 31);
+	ends.g6[0] = DxtQuantize<L>(maxG, 63);
+	ends.g6[1] = DxtQuantize<L>(minG, 63);
+	ends.b5[0] = DxtQuantize<L>(L::Select(flipB, minB, maxB), 31);
+	ends.b5[1] = DxtQuantize<L>(L::Select(flipB, maxB, minB), 31);
+
+	V color0, color1, colorBits;
+	V positions[16];
+	DxtMatchColors<L>(r, g, b, &ends, &color0, &color1, &colorBits, positions);
+
+	// Least squares refit of both endpoints given the positions along the axis.
+	V xx = zero, yy = zero, xy = zero;
+	V at1R = zero, at1G = zero, at1B = zero;
+	V at2R = zero, at2G = zero, at2B = zero;
+
+	for (i32 i = 0; i < 16; ++i)
+	{
+		V w1 = positions[i];
+		V w2 = L::Sub(three, w1);
+		xx = L::Add(xx, L::Mul(w1, w1));
+		yy = L::Add(yy, L::Mul(w2, w2));
+		xy = L::Add(xy, L::Mul(w1, w2));
+		at1R = L::Add(at1R, L::Mul(w1, r[i])); at2R = L::Add(at2R, L::Mul(w2, r[i]));
+		at1G = L::Add(at1G, L::Mul(w1, g[i])); at2G = L::Add(at2G, L::Mul(w2, g[i]));
+		at1B = L::Add(at1B, L::Mul(w1, b[i])); at2B = L::Add(at2B, L::Mul(w2, b[i]));
+	}
+
+	V det = L::Sub(L::Mul(xx, yy), L::Mul(xy, xy));
+	V singular = L::CmpEq(det, zero);
+	F safeDet = L::ToFloat(L::Select(singular, one, det));
+	F scaleRB = L::FDiv(L::FSet(3.0f * 31.0f / 255.0f), safeDet);
+	F scaleG = L::FDiv(L::FSet(3.0f * 63.0f / 255.0f), safeDet);
+
+	vsDxtEndpoints<L> refit;
+	refit.r5[0] = L::Select(singular, ends.r5[0], DxtSolveEndpoint<L>(L::Mul(at1R, yy), L::Mul(at2R, xy), scaleRB, 31));
+	refit.g6[0] = L::Select(singular, ends.g6[0], DxtSolveEndpoint<L>(L::Mul(at1G, yy), L::Mul(at2G, xy), scaleG, 63));
+	refit.b5[0] = L::Select(singular, ends.b5[0], DxtSolveEndpoint<L>(L::Mul(at1B, yy), L::Mul(at2B, xy), scaleRB, 31));
+	refit.r5[1] = L::Select(singular, ends.r5[1], DxtSolveEndpoint<L>(L::Mul(at2R, xx), L::Mul(at1R, xy), scaleRB, 31));
+	refit.g6[1] = L::Select(singular, ends.g6[1], DxtSolveEndpoint<L>(L::Mul(at2G, xx), L::Mul(at1G, xy), scaleG, 63));
+	refit.b5[1] = L::Select(singular, ends.b5[1], DxtSolveEndpoint<L>(L::Mul(at2B, xx), L::Mul(at1B, xy), scaleRB, 31));
+
+	DxtMatchColors<L>(r, g, b, &refit, &color0, &color1, &colorBits, positions);
+
+	// NOTE: Bias matches the truncating 8 value alpha palette, same as stb_dxt.
+	V range = L::Sub(maxA, minA);
+	V bias = L::Select(L::CmpGt(L::Set(8), range), L::Sub(range, one), L::Add(L::Shr(range, 1), two));
+	V stops[7];
+
+	for (i32 k = 0; k < 7; ++k)
+		stops[k] = L::Sub(L::Mul(range, L::Set(k + 1)), one);
+
+	V eight = L::Set(8);
+	V seven = L::Set(7);
+	V alphaBits[2] = { zero, zero };
+
+	for (i32 i = 0; i < 16; ++i)
+	{
+		V d = L::Add(L::Mul(L::Sub(a[i], minA), seven), bias);
+		V j = zero;
+
+		for (i32 k = 0; k < 7; ++k)
+			j = L::Sub(j, L::CmpGt(d, stops[k]));
+
+		// Position from min (0) to max (7), remapped to the 8 value palette order.
+		V idx = L::And(L::Sub(eight, j), seven);
+		idx = L::Xor(idx, L::And(L::CmpGt(two, idx), one));
+
+		alphaBits[i / 8] = L::Or(alphaBits[i / 8], L::Shl(idx, (i % 8) * 3));
+	}
+
+	i32 outColor0[L::count], outColor1[L::count], outColorBits[L::count];
+	i32 outAlpha0[L::count], outAlpha1[L::count], outAlphaLo[L::count], outAlphaHi[L::count];
+
+	L::Store(outColor0, color0);
+	L::Store(outColor1, color1);
+	L::Store(outColorBits, colorBits);
+	L::Store(outAlpha0, maxA);
+	L::Store(outAlpha1, minA);
+	L::Store(outAlphaLo, alphaBits[0]);
+	L::Store(outAlphaHi, alphaBits[1]);
+
+	for (i32 i = 0; i < L::count; ++i)
+	{
+		u8* block = Output[i];
+		block[0] = (u8)outAlpha0[i];
+		block[1] = (u8)outAlpha1[i];
+		block[2] = (u8)(outAlphaLo[i]);
+		block[3] = (u8)(outAlphaLo[i] >> 8);
+		block[4] = (u8)(outAlphaLo[i] >> 16);
+		block[5] = (u8)(outAlphaHi[i]);
+		block[6] = (u8)(outAlphaHi[i] >> 8);
+		block[7] = (u8)(outAlphaHi[i] >> 16);
+		block[8] = (u8)(outColor0[i]);
+		block[9] = (u8)(outColor0[i] >> 8);
+		block[10] = (u8)(outColor1[i]);
+		block[11] = (u8)(outColor1[i] >> 8);
+		block[12] = (u8)(outColorBits[i]);
+		block[13] = (u8)(outColorBits[i] >> 8);
+		block[14] = (u8)(outColorBits[i] >> 16);
+		block[15] = (u8)(outColorBits[i] >> 24);
+	}
+}
+
+template <typename L>
+void DxtEncodeImage(u8* Src, i32 Width, i32 Height, i32 Pitch, vsDxtPixelOrder Order, u8* Dst)
+{
+	i32 blocksX = Width / 4;
+	i32 blocksY = Height / 4;
+	u8* blocks[L::count];
+	u8* output[L::count];
+
+	for (i32 bY = 0; bY < blocksY; ++bY)
+	{
+		u8* srcRow = Src + bY * 4 * Pitch;
+		u8* dstRow = Dst + bY * blocksX * 16;
+		i32 bX = 0;
+
+		for (; bX + L::count <= blocksX; bX += L::count)
+		{
+			for (i32 i = 0; i < L::count; ++i)
+			{
+				blocks[i] = srcRow + (bX + i) * 16;
+				output[i] = dstRow + (bX + i) * 16;
+			}
+
+			DxtEncodeBlocks<L>(blocks, Pitch, Order, output);
+		}
+
+		for (; bX < blocksX; ++bX)
+		{
+			blocks[0] = srcRow + bX * 16;
+			output[0] = dstRow + bX * 16;
+			DxtEncodeBlocks<vsDxtLanes1>(blocks, Pitch, Order, output);
+		}
+	}
+}
+
+// NOTE: Block streams store each block's 16 pixels contiguously, so a block row is 16 bytes apart.
+template <typename L>
+void DxtEncodeBlockStream(u8* Src, i32 BlockCount, vsDxtPixelOrder Order, u8* Dst)
+{
+	u8* blocks[L::count];
+	u8* output[L::count];
+	i32 b = 0;
+
+	for (; b + L::count <= BlockCount; b += L::count)
+	{
+		for (i32 i = 0; i < L::count; ++i)
+		{
+			blocks[i] = Src + (b + i) * 64;
+			output[i] = Dst + (b + i) * 16;
+		}
+
+		DxtEncodeBlocks<L>(blocks, 16, Order, output);
+	}
+
+	for (; b < BlockCount; ++b)
+	{
+		blocks[0] = Src + b * 64;
+		output[0] = Dst + b * 16;
+		DxtEncodeBlocks<vsDxtLanes1>(blocks, 16, Order, output);
+	}
+}
+
+#ifdef DXT_ENABLE_SSE4
+static void DxtEncodeImageSSE4(u8* Src, i32 Width, i32 Height, i32 Pitch, vsDxtPixelOrder Order, u8* Dst)
+{
+	DxtEncodeImage<vsDxtLanes4>(Src, Width, Height, Pitch, Order, Dst);
+}
+
+static void DxtEncodeBlockStreamSSE4(u8* Src, i32 BlockCount, vsDxtPixelOrder Order, u8* Dst)
+{
+	DxtEncodeBlockStream<vsDxtLanes4>(Src, BlockCount, Order, Dst);
+}
+#endif
+
+#ifdef DXT_ENABLE_AVX2
+static void DxtEncodeImageAVX2(u8* Src, i32 Width, i32 Height, i32 Pitch, vsDxtPixelOrder Order, u8* Dst)
+{
+	DxtEncodeImage<vsDxtLanes8>(Src, Width, Height, Pitch, Order, Dst);
+	_mm256_zeroupper();
+}
+
+static void DxtEncodeBlockStreamAVX2(u8* Src, i32 BlockCount, vsDxtPixelOrder Order, u8* Dst)
+{
+	DxtEncodeBlockStream<vsDxtLanes8>(Src, BlockCount, Order, Dst);
+	_mm256_zeroupper();
+}
+#endif
+
+//-----------------------------------------------------------------------------------------------------------
+// Dispatch.
+//-----------------------------------------------------------------------------------------------------------
+static bool dxtPathSupported[DXT_PATH_COUNT] = { true, false, false };
+static vsDxtEncodePath dxtEncodePath = DXT_PATH_SCALAR;
+
+void DxtInitEncoder()
+{
+#if defined(_MSC_VER)
+	i32 cpuInfo[4];
+	__cpuid(cpuInfo, 0);
+	i32 maxLeaf = cpuInfo[0];
+
+	__cpuid(cpuInfo, 1);
+	bool sse41 = (cpuInfo[2] & (1 << 19)) != 0;
+	bool osAvx = (cpuInfo[2] & (1 << 27)) != 0 && (cpuInfo[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+	bool avx2 = false;
+
+	if (maxLeaf >= 7)
+	{
+		__cpuidex(cpuInfo, 7, 0);
+		avx2 = osAvx && (cpuInfo[1] & (1 << 5)) != 0;
+	}
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+	bool sse41 = __builtin_cpu_supports("sse4.1");
+	bool avx2 = __builtin_cpu_supports("avx2");
+#else
+	bool sse41 = false;
+	bool avx2 = false;
+#endif
+
+	// NOTE: Paths that are compiled out never read their flag.
+	(void)sse41;
+	(void)avx2;
+
+#ifdef DXT_ENABLE_SSE4
+	dxtPathSupported[DXT_PATH_SSE4] = sse41;
+#endif
+#ifdef DXT_ENABLE_AVX2
+	dxtPathSupported[DXT_PATH_AVX2] = avx2;
+#endif
+
+	dxtEncodePath = DXT_PATH_SCALAR;
+
+	for (i32 i = 0; i < DXT_PATH_COUNT; ++i)
+	{
+		if (dxtPathSupported[i])
+			dxtEncodePath = (vsDxtEncodePath)i;
+	}
+
+	std::cout << "DXT encoder path: " << DxtGetEncodePathName(dxtEncodePath) << "\n";
+}
+
+bool DxtIsEncodePathSupported(vsDxtEncodePath Path)
+{
+	return dxtPathSupported[Path];
+}
+
+void DxtSetEncodePath(vsDxtEncodePath Path)
+{
+	assert(dxtPathSupported[Path]);
+	dxtEncodePath = Path;
+}
+
+vsDxtEncodePath DxtGetEncodePath()
+{
+	return dxtEncodePath;
+}
+
+const char* DxtGetEncodePathName(vsDxtEncodePath Path)
+{
+	static const char* names[DXT_PATH_COUNT] = { "Scalar", "SSE4", "AVX2" };
+	return names[Path];
+}
+
+void DxtEncodeImageDXT5(u8* Src, i32 Width, i32 Height, i32 Pitch, vsDxtPixelOrder Order, u8* Dst)
+{
+	assert(Width % 4 == 0 && Height % 4 == 0);
+
+	switch (dxtEncodePath)
+	{
+#ifdef DXT_ENABLE_AVX2
+		case DXT_PATH_AVX2: DxtEncodeImageAVX2(Src, Width, Height, Pitch, Order, Dst); break;
+#endif
+#ifdef DXT_ENABLE_SSE4
+		case DXT_PATH_SSE4: DxtEncodeImageSSE4(Src, Width, Height, Pitch, Order, Dst); break;
+#endif
+		default: DxtEncodeImage<vsDxtLanes1>(Src, Width, Height, Pitch, Order, Dst); break;
+	}
+}
+
+void DxtEncodeBlockStreamDXT5(u8* Src, i32 BlockCount, vsDxtPixelOrder Order, u8* Dst)
+{
+	switch (dxtEncodePath)
+	{
+#ifdef DXT_ENABLE_AVX2
+		case DXT_PATH_AVX2: DxtEncodeBlockStreamAVX2(Src, BlockCount, Order, Dst); break;
+#endif
+#ifdef DXT_ENABLE_SSE4
+		case DXT_PATH_SSE4: DxtEncodeBlockStreamSSE4(Src, BlockCount, Order, Dst); break;
+#endif
+		default: DxtEncodeBlockStream<vsDxtLanes1>(Src, BlockCount, Order, Dst); break;
+	}
+}
+
+void DxtDecodeBlockDXT5(u8* Block, u8* Dst)
+{
+	u8 alpha[8];
+	alpha[0] = Block[0];
+	alpha[1] = Block[1];
+
+	if (alpha[0] > alpha[1])
+	{
+		for (i32 i = 2; i < 8; ++i)
+			alpha[i] = (u8)(((8 - i) * alpha[0] + (i - 1) * alpha[1]) / 7);
+	}
+	else
+	{
+		for (i32 i = 2; i < 6; ++i)
+			alpha[i] = (u8)(((6 - i) * alpha[0] + (i - 1) * alpha[1]) / 5);
+
+		alpha[6] = 0;
+		alpha[7] = 255;
+	}
+
+	u64 alphaBits = 0;
+
+	for (i32 i = 0; i < 6; ++i)
+		alphaBits |= (u64)Block[2 + i] << (i * 8);
+
+	u8 colors[4][3];
+	u16 color0 = Block[8] | (Block[9] << 8);
+	u16 color1 = Block[10] | (Block[11] << 8);
+	u16 endpoints[2] = { color0, color1 };
+
+	for (i32 i = 0; i < 2; ++i)
+	{
+		i32 r5 = endpoints[i] >> 11;
+		i32 g6 = (endpoints[i] >> 5) & 63;
+		i32 b5 = endpoints[i] & 31;
+		colors[i][0] = (u8)((r5 << 3) | (r5 >> 2));
+		colors[i][1] = (u8)((g6 << 2) | (g6 >> 4));
+		colors[i][2] = (u8)((b5 << 3) | (b5 >> 2));
+	}
+
+	// NOTE: DXT5 colour blocks always decode in four colour mode.
+	for (i32 c = 0; c < 3; ++c)
+	{
+		colors[2][c] = (u8)((2 * colors[0][c] + colors[1][c]) / 3);
+		colors[3][c] = (u8)((colors[0][c] + 2 * colors[1][c]) / 3);
+	}
+
+	u32 colorBits = Block[12] | (Block[13] << 8) | (Block[14] << 16) | ((u32)Block[15] << 24);
+
+	for (i32 i = 0; i < 16; ++i)
+	{
+		i32 colorIdx = (colorBits >> (i * 2)) & 3;
+		Dst[i * 4 + 0] = colors[colorIdx][0];
+		Dst[i * 4 + 1] = colors[colorIdx][1];
+		Dst[i * 4 + 2] = colors[colorIdx][2];
+		Dst[i * 4 + 3] = alpha[(alphaBits >> (i * 3)) & 7];
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "shared.h"
+
+enum vsDxtPixelOrder
+{
+	DXT_PIXEL_RGBA,
+	DXT_PIXEL_BGRA,
+};
+
+enum vsDxtEncodePath
+{
+	DXT_PATH_SCALAR,
+	DXT_PATH_SSE4,
+	DXT_PATH_AVX2,
+	DXT_PATH_COUNT,
+};
+
+// NOTE: Picks the widest path the CPU supports, can be overridden for benchmarking.
+void DxtInitEncoder();
+bool DxtIsEncodePathSupported(vsDxtEncodePath Path);
+void DxtSetEncodePath(vsDxtEncodePath Path);
+vsDxtEncodePath DxtGetEncodePath();
+const char* DxtGetEncodePathName(vsDxtEncodePath Path);
+
+// Compresses a Width x Height image (multiples of 4) into DXT5 blocks in row order.
+void DxtEncodeImageDXT5(u8* Src, i32 Width, i32 Height, i32 Pitch, vsDxtPixelOrder Order, u8* Dst);
+
+// Compresses a block stream of 16 contiguous pixels per block.
+void DxtEncodeBlockStreamDXT5(u8* Src, i32 BlockCount, vsDxtPixelOrder Order, u8* Dst);
+
+// Decodes a single DXT5 block into 16 RGBA pixels.
+void DxtDecodeBlockDXT5(u8* Block, u8* Dst);
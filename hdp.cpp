@@ -1,269 +1,137 @@
 #include "hdp.h"
 
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 #include <wincodec.h>
+#else
+#include <JXRGlue.h>
+#endif
+
+#if defined(_MSC_VER) || defined(__SSSE3__)
+#include <tmmintrin.h>
+#define HDP_ENABLE_SSSE3
+#endif
+
+//-----------------------------------------------------------------------------------------------------------
+// Codec context.
+//-----------------------------------------------------------------------------------------------------------
+// NOTE: Creating the codec factory per call was most of the cost of decoding a 120x120 page, so every
+// thread that touches the codec keeps its own context alive and reuses it for every image.
+struct vsHdpContext
+{
+#ifdef _WIN32
+	IWICImagingFactory*		factory;
+#else
+	PKCodecFactory*			codecFactory;
+	struct WMPStream*		stream;
+	size_t					streamEnd;
+#endif
+	u8*						scratch;
+	i32						scratchSize;
+};
+
+struct vsHdpEncodeOptions
+{
+	u8		quality;		// 1 - 255 (1 Lossless)
+	u8		alphaQuality;	// 1 - 255 (1 Lossless)
+	u8		subsampling;	// 3 444, 2 420
+	u8		overlap;
+	u16		tileSlices;
+	bool	alpha;
+};
+
+static thread_local vsHdpContext* hdpThreadContext = NULL;
+
+#ifndef _WIN32
+static ERR HdpStreamWrite(struct WMPStream* Stream, const void* Data, size_t Size)
+{
+	ERR err = WriteWS_Memory(Stream, Data, Size);
 
-void HdpEncodeImageRGBA(const char* OutputName, u8* Data, i32 Width, i32 Height)
-{	
-	IWICImagingFactory*		factory = NULL;
-	IWICBitmapEncoder*		encoder = NULL;
-	IWICBitmapFrameEncode*	bitmapFrame = NULL;
-	IPropertyBag2*			propertyBag = NULL;
-	IWICStream*				stream = NULL;
-
-	HRESULT result = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, (LPVOID*)&factory);
-	assert(SUCCEEDED(result));
-
-	result = factory->CreateStream(&stream);
-	assert(SUCCEEDED(result));
-
-	wchar_t fileNameBuffer[256];
-	mbstowcs(fileNameBuffer, OutputName, ARRAY_COUNT(fileNameBuffer));
-	size_t nameLen = strlen(OutputName);
-	fileNameBuffer[nameLen - 3] = 'j';
-	fileNameBuffer[nameLen - 2] = 'x';
-	fileNameBuffer[nameLen - 1] = 'r';
-	
-	//result = stream->InitializeFromFilename(L"output.tif", GENERIC_WRITE);
-	result = stream->InitializeFromFilename(fileNameBuffer, GENERIC_WRITE);	
-	assert(SUCCEEDED(result));
-
-	//result = factory->CreateEncoder(GUID_ContainerFormatTiff, NULL, &encoder);
-	result = factory->CreateEncoder(GUID_ContainerFormatWmp, NULL, &encoder);	
-	assert(SUCCEEDED(result));
-
-	result = encoder->Initialize(stream, WICBitmapEncoderNoCache);
-	assert(SUCCEEDED(result));
-
-	result = encoder->CreateNewFrame(&bitmapFrame, &propertyBag);
-	assert(SUCCEEDED(result));
-
-	/*
-	PROPBAG2 option = { 0 };
-	option.pstrName = L"TiffCompressionMethod";
-	VARIANT varValue;
-	VariantInit(&varValue);
-	varValue.vt = VT_UI1;
-	varValue.bVal = WICTiffCompressionZIP;
-
-	result = propertyBag->Write(1, &option, &varValue);
-	assert(SUCCEEDED(result));
-	*/
-
-	{
-		PROPBAG2 option = {};
-		option.pstrName = L"ImageQuality";
-		VARIANT varValue;
-		VariantInit(&varValue);
-		varValue.vt = VT_R4;
-		varValue.fltVal = 0.7f;
-	
-		result = propertyBag->Write(1, &option, &varValue);
-		assert(SUCCEEDED(result));
-	}
-
-	/*
-	{
-		PROPBAG2 option = {};
-		option.pstrName = L"StreamOnly";
-		VARIANT varValue;
-		VariantInit(&varValue);
-		varValue.vt = VT_BOOL;
-		varValue.boolVal = VARIANT_TRUE;
-
-		result = propertyBag->Write(1, &option, &varValue);
-		assert(SUCCEEDED(result));
-	}
-	//*/
-
-	{ PROPBAG2 option = {}; option.pstrName = L"UseCodecOptions"; VARIANT varValue; VariantInit(&varValue); varValue.vt = VT_BOOL; 
-		varValue.boolVal = VARIANT_TRUE;
-		result = propertyBag->Write(1, &option, &varValue);
-		assert(SUCCEEDED(result));
-	}
-
-	{
-		PROPBAG2 option = {};
-		option.pstrName = L"HorizontalTileSlices";
-		VARIANT varValue;
-		VariantInit(&varValue);
-		varValue.vt = VT_UI2;
-		varValue.uiVal = 32;
-
-		result = propertyBag->Write(1, &option, &varValue);
-		assert(SUCCEEDED(result));
-	}
+	// NOTE: The container writer seeks back to patch offsets, so the encoded size is the furthest byte written.
+	if (Stream->state.buf.cbCur > hdpThreadContext->streamEnd)
+		hdpThreadContext->streamEnd = Stream->state.buf.cbCur;
 
-	{
-		PROPBAG2 option = {};
-		option.pstrName = L"VerticalTileSlices";
-		VARIANT varValue;
-		VariantInit(&varValue);
-		varValue.vt = VT_UI2;
-		varValue.uiVal = 32;
-
-		result = propertyBag->Write(1, &option, &varValue);
-		assert(SUCCEEDED(result));
-	}
+	return err;
+}
 
-	{
-		PROPBAG2 option = {};
-		option.pstrName = L"Subsampling";
-		VARIANT varValue;
-		VariantInit(&varValue);
-		varValue.vt = VT_UI1;
-		varValue.cVal = 2;
-
-		result = propertyBag->Write(1, &option, &varValue);
-		assert(SUCCEEDED(result));
-	}
+static void HdpResetStream(struct WMPStream* Stream, u8* Data, i32 DataSize)
+{
+	Stream->state.buf.pbBuf = Data;
+	Stream->state.buf.cbBuf = DataSize;
+	Stream->state.buf.cbCur = 0;
+	Stream->state.buf.cbBufCount = 0;
+}
+#endif
 
-	{
-		PROPBAG2 option = {};
-		option.pstrName = L"Quality";
-		VARIANT varValue;
-		VariantInit(&varValue);
-		varValue.vt = VT_UI1;
-		varValue.cVal = 32;
-
-		result = propertyBag->Write(1, &option, &varValue);
-		assert(SUCCEEDED(result));
-	}
+static vsHdpContext* HdpGetContext()
+{
+	if (hdpThreadContext)
+		return hdpThreadContext;
 
-	result = bitmapFrame->Initialize(propertyBag);
-	assert(SUCCEEDED(result));
+	vsHdpContext* context = new vsHdpContext();
 
-	result = bitmapFrame->SetSize(Width, Height);
-	assert(SUCCEEDED(result));
+#ifdef _WIN32
+	// NOTE: Safe to call if the thread has already initialized COM.
+	CoInitializeEx(NULL, COINIT_MULTITHREADED);
 
-	WICPixelFormatGUID formatGUID = GUID_WICPixelFormat24bppBGR;
-	result = bitmapFrame->SetPixelFormat(&formatGUID);
+	HRESULT result = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, (LPVOID*)&context->factory);
 	assert(SUCCEEDED(result));
+#else
+	ERR err = PKCreateCodecFactory(&context->codecFactory, WMP_SDK_VERSION);
+	assert(err == WMP_errSuccess);
 
-	result = IsEqualGUID(formatGUID, GUID_WICPixelFormat24bppBGR) ? S_OK : E_FAIL;
-	assert(SUCCEEDED(result));
+	err = CreateWS_Memory(&context->stream, NULL, 0);
+	assert(err == WMP_errSuccess);
+	context->stream->Write = HdpStreamWrite;
+#endif
 
-	UINT cbStride = (Width * 24 + 7) / 8;
-	UINT cbBufferSize = Height * cbStride;
+	context->scratchSize = 128 * 128 * 4;
+	context->scratch = new u8[context->scratchSize];
 
-	BYTE *pbBuffer = new BYTE[cbBufferSize];
+	hdpThreadContext = context;
 
-	i32 pixelCount = Width * Height;
+	return context;
+}
 
-	for (i32 i = 0; i < pixelCount; i++)
+static u8* HdpGetScratch(vsHdpContext* Context, i32 Size)
+{
+	if (Context->scratchSize < Size)
 	{
-		pbBuffer[i * 3 + 0] = Data[i * 4 + 2];
-		pbBuffer[i * 3 + 1] = Data[i * 4 + 1];
-		pbBuffer[i * 3 + 2] = Data[i * 4 + 0];
+		delete[] Context->scratch;
+		Context->scratchSize = Size;
+		Context->scratch = new u8[Size];
 	}
 
-	result = bitmapFrame->WritePixels(Height, cbStride, cbBufferSize, pbBuffer);
-
-	delete[] pbBuffer;
-
-	assert(SUCCEEDED(result));
-
-	result = bitmapFrame->Commit();
-	assert(SUCCEEDED(result));
-
-	result = encoder->Commit();
-	assert(SUCCEEDED(result));
-
-	factory->Release();
-	bitmapFrame->Release();
-	encoder->Release();
-	stream->Release();
+	return Context->scratch;
 }
 
-u8* HdpDecodeImageRGBA(const char* FileName, i32* Width, i32* Height)
+void HdpReleaseThreadContext()
 {
-	IWICImagingFactory*		factory = NULL;
-	IWICBitmapDecoder*		decoder = NULL;
-	IWICBitmapFrameDecode*	bitmapFrame = NULL;
-	IPropertyBag2*			propertyBag = NULL;
-	
-	HRESULT result = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, (LPVOID*)&factory);
-	assert(SUCCEEDED(result));
+	vsHdpContext* context = hdpThreadContext;
 
-	wchar_t fileNameBuffer[256];
-	mbstowcs(fileNameBuffer, FileName, ARRAY_COUNT(fileNameBuffer));
-	
-	const GUID vendorGUID = GUID_ContainerFormatWmp;
-	result = factory->CreateDecoderFromFilename(fileNameBuffer, &vendorGUID, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder);
-	assert(SUCCEEDED(result));
+	if (!context)
+		return;
 
-	result = decoder->GetFrame(0, &bitmapFrame);
-	assert(SUCCEEDED(result));
-
-	UINT w, h;
-	bitmapFrame->GetSize(&w, &h);
-	WICPixelFormatGUID pixelFormat;
-	bitmapFrame->GetPixelFormat(&pixelFormat);
-
-	assert(w == h);
-	*Width = w;
-	*Height = h;
-
-	WICRect srcRect = {};
-	srcRect.X = 0;
-	srcRect.Y = 0;
-	srcRect.Height = h;
-	srcRect.Width = w;
-
-	i32 bufferSize = w * h * 3;
-	u8* buffer = new u8[bufferSize];
-
-	result = bitmapFrame->CopyPixels(&srcRect, 3 * w, bufferSize, buffer);
-	assert(SUCCEEDED(result));
-	
-	// Copy debug info onto page.
-
-	// Assemble block stream.
-	i32 horzBlockCount = w / 4;
-	i32 blockCount = horzBlockCount * horzBlockCount;
-	u8* blockBuffer = new u8[blockCount * 16 * 4];
-
-	// Assemble each block (4x4 neighbouring pixels)
-	for (i32 b = 0; b < blockCount; ++b)
-	{
-		i32 blockOffset = b * 16 * 4;
-		i32 blockX = b % horzBlockCount;
-		i32 blockY = b / horzBlockCount;
-		i32 pixelX = blockX * 4;
-		i32 pixelY = blockY * 4;
-
-		for (i32 bY = 0; bY < 4; ++bY)		
-		{
-			for (i32 bX = 0; bX < 4; ++bX)
-			{
-				i32 pixelIndex = (pixelY + bY) * w + (pixelX + bX);
-				i32 pixelOffset = pixelIndex * 3;
+#ifdef _WIN32
+	context->factory->Release();
+#else
+	CloseWS_Memory(&context->stream);
+	context->codecFactory->Release(&context->codecFactory);
+#endif
 
-				i32 blockPixelOffset = (bY * 4 + bX) * 4;
-				blockBuffer[blockOffset + blockPixelOffset + 0] = buffer[pixelOffset + 2];
-				blockBuffer[blockOffset + blockPixelOffset + 1] = buffer[pixelOffset + 1];
-				blockBuffer[blockOffset + blockPixelOffset + 2] = buffer[pixelOffset + 0];
-				blockBuffer[blockOffset + blockPixelOffset + 3] = 0;
-
-				if (pixelX + bX <= 1 || pixelX + bX >= 126 || pixelY + bY <= 1 || pixelY + bY >= 126)
-				{
-					blockBuffer[blockOffset + blockPixelOffset + 0] = 255;
-					blockBuffer[blockOffset + blockPixelOffset + 1] = 0;
-					blockBuffer[blockOffset + blockPixelOffset + 2] = 0;
-				}
-			}
-		}
-	}
-
-	delete[] buffer;
-	factory->Release();
-	bitmapFrame->Release();
-	decoder->Release();
-	
-	return blockBuffer;
+	delete[] context->scratch;
+	delete context;
+	hdpThreadContext = NULL;
 }
 
+//-----------------------------------------------------------------------------------------------------------
+// Platform codec.
+//-----------------------------------------------------------------------------------------------------------
+#ifdef _WIN32
 __forceinline void WriteBagPropR4(IPropertyBag2* PropertyBag, LPOLESTR Name, float Value)
 {
 	PROPBAG2 option = {};
@@ -320,25 +188,22 @@ __forceinline void WriteBagPropBOOL(IPropertyBag2* PropertyBag, LPOLESTR Name, b
 	assert(SUCCEEDED(result));
 }
 
-bool HdpEncodeImageRGBA(u8* Data, i32 Width, i32 Height, u8* OutData, i32* OutDataSize)
+// NOTE: Pixels are BGRA, or BGR when the options have no alpha.
+static bool HdpEncode(vsHdpContext* Context, u8* Pixels, i32 Width, i32 Height, vsHdpEncodeOptions* Options, u8* OutData, i32* OutDataSize)
 {
-	IWICImagingFactory*		factory = NULL;
 	IWICBitmapEncoder*		encoder = NULL;
 	IWICBitmapFrameEncode*	bitmapFrame = NULL;
 	IPropertyBag2*			propertyBag = NULL;
 	IWICStream*				stream = NULL;
 	HRESULT					result;
 
-	result = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, (LPVOID*)&factory);
-	assert(SUCCEEDED(result));
-
-	result = factory->CreateStream(&stream);
+	result = Context->factory->CreateStream(&stream);
 	assert(SUCCEEDED(result));
 
 	result = stream->InitializeFromMemory(OutData, *OutDataSize);
 	assert(SUCCEEDED(result));
 
-	result = factory->CreateEncoder(GUID_ContainerFormatWmp, NULL, &encoder);
+	result = Context->factory->CreateEncoder(GUID_ContainerFormatWmp, NULL, &encoder);
 	assert(SUCCEEDED(result));
 
 	result = encoder->Initialize(stream, WICBitmapEncoderNoCache);
@@ -349,18 +214,21 @@ bool HdpEncodeImageRGBA(u8* Data, i32 Width, i32 Height, u8* OutData, i32* OutDa
 
 	WriteBagPropBOOL(propertyBag, L"CompressedDomainTranscode", false);
 	WriteBagPropR4(propertyBag, L"ImageQuality", 1.0f); // Ignored UCO, Alpha/Quality
-	WriteBagPropBOOL(propertyBag, L"UseCodecOptions", true);	
-	WriteBagPropUI2(propertyBag, L"HorizontalTileSlices", 1);
-	WriteBagPropUI2(propertyBag, L"VerticalTileSlices", 1);
+	WriteBagPropBOOL(propertyBag, L"UseCodecOptions", true);
+	WriteBagPropUI2(propertyBag, L"HorizontalTileSlices", Options->tileSlices);
+	WriteBagPropUI2(propertyBag, L"VerticalTileSlices", Options->tileSlices);
 	WriteBagPropBOOL(propertyBag, L"ProgressiveMode", false);
 
-	WriteBagPropUI1(propertyBag, L"Overlap", 2); // Or 1?
-	WriteBagPropUI1(propertyBag, L"Quality", 32); // 1 - 255 (1 Lossless)
-	WriteBagPropUI1(propertyBag, L"Subsampling", 3); // 3 444, 2 420
-	
-	WriteBagPropBOOL(propertyBag, L"InterleavedAlpha", false);
-	WriteBagPropUI1(propertyBag, L"AlphaDataDiscard", 0); // Ignored CDT
-	WriteBagPropUI1(propertyBag, L"AlphaQuality", 64); // 1 - 255 (1 Lossless)
+	WriteBagPropUI1(propertyBag, L"Overlap", Options->overlap);
+	WriteBagPropUI1(propertyBag, L"Quality", Options->quality);
+	WriteBagPropUI1(propertyBag, L"Subsampling", Options->subsampling);
+
+	if (Options->alpha)
+	{
+		WriteBagPropBOOL(propertyBag, L"InterleavedAlpha", false);
+		WriteBagPropUI1(propertyBag, L"AlphaDataDiscard", 0); // Ignored CDT
+		WriteBagPropUI1(propertyBag, L"AlphaQuality", Options->alphaQuality);
+	}
 
 	result = bitmapFrame->Initialize(propertyBag);
 	assert(SUCCEEDED(result));
@@ -368,31 +236,18 @@ bool HdpEncodeImageRGBA(u8* Data, i32 Width, i32 Height, u8* OutData, i32* OutDa
 	result = bitmapFrame->SetSize(Width, Height);
 	assert(SUCCEEDED(result));
 
-	//GUID_WICPixelFormat24bppBGR
-	WICPixelFormatGUID formatGUID = GUID_WICPixelFormat32bppBGRA;
+	WICPixelFormatGUID requestedFormat = Options->alpha ? GUID_WICPixelFormat32bppBGRA : GUID_WICPixelFormat24bppBGR;
+	WICPixelFormatGUID formatGUID = requestedFormat;
 	result = bitmapFrame->SetPixelFormat(&formatGUID);
 	assert(SUCCEEDED(result));
 
-	result = IsEqualGUID(formatGUID, GUID_WICPixelFormat32bppBGRA) ? S_OK : E_FAIL;
+	result = IsEqualGUID(formatGUID, requestedFormat) ? S_OK : E_FAIL;
 	assert(SUCCEEDED(result));
 
-	UINT cbStride = Width * 4; // (Width * 24 + 7) / 8;
+	UINT cbStride = Width * (Options->alpha ? 4 : 3);
 	UINT cbBufferSize = Height * cbStride;
-	BYTE *pbBuffer = new BYTE[cbBufferSize];
-	i32 pixelCount = Width * Height;
-
-	for (i32 i = 0; i < pixelCount; i++)
-	{
-		pbBuffer[i * 4 + 0] = Data[i * 4 + 2];
-		pbBuffer[i * 4 + 1] = Data[i * 4 + 1];
-		pbBuffer[i * 4 + 2] = Data[i * 4 + 0];
-		pbBuffer[i * 4 + 3] = Data[i * 4 + 3];
-	}
-
-	result = bitmapFrame->WritePixels(Height, cbStride, cbBufferSize, pbBuffer);
-
-	delete[] pbBuffer;
 
+	result = bitmapFrame->WritePixels(Height, cbStride, cbBufferSize, Pixels);
 	assert(SUCCEEDED(result));
 
 	result = bitmapFrame->Commit();
@@ -406,7 +261,7 @@ bool HdpEncodeImageRGBA(u8* Data, i32 Width, i32 Height, u8* OutData, i32* OutDa
 	stream->Seek(moveZero, STREAM_SEEK_CUR, &streamSize);
 	*OutDataSize = (i32)streamSize.QuadPart;
 
-	factory->Release();
+	propertyBag->Release();
 	bitmapFrame->Release();
 	encoder->Release();
 	stream->Release();
@@ -414,25 +269,24 @@ bool HdpEncodeImageRGBA(u8* Data, i32 Width, i32 Height, u8* OutData, i32* OutDa
 	return true;
 }
 
-bool HdpDecodeImageBGRA(u8* InputData, i32 InputDataSize, u8* OutputData)
+// Returns false without decoding when the image is larger than OutputDataSize, the size is still set.
+static bool HdpDecode(vsHdpContext* Context, u8* InputData, i32 InputDataSize, u8* OutputData, i32 OutputDataSize, i32* Width, i32* Height)
 {
-	IWICImagingFactory*		factory = NULL;
 	IWICBitmapDecoder*		decoder = NULL;
 	IWICBitmapFrameDecode*	bitmapFrame = NULL;
-	IPropertyBag2*			propertyBag = NULL;
 	IWICStream*				stream = NULL;
-	
-	HRESULT result = CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_IWICImagingFactory, (LPVOID*)&factory);
-	assert(SUCCEEDED(result));
 
-	result = factory->CreateStream(&stream);
+	HRESULT result = Context->factory->CreateStream(&stream);
 	assert(SUCCEEDED(result));
 
 	result = stream->InitializeFromMemory(InputData, InputDataSize);
 	assert(SUCCEEDED(result));
 
-	const GUID vendorGUID = GUID_ContainerFormatWmp;
-	result = factory->CreateDecoderFromStream(stream, &vendorGUID, WICDecodeMetadataCacheOnDemand, &decoder);
+	// NOTE: Creating the decoder directly skips probing every installed codec against the stream.
+	result = Context->factory->CreateDecoder(GUID_ContainerFormatWmp, NULL, &decoder);
+	assert(SUCCEEDED(result));
+
+	result = decoder->Initialize(stream, WICDecodeMetadataCacheOnDemand);
 	assert(SUCCEEDED(result));
 
 	result = decoder->GetFrame(0, &bitmapFrame);
@@ -440,10 +294,17 @@ bool HdpDecodeImageBGRA(u8* InputData, i32 InputDataSize, u8* OutputData)
 
 	UINT w, h;
 	bitmapFrame->GetSize(&w, &h);
-	WICPixelFormatGUID pixelFormat;
-	bitmapFrame->GetPixelFormat(&pixelFormat);
+	*Width = w;
+	*Height = h;
 
-	assert(w == 120 && h == 120);
+	if ((i64)w * h * 4 > OutputDataSize)
+	{
+		bitmapFrame->Release();
+		decoder->Release();
+		stream->Release();
+
+		return false;
+	}
 
 	WICRect srcRect = {};
 	srcRect.X = 0;
@@ -451,14 +312,281 @@ bool HdpDecodeImageBGRA(u8* InputData, i32 InputDataSize, u8* OutputData)
 	srcRect.Height = h;
 	srcRect.Width = w;
 
-	result = bitmapFrame->CopyPixels(&srcRect, 4 * w, 120 * 120 * 4, OutputData);
-	assert(SUCCEEDED(result));
-	
-	factory->Release();
+	WICPixelFormatGUID pixelFormat;
+	bitmapFrame->GetPixelFormat(&pixelFormat);
+
+	if (IsEqualGUID(pixelFormat, GUID_WICPixelFormat32bppBGRA))
+	{
+		result = bitmapFrame->CopyPixels(&srcRect, 4 * w, w * h * 4, OutputData);
+		assert(SUCCEEDED(result));
+	}
+	else
+	{
+		IWICFormatConverter* converter = NULL;
+		result = Context->factory->CreateFormatConverter(&converter);
+		assert(SUCCEEDED(result));
+
+		result = converter->Initialize(bitmapFrame, GUID_WICPixelFormat32bppBGRA, WICBitmapDitherTypeNone, NULL, 0.0, WICBitmapPaletteTypeCustom);
+		assert(SUCCEEDED(result));
+
+		result = converter->CopyPixels(&srcRect, 4 * w, w * h * 4, OutputData);
+		assert(SUCCEEDED(result));
+
+		converter->Release();
+	}
+
 	bitmapFrame->Release();
 	decoder->Release();
+	stream->Release();
 
-	return true;
+	return SUCCEEDED(result);
+}
+#else
+static bool HdpEncode(vsHdpContext* Context, u8* Pixels, i32 Width, i32 Height, vsHdpEncodeOptions* Options, u8* OutData, i32* OutDataSize)
+{
+	PKImageEncode* encoder = NULL;
+	ERR err = PKImageEncode_Create_WMP(&encoder);
+	assert(err == WMP_errSuccess);
+
+	// NOTE: Mirrors the WIC codec options, tile slicing is only honoured by the WIC path.
+	CWMIStrCodecParam params = {};
+	params.bVerbose = FALSE;
+	params.cfColorFormat = (Options->subsampling == 3) ? YUV_444 : YUV_420;
+	params.bdBitDepth = BD_LONG;
+	params.bfBitstreamFormat = SPATIAL;
+	params.bProgressiveMode = FALSE;
+	params.olOverlap = (OVERLAP)Options->overlap;
+	params.sbSubband = SB_ALL;
+	params.uAlphaMode = Options->alpha ? 2 : 0;
+	params.uiDefaultQPIndex = Options->quality;
+	params.uiDefaultQPIndexAlpha = Options->alphaQuality;
+
+	// NOTE: Releasing the encoder closes its stream, so each encode gets its own instead of the shared one.
+	struct WMPStream* stream = NULL;
+	err = CreateWS_Memory(&stream, OutData, *OutDataSize);
+	assert(err == WMP_errSuccess);
+	stream->Write = HdpStreamWrite;
+	Context->streamEnd = 0;
+
+	err = encoder->Initialize(encoder, stream, &params, sizeof(params));
+	assert(err == WMP_errSuccess);
+
+	err = encoder->SetPixelFormat(encoder, Options->alpha ? GUID_PKPixelFormat32bppBGRA : GUID_PKPixelFormat24bppBGR);
+	assert(err == WMP_errSuccess);
+
+	encoder->SetSize(encoder, Width, Height);
+	encoder->SetResolution(encoder, 96.0f, 96.0f);
+
+	err = encoder->WritePixels(encoder, Height, Pixels, Width * (Options->alpha ? 4 : 3));
+	assert(err == WMP_errSuccess);
+
+	encoder->Release(&encoder);
+
+	*OutDataSize = (i32)Context->streamEnd;
+
+	return err == WMP_errSuccess;
+}
+
+// Returns false without decoding when the image is larger than OutputDataSize, the size is still set.
+static bool HdpDecode(vsHdpContext* Context, u8* InputData, i32 InputDataSize, u8* OutputData, i32 OutputDataSize, i32* Width, i32* Height)
+{
+	PKImageDecode* decoder = NULL;
+	PKFormatConverter* converter = NULL;
+
+	HdpResetStream(Context->stream, InputData, InputDataSize);
+
+	ERR err = PKImageDecode_Create_WMP(&decoder);
+	assert(err == WMP_errSuccess);
+
+	err = decoder->Initialize(decoder, Context->stream);
+	assert(err == WMP_errSuccess);
+
+	// NOTE: Pages store alpha as a separate plane.
+	if (decoder->WMP.bHasAlpha)
+		decoder->WMP.wmiSCP.uAlphaMode = 2;
+
+	I32 w, h;
+	decoder->GetSize(decoder, &w, &h);
+	*Width = w;
+	*Height = h;
+
+	if ((i64)w * h * 4 > OutputDataSize)
+	{
+		decoder->Release(&decoder);
+		return false;
+	}
+
+	err = Context->codecFactory->CreateFormatConverter(&converter);
+	assert(err == WMP_errSuccess);
+
+	err = converter->Initialize(converter, decoder, NULL, GUID_PKPixelFormat32bppBGRA);
+	assert(err == WMP_errSuccess);
+
+	PKRect srcRect = { 0, 0, w, h };
+	err = converter->Copy(converter, &srcRect, OutputData, w * 4);
+	assert(err == WMP_errSuccess);
+
+	converter->Release(&converter);
+	decoder->Release(&decoder);
+
+	return err == WMP_errSuccess;
+}
+#endif
+
+//-----------------------------------------------------------------------------------------------------------
+// Entry points.
+//-----------------------------------------------------------------------------------------------------------
+void HdpEncodeImageRGBA(const char* OutputName, u8* Data, i32 Width, i32 Height)
+{
+	vsHdpContext* context = HdpGetContext();
+
+	i32 pixelCount = Width * Height;
+	u8* bgrBuffer = new u8[pixelCount * 3];
+
+	for (i32 i = 0; i < pixelCount; i++)
+	{
+		bgrBuffer[i * 3 + 0] = Data[i * 4 + 2];
+		bgrBuffer[i * 3 + 1] = Data[i * 4 + 1];
+		bgrBuffer[i * 3 + 2] = Data[i * 4 + 0];
+	}
+
+	vsHdpEncodeOptions options = {};
+	options.quality = 32;
+	options.subsampling = 2;
+	options.overlap = 1;
+	options.tileSlices = 32;
+	options.alpha = false;
+
+	// NOTE: Compressed output is always smaller than the raw pixels.
+	i32 encodedSize = pixelCount * 3 + 64 * 1024;
+	u8* encoded = new u8[encodedSize];
+	HdpEncode(context, bgrBuffer, Width, Height, &options, encoded, &encodedSize);
+
+	char fileName[256];
+	strcpy(fileName, OutputName);
+	size_t nameLen = strlen(fileName);
+	fileName[nameLen - 3] = 'j';
+	fileName[nameLen - 2] = 'x';
+	fileName[nameLen - 1] = 'r';
+
+	FILE* file = fopen(fileName, "wb");
+	assert(file);
+	fwrite(encoded, encodedSize, 1, file);
+	fclose(file);
+
+	delete[] encoded;
+	delete[] bgrBuffer;
+}
+
+u8* HdpDecodeImageRGBA(const char* FileName, i32* Width, i32* Height)
+{
+	vsHdpContext* context = HdpGetContext();
+
+	FILE* file = fopen(FileName, "rb");
+	assert(file);
+	fseek(file, 0, SEEK_END);
+	i32 fileLen = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	u8* fileData = new u8[fileLen];
+	fread(fileData, fileLen, 1, file);
+	fclose(file);
+
+	// NOTE: Sized for a page, larger images are decoded again once their size is known.
+	i32 w, h;
+	i32 bufferSize = 128 * 128 * 4;
+	u8* buffer = new u8[bufferSize];
+
+	if (!HdpDecode(context, fileData, fileLen, buffer, bufferSize, &w, &h) && w * h * 4 > bufferSize)
+	{
+		delete[] buffer;
+		bufferSize = w * h * 4;
+		buffer = new u8[bufferSize];
+		HdpDecode(context, fileData, fileLen, buffer, bufferSize, &w, &h);
+	}
+
+	delete[] fileData;
+
+	assert(w == h);
+	*Width = w;
+	*Height = h;
+
+	// Assemble block stream.
+	i32 horzBlockCount = w / 4;
+	i32 blockCount = horzBlockCount * horzBlockCount;
+	u8* blockBuffer = new u8[blockCount * 16 * 4];
+
+	// Assemble each block (4x4 neighbouring pixels)
+	for (i32 b = 0; b < blockCount; ++b)
+	{
+		i32 blockOffset = b * 16 * 4;
+		i32 blockX = b % horzBlockCount;
+		i32 blockY = b / horzBlockCount;
+		i32 pixelX = blockX * 4;
+		i32 pixelY = blockY * 4;
+
+		for (i32 bY = 0; bY < 4; ++bY)
+		{
+			for (i32 bX = 0; bX < 4; ++bX)
+			{
+				i32 pixelIndex = (pixelY + bY) * w + (pixelX + bX);
+				i32 pixelOffset = pixelIndex * 4;
+
+				i32 blockPixelOffset = (bY * 4 + bX) * 4;
+				blockBuffer[blockOffset + blockPixelOffset + 0] = buffer[pixelOffset + 2];
+				blockBuffer[blockOffset + blockPixelOffset + 1] = buffer[pixelOffset + 1];
+				blockBuffer[blockOffset + blockPixelOffset + 2] = buffer[pixelOffset + 0];
+				blockBuffer[blockOffset + blockPixelOffset + 3] = 0;
+
+				if (pixelX + bX <= 1 || pixelX + bX >= 126 || pixelY + bY <= 1 || pixelY + bY >= 126)
+				{
+					blockBuffer[blockOffset + blockPixelOffset + 0] = 255;
+					blockBuffer[blockOffset + blockPixelOffset + 1] = 0;
+					blockBuffer[blockOffset + blockPixelOffset + 2] = 0;
+				}
+			}
+		}
+	}
+
+	delete[] buffer;
+
+	return blockBuffer;
+}
+
+bool HdpEncodeImageRGBA(u8* Data, i32 Width, i32 Height, u8* OutData, i32* OutDataSize)
+{
+	vsHdpContext* context = HdpGetContext();
+
+	i32 pixelCount = Width * Height;
+	u8* bgraBuffer = HdpGetScratch(context, pixelCount * 4);
+
+	for (i32 i = 0; i < pixelCount; i++)
+	{
+		bgraBuffer[i * 4 + 0] = Data[i * 4 + 2];
+		bgraBuffer[i * 4 + 1] = Data[i * 4 + 1];
+		bgraBuffer[i * 4 + 2] = Data[i * 4 + 0];
+		bgraBuffer[i * 4 + 3] = Data[i * 4 + 3];
+	}
+
+	vsHdpEncodeOptions options = {};
+	options.quality = 32;
+	options.alphaQuality = 64;
+	options.subsampling = 3;
+	options.overlap = 2;
+	options.tileSlices = 1;
+	options.alpha = true;
+
+	return HdpEncode(context, bgraBuffer, Width, Height, &options, OutData, OutDataSize);
+}
+
+bool HdpDecodeImageBGRA(u8* InputData, i32 InputDataSize, u8* OutputData)
+{
+	vsHdpContext* context = HdpGetContext();
+
+	i32 w, h;
+	bool result = HdpDecode(context, InputData, InputDataSize, OutputData, 120 * 120 * 4, &w, &h);
+	assert(w == 120 && h == 120);
+
+	return result;
 }
 
 void HdpBGRAToRGBABlockStream(u8* InputData, u8* OutputData)
@@ -466,7 +594,7 @@ void HdpBGRAToRGBABlockStream(u8* InputData, u8* OutputData)
 	// Assemble block stream.
 	i32 horzBlockCount = 128 / 4;
 	i32 blockCount = horzBlockCount * horzBlockCount;
-	
+
 	// Assemble each block (4x4 neighbouring pixels)
 	for (i32 b = 0; b < blockCount; ++b)
 	{
@@ -491,4 +619,147 @@ void HdpBGRAToRGBABlockStream(u8* InputData, u8* OutputData)
 			}
 		}
 	}
-}
\ No newline at end of file
+}
+
+void HdpBGRAPayloadToRGBABlockStream(u8* InputData, u8* OutputData)
+{
+	// NOTE: The 4 pixel border is exactly one block wide, so edge blocks are the clamped edge pixel repeated and
+	// every other block row is a straight 16 byte copy from the payload.
+	for (i32 blockY = 0; blockY < 32; ++blockY)
+	{
+		for (i32 bY = 0; bY < 4; ++bY)
+		{
+			i32 srcY = GetMin(GetMax(blockY * 4 + bY - 4, 0), 119);
+			u8* srcRow = InputData + srcY * 120 * 4;
+			u8* dstRow = OutputData + blockY * 32 * 64 + bY * 16;
+
+#ifdef HDP_ENABLE_SSSE3
+			const __m128i swizzle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+			__m128i first = _mm_shuffle_epi8(_mm_cvtsi32_si128(*(i32*)srcRow), swizzle);
+			__m128i last = _mm_shuffle_epi8(_mm_cvtsi32_si128(*(i32*)(srcRow + 119 * 4)), swizzle);
+			_mm_storeu_si128((__m128i*)dstRow, _mm_shuffle_epi32(first, 0));
+			_mm_storeu_si128((__m128i*)(dstRow + 31 * 64), _mm_shuffle_epi32(last, 0));
+
+			for (i32 blockX = 1; blockX < 31; ++blockX)
+			{
+				__m128i pixels = _mm_loadu_si128((__m128i*)(srcRow + (blockX * 4 - 4) * 4));
+				_mm_storeu_si128((__m128i*)(dstRow + blockX * 64), _mm_shuffle_epi8(pixels, swizzle));
+			}
+#else
+			for (i32 blockX = 0; blockX < 32; ++blockX)
+			{
+				for (i32 bX = 0; bX < 4; ++bX)
+				{
+					i32 srcX = GetMin(GetMax(blockX * 4 + bX - 4, 0), 119);
+					u8* src = srcRow + srcX * 4;
+					u8* dst = dstRow + blockX * 64 + bX * 4;
+					dst[0] = src[2];
+					dst[1] = src[1];
+					dst[2] = src[0];
+					dst[3] = src[3];
+				}
+			}
+#endif
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Source image reader.
+//-----------------------------------------------------------------------------------------------------------
+// NOTE: WIC decodes PNG rows on demand, so reading bands top to bottom never holds the whole image. The
+// portable path has no streaming decoder and keeps the full image behind the same interface.
+struct vsHdpImageReader
+{
+#ifdef _WIN32
+	IWICBitmapDecoder*		decoder;
+	IWICBitmapFrameDecode*	frame;
+	IWICFormatConverter*	converter;
+#else
+	u8*						data;
+#endif
+	i32						width;
+	i32						height;
+};
+
+vsHdpImageReader* HdpOpenImageReader(const char* FileName, i32* Width, i32* Height)
+{
+	vsHdpImageReader* reader = new vsHdpImageReader();
+
+#ifdef _WIN32
+	vsHdpContext* context = HdpGetContext();
+
+	wchar_t wideFileName[MAX_PATH];
+	MultiByteToWideChar(CP_ACP, 0, FileName, -1, wideFileName, MAX_PATH);
+
+	HRESULT result = context->factory->CreateDecoderFromFilename(wideFileName, NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &reader->decoder);
+
+	if (FAILED(result))
+	{
+		delete reader;
+		return NULL;
+	}
+
+	result = reader->decoder->GetFrame(0, &reader->frame);
+	assert(SUCCEEDED(result));
+
+	UINT w, h;
+	reader->frame->GetSize(&w, &h);
+	reader->width = w;
+	reader->height = h;
+
+	result = context->factory->CreateFormatConverter(&reader->converter);
+	assert(SUCCEEDED(result));
+
+	result = reader->converter->Initialize(reader->frame, GUID_WICPixelFormat32bppRGBA, WICBitmapDitherTypeNone, NULL, 0.0, WICBitmapPaletteTypeCustom);
+	assert(SUCCEEDED(result));
+#else
+	reader->data = CreateImageFromFile(FileName, &reader->width, &reader->height);
+
+	if (reader->data == NULL)
+	{
+		delete reader;
+		return NULL;
+	}
+#endif
+
+	if (Width)
+		*Width = reader->width;
+
+	if (Height)
+		*Height = reader->height;
+
+	return reader;
+}
+
+void HdpReadImageRows(vsHdpImageReader* Reader, i32 Y, i32 RowCount, u8* OutData)
+{
+	assert(Y >= 0 && Y + RowCount <= Reader->height);
+
+#ifdef _WIN32
+	WICRect srcRect = {};
+	srcRect.X = 0;
+	srcRect.Y = Y;
+	srcRect.Width = Reader->width;
+	srcRect.Height = RowCount;
+
+	HRESULT result = Reader->converter->CopyPixels(&srcRect, Reader->width * 4, Reader->width * RowCount * 4, OutData);
+	assert(SUCCEEDED(result));
+#else
+	memcpy(OutData, Reader->data + (i64)Y * Reader->width * 4, (i64)RowCount * Reader->width * 4);
+#endif
+}
+
+void HdpCloseImageReader(vsHdpImageReader* Reader)
+{
+#ifdef _WIN32
+	Reader->converter->Release();
+	Reader->frame->Release();
+	Reader->decoder->Release();
+#else
+	FreeImage(Reader->data);
+#endif
+
+	delete Reader;
+}
@@ -7,4 +7,16 @@ u8* HdpDecodeImageRGBA(const char* FileName, i32* Width, i32* Height);
 bool HdpEncodeImageRGBA(u8* Data, i32 Width, i32 Height, u8* OutData, i32* OutDataSize);
 
 void HdpBGRAToRGBABlockStream(u8* InputData, u8* OutputData);
-bool HdpDecodeImageBGRA(u8* InputData, i32 InputDataSize, u8* OutputData);
\ No newline at end of file
+bool HdpDecodeImageBGRA(u8* InputData, i32 InputDataSize, u8* OutputData);
+
+// Builds the bordered 128x128 RGBA block stream straight from a decoded 120x120 BGRA payload.
+void HdpBGRAPayloadToRGBABlockStream(u8* InputData, u8* OutputData);
+
+// NOTE: Codec state is created per thread on first use, threads that exit should release it.
+void HdpReleaseThreadContext();
+// Reads a source image as RGBA row bands, for images too large to decode whole.
+// NOTE: Reading bands top to bottom is the fast path, readers are not thread safe.
+struct vsHdpImageReader;
+vsHdpImageReader* HdpOpenImageReader(const char* FileName, i32* Width, i32* Height);
+void HdpReadImageRows(vsHdpImageReader* Reader, i32 Y, i32 RowCount, u8* OutData);
+void HdpCloseImageReader(vsHdpImageReader* Reader);
@@ -0,0 +1,95 @@
+#include "jobSystem.h"
+
+//-----------------------------------------------------------------------------------------------------------
+// Workers.
+//-----------------------------------------------------------------------------------------------------------
+// Runs jobs until there are none left to take, the lock must be held on entry and is held on return.
+static void RunJobs(vsJobSystem* Jobs, std::unique_lock<std::mutex>& Lock)
+{
+	while (Jobs->nextJob < Jobs->jobCount)
+	{
+		i32 index = Jobs->nextJob++;
+		vsJobFunc func = Jobs->func;
+		void* data = Jobs->data;
+
+		Lock.unlock();
+		func(data, index);
+		Lock.lock();
+
+		if (++Jobs->finishedJobs == Jobs->jobCount)
+			Jobs->done.notify_all();
+	}
+}
+
+static void JobWorkerThreadProc(vsJobSystem* Jobs)
+{
+	std::unique_lock<std::mutex> lock(Jobs->lock);
+
+	while (true)
+	{
+		Jobs->wake.wait(lock, [Jobs] { return Jobs->quit || Jobs->nextJob < Jobs->jobCount; });
+
+		if (Jobs->quit)
+			break;
+
+		RunJobs(Jobs, lock);
+	}
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Entry points.
+//-----------------------------------------------------------------------------------------------------------
+void JobSystemInit(vsJobSystem* Jobs, i32 ThreadCount)
+{
+	if (ThreadCount < 0)
+		ThreadCount = GetMax((i32)std::thread::hardware_concurrency() - 1, 0);
+
+	Jobs->func = NULL;
+	Jobs->data = NULL;
+	Jobs->jobCount = 0;
+	Jobs->nextJob = 0;
+	Jobs->finishedJobs = 0;
+	Jobs->quit = false;
+	Jobs->threadCount = ThreadCount;
+	Jobs->threads = new std::thread[ThreadCount];
+
+	for (i32 i = 0; i < ThreadCount; ++i)
+		Jobs->threads[i] = std::thread(JobWorkerThreadProc, Jobs);
+}
+
+void JobSystemShutdown(vsJobSystem* Jobs)
+{
+	{
+		std::unique_lock<std::mutex> lock(Jobs->lock);
+		Jobs->quit = true;
+	}
+
+	Jobs->wake.notify_all();
+
+	for (i32 i = 0; i < Jobs->threadCount; ++i)
+		Jobs->threads[i].join();
+
+	delete[] Jobs->threads;
+	Jobs->threads = NULL;
+	Jobs->threadCount = 0;
+}
+
+void JobSystemParallelFor(vsJobSystem* Jobs, i32 Count, vsJobFunc Func, void* Data)
+{
+	if (Count <= 0)
+		return;
+
+	std::unique_lock<std::mutex> lock(Jobs->lock);
+
+	Jobs->func = Func;
+	Jobs->data = Data;
+	Jobs->jobCount = Count;
+	Jobs->nextJob = 0;
+	Jobs->finishedJobs = 0;
+
+	if (Count > 1)
+		Jobs->wake.notify_all();
+
+	RunJobs(Jobs, lock);
+	Jobs->done.wait(lock, [Jobs] { return Jobs->finishedJobs == Jobs->jobCount; });
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "shared.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+typedef void (*vsJobFunc)(void* Data, i32 Index);
+
+// Persistent worker threads for short parallel loops on the render thread. The calling thread takes
+// jobs as well, so a system with no workers runs everything inline.
+struct vsJobSystem
+{
+	std::thread*			threads;
+	i32						threadCount;
+
+	std::mutex				lock;
+	std::condition_variable	wake;
+	std::condition_variable	done;
+
+	vsJobFunc				func;
+	void*					data;
+	i32						jobCount;
+	i32						nextJob;
+	i32						finishedJobs;
+	bool					quit;
+};
+
+// ThreadCount -1 starts a worker per core, less the calling thread.
+void JobSystemInit(vsJobSystem* Jobs, i32 ThreadCount = -1);
+void JobSystemShutdown(vsJobSystem* Jobs);
+// Calls Func for every Index in [0, Count) and returns once they have all finished.
+// NOTE: Only one thread may issue work at a time.
+void JobSystemParallelFor(vsJobSystem* Jobs, i32 Count, vsJobFunc Func, void* Data);
@@ -0,0 +1,1524 @@
+#include "lightBinning.h"
+#include "jobSystem.h"
+
+#include <string.h>
+
+// Below this many lights per job the thread handoff costs more than the binning.
+#define LIGHT_BIN_JOB_LIGHTS_MIN	64
+
+template <typename Grid>
+struct vsLightBinThread
+{
+	static_assert(Grid::cellCount <= 65536, "Cells are binned as u16s");
+
+	// Per cell item counts, then the next item slot for this job once merged.
+	u32		cellBins[Grid::cellCount];
+	// Per cell count of lights whose first cell it is, then the next light list slot.
+	u32		firstBins[Grid::cellCount];
+	u16		cells[Grid::cellCount];
+
+	// Cells the count pass found for this job's lights, kept for the scatter. Light i of the job has
+	// lightCells[lightCellStart[i], lightCellStart[i + 1]), lights read from the static cache have none.
+	u16*	lightCells;
+	i64		lightCellCapacity;
+	u32*	lightCellStart;
+	i32		lightCellStartCapacity;
+
+	// Items this job's lights lost to inactive cells.
+	u32		inactiveItems;
+
+	// Totals of this job's cell chunk during the merge.
+	u32		chunkItems;
+	u32		chunkLights;
+	u32		chunkHighest;
+};
+
+//-----------------------------------------------------------------------------------------------------------
+// Cluster grid.
+//-----------------------------------------------------------------------------------------------------------
+static float ProjectSphereToPlane(vec3 PlaneN, float PlaneD, vec3 SphereO, float SphereR)
+{
+	float distToPlane = (glm::dot(PlaneN, SphereO) - PlaneD) / glm::length(PlaneN);
+
+	if (distToPlane == 0.0f)
+	{
+		return SphereR;
+	}
+	else if (SphereR < distToPlane || SphereR < -distToPlane)
+	{
+		return -1.0f;
+	}
+	else
+	{
+		float c = sqrt(SphereR * SphereR - distToPlane * distToPlane);
+		return c;
+	}
+}
+
+template <typename Grid>
+void LightBinViewCreate(vsLightBinView<Grid>* BinView, mat4 View, mat4 InvProj)
+{
+	BinView->view = View;
+
+	vec4 ndcNearPointB = InvProj * vec4(-1.0f, -1.0f, -1.0f, 1.0);
+	vec4 ndcNearPointT = InvProj * vec4(-1.0f, 1.0f, -1.0f, 1.0);
+
+	// NOTE: We swap stuff because we are using an inverted Z.
+	ndcNearPointB.z = -ndcNearPointB.z;
+	ndcNearPointB.x = -ndcNearPointB.x;
+	ndcNearPointT.z = -ndcNearPointT.z;
+	ndcNearPointT.x = -ndcNearPointT.x;
+
+	BinView->frustumRay[0] = glm::normalize(vec3(ndcNearPointB));
+	BinView->frustumRay[1] = glm::normalize(vec3(ndcNearPointT));
+	BinView->frustumRay[2] = glm::normalize(vec3(ndcNearPointT) * vec3(-1, 1, 1));
+	BinView->frustumRay[3] = glm::normalize(vec3(ndcNearPointB) * vec3(-1, 1, 1));
+
+	for (int i = 0; i < (int)ARRAY_COUNT(BinView->depthSliceScale); ++i)
+	{
+		float depthZ = Grid::GetDepthSlice((float)i);
+
+		vec3 cornerMax = BinView->frustumRay[1] * (-(depthZ) / (glm::dot(BinView->frustumRay[1], vec3(0, 0, -1))));
+		vec3 cornerMin = BinView->frustumRay[3] * (-(depthZ) / (glm::dot(BinView->frustumRay[3], vec3(0, 0, -1))));
+
+		BinView->depthSliceScale[i] = (vec2(cornerMax) - vec2(cornerMin));
+		BinView->sliceDepth[i] = depthZ;
+	}
+}
+
+// Distance along one axis between two ranges, 0 where they overlap.
+static __forceinline float GetRangeGap(float PMin, float PMax, float Min, float Max)
+{
+	if (PMax < Min)
+		return Min - PMax;
+
+	if (PMin > Max)
+		return PMin - Max;
+
+	return 0.0f;
+}
+
+// False only when the sphere is entirely outside the spot light's cone or range.
+static __forceinline bool IsSpotConeNearSphere(vec3 Apex, vec3 Direction, float Range, float CosAngle, float SinAngle, vec3 Center, float Radius)
+{
+	vec3 v = Center - Apex;
+	float lenSq = glm::dot(v, v);
+	float axisLen = glm::dot(v, Direction);
+	float sideDist = CosAngle * sqrtf(glm::max(lenSq - axisLen * axisLen, 0.0f)) - axisLen * SinAngle;
+
+	if (sideDist > Radius)
+		return false;
+
+	if (lenSq > (Range + Radius) * (Range + Radius))
+		return false;
+
+	return (axisLen >= -Radius);
+}
+
+template <typename Grid>
+static __forceinline vec3 GetClusterViewPos(vsLightBinView<Grid>* BinView, vec3 Pos)
+{
+	vec3 result = vec3(BinView->view * vec4(Pos, 1.0f));
+	result.z = -result.z;
+
+	return result;
+}
+
+// Writes the cells a light touches to Cells in ascending order, returns the count.
+// Tests the light's reach against the view space bounds of each cell, the frustum slice between two depth
+// planes. Point and spot lights reach a radius from a point, capsules from the part of their segment inside
+// the slice. The squared distance splits into X, Y and Z parts, so a slice needs a distance per column and
+// per row rather than a test per cell. Spot lights then drop the cells outside their cone.
+template <typename Grid>
+static i32 GetLightClusterCells(vsLightBinView<Grid>* BinView, vsLight* Light, u16* Cells)
+{
+	i32 cellCount = 0;
+	float lightRadius;
+	vec3 coreA;
+	vec3 coreB;
+	bool capsule = (Light->type == LIGHT_TYPE_CAPSULE);
+	bool spot = (Light->type == LIGHT_TYPE_SPOT && Light->spotCosOuter > 0.0f);
+
+	if (capsule)
+	{
+		lightRadius = Light->radius;
+		coreA = GetClusterViewPos(BinView, Light->position - Light->direction * Light->halfLength);
+		coreB = GetClusterViewPos(BinView, Light->position + Light->direction * Light->halfLength);
+	}
+	else
+	{
+		vec3 center;
+		GetLightBoundingSphere(Light, &center, &lightRadius);
+		coreA = GetClusterViewPos(BinView, center);
+		coreB = coreA;
+	}
+
+	vec3 spotApex;
+	vec3 spotDir;
+	float spotSin = 0.0f;
+
+	if (spot)
+	{
+		spotApex = GetClusterViewPos(BinView, Light->position);
+		spotDir = vec3(BinView->view * vec4(Light->direction, 0.0f));
+		spotDir.z = -spotDir.z;
+		spotSin = sqrtf(1.0f - Light->spotCosOuter * Light->spotCosOuter);
+	}
+
+	int lightMinCZ = (int)Grid::GetSliceFromDepth(glm::max(glm::min(coreA.z, coreB.z) - lightRadius, Grid::GetNearPlane()));
+	int lightMaxCZ = (int)Grid::GetSliceFromDepth(glm::max(glm::max(coreA.z, coreB.z) + lightRadius, Grid::GetNearPlane()));
+
+	// NOTE: Anything past the far slice would land outside the grid.
+	if (lightMaxCZ > Grid::sizeZ - 1)
+		lightMaxCZ = Grid::sizeZ - 1;
+
+	float radiusSq = lightRadius * lightRadius;
+	float columnDistSq[Grid::sizeX];
+	float rowDistSq[Grid::sizeY];
+	vec2 columnRange[Grid::sizeX];
+	vec2 rowRange[Grid::sizeY];
+
+	for (int dS = lightMinCZ; dS <= lightMaxCZ; ++dS)
+	{
+		// NOTE: The shaders clamp anything nearer than slice 1 into it.
+		int nearSlice = (dS == 1) ? 0 : dS;
+		float depthZ1 = BinView->sliceDepth[nearSlice];
+		float depthZ2 = BinView->sliceDepth[dS + 1];
+		vec3 sliceCoreA = coreA;
+		vec3 sliceCoreB = coreB;
+
+		// NOTE: Only the part of the segment within reach of the slice can touch its cells.
+		if (capsule && coreA.z != coreB.z)
+		{
+			float t0 = (depthZ1 - lightRadius - coreA.z) / (coreB.z - coreA.z);
+			float t1 = (depthZ2 + lightRadius - coreA.z) / (coreB.z - coreA.z);
+
+			if (t0 > t1)
+			{
+				float temp = t0;
+				t0 = t1;
+				t1 = temp;
+			}
+
+			t0 = glm::max(t0, 0.0f);
+			t1 = glm::min(t1, 1.0f);
+
+			if (t0 > t1)
+				continue;
+
+			sliceCoreA = coreA + (coreB - coreA) * t0;
+			sliceCoreB = coreA + (coreB - coreA) * t1;
+		}
+
+		vec3 coreMin = glm::min(sliceCoreA, sliceCoreB);
+		vec3 coreMax = glm::max(sliceCoreA, sliceCoreB);
+		float distZ = GetRangeGap(coreMin.z, coreMax.z, depthZ1, depthZ2);
+		float remainSq = radiusSq - distZ * distZ;
+
+		if (remainSq < 0.0f)
+			continue;
+
+		// NOTE: Cell edges are a fixed fraction of the slice width, widest on the far plane.
+		vec2 scale1 = BinView->depthSliceScale[nearSlice];
+		vec2 scale2 = BinView->depthSliceScale[dS + 1];
+
+		for (int cX = 0; cX < Grid::sizeX; ++cX)
+		{
+			float edge0 = cX / (float)Grid::sizeX - 0.5f;
+			float edge1 = (cX + 1) / (float)Grid::sizeX - 0.5f;
+			columnRange[cX] = vec2(glm::min(edge0 * scale1.x, edge0 * scale2.x), glm::max(edge1 * scale1.x, edge1 * scale2.x));
+			float dist = GetRangeGap(coreMin.x, coreMax.x, columnRange[cX].x, columnRange[cX].y);
+			columnDistSq[cX] = dist * dist;
+		}
+
+		for (int cY = 0; cY < Grid::sizeY; ++cY)
+		{
+			float edge0 = cY / (float)Grid::sizeY - 0.5f;
+			float edge1 = (cY + 1) / (float)Grid::sizeY - 0.5f;
+			rowRange[cY] = vec2(glm::min(edge0 * scale1.y, edge0 * scale2.y), glm::max(edge1 * scale1.y, edge1 * scale2.y));
+			float dist = GetRangeGap(coreMin.y, coreMax.y, rowRange[cY].x, rowRange[cY].y);
+			rowDistSq[cY] = dist * dist;
+		}
+
+		for (int cY = 0; cY < Grid::sizeY; ++cY)
+		{
+			if (rowDistSq[cY] > remainSq)
+				continue;
+
+			for (int cX = 0; cX < Grid::sizeX; ++cX)
+			{
+				if (columnDistSq[cX] + rowDistSq[cY] > remainSq)
+					continue;
+
+				if (spot)
+				{
+					vec3 cellMin = vec3(columnRange[cX].x, rowRange[cY].x, depthZ1);
+					vec3 cellMax = vec3(columnRange[cX].y, rowRange[cY].y, depthZ2);
+
+					if (!IsSpotConeNearSphere(spotApex, spotDir, Light->radius, Light->spotCosOuter, spotSin, (cellMin + cellMax) * 0.5f, glm::length(cellMax - cellMin) * 0.5f))
+						continue;
+				}
+
+				Cells[cellCount++] = (u16)(dS * Grid::sliceCellCount + cY * Grid::sizeX + cX);
+			}
+		}
+	}
+
+	return cellCount;
+}
+
+// The screen space square binning used before GetLightClusterCells, kept for the culling comparison.
+template <typename Grid>
+static i32 GetLightClusterCellsProjected(vsLightBinView<Grid>* BinView, vsLight* Light, u16* Cells)
+{
+	i32 cellCount = 0;
+	vec3 lightPos = Light->position;
+	float lightRadius = Light->radius;
+	vec3 lightViewSpace = vec3(BinView->view * vec4(lightPos, 1.0f));
+	lightViewSpace.z = -lightViewSpace.z;
+
+	int lightMinCZ = (int)Grid::GetSliceFromDepth(glm::max(lightViewSpace.z - lightRadius, Grid::GetNearPlane()));
+	int lightMaxCZ = (int)Grid::GetSliceFromDepth(glm::max(lightViewSpace.z + lightRadius, Grid::GetNearPlane()));
+
+	// NOTE: Anything past the far slice would land outside the grid.
+	if (lightMaxCZ > Grid::sizeZ - 1)
+		lightMaxCZ = Grid::sizeZ - 1;
+
+	for (int dS = lightMinCZ; dS <= lightMaxCZ; ++dS)
+	{
+		float depthZ1 = Grid::GetDepthSlice((float)dS);
+		float depthZ2 = Grid::GetDepthSlice((float)(dS + 1));
+
+		float r1 = ProjectSphereToPlane(vec3(0, 0, 1), depthZ1, lightViewSpace, lightRadius);
+		float r2 = ProjectSphereToPlane(vec3(0, 0, 1), depthZ2, lightViewSpace, lightRadius);
+
+		// Take the bigger of the 2, or original if both -1
+		// Project the biggest to BOTH surrounding Z slices, get real bounds
+		if (dS == (int)Grid::GetSliceFromDepth(lightViewSpace.z))
+			r1 = lightRadius;
+		else
+			r1 = glm::max(r1, r2);
+
+		if (r1 == -1)
+			continue;
+
+		// We need to get the max bounds of both depth slices
+		// Convert to depth space (-0.5 to 0.5) then shift to (0 to 1)
+		vec2 nMinVS = vec2(lightViewSpace) - r1;
+		vec2 nMaxVS = vec2(lightViewSpace) + r1;
+
+		vec2 minVS0 = nMinVS / BinView->depthSliceScale[dS] + 0.5f;
+		vec2 maxVS0 = nMaxVS / BinView->depthSliceScale[dS] + 0.5f;
+
+		vec2 minVS1 = nMinVS / BinView->depthSliceScale[dS + 1] + 0.5f;
+		vec2 maxVS1 = nMaxVS / BinView->depthSliceScale[dS + 1] + 0.5f;
+
+		// TODO: Always a min extent regsitered on left if light is offscreen on left?
+		// TODO: Back plane has one extent, front plane has the other
+		minVS0.x = glm::min(minVS0.x, minVS1.x);
+		minVS0.y = glm::min(minVS0.y, minVS1.y);
+
+		maxVS0.x = glm::max(maxVS0.x, maxVS1.x);
+		maxVS0.y = glm::max(maxVS0.y, maxVS1.y);
+
+		int startCellX = (int)(minVS0.x * (float)Grid::sizeX);
+		int startCellY = (int)(minVS0.y * (float)Grid::sizeY);
+		int endCellX = (int)(maxVS0.x * (float)Grid::sizeX) + 1;
+		int endCellY = (int)(maxVS0.y * (float)Grid::sizeY) + 1;
+
+		if (startCellX < 0) startCellX = 0;
+		if (startCellX > Grid::sizeX) startCellX = Grid::sizeX;
+		if (startCellY < 0) startCellY = 0;
+		if (startCellY > Grid::sizeY) startCellY = Grid::sizeY;
+
+		if (endCellX < 0) endCellX = 0;
+		if (endCellX > Grid::sizeX) endCellX = Grid::sizeX;
+		if (endCellY < 0) endCellY = 0;
+		if (endCellY > Grid::sizeY) endCellY = Grid::sizeY;
+
+		// NOTE: Y inner so the cells come out in ascending order.
+		for (int cY = startCellY; cY < endCellY; ++cY)
+		{
+			for (int cX = startCellX; cX < endCellX; ++cX)
+			{
+				int cellIdx = dS * Grid::sliceCellCount + cY * Grid::sizeX + cX;
+				assert(cellIdx < Grid::cellCount);
+				Cells[cellCount++] = (u16)cellIdx;
+			}
+		}
+	}
+
+	return cellCount;
+}
+
+// Columns or rows of a slice whose range in GetLightClusterCells overlaps Min to Max.
+// NOTE: Both ends of a column's range only grow with its index, so the first and last overlapping ones
+// come straight from the edges.
+static __forceinline i32 GetClusterAxisSpan(float Min, float Max, float Scale1, float Scale2, i32 Size)
+{
+	float firstEdge = Min / ((Min >= 0.0f) ? Scale2 : Scale1);
+	float lastEdge = Max / ((Max >= 0.0f) ? Scale1 : Scale2);
+	// NOTE: Clamped before the cast, edges over tiny near slice scales can be huge.
+	float first = glm::min(glm::max(ceilf((firstEdge + 0.5f) * Size - 1.0f), 0.0f), (float)Size);
+	float last = glm::max(glm::min(floorf((lastEdge + 0.5f) * Size), (float)(Size - 1)), -1.0f);
+
+	if (last < first)
+		return 0;
+
+	return (i32)(last - first) + 1;
+}
+
+template <typename Grid>
+i64 GetLightBinItemBound(vsLightBinView<Grid>* BinView, vsLight* Lights, i32 LightCount)
+{
+	i64 result = 0;
+
+	for (i32 i = 0; i < LightCount; ++i)
+	{
+		vec3 center;
+		float radius;
+		GetLightBoundingSphere(&Lights[i], &center, &radius);
+		center = GetClusterViewPos(BinView, center);
+		// NOTE: Slightly larger so rounding in the shader can't reach a cell the bound missed.
+		radius *= 1.01f;
+
+		int minCZ = (int)Grid::GetSliceFromDepth(glm::max(center.z - radius, Grid::GetNearPlane()));
+		int maxCZ = glm::min((int)Grid::GetSliceFromDepth(glm::max(center.z + radius, Grid::GetNearPlane())), Grid::sizeZ - 1);
+
+		for (int dS = minCZ; dS <= maxCZ; ++dS)
+		{
+			int nearSlice = (dS == 1) ? 0 : dS;
+			vec2 scale1 = BinView->depthSliceScale[nearSlice];
+			vec2 scale2 = BinView->depthSliceScale[dS + 1];
+			i32 columns = GetClusterAxisSpan(center.x - radius, center.x + radius, scale1.x, scale2.x, Grid::sizeX);
+			i32 rows = GetClusterAxisSpan(center.y - radius, center.y + radius, scale1.y, scale2.y, Grid::sizeY);
+
+			result += columns * rows;
+		}
+	}
+
+	return result;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Item list.
+//-----------------------------------------------------------------------------------------------------------
+// NOTE: Both binners pick the format from the light count alone, so they always agree.
+static i32 GetLightBinItemFormat(i32 LightCount)
+{
+	return (LightCount <= 65536) ? CLUSTER_ITEM_FORMAT_U16 : CLUSTER_ITEM_FORMAT_U32;
+}
+
+i64 LightBinsGetItemListSize(vsLightBins* Bins)
+{
+	i64 itemSize = (Bins->itemFormat == CLUSTER_ITEM_FORMAT_U16) ? sizeof(u16) : sizeof(u32);
+
+	return ((i64)Bins->itemListCount * itemSize + 3) & ~3LL;
+}
+
+u32 LightBinsGetItem(vsLightBins* Bins, i32 Index)
+{
+	if (Bins->itemFormat == CLUSTER_ITEM_FORMAT_U16)
+		return ((u16*)Bins->itemList)[Index];
+
+	return ((u32*)Bins->itemList)[Index];
+}
+
+static __forceinline void SetLightBinItem(vsLightBins* Bins, u32 Index, u32 Item)
+{
+	if (Bins->itemFormat == CLUSTER_ITEM_FORMAT_U16)
+		((u16*)Bins->itemList)[Index] = (u16)Item;
+	else
+		((u32*)Bins->itemList)[Index] = Item;
+}
+
+static void SetClusterLight(ClusterLightListEntry* Entry, vsLight* Light)
+{
+	Entry->position = Light->position;
+	Entry->radius = Light->radius;
+	Entry->color = Light->color;
+	Entry->type = (uint32_t)Light->type;
+	Entry->direction = Light->direction;
+	Entry->halfLength = Light->halfLength;
+	Entry->spotCosOuter = Light->spotCosOuter;
+	Entry->spotCosInner = Light->spotCosInner;
+	Entry->pad[0] = 0.0f;
+	Entry->pad[1] = 0.0f;
+}
+
+void SetClusterLights(ClusterLightListEntry* Entries, vsLight* Lights, i32 LightCount)
+{
+	for (i32 i = 0; i < LightCount; ++i)
+		SetClusterLight(Entries + i, Lights + i);
+}
+
+// Sets the format and makes room for ItemCount items, the contents are not kept.
+static void ReserveLightBinItems(vsLightBins* Bins, i32 ItemFormat, i32 ItemCount)
+{
+	Bins->itemFormat = ItemFormat;
+	Bins->itemListCount = ItemCount;
+
+	i64 size = LightBinsGetItemListSize(Bins);
+
+	if (Bins->reserveItems)
+	{
+		Bins->itemList = Bins->reserveItems(Bins->reserveItemsData, size);
+		Bins->itemListCapacity = size;
+	}
+	else if (size > Bins->itemListCapacity)
+	{
+		// NOTE: Some headroom so a few more lights don't reallocate every frame.
+		i64 capacity = GetMax((i32)(size + size / 2), 4096);
+		delete[] (u32*)Bins->itemList;
+		Bins->itemList = new u32[capacity / sizeof(u32)];
+		Bins->itemListCapacity = capacity & ~3LL;
+	}
+}
+
+void LightBinsFree(vsLightBins* Bins)
+{
+	if (!Bins->reserveItems)
+		delete[] (u32*)Bins->itemList;
+
+	Bins->itemList = NULL;
+	Bins->itemListCapacity = 0;
+	Bins->itemListCount = 0;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Serial binning.
+//-----------------------------------------------------------------------------------------------------------
+template <typename Grid>
+void BinLightsSerial(vsLightBinView<Grid>* BinView, vsLight* Lights, i32 LightCount, vsLightBins* Bins, u16* CellLights, u16* CellLightCounts, i32 CellLightsMax)
+{
+	assert(LightCount <= 65536);
+
+	memset(CellLightCounts, 0, sizeof(u16) * Grid::cellCount);
+	memset(Bins->offsetList, 0, sizeof(ClusterOffsetListEntry) * Grid::cellCount);
+	Bins->lightListCount = 0;
+	Bins->highestLightsInCell = 0;
+	Bins->inactiveItemCount = 0;
+
+	u16 cells[Grid::cellCount];
+	i32 itemCount = 0;
+
+	for (i32 i = 0; i < LightCount; ++i)
+	{
+		Lights[i].clusterId = -1;
+
+		i32 cellCount = GetLightClusterCells(BinView, Lights + i, cells);
+		itemCount += cellCount;
+
+		for (i32 c = 0; c < cellCount; ++c)
+		{
+			i32 lightIdxInCell = CellLightCounts[cells[c]];
+			assert(lightIdxInCell < CellLightsMax);
+
+			CellLights[cells[c] * CellLightsMax + lightIdxInCell] = (u16)i;
+			++CellLightCounts[cells[c]];
+		}
+	}
+
+	ReserveLightBinItems(Bins, GetLightBinItemFormat(LightCount), itemCount);
+	i32 itemListCount = 0;
+
+	for (int i = 0; i < Grid::cellCount; ++i)
+	{
+		int cellLightCount = CellLightCounts[i];
+
+		if (cellLightCount > 0)
+		{
+			Bins->offsetList[i].lightCount = cellLightCount;
+			Bins->offsetList[i].itemOffset = itemListCount;
+
+			if (cellLightCount > Bins->highestLightsInCell)
+				Bins->highestLightsInCell = cellLightCount;
+
+			for (int j = 0; j < cellLightCount; ++j)
+			{
+				vsLight* worldLight = &Lights[CellLights[i * CellLightsMax + j]];
+
+				if (worldLight->clusterId == -1)
+				{
+					assert(Bins->lightListCount < Bins->lightListMax);
+					SetClusterLight(Bins->lightList + Bins->lightListCount, worldLight);
+
+					worldLight->clusterId = Bins->lightListCount++;
+				}
+
+				SetLightBinItem(Bins, itemListCount++, worldLight->clusterId);
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Parallel binning.
+//-----------------------------------------------------------------------------------------------------------
+// Count then scatter. Each job counts the items a contiguous range of lights adds to every cell. Walking the
+// cells in order and the jobs in order within each cell visits lights in exactly the serial order, so a
+// prefix sum over (cell, job) gives every job its item slots. A light enters the light list at its lowest
+// cell, the serial pass finds lights in (cell, light) order, so the light list is a second prefix sum keyed
+// by that cell. The count pass keeps each light's cells, and the scatter reads them back to fill the packed
+// item list.
+// NOTE: Static lights come from the cache when it holds them.
+template <typename Grid>
+static __forceinline bool IsStaticLightCached(vsLightBinner<Grid>* Binner, i32 Index)
+{
+	return Binner->staticRead && Index < Binner->staticLightCount;
+}
+
+template <typename Grid>
+static __forceinline i32 GetCachedLightCells(vsLightBinner<Grid>* Binner, i32 Index, u16** Cells)
+{
+	*Cells = Binner->staticCells + Binner->staticCellStart[Index];
+	return (i32)(Binner->staticCellStart[Index + 1] - Binner->staticCellStart[Index]);
+}
+
+// Makes room for LightCount lights and enough cells for one more light after the first CellCount.
+template <typename Grid>
+static void ReserveThreadLightCells(vsLightBinThread<Grid>* Thread, i32 LightCount, i64 CellCount)
+{
+	if (LightCount + 1 > Thread->lightCellStartCapacity)
+	{
+		Thread->lightCellStartCapacity = (LightCount + 1) * 2;
+		delete[] Thread->lightCellStart;
+		Thread->lightCellStart = new u32[Thread->lightCellStartCapacity];
+	}
+
+	if (CellCount + Grid::cellCount > Thread->lightCellCapacity)
+	{
+		i64 capacity = (CellCount + Grid::cellCount) * 2;
+		u16* cells = new u16[capacity];
+		memcpy(cells, Thread->lightCells, sizeof(u16) * CellCount);
+		delete[] Thread->lightCells;
+		Thread->lightCells = cells;
+		Thread->lightCellCapacity = capacity;
+	}
+}
+
+// Copies the active cells to Out, which may be Cells, returns how many there are.
+static __forceinline i32 GetActiveLightCells(u8* ActiveCells, u16* Cells, i32 CellCount, u16* Out)
+{
+	i32 activeCount = 0;
+
+	for (i32 c = 0; c < CellCount; ++c)
+	{
+		if (ActiveCells[Cells[c]])
+			Out[activeCount++] = Cells[c];
+	}
+
+	return activeCount;
+}
+
+template <typename Grid>
+static void CountLightRangeJob(void* Data, i32 Index)
+{
+	vsLightBinner<Grid>* binner = (vsLightBinner<Grid>*)Data;
+	vsLightBinThread<Grid>* thread = binner->threads + Index;
+	i32 start = (i32)((i64)binner->lightCount * Index / binner->jobCount);
+	i32 end = (i32)((i64)binner->lightCount * (Index + 1) / binner->jobCount);
+
+	memset(thread->cellBins, 0, sizeof(thread->cellBins));
+	memset(thread->firstBins, 0, sizeof(thread->firstBins));
+	thread->inactiveItems = 0;
+
+	i64 keptCells = 0;
+	ReserveThreadLightCells(thread, end - start, keptCells);
+	thread->lightCellStart[0] = 0;
+
+	for (i32 i = start; i < end; ++i)
+	{
+		u16* cells;
+		i32 cellCount;
+
+		if (IsStaticLightCached(binner, i))
+		{
+			cellCount = GetCachedLightCells(binner, i, &cells);
+		}
+		else
+		{
+			ReserveThreadLightCells(thread, end - start, keptCells);
+			cells = thread->lightCells + keptCells;
+			cellCount = GetLightClusterCells(binner->view, binner->lights + i, cells);
+			keptCells += cellCount;
+		}
+
+		thread->lightCellStart[i - start + 1] = (u32)keptCells;
+
+		// NOTE: Counts for now, BinLights turns them into offsets before the scatter fills the cache.
+		if (binner->staticFill && i < binner->staticLightCount)
+			binner->staticCellStart[i] = cellCount;
+
+		if (binner->activeCells)
+		{
+			i32 activeCount = GetActiveLightCells(binner->activeCells, cells, cellCount, thread->cells);
+			thread->inactiveItems += cellCount - activeCount;
+			cellCount = activeCount;
+			cells = thread->cells;
+		}
+
+		if (cellCount == 0)
+			continue;
+
+		for (i32 c = 0; c < cellCount; ++c)
+			++thread->cellBins[cells[c]];
+
+		++thread->firstBins[cells[0]];
+	}
+}
+
+template <typename Grid>
+static void SumCellChunkJob(void* Data, i32 Index)
+{
+	vsLightBinner<Grid>* binner = (vsLightBinner<Grid>*)Data;
+	i32 start = Grid::cellCount * Index / binner->jobCount;
+	i32 end = Grid::cellCount * (Index + 1) / binner->jobCount;
+	u32 items = 0;
+	u32 lights = 0;
+
+	for (i32 t = 0; t < binner->jobCount; ++t)
+	{
+		vsLightBinThread<Grid>* thread = binner->threads + t;
+
+		for (i32 c = start; c < end; ++c)
+		{
+			items += thread->cellBins[c];
+			lights += thread->firstBins[c];
+		}
+	}
+
+	binner->threads[Index].chunkItems = items;
+	binner->threads[Index].chunkLights = lights;
+}
+
+// Turns the counts of a cell chunk into slots, chunkItems and chunkLights hold the chunk's first slots.
+template <typename Grid>
+static void ApplyCellChunkJob(void* Data, i32 Index)
+{
+	vsLightBinner<Grid>* binner = (vsLightBinner<Grid>*)Data;
+	vsLightBinThread<Grid>* chunk = binner->threads + Index;
+	i32 start = Grid::cellCount * Index / binner->jobCount;
+	i32 end = Grid::cellCount * (Index + 1) / binner->jobCount;
+	u32 itemOffset = chunk->chunkItems;
+	u32 lightOffset = chunk->chunkLights;
+	u32 highest = 0;
+
+	for (i32 c = start; c < end; ++c)
+	{
+		u32 cellLightCount = 0;
+
+		for (i32 t = 0; t < binner->jobCount; ++t)
+		{
+			vsLightBinThread<Grid>* thread = binner->threads + t;
+			u32 count = thread->cellBins[c];
+			thread->cellBins[c] = itemOffset + cellLightCount;
+			cellLightCount += count;
+
+			count = thread->firstBins[c];
+			thread->firstBins[c] = lightOffset;
+			lightOffset += count;
+		}
+
+		ClusterOffsetListEntry* entry = binner->bins->offsetList + c;
+
+		if (cellLightCount > 0)
+		{
+			entry->itemOffset = itemOffset;
+			entry->lightCount = cellLightCount;
+			itemOffset += cellLightCount;
+
+			if (cellLightCount > highest)
+				highest = cellLightCount;
+		}
+		else
+		{
+			entry->itemOffset = 0;
+			entry->lightCount = 0;
+		}
+	}
+
+	chunk->chunkHighest = highest;
+}
+
+template <typename Grid>
+static void ScatterLightRangeJob(void* Data, i32 Index)
+{
+	vsLightBinner<Grid>* binner = (vsLightBinner<Grid>*)Data;
+	vsLightBinThread<Grid>* thread = binner->threads + Index;
+	vsLightBins* bins = binner->bins;
+	i32 start = (i32)((i64)binner->lightCount * Index / binner->jobCount);
+	i32 end = (i32)((i64)binner->lightCount * (Index + 1) / binner->jobCount);
+
+	for (i32 i = start; i < end; ++i)
+	{
+		vsLight* light = binner->lights + i;
+		u16* cells = thread->lightCells + thread->lightCellStart[i - start];
+		i32 cellCount = (i32)(thread->lightCellStart[i - start + 1] - thread->lightCellStart[i - start]);
+
+		if (IsStaticLightCached(binner, i))
+			cellCount = GetCachedLightCells(binner, i, &cells);
+
+		if (binner->staticFill && i < binner->staticLightCount)
+			memcpy(binner->staticCells + binner->staticCellStart[i], cells, sizeof(u16) * cellCount);
+
+		// NOTE: The cache keeps every cell, activity changes each frame.
+		if (binner->activeCells)
+		{
+			cellCount = GetActiveLightCells(binner->activeCells, cells, cellCount, thread->cells);
+			cells = thread->cells;
+		}
+
+		if (cellCount == 0)
+		{
+			light->clusterId = -1;
+			continue;
+		}
+
+		u32 clusterId = thread->firstBins[cells[0]]++;
+		light->clusterId = clusterId;
+		SetClusterLight(bins->lightList + clusterId, light);
+
+		if (bins->itemFormat == CLUSTER_ITEM_FORMAT_U16)
+		{
+			u16* items = (u16*)bins->itemList;
+
+			for (i32 c = 0; c < cellCount; ++c)
+				items[thread->cellBins[cells[c]]++] = (u16)clusterId;
+		}
+		else
+		{
+			u32* items = (u32*)bins->itemList;
+
+			for (i32 c = 0; c < cellCount; ++c)
+				items[thread->cellBins[cells[c]]++] = clusterId;
+		}
+	}
+}
+
+template <typename Grid>
+void LightBinnerInit(vsLightBinner<Grid>* Binner, vsJobSystem* Jobs)
+{
+	*Binner = {};
+	Binner->jobs = Jobs;
+	Binner->jobMax = Jobs->threadCount + 1;
+	Binner->threads = new vsLightBinThread<Grid>[Binner->jobMax]();
+}
+
+template <typename Grid>
+void LightBinnerFree(vsLightBinner<Grid>* Binner)
+{
+	for (i32 i = 0; i < Binner->jobMax; ++i)
+	{
+		delete[] Binner->threads[i].lightCells;
+		delete[] Binner->threads[i].lightCellStart;
+	}
+
+	delete[] Binner->threads;
+	delete[] Binner->staticCellStart;
+	delete[] Binner->staticCells;
+	*Binner = {};
+}
+
+// Sizes the static cache for a refill, cells are reserved once the count pass knows how many there are.
+template <typename Grid>
+static void ReserveStaticLights(vsLightBinner<Grid>* Binner, i32 StaticLightCount)
+{
+	if (StaticLightCount + 1 > Binner->staticLightCapacity)
+	{
+		Binner->staticLightCapacity = (StaticLightCount + 1) * 2;
+		delete[] Binner->staticCellStart;
+		Binner->staticCellStart = new u32[Binner->staticLightCapacity];
+	}
+}
+
+template <typename Grid>
+void BinLights(vsLightBinner<Grid>* Binner, vsLightBinView<Grid>* BinView, vsLight* Lights, i32 LightCount, vsLightBins* Bins, i32 StaticLightCount, u32 StaticVersion, u8* ActiveCells)
+{
+	Binner->jobCount = GetMax(GetMin(LightCount / LIGHT_BIN_JOB_LIGHTS_MIN, Binner->jobMax), 1);
+	Binner->view = BinView;
+	Binner->lights = Lights;
+	Binner->lightCount = LightCount;
+	Binner->bins = Bins;
+	Binner->activeCells = ActiveCells;
+
+	// NOTE: Cached cells only hold for the view they were binned with. While the camera moves a refill would
+	// be thrown away next call, so static lights are binned like the rest until the view holds still.
+	bool viewHeld = Binner->lastViewValid && memcmp(&Binner->lastView, BinView, sizeof(*BinView)) == 0;
+	Binner->staticRead = StaticLightCount > 0 && Binner->staticValid
+		&& StaticLightCount == Binner->staticLightCount && StaticVersion == Binner->staticVersion
+		&& memcmp(&Binner->staticView, BinView, sizeof(*BinView)) == 0;
+	Binner->staticFill = StaticLightCount > 0 && !Binner->staticRead && viewHeld;
+	Binner->lastView = *BinView;
+	Binner->lastViewValid = true;
+
+	if (Binner->staticFill)
+	{
+		ReserveStaticLights(Binner, StaticLightCount);
+		Binner->staticLightCount = StaticLightCount;
+	}
+
+	JobSystemParallelFor(Binner->jobs, Binner->jobCount, CountLightRangeJob<Grid>, Binner);
+
+	if (Binner->staticFill)
+	{
+		u32 staticCellCount = 0;
+
+		for (i32 i = 0; i < StaticLightCount; ++i)
+		{
+			u32 count = Binner->staticCellStart[i];
+			Binner->staticCellStart[i] = staticCellCount;
+			staticCellCount += count;
+		}
+
+		Binner->staticCellStart[StaticLightCount] = staticCellCount;
+
+		if (staticCellCount > Binner->staticCellCapacity)
+		{
+			Binner->staticCellCapacity = staticCellCount + staticCellCount / 2;
+			delete[] Binner->staticCells;
+			Binner->staticCells = new u16[Binner->staticCellCapacity];
+		}
+	}
+
+	JobSystemParallelFor(Binner->jobs, Binner->jobCount, SumCellChunkJob<Grid>, Binner);
+
+	// NOTE: Only one entry per job, not worth spreading.
+	u32 itemCount = 0;
+	u32 lightCount = 0;
+	Bins->inactiveItemCount = 0;
+
+	for (i32 i = 0; i < Binner->jobCount; ++i)
+	{
+		vsLightBinThread<Grid>* chunk = Binner->threads + i;
+		Bins->inactiveItemCount += chunk->inactiveItems;
+		u32 chunkItems = chunk->chunkItems;
+		u32 chunkLights = chunk->chunkLights;
+		chunk->chunkItems = itemCount;
+		chunk->chunkLights = lightCount;
+		itemCount += chunkItems;
+		lightCount += chunkLights;
+	}
+
+	assert(lightCount <= (u32)Bins->lightListMax);
+	Bins->lightListCount = lightCount;
+	ReserveLightBinItems(Bins, GetLightBinItemFormat(LightCount), itemCount);
+
+	JobSystemParallelFor(Binner->jobs, Binner->jobCount, ApplyCellChunkJob<Grid>, Binner);
+	JobSystemParallelFor(Binner->jobs, Binner->jobCount, ScatterLightRangeJob<Grid>, Binner);
+
+	Bins->highestLightsInCell = 0;
+
+	for (i32 i = 0; i < Binner->jobCount; ++i)
+		Bins->highestLightsInCell = GetMax(Bins->highestLightsInCell, Binner->threads[i].chunkHighest);
+
+	if (Binner->staticFill)
+	{
+		Binner->staticView = *BinView;
+		Binner->staticVersion = StaticVersion;
+		Binner->staticValid = true;
+	}
+
+	Binner->view = NULL;
+	Binner->lights = NULL;
+	Binner->bins = NULL;
+	Binner->activeCells = NULL;
+}
+
+#define INSTANCE_LIGHT_BINNING(Grid) \
+	template void LightBinViewCreate<Grid>(vsLightBinView<Grid>* BinView, mat4 View, mat4 InvProj); \
+	template void LightBinnerInit<Grid>(vsLightBinner<Grid>* Binner, vsJobSystem* Jobs); \
+	template void LightBinnerFree<Grid>(vsLightBinner<Grid>* Binner); \
+	template void BinLights<Grid>(vsLightBinner<Grid>* Binner, vsLightBinView<Grid>* BinView, vsLight* Lights, i32 LightCount, vsLightBins* Bins, i32 StaticLightCount, u32 StaticVersion, u8* ActiveCells); \
+	template void BinLightsSerial<Grid>(vsLightBinView<Grid>* BinView, vsLight* Lights, i32 LightCount, vsLightBins* Bins, u16* CellLights, u16* CellLightCounts, i32 CellLightsMax); \
+	template i64 GetLightBinItemBound<Grid>(vsLightBinView<Grid>* BinView, vsLight* Lights, i32 LightCount);
+
+INSTANCE_LIGHT_BINNING(vsClusterGridMain)
+INSTANCE_LIGHT_BINNING(vsClusterGridFine)
+
+//-----------------------------------------------------------------------------------------------------------
+// Benchmark.
+//-----------------------------------------------------------------------------------------------------------
+// Returns true when Cell is in a light's ascending cell list.
+static bool FindLightClusterCell(u16* Cells, i32 CellCount, i32 Cell)
+{
+	i32 first = 0;
+	i32 last = CellCount - 1;
+
+	while (first <= last)
+	{
+		i32 mid = (first + last) / 2;
+
+		if (Cells[mid] == Cell)
+			return true;
+
+		if (Cells[mid] < Cell)
+			first = mid + 1;
+		else
+			last = mid - 1;
+	}
+
+	return false;
+}
+
+// Cell a view space point lands in the way the shaders find it, -1 when it is outside the grid.
+template <typename Grid>
+static i32 GetSampleClusterCell(vsLightBinView<Grid>* BinView, vec3 P)
+{
+	if (P.z < BinView->sliceDepth[0])
+		return -1;
+
+	vec2 widthPerDepth = BinView->depthSliceScale[1] / BinView->sliceDepth[1];
+	int cellX = (int)floorf((P.x / (widthPerDepth.x * P.z) + 0.5f) * (float)Grid::sizeX);
+	int cellY = (int)floorf((P.y / (widthPerDepth.y * P.z) + 0.5f) * (float)Grid::sizeY);
+	int cellZ = (int)Grid::GetSliceFromDepth(P.z);
+
+	if (cellZ < 1)
+		cellZ = 1;
+
+	if (cellX < 0 || cellX >= Grid::sizeX || cellY < 0 || cellY >= Grid::sizeY || cellZ >= Grid::sizeZ)
+		return -1;
+
+	return cellZ * Grid::sliceCellCount + cellY * Grid::sizeX + cellX;
+}
+
+// Counts light, cell pairs for the exact test and the old projected squares. Every pair is a light the
+// fragments in that cell loop over, so fewer pairs is less shading work. Also checks both are conservative
+// by placing points inside each light and looking up their cell the way the shaders do.
+template <typename Grid>
+static void CompareLightCulling(vsLightBinView<Grid>* BinView, vsLight* Lights, i32 LightCount)
+{
+	i32 samplesPerLight = 32;
+	i64 exactPairs = 0;
+	i64 projectedPairs = 0;
+	i64 samples = 0;
+	i64 exactMisses = 0;
+	i64 projectedMisses = 0;
+	u32 seed = 0x9E3779B9;
+
+	u16* exactCells = new u16[Grid::cellCount];
+	u16* projectedCells = new u16[Grid::cellCount];
+
+	for (i32 i = 0; i < LightCount; ++i)
+	{
+		i32 exactCount = GetLightClusterCells(BinView, Lights + i, exactCells);
+		i32 projectedCount = GetLightClusterCellsProjected(BinView, Lights + i, projectedCells);
+		exactPairs += exactCount;
+		projectedPairs += projectedCount;
+
+		vec3 lightViewSpace = vec3(BinView->view * vec4(Lights[i].position, 1.0f));
+		lightViewSpace.z = -lightViewSpace.z;
+
+		for (i32 s = 0; s < samplesPerLight; ++s)
+		{
+			float r[3];
+
+			for (i32 j = 0; j < 3; ++j)
+			{
+				seed = seed * 1664525 + 1013904223;
+				r[j] = (float)(seed >> 8) / (float)(1 << 24) * 2.0f - 1.0f;
+			}
+
+			if (r[0] * r[0] + r[1] * r[1] + r[2] * r[2] > 1.0f)
+				continue;
+
+			vec3 p = vec3(lightViewSpace.x + r[0] * Lights[i].radius, lightViewSpace.y + r[1] * Lights[i].radius, lightViewSpace.z + r[2] * Lights[i].radius);
+			i32 cell = GetSampleClusterCell(BinView, p);
+
+			if (cell == -1)
+				continue;
+
+			++samples;
+
+			if (!FindLightClusterCell(exactCells, exactCount, cell))
+				++exactMisses;
+
+			if (!FindLightClusterCell(projectedCells, projectedCount, cell))
+				++projectedMisses;
+		}
+	}
+
+	std::cout << "  Pairs: projected " << projectedPairs << ", exact " << exactPairs << ", "
+		<< (100.0 - (projectedPairs > 0 ? (double)exactPairs * 100.0 / projectedPairs : 100.0)) << "% less shading. "
+		<< "Missed samples: projected " << projectedMisses << ", exact " << exactMisses << " of " << samples << "\n";
+
+	delete[] exactCells;
+	delete[] projectedCells;
+}
+
+static float GetBenchRandom(u32* Seed)
+{
+	*Seed = *Seed * 1664525 + 1013904223;
+
+	return (float)(*Seed >> 8) / (float)(1 << 24);
+}
+
+// Counts light, cell pairs for spot and capsule lights against binning their bounding spheres, and against
+// faking them with a row of point lights the way the levels used to. Also checks both shapes are
+// conservative by placing points inside them.
+template <typename Grid>
+static void CompareLightShapes(vsLightBinView<Grid>* BinView)
+{
+	i32 lightCount = 2000;
+	i32 fillPoints = 8;
+	i32 samplesPerLight = 256;
+	u32 seed = 0x5EED5EED;
+	float tanHalfY = tanf(glm::radians(25.0f));
+
+	u16* cells = new u16[Grid::cellCount];
+
+	for (i32 type = LIGHT_TYPE_SPOT; type <= LIGHT_TYPE_CAPSULE; ++type)
+	{
+		i64 exactPairs = 0;
+		i64 spherePairs = 0;
+		i64 fillPairs = 0;
+		i64 samples = 0;
+		i64 misses = 0;
+
+		for (i32 i = 0; i < lightCount; ++i)
+		{
+			float z = 2.0f + GetBenchRandom(&seed) * 198.0f;
+			vec3 dir;
+
+			do
+			{
+				dir = vec3(GetBenchRandom(&seed), GetBenchRandom(&seed), GetBenchRandom(&seed)) * 2.0f - vec3(1.0f);
+			}
+			while (glm::dot(dir, dir) < 0.01f || glm::dot(dir, dir) > 1.0f);
+
+			vsLight light = {};
+			light.type = type;
+			light.position = vec3((GetBenchRandom(&seed) * 2.4f - 1.2f) * z * tanHalfY * (16.0f / 9.0f), (GetBenchRandom(&seed) * 2.4f - 1.2f) * z * tanHalfY, -z);
+			light.direction = glm::normalize(dir);
+			light.radius = 4.0f + GetBenchRandom(&seed) * 12.0f;
+			light.color = vec3(1.0f);
+			float spotAngle = glm::radians(15.0f + GetBenchRandom(&seed) * 25.0f);
+			light.spotCosOuter = cosf(spotAngle);
+			light.spotCosInner = cosf(spotAngle * 0.8f);
+			light.halfLength = 2.0f + GetBenchRandom(&seed) * 8.0f;
+
+			i32 cellCount = GetLightClusterCells(BinView, &light, cells);
+			exactPairs += cellCount;
+
+			// NOTE: Cells come out sorted, the samples look them up after the comparison lights are binned.
+			u16* exactCells = new u16[cellCount + 1];
+			memcpy(exactCells, cells, sizeof(u16) * cellCount);
+
+			vsLight sphere = {};
+			GetLightBoundingSphere(&light, &sphere.position, &sphere.radius);
+			spherePairs += GetLightClusterCells(BinView, &sphere, cells);
+
+			// Spots faked with points down the axis sized to the cone, capsules with points along the segment.
+			for (i32 f = 0; f < fillPoints; ++f)
+			{
+				vsLight fill = {};
+				float t = (f + 0.5f) / (float)fillPoints;
+
+				if (type == LIGHT_TYPE_SPOT)
+				{
+					fill.position = light.position + light.direction * (light.radius * t);
+					fill.radius = light.radius * t * tanf(spotAngle) + light.radius / fillPoints;
+				}
+				else
+				{
+					fill.position = light.position + light.direction * (light.halfLength * (t * 2.0f - 1.0f));
+					fill.radius = light.radius;
+				}
+
+				fillPairs += GetLightClusterCells(BinView, &fill, cells);
+			}
+
+			for (i32 s = 0; s < samplesPerLight; ++s)
+			{
+				vec3 r = vec3(GetBenchRandom(&seed), GetBenchRandom(&seed), GetBenchRandom(&seed)) * 2.0f - vec3(1.0f);
+
+				if (glm::dot(r, r) > 1.0f)
+					continue;
+
+				vec3 p;
+
+				if (type == LIGHT_TYPE_SPOT)
+				{
+					p = light.position + r * light.radius;
+					vec3 toP = p - light.position;
+
+					if (glm::dot(toP, light.direction) < light.spotCosOuter * glm::length(toP))
+						continue;
+				}
+				else
+				{
+					p = light.position + light.direction * (light.halfLength * (GetBenchRandom(&seed) * 2.0f - 1.0f)) + r * light.radius;
+				}
+
+				i32 cell = GetSampleClusterCell(BinView, GetClusterViewPos(BinView, p));
+
+				if (cell == -1)
+					continue;
+
+				++samples;
+
+				if (!FindLightClusterCell(exactCells, cellCount, cell))
+					++misses;
+			}
+
+			delete[] exactCells;
+		}
+
+		std::cout << "  " << lightCount << (type == LIGHT_TYPE_SPOT ? " spot" : " capsule") << " lights: " << exactPairs << " pairs, "
+			<< spherePairs << " as bounding spheres, " << fillPairs << " faked with " << fillPoints << " points each. Missed samples: "
+			<< misses << " of " << samples << "\n";
+	}
+
+	delete[] cells;
+}
+
+// Bins with a given grid and reports the cost on both sides. Items are what binning writes and uploads,
+// items over cells is how many lights an average cell's fragments loop over.
+template <typename Grid>
+static void CompareClusterGrid(vsJobSystem* Jobs, mat4 Proj, vsLight* Lights, i32 LightCount, i32 Runs)
+{
+	vsLightBinView<Grid> binView;
+	LightBinViewCreate(&binView, mat4(), glm::inverse(Proj));
+
+	vsLightBinner<Grid> binner;
+	LightBinnerInit(&binner, Jobs);
+
+	vsLightBins bins = {};
+	bins.lightListMax = LightCount;
+	bins.offsetList = new ClusterOffsetListEntry[Grid::cellCount];
+	bins.lightList = new ClusterLightListEntry[LightCount];
+
+	double binTime = GetTime();
+
+	for (i32 i = 0; i < Runs; ++i)
+		BinLights(&binner, &binView, Lights, LightCount, &bins);
+
+	binTime = (GetTime() - binTime) / Runs;
+
+	i32 occupiedCells = 0;
+
+	for (i32 i = 0; i < Grid::cellCount; ++i)
+	{
+		if (bins.offsetList[i].lightCount > 0)
+			++occupiedCells;
+	}
+
+	std::cout << "  " << Grid::sizeX << "x" << Grid::sizeY << "x" << Grid::sizeZ << ": " << (binTime * 1000.0) << "ms, "
+		<< bins.itemListCount << " items in " << ((LightBinsGetItemListSize(&bins) + sizeof(ClusterOffsetListEntry) * Grid::cellCount) / 1024) << "kb, "
+		<< ((double)bins.itemListCount / Grid::cellCount) << " lights per cell, "
+		<< (occupiedCells > 0 ? (double)bins.itemListCount / occupiedCells : 0.0) << " per lit cell, " << bins.highestLightsInCell << " most\n";
+
+	delete[] bins.offsetList;
+	LightBinsFree(&bins);
+	delete[] bins.lightList;
+
+	LightBinnerFree(&binner);
+}
+
+// Marks the cells holding a corridor the way cluster_activation.comp marks them from depth: a floor 2 units
+// below the camera, walls 20 units either side and an end wall 300 units away. Cells next to a marked cell
+// are active, returns how many.
+template <typename Grid>
+static i32 GetCorridorActiveCells(u8* ActiveCells, float TanHalfY, float Aspect)
+{
+	i32 width = 480;
+	i32 height = 270;
+	u8* markedCells = new u8[Grid::cellCount];
+	memset(markedCells, 0, Grid::cellCount);
+
+	for (i32 pY = 0; pY < height; ++pY)
+	{
+		for (i32 pX = 0; pX < width; ++pX)
+		{
+			vec3 ray = vec3(((pX + 0.5f) / width * 2.0f - 1.0f) * TanHalfY * Aspect, ((pY + 0.5f) / height * 2.0f - 1.0f) * TanHalfY, -1.0f);
+
+			// NOTE: The ray is one unit deep per unit along it, so hit distances are view depths.
+			float depth = 300.0f;
+
+			if (ray.y < 0.0f)
+				depth = glm::min(depth, 2.0f / -ray.y);
+
+			if (ray.x != 0.0f)
+				depth = glm::min(depth, 20.0f / fabsf(ray.x));
+
+			i32 cellX = pX * Grid::sizeX / width;
+			i32 cellY = pY * Grid::sizeY / height;
+			i32 cellZ = GetMin(GetMax((i32)Grid::GetSliceFromDepth(depth), 1), Grid::sizeZ - 1);
+			markedCells[cellZ * Grid::sliceCellCount + cellY * Grid::sizeX + cellX] = 1;
+		}
+	}
+
+	i32 activeCount = 0;
+
+	for (i32 cZ = 0; cZ < Grid::sizeZ; ++cZ)
+	{
+		for (i32 cY = 0; cY < Grid::sizeY; ++cY)
+		{
+			for (i32 cX = 0; cX < Grid::sizeX; ++cX)
+			{
+				u8 active = 0;
+
+				for (i32 nZ = GetMax(cZ - 1, 0); nZ <= GetMin(cZ + 1, Grid::sizeZ - 1); ++nZ)
+					for (i32 nY = GetMax(cY - 1, 0); nY <= GetMin(cY + 1, Grid::sizeY - 1); ++nY)
+						for (i32 nX = GetMax(cX - 1, 0); nX <= GetMin(cX + 1, Grid::sizeX - 1); ++nX)
+							active |= markedCells[nZ * Grid::sliceCellCount + nY * Grid::sizeX + nX];
+
+				ActiveCells[cZ * Grid::sliceCellCount + cY * Grid::sizeX + cX] = active;
+				activeCount += active;
+			}
+		}
+	}
+
+	delete[] markedCells;
+
+	return activeCount;
+}
+
+// Bins only the cells the corridor makes active against binning every cell. The items left out are shading
+// work and item list memory spent on empty space.
+template <typename Grid>
+static void CompareClusterActivation(vsJobSystem* Jobs, vsLightBinView<Grid>* BinView, vsLight* Lights, i32 LightCount, i32 Runs)
+{
+	u8* activeCells = new u8[Grid::cellCount];
+	i32 activeCount = GetCorridorActiveCells<Grid>(activeCells, tanf(glm::radians(25.0f)), 16.0f / 9.0f);
+
+	vsLightBinner<Grid> binner;
+	LightBinnerInit(&binner, Jobs);
+
+	vsLightBins all = {};
+	vsLightBins active = {};
+	vsLightBins* bins[] = { &all, &active };
+
+	for (i32 i = 0; i < 2; ++i)
+	{
+		bins[i]->lightListMax = LightCount;
+		bins[i]->offsetList = new ClusterOffsetListEntry[Grid::cellCount];
+		bins[i]->lightList = new ClusterLightListEntry[LightCount];
+	}
+
+	BinLights(&binner, BinView, Lights, LightCount, &all);
+
+	double binTime = GetTime();
+
+	for (i32 i = 0; i < Runs; ++i)
+		BinLights(&binner, BinView, Lights, LightCount, &active, 0, 0, activeCells);
+
+	binTime = (GetTime() - binTime) / Runs;
+
+	bool match = (active.itemListCount + active.inactiveItemCount == all.itemListCount);
+
+	for (i32 c = 0; c < Grid::cellCount && match; ++c)
+	{
+		if (activeCells[c])
+			match = (active.offsetList[c].lightCount == all.offsetList[c].lightCount);
+		else
+			match = (active.offsetList[c].lightCount == 0);
+	}
+
+	std::cout << "  Active cells: " << activeCount << " of " << Grid::cellCount << " (" << (activeCount * 100.0 / Grid::cellCount) << "%), "
+		<< active.itemListCount << " of " << all.itemListCount << " items, "
+		<< (all.itemListCount > 0 ? 100.0 - (double)active.itemListCount * 100.0 / all.itemListCount : 0.0) << "% smaller item list, "
+		<< active.lightListCount << " of " << all.lightListCount << " lights, " << (binTime * 1000.0) << "ms, " << (match ? "consistent" : "MISMATCH") << "\n";
+
+	for (i32 i = 0; i < 2; ++i)
+	{
+		delete[] bins[i]->offsetList;
+		LightBinsFree(bins[i]);
+		delete[] bins[i]->lightList;
+	}
+
+	delete[] activeCells;
+
+	LightBinnerFree(&binner);
+}
+
+// Times binning with every light static against no cache, with the camera still and with it moving every call.
+template <typename Grid>
+static void CompareStaticLightCache(vsJobSystem* Jobs, mat4 Proj, vsLight* Lights, i32 LightCount, i32 Runs)
+{
+	vsLightBinner<Grid> binner;
+	LightBinnerInit(&binner, Jobs);
+
+	vsLightBins cached = {};
+	vsLightBins uncached = {};
+	vsLightBins* bins[] = { &cached, &uncached };
+
+	for (i32 i = 0; i < 2; ++i)
+	{
+		bins[i]->lightListMax = LightCount;
+		bins[i]->offsetList = new ClusterOffsetListEntry[Grid::cellCount];
+		bins[i]->lightList = new ClusterLightListEntry[LightCount];
+	}
+
+	// NOTE: The moving camera never returns to the first view, which the still camera uses.
+	vsLightBinView<Grid>* views = new vsLightBinView<Grid>[Runs + 1];
+
+	for (i32 i = 0; i <= Runs; ++i)
+		LightBinViewCreate(&views[i], glm::translate(mat4(), vec3(i * 0.25f, 0.0f, i * 0.5f)), glm::inverse(Proj));
+
+	double times[3];
+	bool match = true;
+
+	for (i32 pass = 0; pass < 3; ++pass)
+	{
+		// NOTE: Two calls first so the still camera starts from a full cache.
+		BinLights(&binner, &views[0], Lights, LightCount, &cached, LightCount, 1);
+		BinLights(&binner, &views[0], Lights, LightCount, &cached, LightCount, 1);
+
+		double time = GetTime();
+		vsLightBinView<Grid>* view = &views[0];
+
+		for (i32 i = 0; i < Runs; ++i)
+		{
+			if (pass == 2)
+				view = &views[i + 1];
+
+			if (pass == 0)
+				BinLights(&binner, view, Lights, LightCount, &uncached);
+			else
+				BinLights(&binner, view, Lights, LightCount, &cached, LightCount, 1);
+		}
+
+		times[pass] = (GetTime() - time) / Runs;
+
+		if (pass > 0)
+		{
+			BinLights(&binner, view, Lights, LightCount, &uncached);
+
+			match = match && cached.itemListCount == uncached.itemListCount
+				&& cached.lightListCount == uncached.lightListCount
+				&& memcmp(cached.offsetList, uncached.offsetList, sizeof(ClusterOffsetListEntry) * Grid::cellCount) == 0
+				&& memcmp(cached.itemList, uncached.itemList, (size_t)cached.itemListCount * (cached.itemFormat == CLUSTER_ITEM_FORMAT_U16 ? 2 : 4)) == 0;
+		}
+	}
+
+	std::cout << "  Static lights: no cache " << (times[0] * 1000.0) << "ms, camera still " << (times[1] * 1000.0) << "ms, camera moving "
+		<< (times[2] * 1000.0) << "ms, " << (match ? "consistent" : "MISMATCH") << "\n";
+
+	for (i32 i = 0; i < 2; ++i)
+	{
+		delete[] bins[i]->offsetList;
+		LightBinsFree(bins[i]);
+		delete[] bins[i]->lightList;
+	}
+
+	delete[] views;
+
+	LightBinnerFree(&binner);
+}
+
+void BenchmarkLightBinning(vsJobSystem* Jobs)
+{
+	i32 lightCounts[] = { 100, 1000, 5000, 10000, 50000 };
+	i32 lightMax = lightCounts[ARRAY_COUNT(lightCounts) - 1];
+	i32 cellLightsMax = 4096;
+	i32 runs = 10;
+
+	std::cout << "Benchmarking light binning with " << (Jobs->threadCount + 1) << " threads...\n";
+
+	vsLightBinView<vsClusterGridMain> binView;
+	mat4 proj = glm::perspective(glm::radians(50.0f), 16.0f / 9.0f, 0.01f, 1000.0f);
+	LightBinViewCreate(&binView, mat4(), glm::inverse(proj));
+
+	vsLightBinner<vsClusterGridMain> binner;
+	LightBinnerInit(&binner, Jobs);
+
+	vsLight* lights = new vsLight[lightMax];
+	i32* serialClusterIds = new i32[lightMax];
+	u16* cellLights = new u16[CLUSTER_CELL_COUNT * cellLightsMax];
+	u16* cellLightCounts = new u16[CLUSTER_CELL_COUNT];
+
+	vsLightBins serial = {};
+	vsLightBins parallel = {};
+	vsLightBins* bins[] = { &serial, &parallel };
+
+	for (i32 i = 0; i < 2; ++i)
+	{
+		bins[i]->lightListMax = lightMax;
+		bins[i]->offsetList = new ClusterOffsetListEntry[CLUSTER_CELL_COUNT];
+		bins[i]->lightList = new ClusterLightListEntry[lightMax];
+	}
+
+	// NOTE: Lights spread through the view frustum out to 400 units, some straddle the edges.
+	u32 seed = 0x12345678;
+	float tanHalfY = tanf(glm::radians(25.0f));
+
+	for (i32 i = 0; i < lightMax; ++i)
+	{
+		float r[5];
+
+		for (i32 j = 0; j < 5; ++j)
+		{
+			seed = seed * 1664525 + 1013904223;
+			r[j] = (float)(seed >> 8) / (float)(1 << 24);
+		}
+
+		float z = 2.0f + r[0] * 398.0f;
+		lights[i].position = vec3((r[1] * 2.4f - 1.2f) * z * tanHalfY * (16.0f / 9.0f), (r[2] * 2.4f - 1.2f) * z * tanHalfY, -z);
+		lights[i].color = vec3(r[3], r[4], 1.0f);
+		lights[i].radius = 0.5f + r[4] * 7.5f;
+		lights[i].clusterId = -1;
+	}
+
+	for (i32 l = 0; l < (i32)ARRAY_COUNT(lightCounts); ++l)
+	{
+		i32 lightCount = lightCounts[l];
+
+		double serialTime = GetTime();
+
+		for (i32 i = 0; i < runs; ++i)
+			BinLightsSerial(&binView, lights, lightCount, &serial, cellLights, cellLightCounts, cellLightsMax);
+
+		serialTime = (GetTime() - serialTime) / runs;
+
+		for (i32 i = 0; i < lightCount; ++i)
+			serialClusterIds[i] = lights[i].clusterId;
+
+		double parallelTime = GetTime();
+
+		for (i32 i = 0; i < runs; ++i)
+			BinLights(&binner, &binView, lights, lightCount, &parallel);
+
+		parallelTime = (GetTime() - parallelTime) / runs;
+
+		bool match = serial.itemListCount == parallel.itemListCount
+			&& serial.lightListCount == parallel.lightListCount
+			&& serial.highestLightsInCell == parallel.highestLightsInCell
+			&& serial.itemFormat == parallel.itemFormat
+			&& memcmp(serial.offsetList, parallel.offsetList, sizeof(ClusterOffsetListEntry) * CLUSTER_CELL_COUNT) == 0
+			&& memcmp(serial.itemList, parallel.itemList, (size_t)LightBinsGetItemListSize(&serial)) == 0
+			&& memcmp(serial.lightList, parallel.lightList, sizeof(ClusterLightListEntry) * serial.lightListCount) == 0;
+
+		for (i32 i = 0; i < lightCount && match; ++i)
+			match = (serialClusterIds[i] == lights[i].clusterId);
+
+		std::cout << lightCount << " lights, " << serial.itemListCount << " items in " << (LightBinsGetItemListSize(&parallel) / 1024) << "kb: serial " << (serialTime * 1000.0) << "ms, parallel "
+			<< (parallelTime * 1000.0) << "ms, " << (serialTime / parallelTime) << "x, " << (match ? "identical" : "MISMATCH") << "\n";
+
+		CompareLightCulling(&binView, lights, lightCount);
+		CompareClusterActivation(Jobs, &binView, lights, lightCount, runs);
+		CompareStaticLightCache<vsClusterGridMain>(Jobs, proj, lights, lightCount, runs);
+
+		if (lightCount >= 10000)
+		{
+			CompareClusterGrid<vsClusterGridMain>(Jobs, proj, lights, lightCount, runs);
+			CompareClusterGrid<vsClusterGridFine>(Jobs, proj, lights, lightCount, runs);
+		}
+	}
+
+	CompareLightShapes(&binView);
+
+	for (i32 i = 0; i < 2; ++i)
+	{
+		delete[] bins[i]->offsetList;
+		LightBinsFree(bins[i]);
+		delete[] bins[i]->lightList;
+	}
+
+	delete[] lights;
+	delete[] serialClusterIds;
+	delete[] cellLights;
+	delete[] cellLightCounts;
+
+	LightBinnerFree(&binner);
+}
@@ -0,0 +1,268 @@
+#pragma once
+
+#include "shared.h"
+#include "glm.h"
+
+#include <stdio.h>
+#include <cmath>
+
+struct vsJobSystem;
+
+// Starting size of the cluster light list, it grows to fit the lights left after culling.
+#define MAX_LIGHTS 1024
+
+//-----------------------------------------------------------------------------------------------------------
+// Cluster grids.
+//-----------------------------------------------------------------------------------------------------------
+// Slice 0 covers everything in front of the near plane, the rest split near to far exponentially.
+struct vsClusterDepthExponential
+{
+	static float GetNearPlane() { return 0.5f; }
+	static float GetFarPlane() { return 10000.0f; }
+};
+
+// Screen is split into X by Y cells with Z depth slices, Depth places the slices.
+// NOTE: The lighting shaders get the same values through GetShaderDefines.
+template <i32 X, i32 Y, i32 Z, typename Depth>
+struct vsClusterGrid
+{
+	static const i32 sizeX = X;
+	static const i32 sizeY = Y;
+	static const i32 sizeZ = Z;
+	static const i32 sliceCellCount = X * Y;
+	static const i32 cellCount = X * Y * Z;
+
+	static float GetNearPlane() { return Depth::GetNearPlane(); }
+
+	static float GetDepthSlice(float Slice)
+	{
+		float eNear = Depth::GetNearPlane();
+		float eFar = Depth::GetFarPlane();
+
+		if (Slice == 0)
+		{
+			// TODO: Use actual near plane
+			return 0.01f;
+		}
+
+		return eNear * pow((eFar / eNear), ((Slice - 1.0f) / (float)Z));
+	}
+
+	// Fractional slice at a view depth, callers truncate.
+	static float GetSliceFromDepth(float Pos)
+	{
+		float eNear = Depth::GetNearPlane();
+		float eFar = Depth::GetFarPlane();
+
+		return (log((Pos) / eNear) / log(eFar / eNear)) * (float)Z + 1;
+	}
+
+	static void GetShaderDefines(char* Buffer, i32 BufferSize)
+	{
+		snprintf(Buffer, BufferSize,
+			"#define CLUSTER_GRID_X %d\n#define CLUSTER_GRID_Y %d\n#define CLUSTER_GRID_Z %d\n"
+			"#define CLUSTER_NEAR_PLANE %f\n#define CLUSTER_FAR_PLANE %f\n",
+			X, Y, Z, Depth::GetNearPlane(), Depth::GetFarPlane());
+	}
+};
+
+// Grid the renderer uses.
+typedef vsClusterGrid<16, 8, 24, vsClusterDepthExponential> vsClusterGridMain;
+// Finer grid for comparison, cells are still addressed with u16s.
+typedef vsClusterGrid<32, 18, 48, vsClusterDepthExponential> vsClusterGridFine;
+
+#define CLUSTER_CELL_COUNT vsClusterGridMain::cellCount
+
+struct ClusterOffsetListEntry
+{
+	uint32_t	itemOffset;
+	uint32_t	lightCount;
+};
+
+// Light shapes, the shaders read the type from the light list.
+#define LIGHT_TYPE_POINT	0
+#define LIGHT_TYPE_SPOT		1
+#define LIGHT_TYPE_CAPSULE	2
+
+// NOTE: Matches lightData_t in the shaders, 64 bytes under std430.
+struct ClusterLightListEntry
+{
+	vec3 position;
+	float radius;
+	vec3 color;
+	uint32_t type;
+	vec3 direction;
+	float halfLength;
+	float spotCosOuter;
+	float spotCosInner;
+	float pad[2];
+};
+
+// Radius is the range for every type. Spot lights shine from position along direction, capsule lights are
+// a segment halfLength either side of position along direction.
+struct vsLight
+{
+	vec3	position;
+	vec3	color;
+	float	radius;
+	int		clusterId;
+	// NOTE: Static lights are binned once per camera placement, moving one costs a rebin of them all.
+	bool	isStatic;
+
+	i32		type;
+	vec3	direction;
+	// Cosines of the angles from the axis where a spot light ends and where it starts to fade.
+	float	spotCosOuter;
+	float	spotCosInner;
+	float	halfLength;
+};
+
+// Smallest sphere around everything a light reaches.
+inline void GetLightBoundingSphere(vsLight* Light, vec3* Center, float* Radius)
+{
+	if (Light->type == LIGHT_TYPE_CAPSULE)
+	{
+		*Center = Light->position;
+		*Radius = Light->radius + Light->halfLength;
+	}
+	else if (Light->type == LIGHT_TYPE_SPOT && Light->spotCosOuter > 0.0f)
+	{
+		// NOTE: Narrow cones fit the sphere through the apex and the rim of the cap, wide cones the sphere
+		// around the rim.
+		if (Light->spotCosOuter >= 0.70710678f)
+		{
+			float halfChord = Light->radius / (2.0f * Light->spotCosOuter);
+			*Center = Light->position + Light->direction * halfChord;
+			*Radius = halfChord;
+		}
+		else
+		{
+			*Center = Light->position + Light->direction * (Light->radius * Light->spotCosOuter);
+			*Radius = Light->radius * sqrtf(1.0f - Light->spotCosOuter * Light->spotCosOuter);
+		}
+	}
+	else
+	{
+		*Center = Light->position;
+		*Radius = Light->radius;
+	}
+}
+
+// Camera placement of the cluster grid, in view space with Z pointing away from the camera.
+template <typename Grid>
+struct vsLightBinView
+{
+	mat4	view;
+	vec3	frustumRay[4];
+	// NOTE: One more than the slice count, binning reads the far side of the last slice.
+	vec2	depthSliceScale[Grid::sizeZ + 1];
+	float	sliceDepth[Grid::sizeZ + 1];
+};
+
+// Item list entry sizes, the shaders read the format from the item list header.
+#define CLUSTER_ITEM_FORMAT_U32		0
+#define CLUSTER_ITEM_FORMAT_U16		1
+
+// Start of the item list buffer, the packed items follow it.
+struct ClusterItemListHeader
+{
+	uint32_t	itemFormat;
+	uint32_t	itemCount;
+};
+
+typedef void* (*vsReserveLightBinItemsFunc)(void* Data, i64 Size);
+
+// Binning results in the layout the lighting shaders read. Items are indices into the light list, the
+// light list holds each binned light once, in the order the cells first reference them.
+// NOTE: Items are u16 when every light list index fits, otherwise u32.
+struct vsLightBins
+{
+	ClusterOffsetListEntry*	offsetList;
+	ClusterLightListEntry*	lightList;
+	i32						lightListMax;
+
+	// NOTE: Owned by the bins and grown to fit whenever lights are binned, unless reserveItems is set.
+	void*					itemList;
+	i64						itemListCapacity;
+	// Returns room for Size bytes of items once binning knows how many there are, so they can be written
+	// straight to mapped memory. Binning only writes the items, never reads them back.
+	vsReserveLightBinItemsFunc	reserveItems;
+	void*					reserveItemsData;
+
+	i32						itemFormat;
+	i32						itemListCount;
+	i32						lightListCount;
+	i32						highestLightsInCell;
+	// Items left out because their cells were inactive.
+	i32						inactiveItemCount;
+};
+
+template <typename Grid>
+struct vsLightBinThread;
+
+// Parallel binning state.
+template <typename Grid>
+struct vsLightBinner
+{
+	vsJobSystem*			jobs;
+	i32						jobMax;
+	vsLightBinThread<Grid>*	threads;
+
+	// Cells of the static lights, light i has staticCells[staticCellStart[i], staticCellStart[i + 1]).
+	vsLightBinView<Grid>	staticView;
+	u32						staticVersion;
+	i32						staticLightCount;
+	i32						staticLightCapacity;
+	u32*					staticCellStart;
+	u16*					staticCells;
+	i64						staticCellCapacity;
+	bool					staticValid;
+	// View of the last call, the cache only refills once the camera holds still.
+	vsLightBinView<Grid>	lastView;
+	bool					lastViewValid;
+
+	// NOTE: Only valid during BinLights.
+	i32						jobCount;
+	vsLightBinView<Grid>*	view;
+	vsLight*				lights;
+	i32						lightCount;
+	vsLightBins*			bins;
+	u8*						activeCells;
+	bool					staticRead;
+	bool					staticFill;
+};
+
+// NOTE: Binning is instanced for vsClusterGridMain and vsClusterGridFine in lightBinning.cpp.
+template <typename Grid>
+void LightBinViewCreate(vsLightBinView<Grid>* BinView, mat4 View, mat4 InvProj);
+
+template <typename Grid>
+void LightBinnerInit(vsLightBinner<Grid>* Binner, vsJobSystem* Jobs);
+template <typename Grid>
+void LightBinnerFree(vsLightBinner<Grid>* Binner);
+// Bins lights across the job system, sets each light's clusterId, -1 when it touches no cell.
+// NOTE: Output is identical to BinLightsSerial whatever the thread count.
+// The first StaticLightCount lights are static. Their cells are cached once BinView is the same for two calls
+// in a row, and reused while BinView and StaticVersion still match, change StaticVersion whenever those
+// lights change. A moving camera bins them like the other lights.
+// ActiveCells holds a flag per cell, lights are only binned to the cells that are set. NULL bins every cell.
+template <typename Grid>
+void BinLights(vsLightBinner<Grid>* Binner, vsLightBinView<Grid>* BinView, vsLight* Lights, i32 LightCount, vsLightBins* Bins, i32 StaticLightCount = 0, u32 StaticVersion = 0, u8* ActiveCells = NULL);
+// Single threaded reference, CellLights holds CellLightsMax lights for each cell.
+template <typename Grid>
+void BinLightsSerial(vsLightBinView<Grid>* BinView, vsLight* Lights, i32 LightCount, vsLightBins* Bins, u16* CellLights, u16* CellLightCounts, i32 CellLightsMax);
+// Most items binning the lights can write, counting every cell their bounding spheres might reach.
+// NOTE: For sizing item lists up front where binning can't grow them, as on the GPU.
+template <typename Grid>
+i64 GetLightBinItemBound(vsLightBinView<Grid>* BinView, vsLight* Lights, i32 LightCount);
+// Size in bytes of the packed items, padded to whole u32s for the shaders.
+i64 LightBinsGetItemListSize(vsLightBins* Bins);
+u32 LightBinsGetItem(vsLightBins* Bins, i32 Index);
+void LightBinsFree(vsLightBins* Bins);
+// Light list entries for lights in the order given, for binners that index the lights directly.
+void SetClusterLights(ClusterLightListEntry* Entries, vsLight* Lights, i32 LightCount);
+// Times serial against parallel binning from 100 to 50,000 lights and checks they match. Also counts the
+// light, cell pairs of the exact cluster test against the old screen space squares, and compares the main
+// grid against the fine grid. Also bins only the cells a corridor makes active against binning every cell,
+// and times the static light cache with the camera still and moving.
+void BenchmarkLightBinning(vsJobSystem* Jobs);
@@ -0,0 +1,632 @@
+#include "lightCulling.h"
+
+#include <string.h>
+#include <float.h>
+
+//-----------------------------------------------------------------------------------------------------------
+// Light store.
+//-----------------------------------------------------------------------------------------------------------
+void LightStoreInit(vsLightStore* Store)
+{
+	*Store = {};
+}
+
+void LightStoreFree(vsLightStore* Store)
+{
+	delete[] Store->lights;
+	delete[] Store->nodes;
+	delete[] Store->lightOrder;
+	delete[] Store->lightLeaf;
+	delete[] Store->dynamicLights;
+	delete[] Store->candidates;
+	delete[] Store->candidateLights;
+
+	*Store = {};
+}
+
+static void ReserveLights(vsLightStore* Store, i32 LightCount)
+{
+	if (LightCount <= Store->lightCapacity)
+		return;
+
+	i32 capacity = GetMax(GetMax(LightCount, Store->lightCapacity * 2), 64);
+
+	vsLight* lights = new vsLight[capacity];
+	memcpy(lights, Store->lights, sizeof(vsLight) * Store->lightCount);
+	delete[] Store->lights;
+	Store->lights = lights;
+	Store->lightCapacity = capacity;
+
+	// NOTE: Everything else is rebuilt before the next cull.
+	delete[] Store->nodes;
+	delete[] Store->lightOrder;
+	delete[] Store->lightLeaf;
+	delete[] Store->dynamicLights;
+	delete[] Store->candidates;
+	delete[] Store->candidateLights;
+
+	Store->nodes = new vsLightBVHNode[capacity * 2];
+	Store->lightOrder = new i32[capacity];
+	Store->lightLeaf = new i32[capacity];
+	Store->dynamicLights = new i32[capacity];
+	Store->candidates = new vsLight[capacity];
+	Store->candidateLights = new i32[capacity];
+	Store->nodeCount = 0;
+	Store->dynamicLightCount = 0;
+	Store->candidateCount = 0;
+	Store->staticCandidateCount = 0;
+	Store->dirty = true;
+}
+
+i32 LightStoreAdd(vsLightStore* Store, vsLight* Light)
+{
+	ReserveLights(Store, Store->lightCount + 1);
+
+	Store->lights[Store->lightCount] = *Light;
+	Store->dirty = true;
+
+	return Store->lightCount++;
+}
+
+void LightStoreMove(vsLightStore* Store, i32 Index, vec3 Position)
+{
+	assert(Index >= 0 && Index < Store->lightCount);
+
+	vsLight* light = Store->lights + Index;
+	light->position = Position;
+
+	if (!light->isStatic)
+		return;
+
+	++Store->staticVersion;
+
+	if (Store->dirty)
+		return;
+
+	vec3 center;
+	float radius;
+	GetLightBoundingSphere(light, &center, &radius);
+	vec3 lightMin = center - vec3(radius);
+	vec3 lightMax = center + vec3(radius);
+	i32 nodeIdx = Store->lightLeaf[Index];
+
+	while (nodeIdx != -1)
+	{
+		vsLightBVHNode* node = Store->nodes + nodeIdx;
+		vec3 boundsMin = glm::min(node->boundsMin, lightMin);
+		vec3 boundsMax = glm::max(node->boundsMax, lightMax);
+
+		// NOTE: Everything further up already holds these bounds.
+		if (boundsMin == node->boundsMin && boundsMax == node->boundsMax)
+			break;
+
+		node->boundsMin = boundsMin;
+		node->boundsMax = boundsMax;
+		nodeIdx = node->parent;
+	}
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// BVH build.
+//-----------------------------------------------------------------------------------------------------------
+// Reorders lightOrder[First, Last] so Nth holds the light it would hold if sorted along Axis, with no
+// greater lights before it and no lesser lights after it.
+static void SelectLightMedian(vsLightStore* Store, i32 First, i32 Last, i32 Nth, i32 Axis)
+{
+	i32* order = Store->lightOrder;
+	vsLight* lights = Store->lights;
+
+	while (First < Last)
+	{
+		float pivot = lights[order[(First + Last) / 2]].position[Axis];
+		i32 i = First;
+		i32 j = Last;
+
+		while (i <= j)
+		{
+			while (lights[order[i]].position[Axis] < pivot)
+				++i;
+
+			while (lights[order[j]].position[Axis] > pivot)
+				--j;
+
+			if (i <= j)
+			{
+				i32 temp = order[i];
+				order[i] = order[j];
+				order[j] = temp;
+				++i;
+				--j;
+			}
+		}
+
+		if (Nth <= j)
+			Last = j;
+		else if (Nth >= i)
+			First = i;
+		else
+			break;
+	}
+}
+
+// Splits at the median light along the widest axis of the light centers, so the depth stays log2 of the
+// light count whatever the distribution.
+static void BuildLightNode(vsLightStore* Store, i32 NodeIndex, i32 Parent, i32 FirstLight, i32 LightCount)
+{
+	vsLightBVHNode* node = Store->nodes + NodeIndex;
+	node->firstLight = FirstLight;
+	node->lightCount = LightCount;
+	node->firstChild = -1;
+	node->parent = Parent;
+
+	vec3 boundsMin = vec3(FLT_MAX);
+	vec3 boundsMax = vec3(-FLT_MAX);
+	vec3 centerMin = vec3(FLT_MAX);
+	vec3 centerMax = vec3(-FLT_MAX);
+
+	for (i32 i = FirstLight; i < FirstLight + LightCount; ++i)
+	{
+		vsLight* light = Store->lights + Store->lightOrder[i];
+		vec3 center;
+		float radius;
+		GetLightBoundingSphere(light, &center, &radius);
+		boundsMin = glm::min(boundsMin, center - vec3(radius));
+		boundsMax = glm::max(boundsMax, center + vec3(radius));
+		centerMin = glm::min(centerMin, light->position);
+		centerMax = glm::max(centerMax, light->position);
+	}
+
+	node->boundsMin = boundsMin;
+	node->boundsMax = boundsMax;
+
+	if (LightCount <= LIGHT_BVH_LEAF_LIGHTS)
+	{
+		for (i32 i = FirstLight; i < FirstLight + LightCount; ++i)
+			Store->lightLeaf[Store->lightOrder[i]] = NodeIndex;
+
+		return;
+	}
+
+	vec3 extent = centerMax - centerMin;
+	i32 axis = 0;
+
+	if (extent.y > extent[axis])
+		axis = 1;
+
+	if (extent.z > extent[axis])
+		axis = 2;
+
+	i32 half = LightCount / 2;
+	SelectLightMedian(Store, FirstLight, FirstLight + LightCount - 1, FirstLight + half, axis);
+
+	i32 firstChild = Store->nodeCount;
+	Store->nodeCount += 2;
+	node->firstChild = firstChild;
+
+	BuildLightNode(Store, firstChild, NodeIndex, FirstLight, half);
+	BuildLightNode(Store, firstChild + 1, NodeIndex, FirstLight + half, LightCount - half);
+}
+
+void LightStoreBuild(vsLightStore* Store)
+{
+	Store->nodeCount = 0;
+	Store->dynamicLightCount = 0;
+	Store->dirty = false;
+	++Store->staticVersion;
+
+	i32 staticLightCount = 0;
+
+	for (i32 i = 0; i < Store->lightCount; ++i)
+	{
+		Store->lightLeaf[i] = -1;
+
+		if (Store->lights[i].isStatic)
+			Store->lightOrder[staticLightCount++] = i;
+		else
+			Store->dynamicLights[Store->dynamicLightCount++] = i;
+	}
+
+	if (staticLightCount == 0)
+		return;
+
+	Store->nodeCount = 1;
+	BuildLightNode(Store, 0, -1, 0, staticLightCount);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Frustum culling.
+//-----------------------------------------------------------------------------------------------------------
+void LightFrustumCreate(vsLightFrustum* Frustum, mat4 ViewProj)
+{
+	vec4 row0 = vec4(ViewProj[0][0], ViewProj[1][0], ViewProj[2][0], ViewProj[3][0]);
+	vec4 row1 = vec4(ViewProj[0][1], ViewProj[1][1], ViewProj[2][1], ViewProj[3][1]);
+	vec4 row2 = vec4(ViewProj[0][2], ViewProj[1][2], ViewProj[2][2], ViewProj[3][2]);
+	vec4 row3 = vec4(ViewProj[0][3], ViewProj[1][3], ViewProj[2][3], ViewProj[3][3]);
+
+	// Left, right, bottom, top, near, far.
+	Frustum->planes[0] = row3 + row0;
+	Frustum->planes[1] = row3 - row0;
+	Frustum->planes[2] = row3 + row1;
+	Frustum->planes[3] = row3 - row1;
+	Frustum->planes[4] = row3 + row2;
+	Frustum->planes[5] = row3 - row2;
+
+	for (i32 i = 0; i < 6; ++i)
+		Frustum->planes[i] = Frustum->planes[i] / glm::length(vec3(Frustum->planes[i]));
+}
+
+// Only tests the planes in PlaneMask.
+static __forceinline bool IsSphereInFrustum(vsLightFrustum* Frustum, u32 PlaneMask, vec3 Position, float Radius)
+{
+	for (i32 p = 0; p < 6; ++p)
+	{
+		if (!(PlaneMask & (1 << p)))
+			continue;
+
+		vec4 plane = Frustum->planes[p];
+
+		if (glm::dot(vec3(plane), Position) + plane.w < -Radius)
+			return false;
+	}
+
+	return true;
+}
+
+static __forceinline bool IsLightInFrustum(vsLightFrustum* Frustum, u32 PlaneMask, vsLight* Light)
+{
+	vec3 center;
+	float radius;
+	GetLightBoundingSphere(Light, &center, &radius);
+
+	return IsSphereInFrustum(Frustum, PlaneMask, center, radius);
+}
+
+static __forceinline void AddCandidate(vsLightStore* Store, i32 LightIndex)
+{
+	Store->candidates[Store->candidateCount] = Store->lights[LightIndex];
+	Store->candidateLights[Store->candidateCount] = LightIndex;
+	++Store->candidateCount;
+}
+
+// Writes the static lights that touch the frustum to the start of the candidates.
+static void CullStaticLights(vsLightStore* Store, vsLightFrustum* Frustum)
+{
+	Store->candidateCount = 0;
+
+	if (Store->nodeCount == 0)
+		return;
+
+	// NOTE: Median splits keep the depth under 32, each level leaves at most one node on the stack.
+	i32 stackNodes[64];
+	u32 stackMasks[64];
+	i32 stackCount = 0;
+
+	stackNodes[stackCount] = 0;
+	stackMasks[stackCount] = 0x3F;
+	++stackCount;
+
+	while (stackCount > 0)
+	{
+		--stackCount;
+		vsLightBVHNode* node = Store->nodes + stackNodes[stackCount];
+		u32 planeMask = stackMasks[stackCount];
+		bool outside = false;
+
+		for (i32 p = 0; p < 6; ++p)
+		{
+			if (!(planeMask & (1 << p)))
+				continue;
+
+			vec4 plane = Frustum->planes[p];
+			vec3 normal = vec3(plane);
+
+			// Corners furthest along and against the plane normal.
+			vec3 nearCorner = vec3(normal.x >= 0.0f ? node->boundsMax.x : node->boundsMin.x,
+				normal.y >= 0.0f ? node->boundsMax.y : node->boundsMin.y,
+				normal.z >= 0.0f ? node->boundsMax.z : node->boundsMin.z);
+			vec3 farCorner = vec3(normal.x >= 0.0f ? node->boundsMin.x : node->boundsMax.x,
+				normal.y >= 0.0f ? node->boundsMin.y : node->boundsMax.y,
+				normal.z >= 0.0f ? node->boundsMin.z : node->boundsMax.z);
+
+			if (glm::dot(normal, nearCorner) + plane.w < 0.0f)
+			{
+				outside = true;
+				break;
+			}
+
+			// NOTE: Nothing below this node can be outside this plane.
+			if (glm::dot(normal, farCorner) + plane.w >= 0.0f)
+				planeMask &= ~(1 << p);
+		}
+
+		if (outside)
+			continue;
+
+		if (planeMask == 0)
+		{
+			for (i32 i = node->firstLight; i < node->firstLight + node->lightCount; ++i)
+				AddCandidate(Store, Store->lightOrder[i]);
+		}
+		else if (node->firstChild == -1)
+		{
+			for (i32 i = node->firstLight; i < node->firstLight + node->lightCount; ++i)
+			{
+				i32 lightIdx = Store->lightOrder[i];
+				vsLight* light = Store->lights + lightIdx;
+
+				if (IsLightInFrustum(Frustum, planeMask, light))
+					AddCandidate(Store, lightIdx);
+			}
+		}
+		else
+		{
+			assert(stackCount + 2 <= (i32)ARRAY_COUNT(stackNodes));
+
+			stackNodes[stackCount] = node->firstChild + 1;
+			stackMasks[stackCount] = planeMask;
+			++stackCount;
+
+			stackNodes[stackCount] = node->firstChild;
+			stackMasks[stackCount] = planeMask;
+			++stackCount;
+		}
+	}
+}
+
+i32 LightStoreCullFrustum(vsLightStore* Store, vsLightFrustum* Frustum)
+{
+	if (Store->dirty)
+		LightStoreBuild(Store);
+
+	// NOTE: With the camera and static lights still, the static candidates from last time are still right.
+	if (Store->staticVersion != Store->culledStaticVersion || memcmp(&Store->culledFrustum, Frustum, sizeof(*Frustum)) != 0)
+	{
+		CullStaticLights(Store, Frustum);
+		Store->staticCandidateCount = Store->candidateCount;
+		Store->culledStaticVersion = Store->staticVersion;
+		Store->culledFrustum = *Frustum;
+		++Store->staticCandidateVersion;
+	}
+
+	Store->candidateCount = Store->staticCandidateCount;
+
+	for (i32 i = 0; i < Store->dynamicLightCount; ++i)
+	{
+		i32 lightIdx = Store->dynamicLights[i];
+		vsLight* light = Store->lights + lightIdx;
+
+		if (IsLightInFrustum(Frustum, 0x3F, light))
+			AddCandidate(Store, lightIdx);
+	}
+
+	return Store->candidateCount;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Benchmark.
+//-----------------------------------------------------------------------------------------------------------
+// Checks the candidates are exactly the lights that pass a test of every light.
+static bool MatchCandidates(vsLightStore* Store, vsLightFrustum* Frustum, u8* Visible, i32* VisibleCount)
+{
+	i32 visibleCount = 0;
+
+	for (i32 i = 0; i < Store->lightCount; ++i)
+	{
+		Visible[i] = IsLightInFrustum(Frustum, 0x3F, Store->lights + i) ? 1 : 0;
+		visibleCount += Visible[i];
+	}
+
+	*VisibleCount = visibleCount;
+
+	if (visibleCount != Store->candidateCount)
+		return false;
+
+	for (i32 i = 0; i < Store->candidateCount; ++i)
+	{
+		if (Visible[Store->candidateLights[i]] != 1)
+			return false;
+
+		// NOTE: Catches a light being added twice.
+		Visible[Store->candidateLights[i]] = 2;
+	}
+
+	return true;
+}
+
+void BenchmarkLightCulling(vsJobSystem* Jobs)
+{
+	i32 lightCount = 100000;
+	i32 runs = 10;
+
+	std::cout << "Benchmarking light culling with " << lightCount << " lights...\n";
+
+	vsLightStore store;
+	LightStoreInit(&store);
+
+	// NOTE: Lights spread over a 4km square level around the camera, most are out of view.
+	u32 seed = 0x2468ACE1;
+
+	for (i32 i = 0; i < lightCount; ++i)
+	{
+		float r[5];
+
+		for (i32 j = 0; j < 5; ++j)
+		{
+			seed = seed * 1664525 + 1013904223;
+			r[j] = (float)(seed >> 8) / (float)(1 << 24);
+		}
+
+		vsLight light = {};
+		light.position = vec3((r[0] - 0.5f) * 4000.0f, r[1] * 40.0f - 10.0f, (r[2] - 0.5f) * 4000.0f);
+		light.color = vec3(r[3], r[4], 1.0f);
+		light.radius = 0.5f + r[4] * 7.5f;
+		light.clusterId = -1;
+		// NOTE: Every 100th light moves.
+		light.isStatic = (i % 100 != 0);
+
+		// NOTE: Some spot and capsule lights, culled by their bounding spheres.
+		if (i % 10 == 1)
+		{
+			light.type = LIGHT_TYPE_SPOT;
+			light.direction = glm::normalize(vec3(r[3] - 0.5f, -1.0f, r[4] - 0.5f));
+			light.spotCosOuter = cosf(glm::radians(30.0f));
+			light.spotCosInner = cosf(glm::radians(25.0f));
+		}
+		else if (i % 10 == 2)
+		{
+			light.type = LIGHT_TYPE_CAPSULE;
+			light.direction = glm::normalize(vec3(1.0f, 0.0f, r[3] - 0.5f));
+			light.halfLength = 4.0f;
+		}
+		LightStoreAdd(&store, &light);
+	}
+
+	double buildTime = GetTime();
+	LightStoreBuild(&store);
+	buildTime = GetTime() - buildTime;
+
+	mat4 proj = glm::perspective(glm::radians(50.0f), 16.0f / 9.0f, 0.01f, 1000.0f);
+	vsLightFrustum frustum;
+	LightFrustumCreate(&frustum, proj);
+
+	u8* visible = new u8[lightCount];
+	i32 visibleCount = 0;
+
+	double bruteTime = GetTime();
+
+	for (i32 r = 0; r < runs; ++r)
+	{
+		visibleCount = 0;
+
+		for (i32 i = 0; i < lightCount; ++i)
+			visibleCount += IsLightInFrustum(&frustum, 0x3F, store.lights + i) ? 1 : 0;
+	}
+
+	bruteTime = (GetTime() - bruteTime) / runs;
+
+	// NOTE: Straight to the BVH, a store cull would reuse the static candidates after the first run.
+	double cullTime = GetTime();
+
+	for (i32 r = 0; r < runs; ++r)
+		CullStaticLights(&store, &frustum);
+
+	cullTime = (GetTime() - cullTime) / runs;
+
+	LightStoreCullFrustum(&store, &frustum);
+	bool match = MatchCandidates(&store, &frustum, visible, &visibleCount);
+
+	std::cout << "Build " << (buildTime * 1000.0) << "ms, " << store.nodeCount << " nodes. " << visibleCount << " visible: every light "
+		<< (bruteTime * 1000.0) << "ms, BVH " << (cullTime * 1000.0) << "ms, " << (match ? "identical" : "MISMATCH") << "\n";
+
+	// NOTE: Moved static lights only grow the bounds above them, culling must still find exactly the same lights.
+	for (i32 i = 0; i < lightCount; i += 50)
+	{
+		seed = seed * 1664525 + 1013904223;
+		float offset = (float)(seed >> 8) / (float)(1 << 24) * 40.0f - 20.0f;
+		LightStoreMove(&store, i, store.lights[i].position + vec3(offset, 0.0f, -offset));
+	}
+
+	LightStoreCullFrustum(&store, &frustum);
+	match = MatchCandidates(&store, &frustum, visible, &visibleCount);
+	std::cout << "After moving " << (lightCount / 100) << " dynamic and " << (lightCount / 100) << " static lights: " << visibleCount << " visible, " << (match ? "identical" : "MISMATCH") << "\n";
+
+	vsLightBinView<vsClusterGridMain> binView;
+	LightBinViewCreate(&binView, mat4(), glm::inverse(proj));
+
+	vsLightBinner<vsClusterGridMain> binner;
+	LightBinnerInit(&binner, Jobs);
+
+	vsLightBins bins = {};
+	bins.lightListMax = lightCount;
+	bins.offsetList = new ClusterOffsetListEntry[vsClusterGridMain::cellCount];
+	bins.lightList = new ClusterLightListEntry[lightCount];
+
+	double allTime = GetTime();
+
+	for (i32 r = 0; r < runs; ++r)
+		BinLights(&binner, &binView, store.lights, store.lightCount, &bins);
+
+	allTime = (GetTime() - allTime) / runs;
+	i32 allItems = bins.itemListCount;
+
+	double candidateTime = GetTime();
+
+	for (i32 r = 0; r < runs; ++r)
+	{
+		LightStoreCullFrustum(&store, &frustum);
+		BinLights(&binner, &binView, store.candidates, store.candidateCount, &bins);
+	}
+
+	candidateTime = (GetTime() - candidateTime) / runs;
+
+	std::cout << "Binning every light " << (allTime * 1000.0) << "ms, " << allItems << " items. Cull and bin candidates "
+		<< (candidateTime * 1000.0) << "ms, " << bins.itemListCount << " items\n";
+
+	// Static cache. Each frame moves the dynamic lights, then culls and bins with the camera still, with the
+	// camera moving, and with no cache.
+	vsLightBins cachedBins = {};
+	cachedBins.lightListMax = lightCount;
+	cachedBins.offsetList = new ClusterOffsetListEntry[vsClusterGridMain::cellCount];
+	cachedBins.lightList = new ClusterLightListEntry[lightCount];
+
+	double stillTime = 0.0;
+	double movingTime = 0.0;
+	double uncachedTime = 0.0;
+	match = true;
+
+	for (i32 r = 0; r < runs; ++r)
+	{
+		for (i32 i = 0; i < store.dynamicLightCount; ++i)
+		{
+			i32 lightIdx = store.dynamicLights[i];
+			LightStoreMove(&store, lightIdx, store.lights[lightIdx].position + vec3(0.25f, 0.0f, 0.0f));
+		}
+
+		double time = GetTime();
+		LightStoreCullFrustum(&store, &frustum);
+		BinLights(&binner, &binView, store.candidates, store.candidateCount, &cachedBins, store.staticCandidateCount, store.staticCandidateVersion);
+		stillTime += GetTime() - time;
+
+		time = GetTime();
+		LightStoreCullFrustum(&store, &frustum);
+		BinLights(&binner, &binView, store.candidates, store.candidateCount, &bins);
+		uncachedTime += GetTime() - time;
+
+		match = match && cachedBins.itemListCount == bins.itemListCount
+			&& cachedBins.lightListCount == bins.lightListCount
+			&& memcmp(cachedBins.offsetList, bins.offsetList, sizeof(ClusterOffsetListEntry) * vsClusterGridMain::cellCount) == 0
+			&& memcmp(cachedBins.itemList, bins.itemList, (size_t)LightBinsGetItemListSize(&bins)) == 0
+			&& memcmp(cachedBins.lightList, bins.lightList, sizeof(ClusterLightListEntry) * bins.lightListCount) == 0;
+	}
+
+	vsLightBinView<vsClusterGridMain> movingView;
+	vsLightFrustum movingFrustum;
+
+	for (i32 r = 0; r < runs; ++r)
+	{
+		mat4 view = mat4();
+		view[3][0] = (float)(r + 1) * 0.5f;
+
+		double time = GetTime();
+		LightBinViewCreate(&movingView, view, glm::inverse(proj));
+		LightFrustumCreate(&movingFrustum, proj * view);
+		LightStoreCullFrustum(&store, &movingFrustum);
+		BinLights(&binner, &movingView, store.candidates, store.candidateCount, &cachedBins, store.staticCandidateCount, store.staticCandidateVersion);
+		movingTime += GetTime() - time;
+	}
+
+	std::cout << "Static cache with " << store.staticCandidateCount << " static and " << (store.candidateCount - store.staticCandidateCount) << " dynamic candidates: camera still "
+		<< (stillTime * 1000.0 / runs) << "ms, camera moving " << (movingTime * 1000.0 / runs) << "ms, no cache " << (uncachedTime * 1000.0 / runs) << "ms, "
+		<< (match ? "identical" : "MISMATCH") << "\n";
+
+	delete[] cachedBins.offsetList;
+	LightBinsFree(&cachedBins);
+	delete[] cachedBins.lightList;
+	delete[] bins.offsetList;
+	LightBinsFree(&bins);
+	delete[] bins.lightList;
+	delete[] visible;
+
+	LightBinnerFree(&binner);
+	LightStoreFree(&store);
+}
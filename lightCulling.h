@@ -0,0 +1,77 @@
+#pragma once
+
+#include "shared.h"
+#include "glm.h"
+#include "lightBinning.h"
+
+// Most lights in a BVH leaf.
+#define LIGHT_BVH_LEAF_LIGHTS 8
+
+// Bounds of the light spheres below a node. A node's lights are contiguous in the store's light order,
+// so a node fully inside the frustum is copied out without visiting its children.
+struct vsLightBVHNode
+{
+	vec3	boundsMin;
+	vec3	boundsMax;
+	i32		firstLight;
+	i32		lightCount;
+	// NOTE: -1 for leaves, otherwise the children are firstChild and firstChild + 1.
+	i32		firstChild;
+	i32		parent;
+};
+
+// Planes point inwards, a point is inside when dot(plane.xyz, p) + plane.w >= 0 for all six.
+struct vsLightFrustum
+{
+	vec4	planes[6];
+};
+
+// Growable light storage with a BVH over the static light spheres, dynamic lights are tested one by one.
+// Culling writes the lights that touch the view frustum to candidates, which is what gets binned, so the
+// cost follows the visible lights.
+struct vsLightStore
+{
+	vsLight*		lights;
+	i32				lightCount;
+	i32				lightCapacity;
+
+	vsLightBVHNode*	nodes;
+	i32				nodeCount;
+	// Static light indices in leaf order, and the leaf holding each light, -1 for dynamic lights.
+	i32*			lightOrder;
+	i32*			lightLeaf;
+	i32*			dynamicLights;
+	i32				dynamicLightCount;
+	// NOTE: Set when lights are added, the next cull rebuilds the BVH.
+	bool			dirty;
+	// Changes whenever a static light does.
+	u32				staticVersion;
+
+	// Copies of the lights culling kept, and the index of each in the store. Static lights come first and
+	// are only culled again when the frustum or a static light changes.
+	vsLight*		candidates;
+	i32*			candidateLights;
+	i32				candidateCount;
+	i32				staticCandidateCount;
+	// Changes whenever the static candidates do, the binner keys its static cache on it.
+	u32				staticCandidateVersion;
+	u32				culledStaticVersion;
+	vsLightFrustum	culledFrustum;
+};
+
+void LightStoreInit(vsLightStore* Store);
+void LightStoreFree(vsLightStore* Store);
+// Returns the index of the new light, indices stay valid for the life of the store.
+i32 LightStoreAdd(vsLightStore* Store, vsLight* Light);
+// Moves a light, a static light grows the bounds above it to match.
+// NOTE: Bounds only grow, rebuild once static lights have moved a long way.
+void LightStoreMove(vsLightStore* Store, i32 Index, vec3 Position);
+void LightStoreBuild(vsLightStore* Store);
+
+void LightFrustumCreate(vsLightFrustum* Frustum, mat4 ViewProj);
+// Fills the store's candidates with every light whose sphere touches the frustum, returns the count.
+i32 LightStoreCullFrustum(vsLightStore* Store, vsLightFrustum* Frustum);
+
+// Times BVH culling against testing every light for 100,000 lights and checks both find the same lights.
+// Also times binning the candidates against binning everything, and binning with the static cache.
+void BenchmarkLightCulling(vsJobSystem* Jobs);
@@ -21,6 +21,11 @@
 #include "glm.h"
 
 #include "hdp.h"
+#include "dxtEncoder.h"
+#include "pageIndex.h"
+#include "jobSystem.h"
+#include "lightBinning.h"
+#include "lightCulling.h"
 
 int	gWidth;
 int gHeight;
@@ -59,6 +64,12 @@ struct vsInput
 	int		indirectionUIMipLevel = 0;
 	bool	purgeCache = false;
 	bool	vtDebug = false;
+	bool	gpuTranscode = false;
+	bool	gpuLightBinning = false;
+	// NOTE: Off by default, the active cells trail the view by a frame or more so fast turns can leave
+	// clusters unlit, and geometry that skips depth is never marked.
+	bool	clusterActivation = false;
+	bool	clusterStats = false;
 };
 
 struct vsCamera
@@ -88,6 +99,8 @@ struct vsCachePage
 	int mip;
 	int cacheX;
 	int cacheY;
+	i64 sourceOffset;
+	vsCachePage* nextSourcePage;
 };
 
 const i32 cachePageMapBucketCount = 4096;
@@ -101,6 +114,8 @@ struct vsVirtualTextureCache
 	vsCachePage*	pagesLRUFirst;
 	vsCachePage*	pagesLRULast;
 	vsCachePage*	cachePageMap[cachePageMapBucketCount];
+	// NOTE: Resident pages by page file offset, lets duplicate pages copy an existing slot.
+	vsCachePage*	sourcePageMap[cachePageMapBucketCount];
 };
 
 struct vsIndirectionTableEntry
@@ -119,7 +134,7 @@ struct vsVirtualTexture
 	
 	u8*		pageData;
 	FILE*	pageFile;
-	i64**	pageIndexTable;
+	vsPageIndex	pageIndex;
 
 	GLuint						indirectionTex;
 	GLuint						indirectionPBO;
@@ -127,6 +142,9 @@ struct vsVirtualTexture
 	i32							indirectionDataSizeBytes;
 	u8*							jpgxrHeader;
 	i32							jpgxrHeaderSize;
+	u32*						constantPageColors;
+	i32							constantPageCount;
+	i32							pageLayout;
 };
 
 struct vsFeedbackHashNode
@@ -147,50 +165,63 @@ struct vsFeedbackBuffer
 	int					tileHashNodeCount;
 };
 
-struct ClusterOffsetListEntry
+// Frames of cluster data CPU binning can be ahead of the GPU.
+#define CLUSTER_UPLOAD_FRAMES 3
+
+// Persistently mapped cluster buffers that CPU binning writes straight into.
+// NOTE: The mapping is write combined, never read it back.
+struct vsClusterUploadFrame
 {
-	uint32_t	itemOffset;
-	uint32_t	lightCount;
+	GLuint					offsetListSSB;
+	GLuint					itemListSSB;
+	GLuint					lightListSSB;
+	ClusterOffsetListEntry*	offsetList;
+	// Item list header followed by the items.
+	u8*						itemList;
+	ClusterLightListEntry*	lightList;
+	i64						itemListSize;
+	i32						lightListMax;
+
+	// Signalled once the draws that read the frame are done.
+	GLsync					fence;
 };
 
-struct ClusterLightListEntry
+// Copies of a GPU buffer range in flight before the oldest is dropped unread.
+#define GPU_READBACK_FRAMES 3
+
+// Persistently mapped copies of a small GPU buffer range. Each copy is fenced, and the CPU takes the newest
+// one the GPU has finished instead of waiting on the source.
+struct vsGpuReadback
 {
-	vec3 position;
-	float radius;
-	vec4 color;
+	GLuint	buffers[GPU_READBACK_FRAMES];
+	u8*		mapped[GPU_READBACK_FRAMES];
+	// Signalled once the copy into the slot is done, cleared once it has been read.
+	GLsync	fences[GPU_READBACK_FRAMES];
+	i64		size;
+	i32		nextSlot;
 };
 
-#define MAX_LIGHTS 1024
-
 struct vsClusteredLighting
 {
-	uint16_t				tempCellLights[16 * 8 * 24 * 256];
-	uint8_t					tempCellLightCount[16 * 8 * 24];
-
-	ClusterOffsetListEntry	offsetList[16 * 8 * 24];
-	uint32_t				itemList[16 * 8 * 24 * 256];
-	ClusterLightListEntry	lightList[MAX_LIGHTS];
-
-	int		itemListCount;
-	int		lightListCount;
+	// NOTE: Staging for the GPU binning path, grown to fit the lights that survive culling.
+	ClusterLightListEntry*	lightList;
+	i32						lightListMax;
+	vsLightBins				bins;
 
+	// Written by the GPU binning path.
 	GLuint	offsetListSSB;
 	GLuint	itemListSSB;
 	GLuint	lightListSSB;
-};
+	i64		itemListSSBSize;
+	i64		lightListSSBSize;
 
-struct vsLight
-{
-	vec3	position;
-	vec3	color;
-	float	radius;
-	int		clusterId;
+	vsClusterUploadFrame	uploadFrames[CLUSTER_UPLOAD_FRAMES];
+	i32						uploadFrame;
 };
 
 struct vsWorld
 {
-	vsLight	lights[MAX_LIGHTS];
-	int		lightCount;
+	vsLightStore	lights;
 };
 
 struct vsDebugChar
@@ -242,6 +273,8 @@ vsVirtualTextureCache	vtCache;
 vsFeedbackBuffer		feedbackBuffer;
 vsWorld					world;
 vsClusteredLighting		clusterData;
+vsJobSystem				jobSystem;
+vsLightBinner<vsClusterGridMain>	lightBinner;
 vsBloom					bloom;
 vsAmbientOcclusion		ssao;
 
@@ -250,10 +283,82 @@ GLuint	hdrFrameBufferColor;
 GLuint	hdrFrameBufferDepthStencil;
 GLuint	gBufferNormalsColor;
 
-GLint	transCompShader;
-GLuint	transDestTex;
-GLuint	transInputSBO;
-GLuint	transOutputSBO;
+// NOTE: Matches the per frame page upload limit.
+#define GPU_TRANSCODE_PAGES_MAX 16
+
+struct vsGpuTranscoder
+{
+	GLint	shaderProgram;
+	GLuint	inputSBO;
+	GLuint	outputSBO;
+	i32		pageCount;
+	i32		pageCacheX[GPU_TRANSCODE_PAGES_MAX];
+	i32		pageCacheY[GPU_TRANSCODE_PAGES_MAX];
+};
+
+vsGpuTranscoder gpuTranscoder;
+
+// NOTE: Matches light_binning.comp.
+#define GPU_LIGHT_BIN_GROUP_SIZE	64
+#define GPU_LIGHT_BIN_PASS_CLEAR	0
+#define GPU_LIGHT_BIN_PASS_COUNT	1
+#define GPU_LIGHT_BIN_PASS_PREFIX	2
+#define GPU_LIGHT_BIN_PASS_SCATTER	3
+
+// NOTE: Matches lightBinState in light_binning.comp.
+struct vsGpuLightBinState
+{
+	mat4	view;
+	u32		itemsNeeded;
+	u32		pad[3];
+	// Cell edge scale in xy and view depth in z for each depth plane.
+	vec4	slices[vsClusterGridMain::sizeZ + 1];
+	u32		cellCursor[vsClusterGridMain::cellCount];
+};
+
+struct vsGpuLightBinner
+{
+	GLint	shaderProgram;
+	GLuint	stateSBO;
+
+	// Static lights lead the light list buffer and are only uploaded when they change.
+	bool	staticValid;
+	u32		staticVersion;
+	i32		staticLightCount;
+
+	// Items needed by the newest dispatch the GPU has finished, for the stats.
+	u32				itemsNeeded;
+	vsGpuReadback	itemsNeededReadback;
+};
+
+vsGpuLightBinner gpuLightBinner;
+
+// NOTE: Matches cluster_activation.comp.
+#define CLUSTER_ACTIVATION_PASS_CLEAR	0
+#define CLUSTER_ACTIVATION_PASS_MARK	1
+#define CLUSTER_ACTIVATION_PASS_EXPAND	2
+
+// NOTE: Matches clusterActivation in cluster_activation.comp and light_binning.comp.
+struct vsClusterActivationState
+{
+	u32		activeCellCount;
+	u32		pad[3];
+	u32		markedCells[CLUSTER_CELL_COUNT];
+	u32		activeCells[CLUSTER_CELL_COUNT];
+};
+
+struct vsClusterActivation
+{
+	GLint	shaderProgram;
+	GLuint	stateSBO;
+
+	// Copy of the newest finished dispatch's active cells for binning on the CPU.
+	u8				activeCells[CLUSTER_CELL_COUNT];
+	i32				activeCellCount;
+	vsGpuReadback	activeCellsReadback;
+};
+
+vsClusterActivation clusterActivation;
 
 struct vsFileJob
 {
@@ -263,6 +368,12 @@ struct vsFileJob
 	i32 pageX;
 	i32 pageY;
 	i32 pageMip;
+	// NOTE: Data is two RGBA block streams for the GPU encoder rather than DXT5.
+	bool blockStream;
+	// NOTE: Both skip IO and transcoding, constant pages are filled at upload and copy pages duplicate a resident page.
+	bool constantPage;
+	bool copyPage;
+	u32 constantColors[2];
 };
 
 const i32		fileJobMax = 4096;
@@ -308,14 +419,23 @@ struct vsPageIndexEntry
 	i64 pageOffset;
 };
 
+// NOTE: Where the page builder packed each image, in texels of the virtual texture.
+struct vsTexturePlacement
+{
+	char name[64];
+	vec4 uvScaleBias;
+};
+
+vsTexturePlacement texturePlacements[256];
+i32 texturePlacementCount = 0;
+
 __forceinline vsPageIndexEntry GetPageIndex(vsVirtualTexture* Vt, i32 X, i32 Y, i32 Mip)
 {
 	vsPageIndexEntry result;
 
-	i32 pagesInMip = (1 << (Vt->globalMipCount - Mip - 1));
-	i64 pageFileData = Vt->pageIndexTable[Mip][Y * pagesInMip + X];
+	i64 pageFileData = PageIndexGetEntry(&Vt->pageIndex, X, Y, Mip);
 
-	result.pageSize = pageFileData >> 48;
+	result.pageSize = (i32)((u64)pageFileData >> 48);
 	result.pageOffset = pageFileData & 0x0000FFFFFFFFFFFF;
 
 	return result;
@@ -323,9 +443,7 @@ __forceinline vsPageIndexEntry GetPageIndex(vsVirtualTexture* Vt, i32 X, i32 Y,
 
 void AddLight(vsWorld* World, vsLight* Light)
 {
-	assert(World->lightCount < MAX_LIGHTS);
-
-	World->lights[World->lightCount++] = *Light;
+	LightStoreAdd(&World->lights, Light);
 }
 
 vec3 ToLinear(vec3 Value)
@@ -433,9 +551,25 @@ PFNGLCOMPRESSEDTEXSUBIMAGE3DPROC	glCompressedTexSubImage3D = 0;
 PFNGLUNIFORM3FPROC					glUniform3f = 0;
 PFNGLDRAWBUFFERSPROC				glDrawBuffers = 0;
 PFNGLUNIFORM3FVPROC					glUniform3fv = 0;
+PFNGLGETBUFFERSUBDATAPROC			glGetBufferSubData = 0;
+PFNGLBUFFERSTORAGEPROC				glBufferStorage = 0;
+PFNGLMAPBUFFERRANGEPROC				glMapBufferRange = 0;
+PFNGLFENCESYNCPROC					glFenceSync = 0;
+PFNGLCLIENTWAITSYNCPROC				glClientWaitSync = 0;
+PFNGLDELETESYNCPROC					glDeleteSync = 0;
+PFNGLCOPYBUFFERSUBDATAPROC			glCopyBufferSubData = 0;
+PFNGLCLEARBUFFERDATAPROC			glClearBufferData = 0;
 
 void LoadGLFunctions()
 {
+	LOAD_GL_FUNC(glClearBufferData, PFNGLCLEARBUFFERDATAPROC);
+	LOAD_GL_FUNC(glCopyBufferSubData, PFNGLCOPYBUFFERSUBDATAPROC);
+	LOAD_GL_FUNC(glDeleteSync, PFNGLDELETESYNCPROC);
+	LOAD_GL_FUNC(glClientWaitSync, PFNGLCLIENTWAITSYNCPROC);
+	LOAD_GL_FUNC(glFenceSync, PFNGLFENCESYNCPROC);
+	LOAD_GL_FUNC(glMapBufferRange, PFNGLMAPBUFFERRANGEPROC);
+	LOAD_GL_FUNC(glBufferStorage, PFNGLBUFFERSTORAGEPROC);
+	LOAD_GL_FUNC(glGetBufferSubData, PFNGLGETBUFFERSUBDATAPROC);
 	LOAD_GL_FUNC(glUniform3fv, PFNGLUNIFORM3FVPROC);
 	LOAD_GL_FUNC(glDrawBuffers, PFNGLDRAWBUFFERSPROC);
 	LOAD_GL_FUNC(glUniform3f, PFNGLUNIFORM3FPROC);
@@ -580,53 +714,6 @@ void CopyImageData(u8* SrcData, i32 SrcX, i32 SrcY, i32 SrcWidth, u8* DstData, i
 	}
 }
 
-float GetClusterDepthSlice(float Slice)
-{
-	float eNear = 0.5f;
-	float eFar = 10000.0f;
-	
-	if (Slice == 0)
-	{
-		// TODO: Use actual near plane
-		return 0.01f;
-	}
-
-	return eNear * pow((eFar / eNear), ((Slice - 1.0f) / 24.0f));
-}
-
-float GetClustedDepthSliceFromPos(float Pos)
-{
-	float eNear = 0.5f;
-	float eFar = 10000.0f;
-	return (log((Pos) / eNear) / log(eFar / eNear)) * 24.0f + 1;
-}
-
-float ProjectSphereToPlane(vec3 PlaneN, float PlaneD, vec3 SphereO, float SphereR)
-{
-	float distToPlane = (glm::dot(PlaneN, SphereO) - PlaneD) / glm::length(PlaneN);
-
-	if (distToPlane == 0.0f)
-	{
-		return SphereR;
-	}
-	else if (SphereR < distToPlane || SphereR < -distToPlane)
-	{
-		return -1.0f;
-	}
-	else
-	{
-		float c = sqrt(SphereR * SphereR - distToPlane * distToPlane);
-		return c;
-	}
-
-	return distToPlane;
-
-
-	float a = (glm::dot(PlaneN, SphereO) + PlaneD);
-	float circR = sqrtf(SphereR * SphereR - (a * a) / glm::dot(PlaneN, PlaneN));
-	return circR;
-}
-
 __forceinline i32 GetVirtualTexturePageHash(i32 X, i32 Y, i32 Mip)
 {
 	return X * 1000000 + Y * 100 + Mip;
@@ -662,6 +749,8 @@ vsCachePage* AddCachePage(vsVirtualTextureCache* Cache, i32 X, i32 Y, i32 Mip)
 	page->hash = pageHash;
 	page->nextLRUPage = NULL;
 	page->prevLRUPage = NULL;
+	page->sourceOffset = -1;
+	page->nextSourcePage = NULL;
 	
 	i32 bucketIndex = pageHash % cachePageMapBucketCount;
 	
@@ -671,8 +760,49 @@ vsCachePage* AddCachePage(vsVirtualTextureCache* Cache, i32 X, i32 Y, i32 Mip)
 	return page;
 }
 
+vsCachePage* GetResidentSourcePage(vsVirtualTextureCache* Cache, i64 SourceOffset)
+{
+	vsCachePage* page = Cache->sourcePageMap[SourceOffset % cachePageMapBucketCount];
+
+	while (page)
+	{
+		if (page->sourceOffset == SourceOffset)
+			return page;
+
+		page = page->nextSourcePage;
+	}
+
+	return NULL;
+}
+
+void AddResidentSourcePage(vsVirtualTextureCache* Cache, vsCachePage* Page)
+{
+	i32 bucketIndex = Page->sourceOffset % cachePageMapBucketCount;
+	Page->nextSourcePage = Cache->sourcePageMap[bucketIndex];
+	Cache->sourcePageMap[bucketIndex] = Page;
+}
+
+void RemoveResidentSourcePage(vsVirtualTextureCache* Cache, vsCachePage* Page)
+{
+	vsCachePage** prevPage = &Cache->sourcePageMap[Page->sourceOffset % cachePageMapBucketCount];
+
+	while (*prevPage)
+	{
+		if (*prevPage == Page)
+		{
+			*prevPage = Page->nextSourcePage;
+			return;
+		}
+
+		prevPage = &(*prevPage)->nextSourcePage;
+	}
+}
+
 bool RemoveCachePage(vsVirtualTextureCache* Cache, vsCachePage* Page)
 {
+	if (Page->sourceOffset != -1)
+		RemoveResidentSourcePage(Cache, Page);
+
 	// TODO: We only remove from hash map at the moment, need to remove from LRU too.
 	// Also consider memory cleanup here.
 
@@ -714,7 +844,7 @@ __forceinline i32 GetMipWidth(i32 Mip, i32 TotalMips)
 void LoadVirtualTexturePage(vsVirtualTextureCache* Cache, vsVirtualTexture* Vt, i32 X, i32 Y, i32 Mip)
 {
 	i32 pageHash = GetVirtualTexturePageHash(X, Y, Mip);
-	AddCachePage(Cache, X, Y, Mip);
+	vsCachePage* page = AddCachePage(Cache, X, Y, Mip);
 
 	vsPageIndexEntry pageEntry = GetPageIndex(Vt, X, Y, Mip);
 	
@@ -723,13 +853,30 @@ void LoadVirtualTexturePage(vsVirtualTextureCache* Cache, vsVirtualTexture* Vt,
 	fileJobs[fileReadProduce].pageY = Y;
 	fileJobs[fileReadProduce].pageMip = Mip;
 
-	if (pageEntry.pageSize == 0)
+	if (pageEntry.pageSize == PAGE_INDEX_SIZE_EMPTY)
+	{
+		fileJobs[fileReadProduce].dataSize = 0;
+		fileJobs[fileReadProduce].fileOffset = -1;
+	}
+	else if (pageEntry.pageSize == PAGE_INDEX_SIZE_CONSTANT)
+	{
+		assert(pageEntry.pageOffset < Vt->constantPageCount);
+		fileJobs[fileReadProduce].dataSize = 0;
+		fileJobs[fileReadProduce].fileOffset = -1;
+		fileJobs[fileReadProduce].constantPage = true;
+		fileJobs[fileReadProduce].constantColors[0] = Vt->constantPageColors[pageEntry.pageOffset * 2 + 0];
+		fileJobs[fileReadProduce].constantColors[1] = Vt->constantPageColors[pageEntry.pageOffset * 2 + 1];
+	}
+	else if (GetResidentSourcePage(Cache, pageEntry.pageOffset))
 	{
+		page->sourceOffset = pageEntry.pageOffset;
 		fileJobs[fileReadProduce].dataSize = 0;
 		fileJobs[fileReadProduce].fileOffset = -1;
+		fileJobs[fileReadProduce].copyPage = true;
 	}
 	else
 	{
+		page->sourceOffset = pageEntry.pageOffset;
 		fileJobs[fileReadProduce].dataSize = pageEntry.pageSize;
 		fileJobs[fileReadProduce].fileOffset = pageEntry.pageOffset;
 	}
@@ -1169,6 +1316,40 @@ bool ExportTextureAsDXT()
 	return false;
 }
 
+void LoadTexturePlacements()
+{
+	FILE* file = fopen("pages\\placement.txt", "r");
+
+	if (!file)
+	{
+		std::cout << "No texture placement manifest, using default UVs\n";
+		return;
+	}
+
+	vsTexturePlacement placement = {};
+	i32 x, y, width, height;
+
+	while (texturePlacementCount < ARRAY_COUNT(texturePlacements) && fscanf(file, "%63s %d %d %d %d", placement.name, &x, &y, &width, &height) == 5)
+	{
+		placement.uvScaleBias = vec4(width, height, x, y);
+		texturePlacements[texturePlacementCount++] = placement;
+	}
+
+	fclose(file);
+}
+
+// UV scale and bias that maps a mesh's 0-1 UVs onto its image in the virtual texture.
+vec4 GetTextureUVScaleBias(const char* Name, vec4 Default)
+{
+	for (i32 i = 0; i < texturePlacementCount; ++i)
+	{
+		if (strcmp(texturePlacements[i].name, Name) == 0)
+			return texturePlacements[i].uvScaleBias;
+	}
+
+	return Default;
+}
+
 bool CreateModelFromOBJ(const char* FileName, vec4 UVScaleBias, GLuint* VAO, int* IndexCount, vsOBJModel* Model)
 {
 	vsOBJModel objModel = CreateOBJ(FileName, UVScaleBias);
@@ -1250,373 +1431,1652 @@ bool CreateUIQuadModel(GLuint* VAO)
 	return true;
 }
 
-bool EncodeRGBABlockStreamToDXT5(u8* BlockStream)
+//-----------------------------------------------------------------------------------------------------------
+// GPU Transcoding.
+//-----------------------------------------------------------------------------------------------------------
+void InitGpuTranscoder()
 {
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, transInputSBO);
-	u8* inputData = (u8*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_WRITE_ONLY);
-	assert(inputData);
-	memcpy(inputData, BlockStream, 128 * 128 * 4);
-	glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+	gpuTranscoder = {};
+	CreateComputeShaderProgram("shaders\\image_compress.comp", &gpuTranscoder.shaderProgram);
 
-	glUseProgram(transCompShader);	
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, transInputSBO);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, transOutputSBO);
+	// Each page is two channels of 1024 RGBA blocks in, 1024 DXT5 blocks out.
+	glGenBuffers(1, &gpuTranscoder.inputSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuTranscoder.inputSBO);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, GPU_TRANSCODE_PAGES_MAX * 2 * 128 * 128 * 4, NULL, GL_STREAM_DRAW);
 
-	glDispatchCompute(1, 1, 1);
-	GLenum glerr = glGetError();
-	glMemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT);
+	glGenBuffers(1, &gpuTranscoder.outputSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuTranscoder.outputSBO);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, GPU_TRANSCODE_PAGES_MAX * 2 * 128 * 128, NULL, GL_STREAM_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
 
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, transOutputSBO);
-	glBindTexture(GL_TEXTURE_2D, transDestTex);
-	glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 128, 128, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 128 * 128, NULL);
-	//glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 128, 128, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-	glBindTexture(GL_TEXTURE_2D, 0);
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+// Adds both channel block streams of a page to the pending batch.
+void QueueGpuTranscodePage(u8* BlockStreams, i32 CacheX, i32 CacheY)
+{
+	assert(gpuTranscoder.pageCount < GPU_TRANSCODE_PAGES_MAX);
 
-	return true;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuTranscoder.inputSBO);
+
+	// Orphan the previous batch so we don't wait on the last dispatch.
+	if (gpuTranscoder.pageCount == 0)
+		glBufferData(GL_SHADER_STORAGE_BUFFER, GPU_TRANSCODE_PAGES_MAX * 2 * 128 * 128 * 4, NULL, GL_STREAM_DRAW);
+
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, gpuTranscoder.pageCount * 2 * 128 * 128 * 4, 2 * 128 * 128 * 4, BlockStreams);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	gpuTranscoder.pageCacheX[gpuTranscoder.pageCount] = CacheX;
+	gpuTranscoder.pageCacheY[gpuTranscoder.pageCount] = CacheY;
+	++gpuTranscoder.pageCount;
 }
 
-void UpdateIndirectionTable(vsVirtualTexture* Vt, vsCachePage* Page, bool Add)
-{	
-	i32 pageX = Page->x;
-	i32 pageY = Page->y;
-	i32 pageMip = Page->mip;
-	vsIndirectionTableEntry newEntry;
+// Encodes every queued page channel in a single dispatch, results stay in the output SBO.
+void DispatchGpuTranscode()
+{
+	glUseProgram(gpuTranscoder.shaderProgram);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, gpuTranscoder.inputSBO);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, gpuTranscoder.outputSBO);
 
-	if (Add)
-	{
-		newEntry = { (u8)Page->cacheX, (u8)Page->cacheY, (u8)Page->mip };		
-	}
-	else
+	glDispatchCompute(gpuTranscoder.pageCount * 2, 1, 1);
+	glMemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+// Encodes the pending batch and copies each page into its cache slot without leaving the GPU.
+void FlushGpuTranscode(GLuint CacheChannel0, GLuint CacheChannel1)
+{
+	if (gpuTranscoder.pageCount == 0)
+		return;
+
+	DispatchGpuTranscode();
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, gpuTranscoder.outputSBO);
+
+	for (i32 i = 0; i < gpuTranscoder.pageCount; ++i)
 	{
-		//assert(pageMip != 10);
+		i32 x = gpuTranscoder.pageCacheX[i] * 128;
+		i32 y = gpuTranscoder.pageCacheY[i] * 128;
 
-		if (pageMip == 10)
-			return;
-		
-		// Sample texel below
-		i32 lowerOffset = GetMipChainTexelOffset(pageMip + 1, Vt->globalMipCount, Vt->indirectionDataSizeBytes / sizeof(vsIndirectionTableEntry));
-		i32 lowerWidth = GetMipWidth(pageMip + 1, Vt->globalMipCount);
-		newEntry = Vt->indirectionData[lowerOffset + (pageY / 2) * lowerWidth + (pageX / 2)];
+		glBindTexture(GL_TEXTURE_2D, CacheChannel0);
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, 128, 128, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 128 * 128, (void*)((i64)(i * 2 + 0) * 128 * 128));
+
+		glBindTexture(GL_TEXTURE_2D, CacheChannel1);
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, 128, 128, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 128 * 128, (void*)((i64)(i * 2 + 1) * 128 * 128));
 	}
 
-	i32 offset = GetMipChainTexelOffset(pageMip, Vt->globalMipCount, Vt->indirectionDataSizeBytes / sizeof(vsIndirectionTableEntry));
-	i32 width = GetMipWidth(pageMip, Vt->globalMipCount);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 
-	Vt->indirectionData[offset + pageY * width + pageX] = newEntry;
+	gpuTranscoder.pageCount = 0;
+}
 
-	// Propogate updates through mipchain.
-	i32 mipsToUpdate = pageMip;
+//-----------------------------------------------------------------------------------------------------------
+// Cluster Upload.
+//-----------------------------------------------------------------------------------------------------------
+// CPU binning writes the offset, item and light lists straight into persistently mapped buffers. Frames
+// rotate through CLUSTER_UPLOAD_FRAMES sets, each fenced after the draws that read it, so binning only waits
+// when the GPU falls that many frames behind.
 
-	// From finest to coarsest.
-	for (i32 i = 0; i < mipsToUpdate; ++i)
-	{
-		i32 mipoffset = GetMipChainTexelOffset(i, Vt->globalMipCount, Vt->indirectionDataSizeBytes / sizeof(vsIndirectionTableEntry));
-		i32 mipWidth = GetMipWidth(i, Vt->globalMipCount);
+// Storage of Size bytes that stays mapped for writing.
+GLuint CreateMappedBuffer(i64 Size, void** Mapped)
+{
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	GLuint buffer;
 
-		i32 sX = pageX * (mipWidth / width);
-		i32 sY = pageY * (mipWidth / width);
-		i32 eX = (pageX + 1) * (mipWidth / width);
-		i32 eY = (pageY + 1) * (mipWidth / width);
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferStorage(GL_SHADER_STORAGE_BUFFER, Size, NULL, flags);
+	*Mapped = glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, Size, flags);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-		for (i32 mX = sX; mX < eX; ++mX)
-		{
-			for (i32 mY = sY; mY < eY; ++mY)
-			{
-				i32 mipIndex = mY * mipWidth + mX;
+	assert(*Mapped);
 
-				if (Vt->indirectionData[mipoffset + mipIndex].mip >= pageMip)
-				{
-					Vt->indirectionData[mipoffset + mipIndex] = newEntry;
-				}
-			}
-		}
+	return buffer;
+}
+
+// Room for Size bytes of items after the item list header of an upload frame, binning calls it once it
+// knows the item count.
+// NOTE: The frame's fence has been waited on, so a full buffer is replaced without stalling.
+void* ReserveClusterUploadItems(void* Data, i64 Size)
+{
+	vsClusterUploadFrame* frame = (vsClusterUploadFrame*)Data;
+	i64 itemListSize = (i64)sizeof(ClusterItemListHeader) + Size;
+
+	if (itemListSize > frame->itemListSize)
+	{
+		glDeleteBuffers(1, &frame->itemListSSB);
+		frame->itemListSize = itemListSize * 2;
+		frame->itemListSSB = CreateMappedBuffer(frame->itemListSize, (void**)&frame->itemList);
 	}
+
+	return frame->itemList + sizeof(ClusterItemListHeader);
 }
 
-void ResizeFramebuffers(i32 Width, i32 Height)
+void InitClusterUploadFrames()
 {
-	std::cout << "Resize " << Width << " " << Height << "\n";
+	for (i32 i = 0; i < CLUSTER_UPLOAD_FRAMES; ++i)
+	{
+		vsClusterUploadFrame* frame = clusterData.uploadFrames + i;
+		*frame = {};
 
-	gWidth = Width;
-	gHeight = Height;
-	
-	if (!game.running)
-		return;
+		// Buffer Size: 16 * 8 * 24 * 8 = 24KB
+		frame->offsetListSSB = CreateMappedBuffer(sizeof(ClusterOffsetListEntry) * CLUSTER_CELL_COUNT, (void**)&frame->offsetList);
 
-	glBindTexture(GL_TEXTURE_2D, hdrFrameBufferColor);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, gWidth, gHeight, 0, GL_RGBA, GL_FLOAT, NULL);
-	glBindTexture(GL_TEXTURE_2D, 0);
+		// Buffer Size: Starts at 64KB, grown to fit the items when binning.
+		frame->itemListSize = 64 * 1024;
+		frame->itemListSSB = CreateMappedBuffer(frame->itemListSize, (void**)&frame->itemList);
 
-	glBindTexture(GL_TEXTURE_2D, hdrFrameBufferDepthStencil);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, gWidth, gHeight, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
-	glBindTexture(GL_TEXTURE_2D, 0);
+		// Buffer Size: Starts at 1024 * 64 = 64KB, grown with the visible lights.
+		frame->lightListMax = MAX_LIGHTS;
+		frame->lightListSSB = CreateMappedBuffer(sizeof(ClusterLightListEntry) * frame->lightListMax, (void**)&frame->lightList);
+	}
 
-	glBindTexture(GL_TEXTURE_2D, gBufferNormalsColor);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, gWidth, gHeight, 0, GL_RG, GL_FLOAT, NULL);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	clusterData.uploadFrame = 0;
+	clusterData.bins.reserveItems = ReserveClusterUploadItems;
+}
 
-	// Bloom
-	glBindTexture(GL_TEXTURE_2D, bloom.tempColor);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, gWidth, gHeight, 0, GL_RGBA, GL_FLOAT, NULL);
-	
-	i32 blurWidth = gWidth / 2;
-	i32 blurHeight = gHeight / 2;
+// Moves to the next upload frame, waits for the GPU to finish with it, and points the bins at its buffers
+// with room for LightCount lights.
+vsClusterUploadFrame* BeginClusterUploadFrame(i32 LightCount)
+{
+	clusterData.uploadFrame = (clusterData.uploadFrame + 1) % CLUSTER_UPLOAD_FRAMES;
+	vsClusterUploadFrame* frame = clusterData.uploadFrames + clusterData.uploadFrame;
 
-	for (i32 i = 0; i < bloom.blurIterations; ++i)
+	if (frame->fence)
 	{
-		glBindTexture(GL_TEXTURE_2D, bloom.blurColors[i * 2 + 0]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, blurWidth, blurHeight, 0, GL_RGBA, GL_FLOAT, NULL);
-	
-		glBindTexture(GL_TEXTURE_2D, bloom.blurColors[i * 2 + 1]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, blurWidth, blurHeight, 0, GL_RGBA, GL_FLOAT, NULL);
-	
-		blurWidth /= 2;
-		blurHeight /= 2;
+		while (glClientWaitSync(frame->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED);
+
+		glDeleteSync(frame->fence);
+		frame->fence = 0;
 	}
 
-	glBindTexture(GL_TEXTURE_2D, 0);
-	
-	// SSAO
-	glBindTexture(GL_TEXTURE_2D, ssao.colorBuffer);
-	//glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, gWidth / 2, gHeight / 2, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, gWidth / 2, gHeight / 2, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	if (LightCount > frame->lightListMax)
+	{
+		glDeleteBuffers(1, &frame->lightListSSB);
+		frame->lightListMax = LightCount * 2;
+		frame->lightListSSB = CreateMappedBuffer(sizeof(ClusterLightListEntry) * frame->lightListMax, (void**)&frame->lightList);
+	}
 
-	glBindTexture(GL_TEXTURE_2D, ssao.blurColor);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, gWidth / 2, gHeight / 2, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	clusterData.bins.offsetList = frame->offsetList;
+	clusterData.bins.lightList = frame->lightList;
+	clusterData.bins.lightListMax = frame->lightListMax;
+	clusterData.bins.reserveItemsData = frame;
+
+	return frame;
 }
 
-double GetTime()
+// Writes the item list header once the frame is binned and binds its buffers for the lighting shaders.
+void EndClusterUploadFrame(vsClusterUploadFrame* Frame)
 {
-	LARGE_INTEGER counter;
-	QueryPerformanceCounter(&counter);
-	int64_t time = counter.QuadPart - platform.timeCounterStart;
-	double result = (double)time / ((double)platform.timeFrequency);
+	ClusterItemListHeader* header = (ClusterItemListHeader*)Frame->itemList;
+	header->itemFormat = (uint32_t)clusterData.bins.itemFormat;
+	header->itemCount = (uint32_t)clusterData.bins.itemListCount;
 
-	return result;
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, Frame->offsetListSSB);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, Frame->itemListSSB);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, Frame->lightListSSB);
 }
 
-float GetSinTime(float Duration)
+// Fences the current upload frame behind this frame's draws, a frame the GPU path skipped keeps its fence.
+void FenceClusterUploadFrame()
 {
-	return (float)(sin((GetTime() * glm::pi<float>() * 2.0f) / Duration) * 0.5f + 0.5f);
+	vsClusterUploadFrame* frame = clusterData.uploadFrames + clusterData.uploadFrame;
+
+	if (!frame->fence)
+		frame->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 }
 
-LRESULT CALLBACK WndProc(HWND HWnd, UINT Msg, WPARAM WParam, LPARAM LParam)
+//-----------------------------------------------------------------------------------------------------------
+// GPU Readback.
+//-----------------------------------------------------------------------------------------------------------
+// Small results of compute passes come back through a ring of mapped copies so reading them never stalls
+// the CPU on the GPU. The value read trails the newest dispatch by however far the GPU is behind.
+void InitGpuReadback(vsGpuReadback* Readback, i64 Size)
 {
-	switch (Msg)
+	GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	*Readback = {};
+	Readback->size = Size;
+
+	for (i32 i = 0; i < GPU_READBACK_FRAMES; ++i)
 	{
-		case WM_KEYDOWN:
-		{
-			int32_t key = (int32_t)WParam;
+		glGenBuffers(1, &Readback->buffers[i]);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, Readback->buffers[i]);
+		glBufferStorage(GL_COPY_WRITE_BUFFER, Size, NULL, flags);
+		Readback->mapped[i] = (u8*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, Size, flags);
 
-			if (key == 27)
-				Quit();
+		assert(Readback->mapped[i]);
+	}
+
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+// Queues a copy of the readback's size from Offset in Buffer, after the commands already issued.
+// NOTE: A slot whose copy was never read is overwritten, the GPU runs the copies in order.
+void CopyGpuReadback(vsGpuReadback* Readback, GLuint Buffer, i64 Offset)
+{
+	i32 slot = Readback->nextSlot;
+	Readback->nextSlot = (slot + 1) % GPU_READBACK_FRAMES;
+
+	if (Readback->fences[slot])
+		glDeleteSync(Readback->fences[slot]);
+
+	glBindBuffer(GL_COPY_READ_BUFFER, Buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, Readback->buffers[slot]);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, Offset, 0, Readback->size);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	Readback->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+// Returns the newest finished copy not read yet, or NULL if the GPU hasn't finished one since the last read.
+// Older finished copies are dropped.
+u8* ReadGpuReadback(vsGpuReadback* Readback)
+{
+	u8* result = NULL;
+
+	for (i32 i = 1; i <= GPU_READBACK_FRAMES; ++i)
+	{
+		i32 slot = (Readback->nextSlot + GPU_READBACK_FRAMES - i) % GPU_READBACK_FRAMES;
+		GLsync fence = Readback->fences[slot];
+
+		if (!fence)
+			continue;
+
+		if (!result)
+		{
+			GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+				continue;
+
+			result = Readback->mapped[slot];
+		}
+
+		glDeleteSync(fence);
+		Readback->fences[slot] = 0;
+	}
+
+	return result;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// GPU Light Binning.
+//-----------------------------------------------------------------------------------------------------------
+// Lights go up once as the light list, light_binning.comp builds the offset and item lists from them so
+// neither leaves the GPU. Items index the uploaded lights directly. BinLights stays as the reference.
+void InitGpuLightBinner()
+{
+	gpuLightBinner = {};
+	CreateManagedCompShaderProgram("shaders\\light_binning.comp", &gpuLightBinner.shaderProgram);
+
+	// NOTE: Zeroed so the first dispatch reads no items needed.
+	vsGpuLightBinState* state = new vsGpuLightBinState();
+
+	glGenBuffers(1, &gpuLightBinner.stateSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuLightBinner.stateSBO);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(vsGpuLightBinState), state, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	delete state;
+
+	InitGpuReadback(&gpuLightBinner.itemsNeededReadback, sizeof(u32));
+}
+
+// Makes room for LightCount lights in the light list staging copy.
+void ReserveClusterLightList(i32 LightCount)
+{
+	if (LightCount > clusterData.lightListMax)
+	{
+		delete[] clusterData.lightList;
+		clusterData.lightListMax = LightCount * 2;
+		clusterData.lightList = new ClusterLightListEntry[clusterData.lightListMax];
+	}
+}
+
+// Writes the lights to the light list buffer in order. The first StaticLightCount lights are only written
+// when StaticVersion or the count changes, or the buffer had to grow.
+void UploadGpuLights(vsLight* Lights, i32 LightCount, i32 StaticLightCount, u32 StaticVersion)
+{
+	ReserveClusterLightList(LightCount);
+
+	i64 lightListSize = sizeof(ClusterLightListEntry) * LightCount;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterData.lightListSSB);
+
+	if (lightListSize > clusterData.lightListSSBSize)
+	{
+		clusterData.lightListSSBSize = lightListSize * 2;
+		glBufferData(GL_SHADER_STORAGE_BUFFER, clusterData.lightListSSBSize, NULL, GL_DYNAMIC_DRAW);
+		gpuLightBinner.staticValid = false;
+	}
+
+	i32 firstLight = 0;
+
+	if (gpuLightBinner.staticValid && gpuLightBinner.staticVersion == StaticVersion && gpuLightBinner.staticLightCount == StaticLightCount)
+		firstLight = StaticLightCount;
+
+	if (LightCount > firstLight)
+	{
+		SetClusterLights(clusterData.lightList, Lights + firstLight, LightCount - firstLight);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(ClusterLightListEntry) * firstLight, sizeof(ClusterLightListEntry) * (LightCount - firstLight), clusterData.lightList);
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	gpuLightBinner.staticValid = true;
+	gpuLightBinner.staticVersion = StaticVersion;
+	gpuLightBinner.staticLightCount = StaticLightCount;
+}
+
+// Bins the first LightCount lights of the light list buffer into the offset and item list buffers, Lights
+// are the same lights uploaded with UploadGpuLights.
+// NOTE: The item list grows to the bound on the items Lights can make before dispatching, so no cell ever
+// loses lights to a full list.
+// With ActiveCellsOnly lights skip the cells the last cluster activation left inactive.
+void DispatchGpuLightBinning(vsLightBinView<vsClusterGridMain>* BinView, vsLight* Lights, i32 LightCount, bool ActiveCellsOnly)
+{
+	vec4 slices[vsClusterGridMain::sizeZ + 1];
+
+	for (i32 i = 0; i < vsClusterGridMain::sizeZ + 1; ++i)
+		slices[i] = vec4(BinView->depthSliceScale[i], BinView->sliceDepth[i], 0.0f);
+
+	u32* itemsNeeded = (u32*)ReadGpuReadback(&gpuLightBinner.itemsNeededReadback);
+
+	if (itemsNeeded)
+		gpuLightBinner.itemsNeeded = *itemsNeeded;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuLightBinner.stateSBO);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, offsetof(vsGpuLightBinState, view), sizeof(mat4), &BinView->view);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, offsetof(vsGpuLightBinState, slices), sizeof(slices), slices);
+
+	i64 itemBound = GetLightBinItemBound(BinView, Lights, LightCount);
+	i64 itemListSize = sizeof(ClusterItemListHeader) + itemBound * sizeof(u32);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterData.itemListSSB);
+
+	if (itemListSize > clusterData.itemListSSBSize)
+	{
+		clusterData.itemListSSBSize = itemListSize * 2;
+		glBufferData(GL_SHADER_STORAGE_BUFFER, clusterData.itemListSSBSize, NULL, GL_DYNAMIC_DRAW);
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	i32 itemCapacity = (i32)((clusterData.itemListSSBSize - sizeof(ClusterItemListHeader)) / sizeof(u32));
+	i32 cellGroups = (vsClusterGridMain::cellCount + GPU_LIGHT_BIN_GROUP_SIZE - 1) / GPU_LIGHT_BIN_GROUP_SIZE;
+	i32 lightGroups = (LightCount + GPU_LIGHT_BIN_GROUP_SIZE - 1) / GPU_LIGHT_BIN_GROUP_SIZE;
+
+	glUseProgram(gpuLightBinner.shaderProgram);
+	// NOTE: CPU binning leaves its upload frame bound.
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, clusterData.offsetListSSB);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, clusterData.itemListSSB);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, clusterData.lightListSSB);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, gpuLightBinner.stateSBO);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, clusterActivation.stateSBO);
+	glUniform1i(1, LightCount);
+	glUniform1i(2, itemCapacity);
+	glUniform1i(3, ActiveCellsOnly ? 1 : 0);
+
+	glUniform1i(0, GPU_LIGHT_BIN_PASS_CLEAR);
+	glDispatchCompute(cellGroups, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	if (lightGroups > 0)
+	{
+		glUniform1i(0, GPU_LIGHT_BIN_PASS_COUNT);
+		glDispatchCompute(lightGroups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+	glUniform1i(0, GPU_LIGHT_BIN_PASS_PREFIX);
+	glDispatchCompute(1, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	if (lightGroups > 0)
+	{
+		glUniform1i(0, GPU_LIGHT_BIN_PASS_SCATTER);
+		glDispatchCompute(lightGroups, 1, 1);
+	}
+
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	CopyGpuReadback(&gpuLightBinner.itemsNeededReadback, gpuLightBinner.stateSBO, offsetof(vsGpuLightBinState, itemsNeeded));
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Cluster Activation.
+//-----------------------------------------------------------------------------------------------------------
+// Clusters without visible geometry never light a fragment. After the main pass cluster_activation.comp
+// marks the clusters under the depth buffer, and the next frame only bins lights to those and their
+// neighbours.
+void InitClusterActivation()
+{
+	clusterActivation = {};
+	CreateManagedCompShaderProgram("shaders\\cluster_activation.comp", &clusterActivation.shaderProgram);
+
+	// NOTE: Every cell starts active, there is no depth until the first frame is drawn.
+	vsClusterActivationState* state = new vsClusterActivationState();
+	state->activeCellCount = CLUSTER_CELL_COUNT;
+
+	for (i32 i = 0; i < CLUSTER_CELL_COUNT; ++i)
+	{
+		state->activeCells[i] = 1;
+		clusterActivation.activeCells[i] = 1;
+	}
+
+	clusterActivation.activeCellCount = CLUSTER_CELL_COUNT;
+
+	glGenBuffers(1, &clusterActivation.stateSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterActivation.stateSBO);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(vsClusterActivationState), state, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	delete state;
+
+	InitGpuReadback(&clusterActivation.activeCellsReadback, sizeof(u32) * CLUSTER_CELL_COUNT);
+}
+
+// Marks the clusters under DepthTexture, drawn with a projection from Near to Far.
+void DispatchClusterActivation(GLuint DepthTexture, float Near, float Far)
+{
+	i32 cellGroups = (CLUSTER_CELL_COUNT + 63) / 64;
+
+	glUseProgram(clusterActivation.shaderProgram);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, clusterActivation.stateSBO);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, DepthTexture);
+	glUniform2f(1, Near, Far);
+
+	glUniform1i(0, CLUSTER_ACTIVATION_PASS_CLEAR);
+	glDispatchCompute(cellGroups, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUniform1i(0, CLUSTER_ACTIVATION_PASS_MARK);
+	glDispatchCompute((gWidth + 7) / 8, (gHeight + 7) / 8, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUniform1i(0, CLUSTER_ACTIVATION_PASS_EXPAND);
+	glDispatchCompute(cellGroups, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	CopyGpuReadback(&clusterActivation.activeCellsReadback, clusterActivation.stateSBO, offsetof(vsClusterActivationState, activeCells));
+}
+
+// Copies the active cells of the newest finished dispatch for BinLights.
+// NOTE: Never waits on the GPU. Usually that is the dispatch queued a frame ago, and the cells from an
+// earlier one are kept until the GPU finishes a newer one.
+void ReadClusterActivation()
+{
+	u32* activeCells = (u32*)ReadGpuReadback(&clusterActivation.activeCellsReadback);
+
+	if (!activeCells)
+		return;
+
+	// NOTE: Counted here rather than copying the shader's count as a second range.
+	i32 activeCellCount = 0;
+
+	for (i32 i = 0; i < CLUSTER_CELL_COUNT; ++i)
+	{
+		clusterActivation.activeCells[i] = (activeCells[i] != 0);
+		activeCellCount += clusterActivation.activeCells[i];
+	}
+
+	clusterActivation.activeCellCount = activeCellCount;
+}
+
+void UpdateIndirectionTable(vsVirtualTexture* Vt, vsCachePage* Page, bool Add)
+{	
+	i32 pageX = Page->x;
+	i32 pageY = Page->y;
+	i32 pageMip = Page->mip;
+	vsIndirectionTableEntry newEntry;
+
+	if (Add)
+	{
+		newEntry = { (u8)Page->cacheX, (u8)Page->cacheY, (u8)Page->mip };		
+	}
+	else
+	{
+		//assert(pageMip != 10);
+
+		if (pageMip == 10)
+			return;
+		
+		// Sample texel below
+		i32 lowerOffset = GetMipChainTexelOffset(pageMip + 1, Vt->globalMipCount, Vt->indirectionDataSizeBytes / sizeof(vsIndirectionTableEntry));
+		i32 lowerWidth = GetMipWidth(pageMip + 1, Vt->globalMipCount);
+		newEntry = Vt->indirectionData[lowerOffset + (pageY / 2) * lowerWidth + (pageX / 2)];
+	}
+
+	i32 offset = GetMipChainTexelOffset(pageMip, Vt->globalMipCount, Vt->indirectionDataSizeBytes / sizeof(vsIndirectionTableEntry));
+	i32 width = GetMipWidth(pageMip, Vt->globalMipCount);
+
+	Vt->indirectionData[offset + pageY * width + pageX] = newEntry;
+
+	// Propogate updates through mipchain.
+	i32 mipsToUpdate = pageMip;
+
+	// From finest to coarsest.
+	for (i32 i = 0; i < mipsToUpdate; ++i)
+	{
+		i32 mipoffset = GetMipChainTexelOffset(i, Vt->globalMipCount, Vt->indirectionDataSizeBytes / sizeof(vsIndirectionTableEntry));
+		i32 mipWidth = GetMipWidth(i, Vt->globalMipCount);
+
+		i32 sX = pageX * (mipWidth / width);
+		i32 sY = pageY * (mipWidth / width);
+		i32 eX = (pageX + 1) * (mipWidth / width);
+		i32 eY = (pageY + 1) * (mipWidth / width);
+
+		for (i32 mX = sX; mX < eX; ++mX)
+		{
+			for (i32 mY = sY; mY < eY; ++mY)
+			{
+				i32 mipIndex = mY * mipWidth + mX;
+
+				if (Vt->indirectionData[mipoffset + mipIndex].mip >= pageMip)
+				{
+					Vt->indirectionData[mipoffset + mipIndex] = newEntry;
+				}
+			}
+		}
+	}
+}
+
+void ResizeFramebuffers(i32 Width, i32 Height)
+{
+	std::cout << "Resize " << Width << " " << Height << "\n";
+
+	gWidth = Width;
+	gHeight = Height;
+	
+	if (!game.running)
+		return;
+
+	glBindTexture(GL_TEXTURE_2D, hdrFrameBufferColor);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, gWidth, gHeight, 0, GL_RGBA, GL_FLOAT, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindTexture(GL_TEXTURE_2D, hdrFrameBufferDepthStencil);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, gWidth, gHeight, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindTexture(GL_TEXTURE_2D, gBufferNormalsColor);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, gWidth, gHeight, 0, GL_RG, GL_FLOAT, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// Bloom
+	glBindTexture(GL_TEXTURE_2D, bloom.tempColor);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, gWidth, gHeight, 0, GL_RGBA, GL_FLOAT, NULL);
+	
+	i32 blurWidth = gWidth / 2;
+	i32 blurHeight = gHeight / 2;
+
+	for (i32 i = 0; i < bloom.blurIterations; ++i)
+	{
+		glBindTexture(GL_TEXTURE_2D, bloom.blurColors[i * 2 + 0]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, blurWidth, blurHeight, 0, GL_RGBA, GL_FLOAT, NULL);
+	
+		glBindTexture(GL_TEXTURE_2D, bloom.blurColors[i * 2 + 1]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, blurWidth, blurHeight, 0, GL_RGBA, GL_FLOAT, NULL);
+	
+		blurWidth /= 2;
+		blurHeight /= 2;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	
+	// SSAO
+	glBindTexture(GL_TEXTURE_2D, ssao.colorBuffer);
+	//glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, gWidth / 2, gHeight / 2, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, gWidth / 2, gHeight / 2, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindTexture(GL_TEXTURE_2D, ssao.blurColor);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, gWidth / 2, gHeight / 2, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+double GetTime()
+{
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+	int64_t time = counter.QuadPart - platform.timeCounterStart;
+	double result = (double)time / ((double)platform.timeFrequency);
+
+	return result;
+}
+
+float GetSinTime(float Duration)
+{
+	return (float)(sin((GetTime() * glm::pi<float>() * 2.0f) / Duration) * 0.5f + 0.5f);
+}
+
+LRESULT CALLBACK WndProc(HWND HWnd, UINT Msg, WPARAM WParam, LPARAM LParam)
+{
+	switch (Msg)
+	{
+		case WM_KEYDOWN:
+		{
+			int32_t key = (int32_t)WParam;
+
+			if (key == 27)
+				Quit();
+
+			if (key == 87) input.keyForward = true;
+			if (key == 83) input.keyBackward = true;
+			if (key == 65) input.keyLeft = true;
+			if (key == 68) input.keyRight = true;
+						
+			if (key == 76) input.vtDebug = !input.vtDebug;
+
+			if (key == 84)
+			{
+				input.gpuTranscode = !input.gpuTranscode;
+				std::cout << "Page transcode: " << (input.gpuTranscode ? "GPU" : "CPU") << "\n";
+			}
+
+			if (key == 66)
+			{
+				input.gpuLightBinning = !input.gpuLightBinning;
+				std::cout << "Light binning: " << (input.gpuLightBinning ? "GPU" : "CPU") << "\n";
+			}
+
+			if (key == 67)
+			{
+				input.clusterActivation = !input.clusterActivation;
+				std::cout << "Cluster activation: " << (input.clusterActivation ? "On" : "Off") << "\n";
+			}
+
+			if (key == 86) input.clusterStats = true;
+
+			if (key == 79) input.indirectionUIMipLevel = max(input.indirectionUIMipLevel - 1, 0);
+			if (key == 80) input.indirectionUIMipLevel = min(input.indirectionUIMipLevel + 1, 10);
+			
+			break;
+		}
+
+		case WM_KEYUP:
+		{
+			int32_t key = (int32_t)WParam;
+
+			if (key == 87) input.keyForward = false;
+			if (key == 83) input.keyBackward = false;
+			if (key == 65) input.keyLeft = false;
+			if (key == 68) input.keyRight = false;
+
+			if (key == 75) input.purgeCache = true;
+
+			break;
+		}
+
+		case WM_RBUTTONDOWN:
+		{
+			input.mouseRight = true;
+			break;
+		}
+
+		case WM_RBUTTONUP:
+		{
+			input.mouseRight = false;
+			break;
+		}
+
+		case WM_SIZE:
+		{
+			ResizeFramebuffers(LOWORD(LParam), HIWORD(LParam));			
+			break;
+		}
+
+		case WM_DESTROY:
+		{
+			PostQuitMessage(0);
+			break;
+		}
+
+		default:
+		{
+			return DefWindowProc(HWnd, Msg, WParam, LParam);
+		}
+	}
+
+	return 0;
+}
+
+HWND InitializeWindow(HINSTANCE HInstance, int ShowWnd, int Width, int Height, bool Windowed)
+{
+	RECT wr = { 0, 0, Width, Height };
+	AdjustWindowRect(&wr, WS_OVERLAPPEDWINDOW, FALSE);
+
+	WNDCLASSEX wc = {};
+	wc.cbSize = sizeof(WNDCLASSEX);
+	wc.style = CS_HREDRAW | CS_VREDRAW;
+	wc.lpfnWndProc = WndProc;
+	wc.cbClsExtra = NULL;
+	wc.cbWndExtra = NULL;
+	wc.hInstance = HInstance;
+	wc.hIcon = LoadIcon(NULL, IDI_APPLICATION);
+	wc.hCursor = LoadCursor(NULL, IDC_ARROW);
+	wc.hbrBackground = (HBRUSH)(COLOR_WINDOW + 2);
+	wc.lpszMenuName = NULL;
+	wc.lpszClassName = "MainWindow";
+	wc.hIconSm = LoadIcon(NULL, IDI_APPLICATION);
+
+	if (!RegisterClassEx(&wc))
+	{	
+		//gPlatform.ErrorMessageBox("Error Registering Window Class");
+		return 0;
+	}
+
+	HWND hwnd = CreateWindowEx(NULL, "MainWindow", "OpenGL Renderer", WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, CW_USEDEFAULT, wr.right - wr.left, wr.bottom - wr.top, NULL, NULL, HInstance, NULL);
+
+	if (!hwnd)
+	{
+		//gPlatform.ErrorMessageBox("Error Creating Window");
+		return 0;
+	}
+
+	ShowWindow(hwnd, ShowWnd);
+	UpdateWindow(hwnd);
+
+	return hwnd;
+}
+
+__forceinline float GetRand(float Min, float Max)
+{	
+	float range = Max - Min;
+	float r = (rand() % 100) / 100.0f;
+	return Min + range * r;
+}
+
+__forceinline float GetRandF()
+{
+	return float((double)rand() / (double)(RAND_MAX));
+}
+
+__forceinline float Lerp(float A, float B, float T)
+{
+	return A + (B - A) * T;
+}
+
+// NOTE: Pending reads are sorted by offset and pages closer than the gap are read as one span, the gap is read and dropped.
+const i64		fileReadCoalesceGap = 16 * 1024;
+const i32		fileReadSpanMax = 1024 * 1024;
+const i32		fileReadBatchMax = 64;
+
+// Reads the data of every job, neighbouring pages in the file share a read. Returns the number of reads issued.
+// NOTE: Jobs are reordered by file offset, SpanBuffer must hold fileReadSpanMax bytes.
+i32 ReadPageSpans(FILE* File, vsFileJob** Jobs, i32 JobCount, u8* SpanBuffer)
+{
+	for (i32 i = 1; i < JobCount; ++i)
+	{
+		vsFileJob* job = Jobs[i];
+		i32 j = i;
+
+		for (; j > 0 && Jobs[j - 1]->fileOffset > job->fileOffset; --j)
+			Jobs[j] = Jobs[j - 1];
+
+		Jobs[j] = job;
+	}
+
+	i32 readCount = 0;
+	i32 first = 0;
+
+	while (first < JobCount)
+	{
+		i64 spanStart = Jobs[first]->fileOffset;
+		i64 spanEnd = spanStart + Jobs[first]->dataSize;
+		i32 last = first + 1;
+
+		while (last < JobCount && Jobs[last]->fileOffset - spanEnd <= fileReadCoalesceGap && Jobs[last]->fileOffset + Jobs[last]->dataSize - spanStart <= fileReadSpanMax)
+		{
+			// NOTE: Duplicate requests for one page can land in the same batch.
+			if (Jobs[last]->fileOffset + Jobs[last]->dataSize > spanEnd)
+				spanEnd = Jobs[last]->fileOffset + Jobs[last]->dataSize;
+
+			++last;
+		}
+
+		_fseeki64(File, spanStart, SEEK_SET);
+		fread(SpanBuffer, (size_t)(spanEnd - spanStart), 1, File);
+		++readCount;
+
+		for (i32 i = first; i < last; ++i)
+		{
+			// NOTE: Allocate enough data for final DXT output for both channels (Will always be bigger than xr data).
+			Jobs[i]->data = new u8[128 * 128 * 2];
+			memcpy(Jobs[i]->data, SpanBuffer + (Jobs[i]->fileOffset - spanStart), Jobs[i]->dataSize);
+		}
+
+		first = last;
+	}
+
+	return readCount;
+}
+
+DWORD WINAPI fileReadThreadProc(LPVOID lpParameter)
+{
+	u8* spanBuffer = new u8[fileReadSpanMax];
+	vsFileJob* batchJobs[fileReadBatchMax];
+	vsFileJob* readJobs[fileReadBatchMax];
+
+	while (true)
+	{
+		while (fileReadConsume != fileReadProduce)
+		{
+			// Take every pending request, up to a batch, so neighbouring pages can share a read.
+			i32 batchCount = 0;
+			i32 readCount = 0;
+
+			for (i32 i = fileReadConsume; i != fileReadProduce && batchCount < fileReadBatchMax; i = (i + 1) % fileJobMax)
+			{
+				vsFileJob* fileJob = &fileJobs[i];
+				batchJobs[batchCount++] = fileJob;
+
+				if (fileJob->fileOffset == -1)
+					fileJob->data = NULL;
+				else if (virtualTexture.pageData != NULL)
+					fileJob->data = virtualTexture.pageData + fileJob->fileOffset + 4;
+				else if (virtualTexture.pageFile != NULL)
+					readJobs[readCount++] = fileJob;
+			}
+
+			double jobTime = GetTime();
+			ReadPageSpans(virtualTexture.pageFile, readJobs, readCount, spanBuffer);
+			jobTime = GetTime() - jobTime;
+			//std::cout << "Done " << batchCount << " jobs in " << (jobTime * 1000.0) << "ms\n";
+
+			// Jobs move on in request order.
+			for (i32 i = 0; i < batchCount; ++i)
+			{
+				WriteBarrier;
+				fileReadConsume = (fileReadConsume + 1) % fileJobMax;
+
+				while (InterlockedCompareExchange((volatile long*)&transcodeLock, 1, 0) == 1);
+				transcodeJobs[transcodeProduce] = batchJobs[i];
+				transcodeProduce = (transcodeProduce + 1) % fileJobMax;
+				InterlockedDecrement((volatile long*)&transcodeLock);
+
+				ReleaseSemaphore(jobFileLoadedSemaphore, 1, NULL);
+			}
+		}
+		
+		// Sleepies time.
+		WaitForSingleObjectEx(jobNewRequestSemaphore, INFINITE, FALSE);
+	}
 
-			if (key == 87) input.keyForward = true;
-			if (key == 83) input.keyBackward = true;
-			if (key == 65) input.keyLeft = true;
-			if (key == 68) input.keyRight = true;
-						
-			if (key == 76) input.vtDebug = !input.vtDebug;
+	return 0;
+}
 
-			if (key == 79) input.indirectionUIMipLevel = max(input.indirectionUIMipLevel - 1, 0);
-			if (key == 80) input.indirectionUIMipLevel = min(input.indirectionUIMipLevel + 1, 10);
-			
-			break;
+void DecodePackedPagePayload(u8* ChannelData, i32 ChannelSize, i32 RGBSize, i32 AlphaOffset, i32 AlphaSize, u8* DecodeBuffer, u8* PayloadBuffer)
+{
+	memcpy(DecodeBuffer + virtualTexture.jpgxrHeaderSize, ChannelData, ChannelSize);
+
+	*(i32*)(&DecodeBuffer[XR_META_RGB_SIZE]) = RGBSize;
+	*(i32*)(&DecodeBuffer[XR_META_ALPHA_OFFSET]) = AlphaOffset;
+	*(i32*)(&DecodeBuffer[XR_META_ALPHA_SIZE]) = AlphaSize;
+
+	HdpDecodeImageBGRA(DecodeBuffer, virtualTexture.jpgxrHeaderSize + ChannelSize, PayloadBuffer);
+}
+
+void BorderPagePayload(u8* PayloadData, u8* OutData)
+{
+	// Create bordered page.
+	CopyImageData(PayloadData, 0, 0, 120, OutData, 4, 4, 128, 120, 120, 4);
+
+	// Expand borders
+	for (i32 r = 4; r < 124; ++r)
+	{
+		i32 t = *(i32*)&OutData[(r * 128 + 4) * 4];
+
+		for (i32 c = 0; c < 4; ++c)
+		{
+			*(i32*)&OutData[(r * 128 + c) * 4] = t;
 		}
 
-		case WM_KEYUP:
+		t = *(i32*)&OutData[(r * 128 + 123) * 4];
+
+		for (i32 c = 124; c < 128; ++c)
 		{
-			int32_t key = (int32_t)WParam;
+			*(i32*)&OutData[(r * 128 + c) * 4] = t;
+		}
+	}
 
-			if (key == 87) input.keyForward = false;
-			if (key == 83) input.keyBackward = false;
-			if (key == 65) input.keyLeft = false;
-			if (key == 68) input.keyRight = false;
+	for (i32 r = 0; r < 4; ++r)
+	{
+		memcpy(&OutData[r * 128 * 4], &OutData[4 * 128 * 4], 128 * 4);
+		memcpy(&OutData[(r + 124) * 128 * 4], &OutData[123 * 128 * 4], 128 * 4);
+	}
+}
 
-			if (key == 75) input.purgeCache = true;
+// NOTE: Only the debug overlay still needs the bordered BGRA page, transcoding goes through DecodePackedPageBlockStream.
+void DecodePackedPage(u8* ChannelData, i32 ChannelSize, u8* OutData, i32 RGBSize, i32 AlphaOffset, i32 AlphaSize, u8* DecodeBuffer, u8* PayloadBuffer)
+{
+	DecodePackedPagePayload(ChannelData, ChannelSize, RGBSize, AlphaOffset, AlphaSize, DecodeBuffer, PayloadBuffer);
+	BorderPagePayload(PayloadBuffer, OutData);
+}
 
-			break;
+void DecodePackedPageBlockStream(u8* ChannelData, i32 ChannelSize, u8* OutBlockStream, i32 RGBSize, i32 AlphaOffset, i32 AlphaSize, u8* DecodeBuffer, u8* PayloadBuffer)
+{
+	DecodePackedPagePayload(ChannelData, ChannelSize, RGBSize, AlphaOffset, AlphaSize, DecodeBuffer, PayloadBuffer);
+	HdpBGRAPayloadToRGBABlockStream(PayloadBuffer, OutBlockStream);
+}
+
+// Fills both channels of a DXT5 page with a solid colour, Colors are RGBA.
+void FillConstantPageDXT(u8* Dst, u32* Colors)
+{
+	for (i32 c = 0; c < 2; ++c)
+	{
+		u32 pixels[16];
+		u8 block[16];
+
+		for (i32 i = 0; i < 16; ++i)
+			pixels[i] = Colors[c];
+
+		DxtEncodeBlockStreamDXT5((u8*)pixels, 1, DXT_PIXEL_RGBA, block);
+
+		for (i32 b = 0; b < 1024; ++b)
+			memcpy(Dst + c * 128 * 128 + b * 16, block, 16);
+	}
+}
+
+struct vsBenchmarkPages
+{
+	u8**	data;
+	i32*	dataSize;
+	i32		count;
+};
+
+// Reads up to PageCount real pages, from the coarsest mips down so the set is never empty.
+vsBenchmarkPages LoadBenchmarkPages(i32 PageCount)
+{
+	vsBenchmarkPages pages = {};
+	pages.data = new u8*[PageCount];
+	pages.dataSize = new i32[PageCount];
+
+	for (i32 m = virtualTexture.globalMipCount - 1; m >= 0 && pages.count < PageCount; --m)
+	{
+		i32 pagesInMip = (1 << (virtualTexture.globalMipCount - m - 1));
+
+		for (i32 p = 0; p < pagesInMip * pagesInMip && pages.count < PageCount; ++p)
+		{
+			vsPageIndexEntry pageIndex = GetPageIndex(&virtualTexture, p % pagesInMip, p / pagesInMip, m);
+
+			if (pageIndex.pageSize == PAGE_INDEX_SIZE_EMPTY || pageIndex.pageSize == PAGE_INDEX_SIZE_CONSTANT)
+				continue;
+
+			pages.data[pages.count] = new u8[pageIndex.pageSize];
+			pages.dataSize[pages.count] = pageIndex.pageSize;
+			_fseeki64(virtualTexture.pageFile, pageIndex.pageOffset, SEEK_SET);
+			fread(pages.data[pages.count], pageIndex.pageSize, 1, virtualTexture.pageFile);
+			++pages.count;
 		}
+	}
 
-		case WM_RBUTTONDOWN:
+	return pages;
+}
+
+void FreeBenchmarkPages(vsBenchmarkPages* Pages)
+{
+	for (i32 i = 0; i < Pages->count; ++i)
+		delete[] Pages->data[i];
+
+	delete[] Pages->data;
+	delete[] Pages->dataSize;
+	*Pages = {};
+}
+
+// Decodes both channels of a packed page into bordered 128x128 BGRA pages.
+void DecodeBenchmarkPage(vsBenchmarkPages* Pages, i32 Index, u8* Channel0, u8* Channel1, u8* DecodeBuffer, u8* PayloadBuffer)
+{
+	i32* metaData = (i32*)Pages->data[Index];
+	i32 metaDataSize = sizeof(i32) * 7;
+	i32 channel0Size = metaData[0];
+	i32 channel1Size = Pages->dataSize[Index] - metaDataSize - channel0Size;
+	u8* channel0Data = Pages->data[Index] + metaDataSize;
+	u8* channel1Data = Pages->data[Index] + metaDataSize + channel0Size;
+
+	DecodePackedPage(channel0Data, channel0Size, Channel0, metaData[1], metaData[2], metaData[3], DecodeBuffer, PayloadBuffer);
+	DecodePackedPage(channel1Data, channel1Size, Channel1, metaData[4], metaData[5], metaData[6], DecodeBuffer, PayloadBuffer);
+}
+
+void BenchmarkPageDecode(i32 PageCount)
+{
+	std::cout << "Benchmarking page decode...\n";
+
+	vsBenchmarkPages pages = LoadBenchmarkPages(PageCount);
+
+	u8* decodeBuffer = new u8[128 * 128];
+	memcpy(decodeBuffer, virtualTexture.jpgxrHeader, virtualTexture.jpgxrHeaderSize);
+	u8* bgraBuffer = new u8[128 * 128 * 4];
+	u8* bgraPayloadBuffer = new u8[128 * 128 * 4];
+	u8* blockStreamBuffer = new u8[128 * 128 * 4];
+	u8* fusedBlockStreamBuffer = new u8[128 * 128 * 4];
+	i64 encodedBytes = 0;
+
+	double decodeTime = GetTime();
+
+	for (i32 i = 0; i < pages.count; ++i)
+	{
+		DecodeBenchmarkPage(&pages, i, bgraBuffer, bgraBuffer, decodeBuffer, bgraPayloadBuffer);
+		encodedBytes += pages.dataSize[i];
+	}
+
+	decodeTime = GetTime() - decodeTime;
+
+	std::cout << "Decoded " << pages.count << " pages (" << (encodedBytes / 1024) << "kb) in " << (decodeTime * 1000.0) << "ms, "
+		<< (decodeTime * 1000.0 / pages.count) << "ms per page, " << (pages.count / decodeTime) << " pages/s\n";
+
+	// Post decode stage on its own: border copy plus swizzle against the fused pass.
+	i32 payloadCount = pages.count * 2;
+	u8* payloads = new u8[payloadCount * 120 * 120 * 4];
+
+	for (i32 i = 0; i < pages.count; ++i)
+	{
+		i32* metaData = (i32*)pages.data[i];
+		i32 metaDataSize = sizeof(i32) * 7;
+		i32 channel0Size = metaData[0];
+		i32 channel1Size = pages.dataSize[i] - metaDataSize - channel0Size;
+
+		DecodePackedPagePayload(pages.data[i] + metaDataSize, channel0Size, metaData[1], metaData[2], metaData[3], decodeBuffer, payloads + (i * 2 + 0) * 120 * 120 * 4);
+		DecodePackedPagePayload(pages.data[i] + metaDataSize + channel0Size, channel1Size, metaData[4], metaData[5], metaData[6], decodeBuffer, payloads + (i * 2 + 1) * 120 * 120 * 4);
+	}
+
+	double separateTime = GetTime();
+
+	for (i32 i = 0; i < payloadCount; ++i)
+	{
+		BorderPagePayload(payloads + i * 120 * 120 * 4, bgraBuffer);
+		HdpBGRAToRGBABlockStream(bgraBuffer, blockStreamBuffer);
+	}
+
+	separateTime = GetTime() - separateTime;
+
+	double fusedTime = GetTime();
+
+	for (i32 i = 0; i < payloadCount; ++i)
+		HdpBGRAPayloadToRGBABlockStream(payloads + i * 120 * 120 * 4, fusedBlockStreamBuffer);
+
+	fusedTime = GetTime() - fusedTime;
+
+	i32 mismatches = 0;
+
+	for (i32 i = 0; i < payloadCount; ++i)
+	{
+		u8* payload = payloads + i * 120 * 120 * 4;
+		BorderPagePayload(payload, bgraBuffer);
+		HdpBGRAToRGBABlockStream(bgraBuffer, blockStreamBuffer);
+		HdpBGRAPayloadToRGBABlockStream(payload, fusedBlockStreamBuffer);
+
+		if (memcmp(blockStreamBuffer, fusedBlockStreamBuffer, 128 * 128 * 4) != 0)
+			++mismatches;
+	}
+
+	std::cout << "Border and block stream: separate " << (separateTime * 1000000.0 / payloadCount) << "us, fused " << (fusedTime * 1000000.0 / payloadCount)
+		<< "us per channel, " << mismatches << " mismatches\n";
+
+	FreeBenchmarkPages(&pages);
+	delete[] payloads;
+	delete[] decodeBuffer;
+	delete[] bgraBuffer;
+	delete[] bgraPayloadBuffer;
+	delete[] blockStreamBuffer;
+	delete[] fusedBlockStreamBuffer;
+}
+
+// NOTE: Largest PSNR drop we accept from the page encoder relative to stb_dxt normal quality.
+#define DXT_MAX_PSNR_LOSS 1.0
+
+double GetDXTPagePSNR(u8* BGRAPage, u8* DXTPage, i32 Channel)
+{
+	double error = 0.0;
+	u8 pixels[16 * 4];
+
+	for (i32 b = 0; b < 1024; ++b)
+	{
+		DxtDecodeBlockDXT5(DXTPage + b * 16, pixels);
+
+		for (i32 i = 0; i < 16; ++i)
 		{
-			input.mouseRight = true;
-			break;
+			i32 pixelOffset = (((b / 32) * 4 + i / 4) * 128 + (b % 32) * 4 + i % 4) * 4;
+			// NOTE: Decoded blocks are RGBA, source pages are BGRA.
+			i32 srcChannel = (Channel < 3) ? 2 - Channel : 3;
+			double d = (double)pixels[i * 4 + Channel] - (double)BGRAPage[pixelOffset + srcChannel];
+			error += d * d;
 		}
+	}
 
-		case WM_RBUTTONUP:
+	error /= 128.0 * 128.0;
+
+	return (error == 0.0) ? 99.0 : 10.0 * log10(255.0 * 255.0 / error);
+}
+
+// Loads the page index the old way, one read per entry, against the compact index and checks they agree.
+void BenchmarkPageIndexLoad()
+{
+	std::cout << "Benchmarking page index load...\n";
+
+	i32 mipCount = virtualTexture.globalMipCount;
+	double legacyTime = GetTime();
+
+	FILE* pageTableFile = fopen("pages\\index.dat", "rb");
+	i64** legacyTable = new i64*[mipCount];
+	i64 legacyBytes = 0;
+
+	for (i32 i = 0; i < mipCount; ++i)
+	{
+		i32 pages = GetMipWidth(i, mipCount);
+		legacyTable[i] = new i64[pages * pages];
+		legacyBytes += (i64)pages * pages * sizeof(i64);
+
+		for (i32 j = 0; j < pages * pages; ++j)
+			fread(&legacyTable[i][j], sizeof(i64), 1, pageTableFile);
+	}
+
+	fclose(pageTableFile);
+	legacyTime = GetTime() - legacyTime;
+
+	double compactTime = GetTime();
+	vsPageIndex index;
+	bool loaded = PageIndexLoad(&index, "pages\\index.vti");
+	compactTime = GetTime() - compactTime;
+
+	if (!loaded)
+	{
+		std::cout << "No compact page index to compare against\n";
+	}
+	else
+	{
+		i32 mismatches = 0;
+		double legacyLookupTime = GetTime();
+		i64 legacySum = 0;
+
+		for (i32 m = 0; m < mipCount; ++m)
 		{
-			input.mouseRight = false;
-			break;
+			i32 pages = GetMipWidth(m, mipCount);
+
+			for (i32 j = 0; j < pages * pages; ++j)
+				legacySum += legacyTable[m][j];
 		}
 
-		case WM_SIZE:
+		legacyLookupTime = GetTime() - legacyLookupTime;
+
+		double compactLookupTime = GetTime();
+		i64 compactSum = 0;
+
+		for (i32 m = 0; m < mipCount; ++m)
 		{
-			ResizeFramebuffers(LOWORD(LParam), HIWORD(LParam));			
-			break;
+			i32 pages = GetMipWidth(m, mipCount);
+
+			for (i32 y = 0; y < pages; ++y)
+			{
+				for (i32 x = 0; x < pages; ++x)
+					compactSum += PageIndexGetEntry(&index, x, y, m);
+			}
 		}
 
-		case WM_DESTROY:
+		compactLookupTime = GetTime() - compactLookupTime;
+
+		for (i32 m = 0; m < mipCount; ++m)
 		{
-			PostQuitMessage(0);
-			break;
+			i32 pages = GetMipWidth(m, mipCount);
+
+			for (i32 j = 0; j < pages * pages; ++j)
+			{
+				if (legacyTable[m][j] != PageIndexGetEntry(&index, j % pages, j / pages, m))
+					++mismatches;
+			}
 		}
 
-		default:
+		std::cout << "Per entry: " << (legacyTime * 1000.0) << "ms, " << (legacyBytes / 1024) << "kb resident\n";
+		std::cout << "Compact: " << (compactTime * 1000.0) << "ms, " << (index.header->fileSize / 1024) << "kb resident, " << index.header->blockCount << " blocks\n";
+		std::cout << "Full lookup pass: " << (legacyLookupTime * 1000.0) << "ms flat, " << (compactLookupTime * 1000.0) << "ms compact, sums " << (legacySum == compactSum ? "match" : "differ") << "\n";
+		std::cout << "Mismatched entries: " << mismatches << "\n";
+
+		PageIndexFree(&index);
+	}
+
+	for (i32 i = 0; i < mipCount; ++i)
+		delete[] legacyTable[i];
+
+	delete[] legacyTable;
+}
+
+// Reads 8x8 page windows around random real pages, one read per page against coalesced span reads.
+// NOTE: Both passes share the OS file cache, the read counts are the stable part of the comparison.
+void BenchmarkPageReads(i32 WindowCount)
+{
+	std::cout << "Benchmarking page reads, " << (virtualTexture.pageLayout == PAGE_LAYOUT_MORTON ? "morton" : "row") << " layout...\n";
+
+	srand(1);
+
+	vsFileJob* jobs = new vsFileJob[WindowCount * 64];
+	vsFileJob** jobPointers = new vsFileJob*[WindowCount * 64];
+	i32* windowStarts = new i32[WindowCount + 1];
+	i32 jobCount = 0;
+
+	for (i32 w = 0; w < WindowCount; ++w)
+	{
+		windowStarts[w] = jobCount;
+
+		i32 mip = rand() % 5;
+		i32 pagesInMip = GetMipWidth(mip, virtualTexture.globalMipCount);
+		vsPageIndexEntry entry = {};
+		i32 x = 0;
+		i32 y = 0;
+
+		for (i32 t = 0; t < 256 && (entry.pageSize == PAGE_INDEX_SIZE_EMPTY || entry.pageSize == PAGE_INDEX_SIZE_CONSTANT); ++t)
 		{
-			return DefWindowProc(HWnd, Msg, WParam, LParam);
+			x = rand() % pagesInMip;
+			y = rand() % pagesInMip;
+			entry = GetPageIndex(&virtualTexture, x, y, mip);
+		}
+
+		i32 sX = GetMax(0, GetMin(x - 4, pagesInMip - 8));
+		i32 sY = GetMax(0, GetMin(y - 4, pagesInMip - 8));
+
+		for (i32 iY = sY; iY < GetMin(sY + 8, pagesInMip); ++iY)
+		{
+			for (i32 iX = sX; iX < GetMin(sX + 8, pagesInMip); ++iX)
+			{
+				entry = GetPageIndex(&virtualTexture, iX, iY, mip);
+
+				if (entry.pageSize == PAGE_INDEX_SIZE_EMPTY || entry.pageSize == PAGE_INDEX_SIZE_CONSTANT)
+					continue;
+
+				jobs[jobCount] = {};
+				jobs[jobCount].fileOffset = entry.pageOffset;
+				jobs[jobCount].dataSize = entry.pageSize;
+				jobPointers[jobCount] = &jobs[jobCount];
+				++jobCount;
+			}
 		}
 	}
 
-	return 0;
+	windowStarts[WindowCount] = jobCount;
+
+	u8* pageBuffer = new u8[128 * 128 * 2];
+	double singleTime = GetTime();
+
+	for (i32 i = 0; i < jobCount; ++i)
+	{
+		_fseeki64(virtualTexture.pageFile, jobs[i].fileOffset, SEEK_SET);
+		fread(pageBuffer, jobs[i].dataSize, 1, virtualTexture.pageFile);
+	}
+
+	singleTime = GetTime() - singleTime;
+
+	u8* spanBuffer = new u8[fileReadSpanMax];
+	i32 spanReadCount = 0;
+	double spanTime = GetTime();
+
+	for (i32 w = 0; w < WindowCount; ++w)
+		spanReadCount += ReadPageSpans(virtualTexture.pageFile, jobPointers + windowStarts[w], windowStarts[w + 1] - windowStarts[w], spanBuffer);
+
+	spanTime = GetTime() - spanTime;
+
+	std::cout << "Read " << jobCount << " pages in " << WindowCount << " windows\n";
+	std::cout << "Per page: " << jobCount << " reads in " << (singleTime * 1000.0) << "ms\n";
+	std::cout << "Coalesced: " << spanReadCount << " reads in " << (spanTime * 1000.0) << "ms, " << ((f64)jobCount / GetMax(spanReadCount, 1)) << " pages per read\n";
+
+	for (i32 i = 0; i < jobCount; ++i)
+		delete[] jobs[i].data;
+
+	delete[] jobs;
+	delete[] jobPointers;
+	delete[] windowStarts;
+	delete[] pageBuffer;
+	delete[] spanBuffer;
 }
 
-HWND InitializeWindow(HINSTANCE HInstance, int ShowWnd, int Width, int Height, bool Windowed)
+void BenchmarkDXTEncode(i32 PageCount)
 {
-	RECT wr = { 0, 0, Width, Height };
-	AdjustWindowRect(&wr, WS_OVERLAPPEDWINDOW, FALSE);
+	std::cout << "Benchmarking DXT page encode...\n";
 
-	WNDCLASSEX wc = {};
-	wc.cbSize = sizeof(WNDCLASSEX);
-	wc.style = CS_HREDRAW | CS_VREDRAW;
-	wc.lpfnWndProc = WndProc;
-	wc.cbClsExtra = NULL;
-	wc.cbWndExtra = NULL;
-	wc.hInstance = HInstance;
-	wc.hIcon = LoadIcon(NULL, IDI_APPLICATION);
-	wc.hCursor = LoadCursor(NULL, IDC_ARROW);
-	wc.hbrBackground = (HBRUSH)(COLOR_WINDOW + 2);
-	wc.lpszMenuName = NULL;
-	wc.lpszClassName = "MainWindow";
-	wc.hIconSm = LoadIcon(NULL, IDI_APPLICATION);
+	vsBenchmarkPages pages = LoadBenchmarkPages(PageCount);
 
-	if (!RegisterClassEx(&wc))
-	{	
-		//gPlatform.ErrorMessageBox("Error Registering Window Class");
-		return 0;
+	u8* decodeBuffer = new u8[128 * 128];
+	memcpy(decodeBuffer, virtualTexture.jpgxrHeader, virtualTexture.jpgxrHeaderSize);
+	u8* bgraPayloadBuffer = new u8[128 * 128 * 4];
+	u8* blockStreamBuffer = new u8[128 * 128 * 4];
+
+	// Decode everything up front, both channels are encoded as separate pages.
+	i32 bgraPageCount = pages.count * 2;
+	u8* bgraPages = new u8[bgraPageCount * 128 * 128 * 4];
+
+	for (i32 i = 0; i < pages.count; ++i)
+		DecodeBenchmarkPage(&pages, i, bgraPages + (i * 2 + 0) * 128 * 128 * 4, bgraPages + (i * 2 + 1) * 128 * 128 * 4, decodeBuffer, bgraPayloadBuffer);
+
+	u8* referenceDXT = new u8[bgraPageCount * 128 * 128];
+	u8* dxtPages = new u8[bgraPageCount * 128 * 128];
+
+	double encodeTime = GetTime();
+
+	for (i32 p = 0; p < bgraPageCount; ++p)
+	{
+		HdpBGRAToRGBABlockStream(bgraPages + p * 128 * 128 * 4, blockStreamBuffer);
+
+		for (i32 i = 0; i < 1024; ++i)
+			stb_compress_dxt_block(referenceDXT + p * 128 * 128 + i * 16, blockStreamBuffer + i * 16 * 4, 1, STB_DXT_NORMAL);
 	}
 
-	HWND hwnd = CreateWindowEx(NULL, "MainWindow", "OpenGL Renderer", WS_OVERLAPPEDWINDOW, CW_USEDEFAULT, CW_USEDEFAULT, wr.right - wr.left, wr.bottom - wr.top, NULL, NULL, HInstance, NULL);
+	encodeTime = GetTime() - encodeTime;
+
+	double referenceRGB = 0.0;
+	double referenceAlpha = 0.0;
+
+	for (i32 p = 0; p < bgraPageCount; ++p)
+	{
+		for (i32 c = 0; c < 3; ++c)
+			referenceRGB += GetDXTPagePSNR(bgraPages + p * 128 * 128 * 4, referenceDXT + p * 128 * 128, c) / 3.0;
+
+		referenceAlpha += GetDXTPagePSNR(bgraPages + p * 128 * 128 * 4, referenceDXT + p * 128 * 128, 3);
+	}
+
+	referenceRGB /= bgraPageCount;
+	referenceAlpha /= bgraPageCount;
+
+	std::cout << "stb_dxt: " << (encodeTime * 1000.0 / bgraPageCount) << "ms per page, PSNR RGB " << referenceRGB << " A " << referenceAlpha << "\n";
+
+	vsDxtEncodePath defaultPath = DxtGetEncodePath();
+
+	for (i32 path = 0; path < DXT_PATH_COUNT; ++path)
+	{
+		if (!DxtIsEncodePathSupported((vsDxtEncodePath)path))
+			continue;
+
+		DxtSetEncodePath((vsDxtEncodePath)path);
+
+		encodeTime = GetTime();
+
+		for (i32 p = 0; p < bgraPageCount; ++p)
+			DxtEncodeImageDXT5(bgraPages + p * 128 * 128 * 4, 128, 128, 128 * 4, DXT_PIXEL_BGRA, dxtPages + p * 128 * 128);
+
+		encodeTime = GetTime() - encodeTime;
+
+		double rgb = 0.0;
+		double alpha = 0.0;
+
+		for (i32 p = 0; p < bgraPageCount; ++p)
+		{
+			for (i32 c = 0; c < 3; ++c)
+				rgb += GetDXTPagePSNR(bgraPages + p * 128 * 128 * 4, dxtPages + p * 128 * 128, c) / 3.0;
+
+			alpha += GetDXTPagePSNR(bgraPages + p * 128 * 128 * 4, dxtPages + p * 128 * 128, 3);
+		}
+
+		rgb /= bgraPageCount;
+		alpha /= bgraPageCount;
+
+		bool passed = (referenceRGB - rgb <= DXT_MAX_PSNR_LOSS) && (referenceAlpha - alpha <= DXT_MAX_PSNR_LOSS);
 
-	if (!hwnd)
-	{
-		//gPlatform.ErrorMessageBox("Error Creating Window");
-		return 0;
+		std::cout << DxtGetEncodePathName((vsDxtEncodePath)path) << ": " << (encodeTime * 1000.0 / bgraPageCount) << "ms per page, PSNR RGB " << rgb << " A " << alpha
+			<< (passed ? " PASSED\n" : " FAILED\n");
 	}
 
-	ShowWindow(hwnd, ShowWnd);
-	UpdateWindow(hwnd);
+	DxtSetEncodePath(defaultPath);
 
-	return hwnd;
+	FreeBenchmarkPages(&pages);
+	delete[] decodeBuffer;
+	delete[] bgraPayloadBuffer;
+	delete[] blockStreamBuffer;
+	delete[] bgraPages;
+	delete[] referenceDXT;
+	delete[] dxtPages;
 }
 
-__forceinline float GetRand(float Min, float Max)
-{	
-	float range = Max - Min;
-	float r = (rand() % 100) / 100.0f;
-	return Min + range * r;
-}
+// NOTE: The GPU encoder has no endpoint refinement, so it gets more slack than the CPU paths.
+#define GPU_DXT_MAX_PSNR_LOSS 3.0
 
-__forceinline float GetRandF()
+// Runs real pages through both transcode paths and compares quality against the decoded source.
+// Only needs a GL 4.3 context so it also runs under a software driver like llvmpipe.
+void TestGpuTranscode(i32 PageCount)
 {
-	return float((double)rand() / (double)(RAND_MAX));
-}
+	std::cout << "Testing GPU page transcode...\n";
 
-__forceinline float Lerp(float A, float B, float T)
-{
-	return A + (B - A) * T;
-}
+	vsBenchmarkPages pages = LoadBenchmarkPages(PageCount);
 
-DWORD WINAPI fileReadThreadProc(LPVOID lpParameter)
-{
-	while (true)
+	u8* decodeBuffer = new u8[128 * 128];
+	memcpy(decodeBuffer, virtualTexture.jpgxrHeader, virtualTexture.jpgxrHeaderSize);
+	u8* bgraPayloadBuffer = new u8[128 * 128 * 4];
+	u8* bgraPages = new u8[GPU_TRANSCODE_PAGES_MAX * 2 * 128 * 128 * 4];
+	u8* blockStreams = new u8[GPU_TRANSCODE_PAGES_MAX * 2 * 128 * 128 * 4];
+	u8* cpuDXT = new u8[GPU_TRANSCODE_PAGES_MAX * 2 * 128 * 128];
+	u8* gpuDXT = new u8[GPU_TRANSCODE_PAGES_MAX * 2 * 128 * 128];
+
+	double cpuRGB = 0.0;
+	double cpuAlpha = 0.0;
+	double gpuRGB = 0.0;
+	double gpuAlpha = 0.0;
+	double cpuTime = 0.0;
+	double gpuTime = 0.0;
+	i32 channelCount = 0;
+
+	for (i32 batchStart = 0; batchStart < pages.count; batchStart += GPU_TRANSCODE_PAGES_MAX)
 	{
-		while (fileReadConsume != fileReadProduce)
+		i32 batchCount = GetMin(pages.count - batchStart, GPU_TRANSCODE_PAGES_MAX);
+
+		for (i32 i = 0; i < batchCount; ++i)
 		{
-			vsFileJob *fileJob = &fileJobs[fileReadConsume];
-			double jobTime = GetTime();
+			u8* channel0 = bgraPages + (i * 2 + 0) * 128 * 128 * 4;
+			u8* channel1 = bgraPages + (i * 2 + 1) * 128 * 128 * 4;
+			DecodeBenchmarkPage(&pages, batchStart + i, channel0, channel1, decodeBuffer, bgraPayloadBuffer);
+			HdpBGRAToRGBABlockStream(channel0, blockStreams + (i * 2 + 0) * 128 * 128 * 4);
+			HdpBGRAToRGBABlockStream(channel1, blockStreams + (i * 2 + 1) * 128 * 128 * 4);
+		}
 
-			if (fileJob->fileOffset != -1)
-			{
-				if (virtualTexture.pageData != NULL)
-				{
-					fileJob->data = virtualTexture.pageData + fileJob->fileOffset + 4;
-				}
-				else if (virtualTexture.pageFile != NULL)
-				{
-					_fseeki64(virtualTexture.pageFile, fileJob->fileOffset, SEEK_SET);
+		double time = GetTime();
+		DxtEncodeBlockStreamDXT5(blockStreams, batchCount * 2 * 1024, DXT_PIXEL_RGBA, cpuDXT);
+		cpuTime += GetTime() - time;
 
-					// NOTE: Allocate enough data for final DXT output for both channels (Will always be bigger than xr data).
-					//fileJob->data = new u8[virtualTexture.jpgxrHeaderSize + fileJob->dataSize];
-					fileJob->data = new u8[128 * 128 * 2];
-					fread(fileJob->data, fileJob->dataSize, 1, virtualTexture.pageFile);
-				}
-			}
-			else
-			{
-				fileJob->data = NULL;
-			}
+		time = GetTime();
 
-			jobTime = GetTime() - jobTime;
-			//std::cout << "Done Job in " << (jobTime * 1000.0) << "ms\n";
+		for (i32 i = 0; i < batchCount; ++i)
+			QueueGpuTranscodePage(blockStreams + i * 2 * 128 * 128 * 4, 0, 0);
 
-			WriteBarrier;
-			fileReadConsume = (fileReadConsume + 1) % fileJobMax;
+		DispatchGpuTranscode();
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, gpuTranscoder.outputSBO);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, batchCount * 2 * 128 * 128, gpuDXT);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		gpuTranscoder.pageCount = 0;
 
-			while (InterlockedCompareExchange((volatile long*)&transcodeLock, 1, 0) == 1);
-			transcodeJobs[transcodeProduce] = fileJob;
-			transcodeProduce = (transcodeProduce + 1) % fileJobMax;
-			InterlockedDecrement((volatile long*)&transcodeLock);
+		gpuTime += GetTime() - time;
+
+		for (i32 p = 0; p < batchCount * 2; ++p)
+		{
+			for (i32 c = 0; c < 3; ++c)
+			{
+				cpuRGB += GetDXTPagePSNR(bgraPages + p * 128 * 128 * 4, cpuDXT + p * 128 * 128, c) / 3.0;
+				gpuRGB += GetDXTPagePSNR(bgraPages + p * 128 * 128 * 4, gpuDXT + p * 128 * 128, c) / 3.0;
+			}
 
-			ReleaseSemaphore(jobFileLoadedSemaphore, 1, NULL);
+			cpuAlpha += GetDXTPagePSNR(bgraPages + p * 128 * 128 * 4, cpuDXT + p * 128 * 128, 3);
+			gpuAlpha += GetDXTPagePSNR(bgraPages + p * 128 * 128 * 4, gpuDXT + p * 128 * 128, 3);
 		}
-		
-		// Sleepies time.
-		WaitForSingleObjectEx(jobNewRequestSemaphore, INFINITE, FALSE);
+
+		channelCount += batchCount * 2;
 	}
 
-	return 0;
+	if (channelCount)
+	{
+		cpuRGB /= channelCount;
+		cpuAlpha /= channelCount;
+		gpuRGB /= channelCount;
+		gpuAlpha /= channelCount;
+	}
+
+	bool passed = (cpuRGB - gpuRGB <= GPU_DXT_MAX_PSNR_LOSS) && (cpuAlpha - gpuAlpha <= GPU_DXT_MAX_PSNR_LOSS);
+
+	std::cout << "CPU " << DxtGetEncodePathName(DxtGetEncodePath()) << ": " << (cpuTime * 1000.0 / GetMax(channelCount, 1)) << "ms per channel, PSNR RGB " << cpuRGB << " A " << cpuAlpha << "\n";
+	std::cout << "GPU: " << (gpuTime * 1000.0 / GetMax(channelCount, 1)) << "ms per channel (incl. readback), PSNR RGB " << gpuRGB << " A " << gpuAlpha
+		<< (passed ? " PASSED\n" : " FAILED\n");
+
+	FreeBenchmarkPages(&pages);
+	delete[] decodeBuffer;
+	delete[] bgraPayloadBuffer;
+	delete[] bgraPages;
+	delete[] blockStreams;
+	delete[] cpuDXT;
+	delete[] gpuDXT;
 }
 
-void DecodePackedPage(u8* ChannelData, i32 ChannelSize, u8* OutData, i32 RGBSize, i32 AlphaOffset, i32 AlphaSize, u8* DecodeBuffer, u8* PayloadBuffer)
+// Bins random lights with BinLights and light_binning.comp from a few camera placements and compares the
+// lights of every cell. GPU order within a cell is up to the scheduler, so cells are compared as sets. The
+// later placements only bin to a random set of active cells.
+// NOTE: Works on any driver with compute shaders, a software driver checks the shader without a GPU.
+void TestGpuLightBinning(i32 LightCount)
 {
-	memcpy(DecodeBuffer + virtualTexture.jpgxrHeaderSize, ChannelData, ChannelSize);
-
-	*(i32*)(&DecodeBuffer[XR_META_RGB_SIZE]) = RGBSize;
-	*(i32*)(&DecodeBuffer[XR_META_ALPHA_OFFSET]) = AlphaOffset;
-	*(i32*)(&DecodeBuffer[XR_META_ALPHA_SIZE]) = AlphaSize;
+	std::cout << "Testing GPU light binning...\n";
 
-	HdpDecodeImageBGRA(DecodeBuffer, virtualTexture.jpgxrHeaderSize + ChannelSize, PayloadBuffer);
+	srand(1);
+	vsLight* lights = new vsLight[LightCount];
 
-	// Create bordered page.
-	CopyImageData(PayloadBuffer, 0, 0, 120, OutData, 4, 4, 128, 120, 120, 4);
+	for (i32 i = 0; i < LightCount; ++i)
+	{
+		vsLight* light = lights + i;
+		*light = {};
+		light->type = i % 3;
+		light->position = vec3(GetRand(-60.0f, 60.0f), GetRand(-5.0f, 20.0f), GetRand(20.0f, -250.0f));
+		light->direction = glm::normalize(vec3(GetRand(-1.0f, 1.0f), -1.0f, GetRand(-1.0f, 1.0f)));
+		light->color = vec3(1.0f);
+		light->radius = GetRand(1.0f, 12.0f);
+		float spotAngle = glm::radians(GetRand(10.0f, 60.0f));
+		light->spotCosOuter = cos(spotAngle);
+		light->spotCosInner = cos(spotAngle * 0.8f);
+		light->halfLength = GetRand(0.5f, 6.0f);
+		light->clusterId = -1;
+	}
 
-	// Expand borders
-	for (i32 r = 4; r < 124; ++r)
+	vsLightBins bins = {};
+	bins.offsetList = new ClusterOffsetListEntry[CLUSTER_CELL_COUNT];
+	bins.lightList = new ClusterLightListEntry[LightCount];
+	bins.lightListMax = LightCount;
+
+	ClusterOffsetListEntry* gpuCells = new ClusterOffsetListEntry[CLUSTER_CELL_COUNT];
+	u32* gpuItems = new u32[LightCount];
+	i64 gpuItemCapacity = LightCount;
+	i32* listLights = new i32[LightCount];
+	// NOTE: Cell a light was last seen in on the CPU, flipped negative once the GPU finds it there.
+	i32* lightCells = new i32[LightCount];
+	u8* activeCells = new u8[CLUSTER_CELL_COUNT];
+	u32* gpuActiveCells = new u32[CLUSTER_CELL_COUNT];
+
+	mat4 proj = glm::perspective(glm::radians(50.0f), (float)gWidth / gHeight, 0.01f, 1000.0f);
+	mat4 invProj = glm::inverse(proj);
+	bool passed = true;
+
+	for (i32 v = 0; v < 4; ++v)
 	{
-		i32 t = *(i32*)&OutData[(r * 128 + 4) * 4];
+		mat4 rot = glm::rotate(mat4(), glm::radians(v * 30.0f - 45.0f), vec3(0, 1, 0));
+		mat4 view = rot * glm::translate(mat4(), -vec3(v * 5.0f - 10.0f, 4.0f, 10.0f));
+		vsLightBinView<vsClusterGridMain> binView;
+		LightBinViewCreate(&binView, view, invProj);
 
-		for (i32 c = 0; c < 4; ++c)
+		bool activeOnly = (v >= 2);
+
+		for (i32 c = 0; c < CLUSTER_CELL_COUNT; ++c)
 		{
-			*(i32*)&OutData[(r * 128 + c) * 4] = t;
+			activeCells[c] = (rand() % 4 != 0);
+			gpuActiveCells[c] = activeCells[c];
 		}
 
-		t = *(i32*)&OutData[(r * 128 + 123) * 4];
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterActivation.stateSBO);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, offsetof(vsClusterActivationState, activeCells), sizeof(u32) * CLUSTER_CELL_COUNT, gpuActiveCells);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-		for (i32 c = 124; c < 128; ++c)
+		double cpuTime = GetTime();
+		BinLights(&lightBinner, &binView, lights, LightCount, &bins, 0, 0, activeOnly ? activeCells : NULL);
+		cpuTime = GetTime() - cpuTime;
+
+		// NOTE: Binned twice so growing the item list stays out of the timed run.
+		UploadGpuLights(lights, LightCount, 0, 0);
+		DispatchGpuLightBinning(&binView, lights, LightCount, activeOnly);
+		glFinish();
+
+		double gpuTime = GetTime();
+		DispatchGpuLightBinning(&binView, lights, LightCount, activeOnly);
+		glFinish();
+		gpuTime = GetTime() - gpuTime;
+
+		ClusterItemListHeader gpuHeader;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterData.offsetListSSB);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(ClusterOffsetListEntry) * CLUSTER_CELL_COUNT, gpuCells);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterData.itemListSSB);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(gpuHeader), &gpuHeader);
+
+		if (gpuHeader.itemCount > gpuItemCapacity)
 		{
-			*(i32*)&OutData[(r * 128 + c) * 4] = t;
+			delete[] gpuItems;
+			gpuItemCapacity = gpuHeader.itemCount;
+			gpuItems = new u32[gpuItemCapacity];
 		}
-	}
 
-	for (i32 r = 0; r < 4; ++r)
-	{
-		memcpy(&OutData[r * 128 * 4], &OutData[4 * 128 * 4], 128 * 4);
-		memcpy(&OutData[(r + 124) * 128 * 4], &OutData[123 * 128 * 4], 128 * 4);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(gpuHeader), sizeof(u32) * gpuHeader.itemCount, gpuItems);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		for (i32 i = 0; i < LightCount; ++i)
+		{
+			lightCells[i] = -1;
+
+			if (lights[i].clusterId != -1)
+				listLights[lights[i].clusterId] = i;
+		}
+
+		i32 mismatchedCells = 0;
+
+		for (i32 c = 0; c < CLUSTER_CELL_COUNT; ++c)
+		{
+			ClusterOffsetListEntry* cpuCell = bins.offsetList + c;
+			ClusterOffsetListEntry* gpuCell = gpuCells + c;
+			bool match = (cpuCell->lightCount == gpuCell->lightCount) && (gpuCell->itemOffset + gpuCell->lightCount <= gpuHeader.itemCount);
+
+			for (u32 i = 0; match && i < cpuCell->lightCount; ++i)
+				lightCells[listLights[LightBinsGetItem(&bins, cpuCell->itemOffset + i)]] = c;
+
+			for (u32 i = 0; match && i < gpuCell->lightCount; ++i)
+			{
+				u32 light = gpuItems[gpuCell->itemOffset + i];
+				match = (light < (u32)LightCount) && (lightCells[light] == c);
+
+				if (match)
+					lightCells[light] = -2 - c;
+			}
+
+			if (!match)
+			{
+				if (mismatchedCells < 4)
+					std::cout << "Cell " << c << ": CPU " << cpuCell->lightCount << " lights, GPU " << gpuCell->lightCount << "\n";
+
+				++mismatchedCells;
+			}
+		}
+
+		passed = passed && (mismatchedCells == 0);
+
+		std::cout << "View " << v << (activeOnly ? " active cells: " : ": ") << bins.itemListCount << " items, CPU " << (cpuTime * 1000.0) << "ms, GPU "
+			<< (gpuTime * 1000.0) << "ms (incl. sync), " << gpuHeader.itemCount << " items, mismatched cells "
+			<< mismatchedCells << "\n";
 	}
+
+	std::cout << "GPU light binning " << (passed ? "PASSED\n" : "FAILED\n");
+
+	// NOTE: The light list buffer now holds the test lights.
+	gpuLightBinner.staticValid = false;
+
+	for (i32 c = 0; c < CLUSTER_CELL_COUNT; ++c)
+		gpuActiveCells[c] = 1;
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterActivation.stateSBO);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, offsetof(vsClusterActivationState, activeCells), sizeof(u32) * CLUSTER_CELL_COUNT, gpuActiveCells);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	LightBinsFree(&bins);
+	delete[] bins.offsetList;
+	delete[] bins.lightList;
+	delete[] gpuCells;
+	delete[] gpuItems;
+	delete[] listLights;
+	delete[] lightCells;
+	delete[] activeCells;
+	delete[] gpuActiveCells;
 }
 
 DWORD WINAPI PageTranscodeThreadProc(LPVOID lpParameter)
@@ -1626,9 +3086,9 @@ DWORD WINAPI PageTranscodeThreadProc(LPVOID lpParameter)
 	CoInitializeEx(NULL, COINIT_MULTITHREADED);
 	
 	u8* bgraBuffer = new u8[128 * 128 * 4];
-	u8* blockStreamBuffer = new u8[128 * 128 * 4];
 	u8* decodeBuffer = NULL;
 	u8* bgraPayloadBuffer = new u8[128 * 128 * 4];
+	u8* blockStreamBuffer = new u8[128 * 128 * 4];
 
 	while (true)
 	{
@@ -1679,10 +3139,30 @@ DWORD WINAPI PageTranscodeThreadProc(LPVOID lpParameter)
 				i32 channel1AlphaOffset = metaData[5];
 				i32 channel1AlphaSize = metaData[6];
 
-				DecodePackedPage(channel0Data, channel0Size, bgraBuffer, channel0RGBSize, channel0AlphaOffset, channel0AlphaSize, decodeBuffer, bgraPayloadBuffer);
-								
-				if (input.vtDebug)
+				u8* dxtBuffer = NULL;
+
+				if (input.gpuTranscode && !input.vtDebug)
+				{
+					// NOTE: Encoding happens in the main thread's batched dispatch.
+					dxtBuffer = new u8[128 * 128 * 4 * 2];
+					DecodePackedPageBlockStream(channel0Data, channel0Size, dxtBuffer, channel0RGBSize, channel0AlphaOffset, channel0AlphaSize, decodeBuffer, bgraPayloadBuffer);
+					DecodePackedPageBlockStream(channel1Data, channel1Size, dxtBuffer + 128 * 128 * 4, channel1RGBSize, channel1AlphaOffset, channel1AlphaSize, decodeBuffer, bgraPayloadBuffer);
+					fileJob->blockStream = true;
+				}
+				else if (!input.vtDebug)
+				{
+					dxtBuffer = new u8[128 * 128 * 2];
+					DecodePackedPageBlockStream(channel0Data, channel0Size, blockStreamBuffer, channel0RGBSize, channel0AlphaOffset, channel0AlphaSize, decodeBuffer, bgraPayloadBuffer);
+					DxtEncodeBlockStreamDXT5(blockStreamBuffer, 1024, DXT_PIXEL_RGBA, dxtBuffer);
+
+					DecodePackedPageBlockStream(channel1Data, channel1Size, blockStreamBuffer, channel1RGBSize, channel1AlphaOffset, channel1AlphaSize, decodeBuffer, bgraPayloadBuffer);
+					DxtEncodeBlockStreamDXT5(blockStreamBuffer, 1024, DXT_PIXEL_RGBA, dxtBuffer + 128 * 128);
+				}
+				else
 				{
+					dxtBuffer = new u8[128 * 128 * 2];
+					DecodePackedPage(channel0Data, channel0Size, bgraBuffer, channel0RGBSize, channel0AlphaOffset, channel0AlphaSize, decodeBuffer, bgraPayloadBuffer);
+
 					for (i32 iX = 0; iX < 128; ++iX)
 					{
 						for (i32 iY = 0; iY < 128; ++iY)
@@ -1715,20 +3195,13 @@ DWORD WINAPI PageTranscodeThreadProc(LPVOID lpParameter)
 
 						xMark += 8;
 					}
-				}
-				
-				HdpBGRAToRGBABlockStream(bgraBuffer, blockStreamBuffer);
 
-				u8* dxtBuffer = new u8[128 * 128 * 2];
+					DxtEncodeImageDXT5(bgraBuffer, 128, 128, 128 * 4, DXT_PIXEL_BGRA, dxtBuffer);
 
-				for (i32 i = 0; i < 1024; ++i)
-					stb_compress_dxt_block(dxtBuffer + i * 16, blockStreamBuffer + i * 16 * 4, 1, STB_DXT_NORMAL);//STB_DXT_HIGHQUAL
-				
-				// Channel 2
-				DecodePackedPage(channel1Data, channel1Size, bgraBuffer, channel1RGBSize, channel1AlphaOffset, channel1AlphaSize, decodeBuffer, bgraPayloadBuffer);
-				HdpBGRAToRGBABlockStream(bgraBuffer, blockStreamBuffer);
-				for (i32 i = 0; i < 1024; ++i)
-					stb_compress_dxt_block(dxtBuffer + 128 * 128 + i * 16, blockStreamBuffer + i * 16 * 4, 1, STB_DXT_NORMAL);//STB_DXT_HIGHQUAL
+					// Channel 2
+					DecodePackedPage(channel1Data, channel1Size, bgraBuffer, channel1RGBSize, channel1AlphaOffset, channel1AlphaSize, decodeBuffer, bgraPayloadBuffer);
+					DxtEncodeImageDXT5(bgraBuffer, 128, 128, 128 * 4, DXT_PIXEL_BGRA, dxtBuffer + 128 * 128);
+				}
 
 				delete[] fileJob->data;
 				fileJob->data = dxtBuffer;
@@ -1930,6 +3403,8 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 	//-----------------------------------------------------------------------------------------------------------	
 	platform.pageTranscodeThreadCount = 3;
 
+	DxtInitEncoder();
+
 	jobNewRequestSemaphore = CreateSemaphoreEx(NULL, 0, 1, NULL, 0, SEMAPHORE_ALL_ACCESS);
 	jobFileLoadedSemaphore = CreateSemaphoreEx(NULL, 0, platform.pageTranscodeThreadCount, NULL, 0, SEMAPHORE_ALL_ACCESS);
 	platform.fileReadThread = CreateThread(0, 0, fileReadThreadProc, NULL, 0, NULL);
@@ -2034,6 +3509,11 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 	glBindTexture(GL_TEXTURE_2D, 0);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+	// NOTE: The lighting shaders size the cluster grid from these.
+	char clusterDefines[256];
+	vsClusterGridMain::GetShaderDefines(clusterDefines, sizeof(clusterDefines));
+	scompSetDefines(clusterDefines);
+
 	CreateManagedShaderProgram("shaders\\ui.vert", "shaders\\blur.frag", &bloom.blurShaderProgram);
 	CreateManagedShaderProgram("shaders\\ui.vert", "shaders\\bloom.frag", &bloom.bloomShaderProgram);
 
@@ -2114,15 +3594,19 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 	debugChars[10].data = CreateImageFromFile("textures\\debugChars\\charDash.png", &debugChars[10].width, &debugChars[10].height);
 
 	// Models.
+	LoadTexturePlacements();
+	vec4 baronUVScaleBias = GetTextureUVScaleBias("baron", vec4(4096, 4096, 4096 * 16, 0));
+	vec4 capsuleUVScaleBias = GetTextureUVScaleBias("capsule", vec4(2048, 2048, 4096 * 17, 0));
+
 	GLuint vao0, vao1, uiVAO, baronVAO;
 	int indexCount0, indexCount1, baronIndexCount;
 	//CreateModelFromOBJ("ShipTest.obj", vec4(4096, 4096, 69632, 4096), &vao0, &indexCount0);
 	//CreateModelFromOBJ("ShipTest.obj", vec4(65536, 65536, 0, 0), &vao0, &indexCount0);
 	//CreateModelFromOBJ("ShipTest.obj", vec4(131072, 131072, 0, 0), &vao0, &indexCount0);
 	vsOBJModel baronModel;
-	CreateModelFromOBJ("models\\Baron.obj", vec4(4096, 4096, 4096 * 16, 0), &vao0, &indexCount0, &baronModel);
+	CreateModelFromOBJ("models\\Baron.obj", baronUVScaleBias, &vao0, &indexCount0, &baronModel);
 	//CreateModelFromOBJ("models\\Baron.obj", vec4(65536, 65536, 0, 0), &vao0, &indexCount0);
-	CreateModelFromOBJ("models\\Baron.obj", vec4(4096, 4096, 4096 * 16, 0), &baronVAO, &baronIndexCount, NULL);
+	CreateModelFromOBJ("models\\Baron.obj", baronUVScaleBias, &baronVAO, &baronIndexCount, NULL);
 	//CreateModelFromOBJ("models\\FuelTank.obj", vec4(4096, 4096, 4096 * 16, 4096), &vao1, &indexCount1, NULL);
 	CreateModelFromOBJ("models\\FuelTank.obj", vec4(131072.0f, 131072.0f, 0, 0), &vao1, &indexCount1, NULL);
 	CreateUIQuadModel(&uiVAO);
@@ -2137,15 +3621,15 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 
 	GLuint planeVAO;
 	int planeIndexCount;
-	CreateModelFromOBJ("models\\plane.obj", vec4(2048, 2048, 4096 * 17, 0), &planeVAO, &planeIndexCount, NULL);
+	CreateModelFromOBJ("models\\plane.obj", capsuleUVScaleBias, &planeVAO, &planeIndexCount, NULL);
 
 	GLuint skySphereVAO;
 	int skySphereIndexCount;
-	CreateModelFromOBJ("models\\skySphere.obj", vec4(2048, 2048, 4096 * 17, 0), &skySphereVAO, &skySphereIndexCount, NULL);
+	CreateModelFromOBJ("models\\skySphere.obj", capsuleUVScaleBias, &skySphereVAO, &skySphereIndexCount, NULL);
 
 	GLuint sphereVAO;
 	int sphereIndexCount;
-	CreateModelFromOBJ("models\\sphere.obj", vec4(2048, 2048, 4096 * 17, 0), &sphereVAO, &sphereIndexCount, NULL);
+	CreateModelFromOBJ("models\\sphere.obj", capsuleUVScaleBias, &sphereVAO, &sphereIndexCount, NULL);
 	
 	// Shaders.
 	GLint svtForwardShaderProgram, uiShaderProgram, feedbackShaderProgram, simpleShaderProgram, forwardShaderProgram;
@@ -2172,8 +3656,6 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 	GLint tonemapShaderProgram;
 	CreateManagedShaderProgram("shaders\\ui.vert", "shaders\\tonemap.frag", &tonemapShaderProgram);
 	
-	CreateComputeShaderProgram("shaders\\image_compress.comp", &transCompShader);
-
 	GLint shSolveCompShader;
 	CreateManagedCompShaderProgram("shaders\\spherical_harmonics_solve.comp", &shSolveCompShader);
 
@@ -2294,32 +3776,44 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 	std::cout << "Caching virtual texture completed\n";
 	//*/
 
-	FILE* pageTableFile = fopen("pages\\index.dat", "rb");
-	int vstWidth = 131072;
-	int pageWidth = 128;
-	int mipLevels = 11;
+	// NOTE: Builds before the compact index only have index.dat, it's converted on load.
+	if (!PageIndexLoad(&virtualTexture.pageIndex, "pages\\index.vti"))
+	{
+		std::cout << "No compact page index, loading pages\\index.dat\n";
+		bool loaded = PageIndexLoadLegacy(&virtualTexture.pageIndex, "pages\\index.dat", virtualTexture.globalMipCount);
+		assert(loaded);
+	}
 
-	virtualTexture.pageIndexTable = new i64*[mipLevels];
+	// NOTE: These point into the index data, which stays loaded for the life of the app.
+	virtualTexture.jpgxrHeaderSize = virtualTexture.pageIndex.header->xrHeaderSize;
+	virtualTexture.jpgxrHeader = virtualTexture.pageIndex.xrHeader;
+	virtualTexture.constantPageCount = virtualTexture.pageIndex.header->constantCount;
+	virtualTexture.constantPageColors = virtualTexture.pageIndex.constantColors;
+	virtualTexture.pageLayout = virtualTexture.pageIndex.header->layout;
 
-	for (int i = 0; i < mipLevels; ++i)
-	{
-		int pages = (1 << (mipLevels - i - 1));
-		pages = max(1, pages);
+	if (strstr(LPCmdLine, "-benchdecode"))
+		BenchmarkPageDecode(4096);
 
-		virtualTexture.pageIndexTable[i] = new int64_t[pages * pages];
+	if (strstr(LPCmdLine, "-benchio"))
+		BenchmarkPageReads(1024);
 
-		for (int j = 0; j < pages * pages; ++j)
-		{
-			fread(&virtualTexture.pageIndexTable[i][j], sizeof(int64_t), 1, pageTableFile);
-		}
-	}
+	if (strstr(LPCmdLine, "-benchindex"))
+		BenchmarkPageIndexLoad();
 
-	// JPEGXR Header
-	fread(&virtualTexture.jpgxrHeaderSize, sizeof(i32), 1, pageTableFile);
-	virtualTexture.jpgxrHeader = new u8[virtualTexture.jpgxrHeaderSize];
-	fread(virtualTexture.jpgxrHeader, virtualTexture.jpgxrHeaderSize, 1, pageTableFile);
+	if (strstr(LPCmdLine, "-benchdxt"))
+		BenchmarkDXTEncode(1024);
 
-	fclose(pageTableFile);
+	if (strstr(LPCmdLine, "-benchmip"))
+		BenchmarkMipReduce(16384);
+
+	JobSystemInit(&jobSystem);
+	LightBinnerInit(&lightBinner, &jobSystem);
+
+	if (strstr(LPCmdLine, "-benchlights"))
+		BenchmarkLightBinning(&jobSystem);
+
+	if (strstr(LPCmdLine, "-benchlightcull"))
+		BenchmarkLightCulling(&jobSystem);
 
 	// Page Caches.	
 	vtCache.width = 64;
@@ -2329,6 +3823,7 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 	vtCache.pagesLRULast = NULL;
 	// TODO: Assemble all the pages into a free list.
 	memset(vtCache.cachePageMap, 0, sizeof(vsCachePage*) * cachePageMapBucketCount);
+	memset(vtCache.sourcePageMap, 0, sizeof(vsCachePage*) * cachePageMapBucketCount);
 	
 	GLuint pageCachePBO;
 	glGenBuffers(1, &pageCachePBO);
@@ -2423,26 +3918,10 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 	//-----------------------------------------------------------------------------------------------------------
 	// Compute Setup.
 	//-----------------------------------------------------------------------------------------------------------
-	glGenTextures(1, &transDestTex);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, transDestTex);
-	//glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 128, 128, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-	glCompressedTexImage2D(GL_TEXTURE_2D, 0, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 128, 128, 0, 128 * 128, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	glGenBuffers(1, &transInputSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, transInputSBO);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, 128 * 128 * 4, NULL, GL_DYNAMIC_DRAW);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	InitGpuTranscoder();
 
-	glGenBuffers(1, &transOutputSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, transOutputSBO);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, 128 * 128, NULL, GL_DYNAMIC_DRAW);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	if (strstr(LPCmdLine, "-testgputranscode"))
+		TestGpuTranscode(256);
 
 	GLuint computeDestTex;
 	glGenTextures(1, &computeDestTex);
@@ -2541,15 +4020,6 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 	*/
 
-	//u8* blockStream = DecodeHDP("tile_high.jxr");
-	//EncodeRGBABlockStreamToDXT5(blockStream);
-	// TODO: Free block stream
-	// Any other image data that needs to be free.
-
-	//blockStream = DecodeHDP("tile_low.jxr");
-	//EncodeRGBABlockStreamToDXT5(blockStream);
-	// TODO: Free block stream
-
 	//-----------------------------------------------------------------------------------------------------------
 	// Clustered Lighting Setup
 	//-----------------------------------------------------------------------------------------------------------
@@ -2559,39 +4029,53 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 	//	Light Count 8b
 	
 	// Item List:
-	//	- 32bits * 256 * (All occupied cells)
-	//	Array of Light Index 12b x ClusterList.LightCount
+	//	Header, item format and count
+	//	Light Index 16b (32b past 64K lights) x Total lights in all cells, packed
 
 	// Light List:
 	//	Type?
 	//	Position
 	//	Color
 	
-	memset(clusterData.offsetList, 0, sizeof(clusterData.offsetList));
-	memset(clusterData.itemList, 0, sizeof(clusterData.itemList));
-	memset(clusterData.lightList, 0, sizeof(clusterData.lightList));
+	clusterData.lightList = new ClusterLightListEntry[MAX_LIGHTS];
+	memset(clusterData.lightList, 0, sizeof(ClusterLightListEntry) * MAX_LIGHTS);
+
+	clusterData.lightListMax = MAX_LIGHTS;
+	clusterData.bins = {};
 	
-	// Buffer Size: 16 * 8 * 24 * 256 * 2 = 1.5MB
+	// Buffer Size: 16 * 8 * 24 * 8 = 24KB
 	glGenBuffers(1, &clusterData.offsetListSSB);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterData.offsetListSSB);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(clusterData.offsetList), clusterData.offsetList, GL_DYNAMIC_DRAW);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(ClusterOffsetListEntry) * CLUSTER_CELL_COUNT, NULL, GL_DYNAMIC_DRAW);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, clusterData.offsetListSSB);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-	// Buffer Size: 16 * 8 * 24 * 256 * 4 = 3MB
+	// Buffer Size: Starts at 64KB, grown to fit the items when binning.
+	ClusterItemListHeader emptyItemList = { CLUSTER_ITEM_FORMAT_U16, 0 };
+	clusterData.itemListSSBSize = 64 * 1024;
 	glGenBuffers(1, &clusterData.itemListSSB);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterData.itemListSSB);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(clusterData.itemList), clusterData.itemList, GL_DYNAMIC_DRAW);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, clusterData.itemListSSBSize, NULL, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(emptyItemList), &emptyItemList);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, clusterData.itemListSSB);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-	// Buffer Size: 1024 * 32 = 32KB
+	// Buffer Size: Starts at 1024 * 64 = 64KB, grown with the light list.
+	clusterData.lightListSSBSize = sizeof(ClusterLightListEntry) * MAX_LIGHTS;
 	glGenBuffers(1, &clusterData.lightListSSB);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterData.lightListSSB);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(clusterData.lightList), clusterData.lightList, GL_DYNAMIC_DRAW);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, clusterData.lightListSSBSize, clusterData.lightList, GL_DYNAMIC_DRAW);
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, clusterData.lightListSSB);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
+	InitClusterUploadFrames();
+	InitGpuLightBinner();
+	InitClusterActivation();
+
+	if (strstr(LPCmdLine, "-testgpulights"))
+		TestGpuLightBinning(4096);
+
 	//-----------------------------------------------------------------------------------------------------------
 	// Game state setup.
 	//-----------------------------------------------------------------------------------------------------------
@@ -2605,9 +4089,11 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 	camera.view = mat4();
 
 	input.vtDebug = false;
+	input.gpuTranscode = (strstr(LPCmdLine, "-gputranscode") != NULL);
+	input.gpuLightBinning = (strstr(LPCmdLine, "-gpulights") != NULL);
 
 	// TODO: Move to World setup.
-	world.lightCount = 0;
+	LightStoreInit(&world.lights);
 
 	vsLight light = {};
 
@@ -2659,6 +4145,8 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 		light.color = ToLinear(vec3(GetRand(1.0f, 4.0f), GetRand(1.0f, 4.0f), GetRand(1.0f, 4.0f)));
 		light.radius = 10.0f;
 		light.clusterId = -1;
+		// NOTE: The first light in here is lights[1], which moves in the main loop.
+		light.isStatic = (i != 0);
 		AddLight(&world, &light);
 	}
 	//*/
@@ -2682,6 +4170,31 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 	}
 	//*/
 
+	//*
+	light = {};
+	light.type = LIGHT_TYPE_SPOT;
+	light.position = vec3(10.0f, 8.0f, -20.0f);
+	light.direction = glm::normalize(vec3(0.3f, -1.0f, -0.2f));
+	light.color = ToLinear(vec3(2.0f, 1.8f, 1.5f)) * 10.0f;
+	light.radius = 16.0f;
+	light.spotCosOuter = cos(glm::radians(30.0f));
+	light.spotCosInner = cos(glm::radians(24.0f));
+	light.clusterId = -1;
+	light.isStatic = true;
+	AddLight(&world, &light);
+
+	light = {};
+	light.type = LIGHT_TYPE_CAPSULE;
+	light.position = vec3(20.0f, 1.0f, -60.0f);
+	light.direction = vec3(1.0f, 0.0f, 0.0f);
+	light.halfLength = 6.0f;
+	light.color = ToLinear(vec3(0.6f, 1.0f, 2.0f)) * 4.0f;
+	light.radius = 6.0f;
+	light.clusterId = -1;
+	light.isStatic = true;
+	AddLight(&world, &light);
+	//*/
+
 	//-----------------------------------------------------------------------------------------------------------
 	// Main Loop.
 	//-----------------------------------------------------------------------------------------------------------
@@ -2762,8 +4275,8 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 		mat4 view = camera.view;
 		mat4 model = mat4();// glm::rotate(mat4(), (float)GetTime(), vec3Up);
 
-		world.lights[0].position = vec3(0.5f, 3.0f, sin(GetTime()) * 6.0f);
-		world.lights[1].position = vec3(sin(GetTime()) * 20.0f + 20.0f, 3.0f, 5.0f);
+		LightStoreMove(&world.lights, 0, vec3(0.5f, 3.0f, sin(GetTime()) * 6.0f));
+		LightStoreMove(&world.lights, 1, vec3(sin(GetTime()) * 20.0f + 20.0f, 3.0f, 5.0f));
 
 		//-----------------------------------------------------------------------------------------------------------
 		// Z Pass.
@@ -2788,249 +4301,55 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 		//-----------------------------------------------------------------------------------------------------------
 		// Prepare Clustered Lighting.
 		//-----------------------------------------------------------------------------------------------------------
-		memset(clusterData.tempCellLightCount, 0, sizeof(clusterData.tempCellLightCount));
-		memset(clusterData.offsetList, 0, sizeof(clusterData.offsetList));
-		clusterData.itemListCount = 0;
-		clusterData.lightListCount = 0;
-
-		for (int i = 0; i < world.lightCount; ++i)
-		{
-			world.lights[i].clusterId = -1;
-		}
-
 		mat4 tempProj = glm::perspective(glm::radians(50.0f), (float)gWidth / gHeight, pNear, pFar);
-		mat4 tempInvProj = glm::inverse(tempProj);
-		mat4 tempView = view;
-
-		vec4 ndcNearPointB = tempInvProj * vec4(-1.0f, -1.0f, -1.0f, 1.0);
-		vec4 ndcNearPointT = tempInvProj * vec4(-1.0f, 1.0f, -1.0f, 1.0);
+		vsLightBinView<vsClusterGridMain> lightBinView;
+		LightBinViewCreate(&lightBinView, view, glm::inverse(tempProj));
 
-		// NOTE: We swap stuff because we are using an inverted Z.
-		ndcNearPointB.z = -ndcNearPointB.z;
-		ndcNearPointB.x = -ndcNearPointB.x;
-		ndcNearPointT.z = -ndcNearPointT.z;
-		ndcNearPointT.x = -ndcNearPointT.x;
+		double lightClusterTime = GetTime();
+		vsLightFrustum lightFrustum;
+		LightFrustumCreate(&lightFrustum, tempProj * view);
+		i32 visibleLightCount = LightStoreCullFrustum(&world.lights, &lightFrustum);
 
-		vec3 frustumRay[] =
+		if (input.gpuLightBinning)
 		{
-			glm::normalize(vec3(ndcNearPointB)),
-			glm::normalize(vec3(ndcNearPointT)),
-			glm::normalize(vec3(ndcNearPointT) * vec3(-1, 1, 1)),
-			glm::normalize(vec3(ndcNearPointB) * vec3(-1, 1, 1)),
-		};
-
-		vec2 depthSliceScale[24];
-
-		for (int i = 0; i < 24; ++i)
+			UploadGpuLights(world.lights.candidates, visibleLightCount, world.lights.staticCandidateCount, world.lights.staticCandidateVersion);
+			DispatchGpuLightBinning(&lightBinView, world.lights.candidates, visibleLightCount, input.clusterActivation);
+			lightClusterTime = GetTime() - lightClusterTime;
+		}
+		else
 		{
-			float depthZ = GetClusterDepthSlice((float)i);
+			vsClusterUploadFrame* uploadFrame = BeginClusterUploadFrame(visibleLightCount);
 
-			vec3 cornerMax = frustumRay[1] * (-(depthZ) / (glm::dot(frustumRay[1], vec3(0, 0, -1))));
-			vec3 cornerMin = frustumRay[3] * (-(depthZ) / (glm::dot(frustumRay[3], vec3(0, 0, -1))));
+			if (input.clusterActivation)
+				ReadClusterActivation();
 
-			depthSliceScale[i] = (vec2(cornerMax) - vec2(cornerMin));
+			u8* activeCells = input.clusterActivation ? clusterActivation.activeCells : NULL;
+			BinLights(&lightBinner, &lightBinView, world.lights.candidates, visibleLightCount, &clusterData.bins, world.lights.staticCandidateCount, world.lights.staticCandidateVersion, activeCells);
+			EndClusterUploadFrame(uploadFrame);
+			lightClusterTime = GetTime() - lightClusterTime;
+			//std::cout << "Item Count: " << clusterData.bins.itemListCount << " Light Count: " << clusterData.bins.lightListCount << " Highest: " << clusterData.bins.highestLightsInCell << " " << (lightClusterTime * 1000) << "ms\n";
 		}
 
-		double lightClusterTime = GetTime();
-		// Per Light
-		for (int wl = 0; wl < world.lightCount; ++wl)
+		if (input.clusterStats)
 		{
-			vec3 lightPos = world.lights[wl].position;
-			float lightRadius = world.lights[wl].radius;
-			uint16_t lightId = wl;
-			vec3 lightViewSpace = vec3(tempView * vec4(lightPos, 1.0f));
-			lightViewSpace.z = -lightViewSpace.z;
-
-			int lightMinCX = 16;
-			int lightMaxCX = 0;
-			int lightMinCY = 8;
-			int lightMaxCY = 0;
-			int lightMinCZ = (int)GetClustedDepthSliceFromPos(max(lightViewSpace.z - lightRadius, 0.5f));
-			int lightMaxCZ = (int)GetClustedDepthSliceFromPos(max(lightViewSpace.z + lightRadius, 0.5f));
-
-			//std::cout << "X: " << lightMinCX << "," << lightMaxCX << "Y: " << lightMinCY << "," << lightMaxCY << " Z: " << lightMinCZ << "," << lightMaxCZ << "\n";
-
-			for (int dS = lightMinCZ; dS <= lightMaxCZ; ++dS)
-			{
-				float depthZ1 = GetClusterDepthSlice((float)dS);
-				float depthZ2 = GetClusterDepthSlice((float)(dS + 1));
-
-				float r1 = ProjectSphereToPlane(vec3(0, 0, 1), depthZ1, lightViewSpace, lightRadius);
-				float r2 = ProjectSphereToPlane(vec3(0, 0, 1), depthZ2, lightViewSpace, lightRadius);
-
-				// Take the bigger of the 2, or original if both -1
-				// Project the biggest to BOTH surrounding Z slices, get real bounds
+			input.clusterStats = false;
 
-				if (dS == (int)GetClustedDepthSliceFromPos(lightViewSpace.z))
-					r1 = lightRadius;
-				else
-					r1 = max(r1, r2);
-
-				glColor3f(1, 0, 0);
-
-				if (r1 != -1)
-				{
-					/*
-					for (int i = 0; i < circleRes; ++i)
-					{
-					vec2 a, b;
-
-					a.x = (sin((glm::pi<float>() * 2.0f) / circleRes * i)) * r1;
-					a.y = (cos((glm::pi<float>() * 2.0f) / circleRes * i)) * r1;
+			if (input.gpuLightBinning || !input.clusterActivation)
+				ReadClusterActivation();
 
-					b.x = (sin((glm::pi<float>() * 2.0f) / circleRes * (i + 1))) * r1;
-					b.y = (cos((glm::pi<float>() * 2.0f) / circleRes * (i + 1))) * r1;
+			std::cout << "Active cells: " << clusterActivation.activeCellCount << " of " << CLUSTER_CELL_COUNT << " (" << (clusterActivation.activeCellCount * 100.0f / CLUSTER_CELL_COUNT) << "%)";
 
-					glVertex3f(lightViewSpace.x + a.x, lightViewSpace.y + a.y, depthZ1);
-					glVertex3f(lightViewSpace.x + b.x, lightViewSpace.y + b.y, depthZ1);
-					}
-					*/
-
-					// We need to get the max bounds of both depth slices
-					// Convert to depth space (-0.5 to 0.5) then shift to (0 to 1)
-					vec2 nMinVS = vec2(lightViewSpace) - r1;
-					vec2 nMaxVS = vec2(lightViewSpace) + r1;
-
-					// NOTE: Clamping slightily within bounds to prevent overflow in clusters.
-					//vec2 minVS0 = glm::clamp(nMinVS / depthSliceScale[dS] + 0.5f, 0.01f, 0.99f);
-					//vec2 maxVS0 = glm::clamp(nMaxVS / depthSliceScale[dS] + 0.5f, 0.01f, 0.99f);
-
-					//vec2 minVS1 = glm::clamp(nMinVS / depthSliceScale[dS + 1] + 0.5f, 0.01f, 0.99f);
-					//vec2 maxVS1 = glm::clamp(nMaxVS / depthSliceScale[dS + 1] + 0.5f, 0.01f, 0.99f);
-
-					vec2 minVS0 = nMinVS / depthSliceScale[dS] + 0.5f;
-					vec2 maxVS0 = nMaxVS / depthSliceScale[dS] + 0.5f;
-
-					vec2 minVS1 = nMinVS / depthSliceScale[dS + 1] + 0.5f;
-					vec2 maxVS1 = nMaxVS / depthSliceScale[dS + 1] + 0.5f;
-
-					// TODO: Always a min extent regsitered on left if light is offscreen on left?
-					// TODO: Back plane has one extent, front plane has the other
-					minVS0.x = min(minVS0.x, minVS1.x);
-					minVS0.y = min(minVS0.y, minVS1.y);
-
-					maxVS0.x = max(maxVS0.x, maxVS1.x);
-					maxVS0.y = max(maxVS0.y, maxVS1.y);
-
-					int startCellX = (int)(minVS0.x * 16.0f);
-					int startCellY = (int)(minVS0.y * 8.0f);
-					int endCellX = (int)(maxVS0.x * 16.0f) + 1;
-					int endCellY = (int)(maxVS0.y * 8.0f) + 1;
-
-					if (startCellX < 0) startCellX = 0;
-					if (startCellX > 16) startCellX = 16;
-					if (startCellY < 0) startCellY = 0;
-					if (startCellY > 8) startCellY = 8;
-
-					if (endCellX < 0) endCellX = 0;
-					if (endCellX > 16) endCellX = 16;
-					if (endCellY < 0) endCellY = 0;
-					if (endCellY > 8) endCellY = 8;
-
-					/*
-					minVS0 = (minVS0 - 0.5f) * depthSliceScale[dS];
-					maxVS0 = (maxVS0 - 0.5f) * depthSliceScale[dS];
-					glColor3f(0, 1, 1);
-					glVertex3f(minVS0.x, minVS0.y, depthZ1); glVertex3f(maxVS0.x, minVS0.y, depthZ1);
-					glVertex3f(maxVS0.x, minVS0.y, depthZ1); glVertex3f(maxVS0.x, maxVS0.y, depthZ1);
-					glVertex3f(maxVS0.x, maxVS0.y, depthZ1); glVertex3f(minVS0.x, maxVS0.y, depthZ1);
-					glVertex3f(minVS0.x, maxVS0.y, depthZ1); glVertex3f(minVS0.x, minVS0.y, depthZ1);
-					*/
-
-					for (int cX = startCellX; cX < endCellX; ++cX)
-					{
-						for (int cY = startCellY; cY < endCellY; ++cY)
-						{
-							// Add light to cluster
-							int cellIdx = dS * (16 * 8) + cY * 16 + cX;
-							assert(cellIdx < (16 * 8 * 24));
-							int lightIdxInCell = clusterData.tempCellLightCount[cellIdx];
-							assert(lightIdxInCell < 256);
-
-							clusterData.tempCellLights[cellIdx * 256 + lightIdxInCell] = lightId;
-							++clusterData.tempCellLightCount[cellIdx];
-
-							//offsetList[dS * (16 * 8) + cY * 16 + cX].itemOffset = 0;
-							//offsetList[dS * (16 * 8) + cY * 16 + cX].lightCount = 1;
-
-							/*
-							vec2 cellMin(cX * 1.0f / 16.0f, cY * 1.0f / 8.0f);
-							vec2 cellMax((cX + 1) * (1.0f / 16.0f), (cY + 1) * 1.0f / 8.0f);
-
-							cellMin = (cellMin - 0.5f) * depthSliceScale[dS];
-							cellMax = (cellMax - 0.5f) * depthSliceScale[dS];
-
-							glColor3f(0, 1, 0);
-							glVertex3f(cellMin.x, cellMin.y, depthZ1); glVertex3f(cellMax.x, cellMin.y, depthZ1);
-							glVertex3f(cellMax.x, cellMin.y, depthZ1); glVertex3f(cellMax.x, cellMax.y, depthZ1);
-							glVertex3f(cellMax.x, cellMax.y, depthZ1); glVertex3f(cellMin.x, cellMax.y, depthZ1);
-							glVertex3f(cellMin.x, cellMax.y, depthZ1); glVertex3f(cellMin.x, cellMin.y, depthZ1);
-							*/
-						}
-					}
-				}
+			if (input.gpuLightBinning)
+			{
+				std::cout << " GPU items: " << gpuLightBinner.itemsNeeded << "\n";
 			}
-		}
-
-		int highestLightsInCell = 0;
-
-		for (int i = 0; i < 16 * 8 * 24; ++i)
-		{
-			int cellLightCount = clusterData.tempCellLightCount[i];
-
-			if (cellLightCount > 0)
+			else
 			{
-				clusterData.offsetList[i].lightCount = cellLightCount;
-				clusterData.offsetList[i].itemOffset = clusterData.itemListCount;
-
-				if (cellLightCount > highestLightsInCell)
-					highestLightsInCell = cellLightCount;
-
-				for (int j = 0; j < cellLightCount; ++j)
-				{
-					vsLight* worldLight = &world.lights[clusterData.tempCellLights[i * 256 + j]];
-
-					if (worldLight->clusterId == -1)
-					{
-						clusterData.lightList[clusterData.lightListCount].position = worldLight->position;
-						clusterData.lightList[clusterData.lightListCount].radius = worldLight->radius;
-						clusterData.lightList[clusterData.lightListCount].color = vec4(worldLight->color, 0);
-
-						worldLight->clusterId = clusterData.lightListCount++;
-					}
-
-					clusterData.itemList[clusterData.itemListCount++] = worldLight->clusterId;
-				}
+				i32 allItems = clusterData.bins.itemListCount + clusterData.bins.inactiveItemCount;
+				std::cout << " Items: " << clusterData.bins.itemListCount << " of " << allItems << " (" << (allItems ? clusterData.bins.inactiveItemCount * 100.0f / allItems : 0.0f) << "% skipped)\n";
 			}
 		}
 
-		lightClusterTime = GetTime() - lightClusterTime;
-		//std::cout << "Item Count: " << clusterData.itemListCount << " Light Count: " << clusterData.lightListCount << " Highest: " << highestLightsInCell << " " << (lightClusterTime * 1000) << "ms\n";
-
-		// Upload cluster info
-		// TODO: Play nice with GPU sync.
-		// TODO: Use glMapBufferRange
-
-		// Upload entire offset list.
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterData.offsetListSSB);
-		void* uploadData = glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_WRITE_ONLY);
-		memcpy(uploadData, clusterData.offsetList, sizeof(clusterData.offsetList));
-		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-
-		// Upload max item list.
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterData.itemListSSB);
-		uploadData = glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_WRITE_ONLY);
-		memcpy(uploadData, clusterData.itemList, sizeof(uint32_t) * clusterData.itemListCount);
-		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
-		// Upload max light list.
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, clusterData.lightListSSB);
-		uploadData = glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_WRITE_ONLY);
-		memcpy(uploadData, clusterData.lightList, sizeof(ClusterLightListEntry) * clusterData.lightListCount);
-		glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-
 		// Debug
 		glUseProgram(simpleShaderProgram);
 		glUniformMatrix4fv(0, 1, GL_FALSE, (float*)&proj);
@@ -3041,8 +4360,8 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 		glBegin(GL_LINES);
 
 		/*
-		for (int i = 0; i < world.lightCount; ++i)
-			DrawSphereIM(world.lights[i].position, world.lights[i].radius, world.lights[i].color * 0.1f);
+		for (int i = 0; i < world.lights.candidateCount; ++i)
+			DrawSphereIM(world.lights.candidates[i].position, world.lights.candidates[i].radius, world.lights.candidates[i].color * 0.1f);
 		//*/
 
 		/*
@@ -3115,9 +4434,9 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 		glVertex3f(1, 1, 0); glVertex3f(-1, 1, 0);
 		glVertex3f(-1, 1, 0); glVertex3f(-1, -1, 0);
 
-		for (int i = 0; i < 24; ++i)
+		for (int i = 0; i < vsClusterGridMain::sizeZ; ++i)
 		{
-		float depthZ = GetClusterDepthSlice(i);
+		float depthZ = vsClusterGridMain::GetDepthSlice(i);
 
 		vec3 corner[] =
 		{
@@ -3208,7 +4527,7 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 		// Upload Pages.
 		//-----------------------------------------------------------------------------------------------------------
 		bool updatedPageCache = false;
-		i32 pagesToUploadMax = 16;
+		i32 pagesToUploadMax = GPU_TRANSCODE_PAGES_MAX;
 
 		if (input.purgeCache)
 		{
@@ -3225,6 +4544,7 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 				}
 
 				vtCache.cachePageMap[i] = NULL;
+				vtCache.sourcePageMap[i] = NULL;
 			}
 
 			vtCache.pageCount = 0;
@@ -3278,6 +4598,26 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 				{
 					// TODO: If the page is marked as rejected then ignore and kill page.
 
+					// Find the page we duplicate before its slot can be recycled.
+					i32 copyCacheX = -1;
+					i32 copyCacheY = -1;
+
+					if (fileJob.copyPage)
+					{
+						vsCachePage* sourcePage = GetResidentSourcePage(&vtCache, cachePage->sourceOffset);
+
+						if (sourcePage == NULL)
+						{
+							// NOTE: Source was evicted while in flight, drop the page so feedback requests it again.
+							RemoveCachePage(&vtCache, cachePage);
+							delete cachePage;
+							continue;
+						}
+
+						copyCacheX = sourcePage->cacheX;
+						copyCacheY = sourcePage->cacheY;
+					}
+
 					updatedPageCache = true;
 					vsCachePage* removedPage = NULL;
 
@@ -3317,38 +4657,63 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 						RemoveCachePage(&vtCache, removedPage);
 					}
 
-					// Allocate new memory for upload page, prevents GPU stall while using old data.
-					// TODO: But can this get out of hand?
-					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pageCachePBO);
-					glBufferData(GL_PIXEL_UNPACK_BUFFER, 128 * 128 * 2, NULL, GL_STREAM_DRAW);
-					uint32_t* pcuData = (uint32_t*)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-
-					if (pcuData)
+					if (fileJob.copyPage)
 					{
-						if (fileJob.data)
+						// NOTE: Source may have been evicted for this page, then the slot already holds the data.
+						if (copyCacheX != cachePage->cacheX || copyCacheY != cachePage->cacheY)
 						{
-							memcpy(pcuData, fileJob.data, 128 * 128 * 2);
-							delete[] fileJob.data;
+							// Source could still be waiting in the GPU batch.
+							FlushGpuTranscode(pageCacheChannel0, pageCacheChannel1);
+
+							glCopyImageSubData(pageCacheChannel0, GL_TEXTURE_2D, 0, copyCacheX * 128, copyCacheY * 128, 0, pageCacheChannel0, GL_TEXTURE_2D, 0, cachePage->cacheX * 128, cachePage->cacheY * 128, 0, 128, 128, 1);
+							glCopyImageSubData(pageCacheChannel1, GL_TEXTURE_2D, 0, copyCacheX * 128, copyCacheY * 128, 0, pageCacheChannel1, GL_TEXTURE_2D, 0, cachePage->cacheX * 128, cachePage->cacheY * 128, 0, 128, 128, 1);
 						}
-						else
+					}
+					else if (fileJob.blockStream)
+					{
+						QueueGpuTranscodePage(fileJob.data, cachePage->cacheX, cachePage->cacheY);
+						delete[] fileJob.data;
+					}
+					else
+					{
+						// Allocate new memory for upload page, prevents GPU stall while using old data.
+						// TODO: But can this get out of hand?
+						glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pageCachePBO);
+						glBufferData(GL_PIXEL_UNPACK_BUFFER, 128 * 128 * 2, NULL, GL_STREAM_DRAW);
+						uint32_t* pcuData = (uint32_t*)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+
+						if (pcuData)
 						{
-							memcpy(pcuData, noPageFoundData, 128 * 128);
-						}
+							if (fileJob.data)
+							{
+								memcpy(pcuData, fileJob.data, 128 * 128 * 2);
+								delete[] fileJob.data;
+							}
+							else if (fileJob.constantPage)
+							{
+								FillConstantPageDXT((u8*)pcuData, fileJob.constantColors);
+							}
+							else
+							{
+								memcpy(pcuData, noPageFoundData, 128 * 128);
+							}
 
-						glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-					}
+							glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+						}
 
-					//glBindBuffer(GL_PIXEL_UNPACK_BUFFER, transOutputSBO);
+						glBindTexture(GL_TEXTURE_2D, pageCacheChannel0);
+						// TODO: Check why this returns an error?
+						glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, cachePage->cacheX * 128, cachePage->cacheY * 128, 128, 128, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 128 * 128, 0);
 
-					glBindTexture(GL_TEXTURE_2D, pageCacheChannel0);
-					// TODO: Check why this returns an error?
-					glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, cachePage->cacheX * 128, cachePage->cacheY * 128, 128, 128, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 128 * 128, 0);
+						glBindTexture(GL_TEXTURE_2D, pageCacheChannel1);
+						glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, cachePage->cacheX * 128, cachePage->cacheY * 128, 128, 128, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 128 * 128, (void*)(128 * 128));
 
-					glBindTexture(GL_TEXTURE_2D, pageCacheChannel1);
-					glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, cachePage->cacheX * 128, cachePage->cacheY * 128, 128, 128, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 128 * 128, (void*)(128 * 128));
+						glBindTexture(GL_TEXTURE_2D, 0);
+						glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+					}
 
-					glBindTexture(GL_TEXTURE_2D, 0);
-					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+					if (cachePage->sourceOffset != -1)
+						AddResidentSourcePage(&vtCache, cachePage);
 
 					if (removedPage != NULL)
 					{
@@ -3360,6 +4725,8 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 				}
 				//std::cout << "Process Job in " << (lz4Time * 1000.0) << "ms\n";
 			}
+
+			FlushGpuTranscode(pageCacheChannel0, pageCacheChannel1);
 		}
 
 		/*
@@ -3654,12 +5021,12 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 
 		glBindVertexArray(sphereVAO);
 		
-		for (int i = 0; i < world.lightCount; ++i)
+		for (int i = 0; i < world.lights.candidateCount; ++i)
 		{
-			model = glm::translate(mat4(), world.lights[i].position);
+			model = glm::translate(mat4(), world.lights.candidates[i].position);
 			model = glm::scale(model, vec3(0.001f, 0.001f, 0.001f));
 			glUniformMatrix4fv(2, 1, GL_FALSE, (float*)&model);
-			vec3 col = world.lights[i].color;
+			vec3 col = world.lights.candidates[i].color;
 			glUniform4f(4, col.x, col.y, col.z, 0);
 			glDrawElements(GL_TRIANGLES, sphereIndexCount, GL_UNSIGNED_SHORT, 0);
 		}
@@ -3908,6 +5275,11 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 		*/
 
+		//-----------------------------------------------------------------------------------------------------------
+		// Cluster Activation.
+		//-----------------------------------------------------------------------------------------------------------
+		DispatchClusterActivation(hdrFrameBufferDepthStencil, pNear, pFar);
+
 		//-----------------------------------------------------------------------------------------------------------
 		// SSAO Pass.
 		//-----------------------------------------------------------------------------------------------------------
@@ -4155,6 +5527,8 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 		glBindVertexArray(0);
 		glBindTexture(GL_TEXTURE_2D, 0);
 		
+		FenceClusterUploadFrame();
+
 		//-----------------------------------------------------------------------------------------------------------
 		// Swap to screen.
 		//-----------------------------------------------------------------------------------------------------------
@@ -4166,6 +5540,10 @@ int WINAPI WinMain(HINSTANCE HInstance, HINSTANCE HPrevInstance, LPSTR LPCmdLine
 	//-----------------------------------------------------------------------------------------------------------
 	// TODO: Destroy all the things!
 
+	// Join the job system workers rather than leave them blocked while the process exits.
+	LightBinnerFree(&lightBinner);
+	JobSystemShutdown(&jobSystem);
+
 	wglMakeCurrent(NULL, NULL);
 	wglDeleteContext(glContext);
 
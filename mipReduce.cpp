@@ -0,0 +1,398 @@
+#include "mipReduce.h"
+
+#include <math.h>
+#include <string.h>
+#include <thread>
+
+#if defined(_MSC_VER) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MIP_ENABLE_SSE2
+#endif
+
+//-----------------------------------------------------------------------------------------------------------
+// Tables.
+//-----------------------------------------------------------------------------------------------------------
+// NOTE: Linear to sRGB goes through a 16 bit table, fine enough that even the darkest codes round correctly.
+#define MIP_LINEAR_TABLE_SIZE	65536
+#define MIP_KAISER_TAPS			8
+// NOTE: The sRGB box sums four 20 bit linear values, shifting the sum down by 6 indexes a 16 bit table.
+#define MIP_BOX_LINEAR_SCALE	1048560
+#define MIP_BOX_SUM_SHIFT		6
+
+struct vsMipTables
+{
+	f32	srgbToLinear[256];
+	f32	unormToFloat[256];
+	u8	linearToSrgb[MIP_LINEAR_TABLE_SIZE];
+	u32	srgbToLinearBox[256];
+	u8	boxSumToSrgb[MIP_LINEAR_TABLE_SIZE];
+	f32	kaiserWeights[MIP_KAISER_TAPS];
+
+	vsMipTables()
+	{
+		for (i32 i = 0; i < 256; ++i)
+		{
+			f32 c = i / 255.0f;
+			srgbToLinear[i] = (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+			unormToFloat[i] = c;
+			srgbToLinearBox[i] = (u32)(srgbToLinear[i] * MIP_BOX_LINEAR_SCALE + 0.5f);
+		}
+
+		for (i32 i = 0; i < MIP_LINEAR_TABLE_SIZE; ++i)
+		{
+			linearToSrgb[i] = LinearToSrgb(i / (f32)(MIP_LINEAR_TABLE_SIZE - 1));
+			boxSumToSrgb[i] = LinearToSrgb((f32)((f64)(i << MIP_BOX_SUM_SHIFT) / (4.0 * MIP_BOX_LINEAR_SCALE)));
+		}
+
+		// Kaiser windowed sinc for 2:1 decimation, taps sit at half texel distances from the output centre.
+		const f64 beta = 4.0;
+		f64 total = 0.0;
+
+		for (i32 i = 0; i < MIP_KAISER_TAPS; ++i)
+		{
+			f64 d = i - (MIP_KAISER_TAPS / 2) + 0.5;
+			f64 x = d * 0.5 * 3.14159265358979;
+			f64 sinc = sin(x) / x;
+			f64 w = d / (MIP_KAISER_TAPS / 2);
+			f64 window = BesselI0(beta * sqrt(1.0 - w * w)) / BesselI0(beta);
+
+			kaiserWeights[i] = (f32)(sinc * window);
+			total += kaiserWeights[i];
+		}
+
+		for (i32 i = 0; i < MIP_KAISER_TAPS; ++i)
+			kaiserWeights[i] = (f32)(kaiserWeights[i] / total);
+	}
+
+	static u8 LinearToSrgb(f32 L)
+	{
+		f32 c = (L <= 0.0031308f) ? L * 12.92f : 1.055f * powf(L, 1.0f / 2.4f) - 0.055f;
+		return (u8)(c * 255.0f + 0.5f);
+	}
+
+	static f64 BesselI0(f64 X)
+	{
+		f64 sum = 1.0;
+		f64 term = 1.0;
+
+		for (i32 k = 1; k < 32; ++k)
+		{
+			term *= (X * 0.5 / k) * (X * 0.5 / k);
+			sum += term;
+		}
+
+		return sum;
+	}
+};
+
+static const vsMipTables& MipGetTables()
+{
+	static vsMipTables tables;
+	return tables;
+}
+
+__forceinline i32 MipClamp(i32 Value, i32 Min, i32 Max)
+{
+	return Value < Min ? Min : (Value > Max ? Max : Value);
+}
+
+__forceinline u8 MipEncode(const vsMipTables& Tables, f32 Value, bool SRGB)
+{
+	Value = Value < 0.0f ? 0.0f : (Value > 1.0f ? 1.0f : Value);
+
+	if (SRGB)
+		return Tables.linearToSrgb[(i32)(Value * (MIP_LINEAR_TABLE_SIZE - 1) + 0.5f)];
+
+	return (u8)(Value * 255.0f + 0.5f);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Box.
+//-----------------------------------------------------------------------------------------------------------
+static void MipBoxRowLinear(u8* SrcRow0, u8* SrcRow1, u8* DstRow, i32 DstWidth)
+{
+	i32 x = 0;
+
+#ifdef MIP_ENABLE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi16(2);
+
+	// 4 source pixels of each row make 2 output pixels.
+	for (; x + 2 <= DstWidth; x += 2)
+	{
+		__m128i r0 = _mm_loadu_si128((__m128i*)(SrcRow0 + x * 8));
+		__m128i r1 = _mm_loadu_si128((__m128i*)(SrcRow1 + x * 8));
+
+		__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(r0, zero), _mm_unpacklo_epi8(r1, zero));
+		__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(r0, zero), _mm_unpackhi_epi8(r1, zero));
+
+		lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+		hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+
+		__m128i sum = _mm_unpacklo_epi64(lo, hi);
+		sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+
+		_mm_storel_epi64((__m128i*)(DstRow + x * 4), _mm_packus_epi16(sum, sum));
+	}
+#endif
+
+	for (x *= 4; x < DstWidth * 4; ++x)
+	{
+		i32 c = x & 3;
+		i32 sx = (x >> 2) * 8 + c;
+		DstRow[x] = (u8)((SrcRow0[sx] + SrcRow0[sx + 4] + SrcRow1[sx] + SrcRow1[sx + 4] + 2) >> 2);
+	}
+}
+
+// NOTE: Only the colour goes through linear light, alpha matches the linear box exactly. Colour sums fixed point
+// linear values so every path rounds the same, SSE2 has no gather so the table reads stay scalar.
+static void MipBoxRowSRGB(const vsMipTables& Tables, u8* SrcRow0, u8* SrcRow1, u8* DstRow, i32 DstWidth)
+{
+	const u32* decode = Tables.srgbToLinearBox;
+	const u32 round = 1 << (MIP_BOX_SUM_SHIFT - 1);
+	i32 x = 0;
+
+#ifdef MIP_ENABLE_SSE2
+	const __m128i roundSum = _mm_set1_epi32(round);
+
+	for (; x < DstWidth; ++x)
+	{
+		u8* p0 = SrcRow0 + x * 8;
+		u8* p1 = SrcRow1 + x * 8;
+		u8* dst = DstRow + x * 4;
+
+		__m128i sum = _mm_setr_epi32(decode[p0[0]], decode[p0[1]], decode[p0[2]], 0);
+		sum = _mm_add_epi32(sum, _mm_setr_epi32(decode[p0[4]], decode[p0[5]], decode[p0[6]], 0));
+		sum = _mm_add_epi32(sum, _mm_setr_epi32(decode[p1[0]], decode[p1[1]], decode[p1[2]], 0));
+		sum = _mm_add_epi32(sum, _mm_setr_epi32(decode[p1[4]], decode[p1[5]], decode[p1[6]], 0));
+		sum = _mm_srli_epi32(_mm_add_epi32(sum, roundSum), MIP_BOX_SUM_SHIFT);
+
+		u32 index[4];
+		_mm_storeu_si128((__m128i*)index, sum);
+
+		dst[0] = Tables.boxSumToSrgb[index[0]];
+		dst[1] = Tables.boxSumToSrgb[index[1]];
+		dst[2] = Tables.boxSumToSrgb[index[2]];
+		dst[3] = (u8)((p0[3] + p0[7] + p1[3] + p1[7] + 2) >> 2);
+	}
+#endif
+
+	for (; x < DstWidth; ++x)
+	{
+		u8* p0 = SrcRow0 + x * 8;
+		u8* p1 = SrcRow1 + x * 8;
+		u8* dst = DstRow + x * 4;
+
+		for (i32 c = 0; c < 3; ++c)
+		{
+			u32 sum = decode[p0[c]] + decode[p0[c + 4]] + decode[p1[c]] + decode[p1[c + 4]];
+			dst[c] = Tables.boxSumToSrgb[(sum + round) >> MIP_BOX_SUM_SHIFT];
+		}
+
+		dst[3] = (u8)((p0[3] + p0[7] + p1[3] + p1[7] + 2) >> 2);
+	}
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Kaiser.
+//-----------------------------------------------------------------------------------------------------------
+// Source rows are decoded to floats once, each is read by up to four output rows.
+static void MipDecodeRow(const vsMipTables& Tables, u8* SrcRow, i32 SrcWidth, bool SRGB, f32* Row)
+{
+	const f32* colourTable = SRGB ? Tables.srgbToLinear : Tables.unormToFloat;
+
+	for (i32 x = 0; x < SrcWidth; ++x)
+	{
+		Row[x * 4 + 0] = colourTable[SrcRow[x * 4 + 0]];
+		Row[x * 4 + 1] = colourTable[SrcRow[x * 4 + 1]];
+		Row[x * 4 + 2] = colourTable[SrcRow[x * 4 + 2]];
+		Row[x * 4 + 3] = Tables.unormToFloat[SrcRow[x * 4 + 3]];
+	}
+}
+
+// Vertical pass into a float row of the full source width, 4 floats per pixel.
+static void MipKaiserColumn(const vsMipTables& Tables, f32** Rows, i32 SrcWidth, f32* Column)
+{
+	i32 i = 0;
+	i32 count = SrcWidth * 4;
+
+#ifdef MIP_ENABLE_SSE2
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 acc = _mm_setzero_ps();
+
+		for (i32 t = 0; t < MIP_KAISER_TAPS; ++t)
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(Rows[t] + i), _mm_set1_ps(Tables.kaiserWeights[t])));
+
+		_mm_storeu_ps(Column + i, acc);
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		f32 acc = 0.0f;
+
+		for (i32 t = 0; t < MIP_KAISER_TAPS; ++t)
+			acc += Rows[t][i] * Tables.kaiserWeights[t];
+
+		Column[i] = acc;
+	}
+}
+
+static void MipKaiserRow(const vsMipTables& Tables, f32* Column, i32 SrcWidth, u8* DstRow, i32 DstWidth, bool SRGB)
+{
+	for (i32 x = 0; x < DstWidth; ++x)
+	{
+		f32 acc[4];
+
+#ifdef MIP_ENABLE_SSE2
+		__m128 sum = _mm_setzero_ps();
+
+		for (i32 t = 0; t < MIP_KAISER_TAPS; ++t)
+		{
+			i32 sx = MipClamp(x * 2 - (MIP_KAISER_TAPS / 2 - 1) + t, 0, SrcWidth - 1);
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(Column + sx * 4), _mm_set1_ps(Tables.kaiserWeights[t])));
+		}
+
+		_mm_storeu_ps(acc, sum);
+#else
+		acc[0] = acc[1] = acc[2] = acc[3] = 0.0f;
+
+		for (i32 t = 0; t < MIP_KAISER_TAPS; ++t)
+		{
+			i32 sx = MipClamp(x * 2 - (MIP_KAISER_TAPS / 2 - 1) + t, 0, SrcWidth - 1);
+			f32 w = Tables.kaiserWeights[t];
+
+			for (i32 c = 0; c < 4; ++c)
+				acc[c] += Column[sx * 4 + c] * w;
+		}
+#endif
+
+		u8* dst = DstRow + x * 4;
+		dst[0] = MipEncode(Tables, acc[0], SRGB);
+		dst[1] = MipEncode(Tables, acc[1], SRGB);
+		dst[2] = MipEncode(Tables, acc[2], SRGB);
+		dst[3] = MipEncode(Tables, acc[3], false);
+	}
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Entry points.
+//-----------------------------------------------------------------------------------------------------------
+void MipReduceRowsRGBA8(u8* Src, i32 SrcWidth, i32 SrcHeight, i32 SrcY, u8* Dst, i32 DstY, i32 DstRowCount, vsMipFilter Filter, bool SRGB)
+{
+	const vsMipTables& tables = MipGetTables();
+	i32 dstWidth = SrcWidth / 2;
+	i32 srcPitch = SrcWidth * 4;
+
+	if (Filter == MIP_FILTER_BOX)
+	{
+		for (i32 y = 0; y < DstRowCount; ++y)
+		{
+			u8* srcRow0 = Src + (i64)((DstY + y) * 2 - SrcY) * srcPitch;
+			u8* srcRow1 = srcRow0 + srcPitch;
+			u8* dstRow = Dst + (i64)y * dstWidth * 4;
+
+			if (SRGB)
+				MipBoxRowSRGB(tables, srcRow0, srcRow1, dstRow, dstWidth);
+			else
+				MipBoxRowLinear(srcRow0, srcRow1, dstRow, dstWidth);
+		}
+
+		return;
+	}
+
+	f32* column = new f32[SrcWidth * 4];
+
+	// NOTE: Ring of decoded rows, a slot holds source row sy when sy % taps matches it.
+	f32* decodedRows[MIP_KAISER_TAPS];
+	i32 decodedRowIndex[MIP_KAISER_TAPS];
+
+	for (i32 t = 0; t < MIP_KAISER_TAPS; ++t)
+	{
+		decodedRows[t] = new f32[SrcWidth * 4];
+		decodedRowIndex[t] = -1;
+	}
+
+	for (i32 y = 0; y < DstRowCount; ++y)
+	{
+		f32* rows[MIP_KAISER_TAPS];
+
+		for (i32 t = 0; t < MIP_KAISER_TAPS; ++t)
+		{
+			i32 sy = MipClamp((DstY + y) * 2 - (MIP_KAISER_TAPS / 2 - 1) + t, 0, SrcHeight - 1);
+			i32 slot = sy % MIP_KAISER_TAPS;
+			assert(sy >= SrcY);
+
+			if (decodedRowIndex[slot] != sy)
+			{
+				MipDecodeRow(tables, Src + (i64)(sy - SrcY) * srcPitch, SrcWidth, SRGB, decodedRows[slot]);
+				decodedRowIndex[slot] = sy;
+			}
+
+			rows[t] = decodedRows[slot];
+		}
+
+		MipKaiserColumn(tables, rows, SrcWidth, column);
+		MipKaiserRow(tables, column, SrcWidth, Dst + (i64)y * dstWidth * 4, dstWidth, SRGB);
+	}
+
+	for (i32 t = 0; t < MIP_KAISER_TAPS; ++t)
+		delete[] decodedRows[t];
+
+	delete[] column;
+}
+
+void MipReduceRGBA8(u8* Src, i32 SrcWidth, i32 SrcHeight, u8* Dst, vsMipFilter Filter, bool SRGB, i32 ThreadCount)
+{
+	i32 dstWidth = SrcWidth / 2;
+	i32 dstHeight = SrcHeight / 2;
+
+	if (ThreadCount <= 0)
+		ThreadCount = GetMax((i32)std::thread::hardware_concurrency(), 1);
+
+	// NOTE: Small levels aren't worth the thread start up.
+	if ((i64)dstWidth * dstHeight < 256 * 256)
+		ThreadCount = 1;
+
+	ThreadCount = GetMin(ThreadCount, GetMax(dstHeight, 1));
+
+	if (ThreadCount == 1)
+	{
+		MipReduceRowsRGBA8(Src, SrcWidth, SrcHeight, 0, Dst, 0, dstHeight, Filter, SRGB);
+		return;
+	}
+
+	std::thread* threads = new std::thread[ThreadCount];
+	i32 rowsPerThread = (dstHeight + ThreadCount - 1) / ThreadCount;
+
+	for (i32 i = 0; i < ThreadCount; ++i)
+	{
+		i32 dstY = i * rowsPerThread;
+		i32 rowCount = GetMin(rowsPerThread, dstHeight - dstY);
+
+		if (rowCount <= 0)
+			break;
+
+		threads[i] = std::thread(MipReduceRowsRGBA8, Src, SrcWidth, SrcHeight, 0, Dst + (i64)dstY * dstWidth * 4, dstY, rowCount, Filter, SRGB);
+	}
+
+	for (i32 i = 0; i < ThreadCount; ++i)
+	{
+		if (threads[i].joinable())
+			threads[i].join();
+	}
+
+	delete[] threads;
+}
+
+const char* MipGetFilterName(vsMipFilter Filter)
+{
+	switch (Filter)
+	{
+		case MIP_FILTER_BOX: return "Box";
+		case MIP_FILTER_KAISER: return "Kaiser";
+	}
+
+	return "Unknown";
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "shared.h"
+
+enum vsMipFilter
+{
+	MIP_FILTER_BOX,
+	MIP_FILTER_KAISER,
+};
+
+// Source rows the filters read past the two rows under each output row, on either side.
+#define MIP_FILTER_MARGIN_ROWS 3
+
+// Halves an RGBA8 image, odd trailing rows and columns are dropped. ThreadCount 0 uses every core.
+// NOTE: SRGB filters the colour in linear light, alpha is always treated as linear data.
+void MipReduceRGBA8(u8* Src, i32 SrcWidth, i32 SrcHeight, u8* Dst, vsMipFilter Filter, bool SRGB, i32 ThreadCount = 0);
+
+// Produces DstRowCount rows of the halved image starting at DstY, Dst points at the first of them.
+// Src holds source rows from SrcY and must cover every row the filter reads, clamped to the image.
+void MipReduceRowsRGBA8(u8* Src, i32 SrcWidth, i32 SrcHeight, i32 SrcY, u8* Dst, i32 DstY, i32 DstRowCount, vsMipFilter Filter, bool SRGB);
+
+const char* MipGetFilterName(vsMipFilter Filter);
@@ -1,28 +1,59 @@
 #include "pageBuilder.h"
 #include "hdp.h"
+#include "mipReduce.h"
+#include "pageIndex.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #define STB_IMAGE_RESIZE_IMPLEMENTATION
 #include "stb_image_resize.h"
 
-struct vsTextureDef;
+struct vsImageDef;
 
 struct vsMipCacheEntry
 {
-	vsTextureDef*		texture;
+	vsImageDef*			image;
 	i32					mipLevel;
 	u8*					channel0Data;
 	u8*					channel1Data;
 	i32					imgWidth;
 	i32					imgHeight;
+	// NOTE: Streamed images are cached as bands of rows, other images as one band holding the whole level.
+	i32					bandY;
+	i32					bandHeight;
+	vsMipCacheEntry*	nextBand;
+	// NOTE: Channel 0 of a decoded level 0 belongs to the image loader.
+	bool				loaderOwned;
+	i64					memory;
+	// NOTE: Pinned entries are being read by a worker and can't be evicted.
+	i32					pinCount;
+	u64					lastUse;
 	vsMipCacheEntry*	next;
 };
 
 struct vsImageDef
 {
 	vsMipCacheEntry* mipCache[11];
+	// NOTE: Held while loading or resizing the image, building keeps the cache from evicting its entries meanwhile.
+	std::mutex lock;
+	bool building;
+	bool probed;
+	// NOTE: Streamed images are decoded in row bands and their mips are spilled to disk, only bands are cached.
+	bool streamed;
+	i32 spillLevel;
+	i32 width;
+	i32 height;
+	const char* name;
 	const char* bcFileName;
 	const char* nmFileName;
 	const char* mrFileName;
+	// NOTE: Content hashes of the bc, nm and mr source files.
+	u64 sourceHash[3];
 };
 
 struct vsTextureDef
@@ -31,11 +62,33 @@ struct vsTextureDef
 	i32 y;
 	i32 width;
 	i32 height;
+	i32 texelWidth;
+	i32 texelHeight;
 	vsImageDef* image;
+	// NOTE: Next texture held by the same quadtree node, -1 ends the list.
+	i32 nextInNode;
+};
+
+// Quadtree over the 1024x1024 page cells, a node at depth d is exactly one page of mip 10 - d.
+// NOTE: Textures live in the smallest node that fully holds them, nodes only exist where textures do.
+struct vsTextureQuadNode
+{
+	i32 x;
+	i32 y;
+	i32 size;
+	i32 firstTexture;
+	vsTextureQuadNode* children[4];
 };
 
-const i32 maxMipCacheSize = 32;
+// NOTE: Budget for unpinned entries, the cache can go over while every entry is in use.
+const i32 maxMipCacheSize = 1024;
 const i64 maxMipCacheMemory = 1024LL * 1024LL * 1024LL * 2LL; // 2GB
+// Sources bigger than this are streamed instead of decoded whole.
+const i64 maxInMemorySourcePixels = 8192LL * 8192LL;
+const i32 mipBandRows = 128;
+// NOTE: Channel 0 colour is sRGB and is filtered in linear light, everything else is data.
+const vsMipFilter pageMipFilter = MIP_FILTER_BOX;
+const i32 spillBandRows = 256;
 const i32 maxTextures = 65536;
 const i32 maxImages = 65536;
 
@@ -45,11 +98,227 @@ i32 imageCount = 0;
 vsTextureDef textures[maxTextures];
 i32 textureCount = 0;
 
-i16 textureIdTable[1024 * 1024];
+vsTextureQuadNode* textureQuadRoot = NULL;
+
+// Every file the builder writes goes here, spills included.
+char pageOutputDirectory[256] = "pages";
 
+// Everything below is guarded by mipCacheLock.
+std::mutex mipCacheLock;
 vsMipCacheEntry* mipCacheHead = NULL;
 i32 mipCacheCount = 0;
 i64 mipCacheMemory = 0;
+i64 mipCachePeakMemory = 0;
+u64 mipCacheUseCounter = 0;
+i32 mipCacheLoadCount = 0;
+i32 mipCacheEvictCount = 0;
+
+struct vsPageHashNode
+{
+	u64				hash;
+	i64				indexData;
+	// NOTE: Index entry of an unchanged page in the previous build, its bytes are copied across.
+	i64				previousIndexData;
+	bool			written;
+	bool			constant;
+	bool			encoded;
+	u32				constantColors[2];
+	// Page the node came from, composited again to check a hash match against it.
+	i32				mip;
+	i32				pageIndex;
+	u8*				encodedChannel0;
+	u8*				encodedChannel1;
+	i32				encodedSizeChannel0;
+	i32				encodedSizeChannel1;
+	vsPageHashNode*	next;
+};
+
+// A page looking for its node. The payloads are only composited for reused pages when a hash match has to
+// be checked.
+struct vsPageCandidate
+{
+	i32		pageIndex;
+	u64		hash;
+	bool	constant;
+	u32		colors[2];
+	i64		previousIndexData;
+	bool	payloadReady;
+	u8*		payloadChannel0;
+	u8*		payloadChannel1;
+
+	// Scratch for the page behind a matching hash.
+	u8*		compositeChannel0;
+	u8*		compositeChannel1;
+	i32*	pageTextures;
+	u8*		checkChannel0;
+	u8*		checkChannel1;
+};
+
+struct vsPageResult
+{
+	bool			ready;
+	bool			empty;
+	vsPageHashNode*	node;
+};
+
+const i32 pageHashBucketCount = 65536;
+// NOTE: Every page in the 11 level chain, so the constant table can't fill up.
+const i32 maxPages = 1398101;
+// NOTE: How far workers can run ahead of the writer, bounds the encoded pages waiting in memory.
+const i32 pageWindowPerWorker = 8;
+
+#define PAGE_MANIFEST_MAGIC		0x464D5456
+#define PAGE_MANIFEST_VERSION	2
+
+struct vsManifestTexture
+{
+	i32 x;
+	i32 y;
+	i32 width;
+	i32 height;
+	u64 sourceHash[3];
+};
+
+// Output of the last build, unchanged pages are taken from here instead of being encoded again.
+struct vsPreviousBuild
+{
+	FILE*	pageFile;
+	i64*	indexEntries;
+	u64*	pageHashes;
+	u8		xrHeader[XR_META_SIZE];
+	u32*	constantColors;
+	i32		constantCount;
+};
+
+struct vsPageWriter
+{
+	FILE*	indexFile;
+	FILE*	pageFile;
+	i64		pageFileOffset;
+	u8		xrHeader[XR_META_SIZE];
+
+	// NOTE: Payload hash to the first page seen with it, the first worker to insert a hash encodes it.
+	vsPageHashNode*	pageHashMap[pageHashBucketCount];
+
+	// NOTE: Channel 0 and channel 1 RGBA pairs.
+	u32*	constantColors;
+	i32		constantCount;
+
+	i32		encodedPageCount;
+	i32		constantPageCount;
+	i32		duplicatePageCount;
+	i32		reusedPageCount;
+
+	// NOTE: Payload hash of every page in index order, 0 for empty pages. Saved to the manifest.
+	u64*				pageHashes;
+	i32					pageBase;
+	vsPreviousBuild*	previous;
+	// Cells of the texture id table touched by a changed texture, and the pages of the current level over them.
+	u8*					dirtyCells;
+	u8*					dirtyPages;
+
+	// Current mip level, everything below is guarded by lock.
+	std::mutex				lock;
+	std::condition_variable	signal;
+	i32						mip;
+	i32						mipPages;
+	i32						pageCount;
+	i32						nextPage;
+	i32						writtenPage;
+	i32						pageWindow;
+	vsPageResult*			results;
+
+	u8*						mipTempChannel0;
+	u8*						mipTempChannel1;
+	u8*						finalMipChannel0[3];
+	u8*						finalMipChannel1[3];
+};
+
+void FreeTextureQuadNode(vsTextureQuadNode* Node)
+{
+	if (Node == NULL)
+		return;
+
+	for (i32 i = 0; i < 4; ++i)
+		FreeTextureQuadNode(Node->children[i]);
+
+	delete Node;
+}
+
+vsTextureQuadNode* CreateTextureQuadNode(i32 X, i32 Y, i32 Size)
+{
+	vsTextureQuadNode* node = new vsTextureQuadNode();
+	node->x = X;
+	node->y = Y;
+	node->size = Size;
+	node->firstTexture = -1;
+
+	return node;
+}
+
+void ClearTextureQuadTree()
+{
+	FreeTextureQuadNode(textureQuadRoot);
+	textureQuadRoot = CreateTextureQuadNode(0, 0, 1024);
+}
+
+void InsertTextureQuadTree(i32 TexIndex)
+{
+	vsTextureDef* t = &textures[TexIndex];
+	vsTextureQuadNode* node = textureQuadRoot;
+
+	while (node->size > 1)
+	{
+		i32 half = node->size / 2;
+		i32 midX = node->x + half;
+		i32 midY = node->y + half;
+		i32 quadrant;
+
+		if (t->x + t->width <= midX)
+			quadrant = 0;
+		else if (t->x >= midX)
+			quadrant = 1;
+		else
+			break;
+
+		if (t->y + t->height <= midY)
+			quadrant += 0;
+		else if (t->y >= midY)
+			quadrant += 2;
+		else
+			break;
+
+		if (node->children[quadrant] == NULL)
+			node->children[quadrant] = CreateTextureQuadNode((quadrant & 1) ? midX : node->x, (quadrant & 2) ? midY : node->y, half);
+
+		node = node->children[quadrant];
+	}
+
+	t->nextInNode = node->firstTexture;
+	node->firstTexture = TexIndex;
+}
+
+// Gathers up to MaxCount textures overlapping the cell rect [SX, EX) x [SY, EY), returns the new result count.
+i32 QueryTextureQuadTree(vsTextureQuadNode* Node, i32 SX, i32 SY, i32 EX, i32 EY, i32* Results, i32 Count, i32 MaxCount)
+{
+	for (i32 texIndex = Node->firstTexture; texIndex != -1 && Count < MaxCount; texIndex = textures[texIndex].nextInNode)
+	{
+		vsTextureDef* t = &textures[texIndex];
+
+		if (t->x < EX && t->x + t->width > SX && t->y < EY && t->y + t->height > SY)
+			Results[Count++] = texIndex;
+	}
+
+	for (i32 i = 0; i < 4 && Count < MaxCount; ++i)
+	{
+		vsTextureQuadNode* child = Node->children[i];
+
+		if (child && child->x < EX && child->x + child->size > SX && child->y < EY && child->y + child->size > SY)
+			Count = QueryTextureQuadTree(child, SX, SY, EX, EY, Results, Count, MaxCount);
+	}
+
+	return Count;
+}
 
 void AddTexture(i32 X, i32 Y, i32 Width, i32 Height, vsImageDef* Image)
 {
@@ -64,12 +333,29 @@ void AddTexture(i32 X, i32 Y, i32 Width, i32 Height, vsImageDef* Image)
 	tex.y = Y / 128;
 	tex.width = (Width + 127) / 128;
 	tex.height = (Height + 127) / 128;
+	tex.texelWidth = Width;
+	tex.texelHeight = Height;
 	tex.image = Image;
 
-	textures[textureCount++] = tex;
+	if (tex.x < 0 || tex.y < 0 || tex.x + tex.width > 1024 || tex.y + tex.height > 1024)
+	{
+		std::cout << "Texture " << Image->name << " is outside the virtual texture\n";
+		return;
+	}
+
+	i32 overlap;
+
+	if (QueryTextureQuadTree(textureQuadRoot, tex.x, tex.y, tex.x + tex.width, tex.y + tex.height, &overlap, 0, 1) > 0)
+	{
+		std::cout << "Texture " << Image->name << " overlaps " << textures[overlap].image->name << "\n";
+		return;
+	}
+
+	textures[textureCount] = tex;
+	InsertTextureQuadTree(textureCount++);
 }
 
-void AddImage(const char* BCFileName, const char* NMFileName, const char* MRFileName)
+void AddImage(const char* Name, const char* BCFileName, const char* NMFileName, const char* MRFileName)
 {
 	if (imageCount > maxImages)
 	{
@@ -77,14 +363,326 @@ void AddImage(const char* BCFileName, const char* NMFileName, const char* MRFile
 		return;
 	}
 
-	vsImageDef image = {};
-	image.bcFileName = BCFileName;
-	image.nmFileName = NMFileName;
-	image.mrFileName = MRFileName;
+	vsImageDef* image = &images[imageCount++];
+	image->name = Name;
+	image->bcFileName = BCFileName;
+	image->nmFileName = NMFileName;
+	image->mrFileName = MRFileName;
+	image->spillLevel = -1;
+}
+
+void AddMipCacheEntry(vsMipCacheEntry* Entry)
+{
+	Entry->memory = (i64)Entry->imgWidth * Entry->bandHeight * 8;
+
+	std::unique_lock<std::mutex> lock(mipCacheLock);
+	Entry->next = mipCacheHead;
+	mipCacheHead = Entry;
+	Entry->nextBand = Entry->image->mipCache[Entry->mipLevel];
+	Entry->image->mipCache[Entry->mipLevel] = Entry;
+
+	++mipCacheCount;
+	mipCacheMemory += Entry->memory;
+
+	if (mipCacheMemory > mipCachePeakMemory)
+		mipCachePeakMemory = mipCacheMemory;
+
+	if (Entry->mipLevel == 0 && !Entry->image->streamed)
+		++mipCacheLoadCount;
+}
+
+// NOTE: Caller must hold mipCacheLock.
+void RemoveMipCacheEntry(vsMipCacheEntry* Entry)
+{
+	vsMipCacheEntry** link = &mipCacheHead;
+
+	while (*link != Entry)
+		link = &(*link)->next;
+
+	*link = Entry->next;
+
+	vsMipCacheEntry** band = &Entry->image->mipCache[Entry->mipLevel];
+
+	while (*band != Entry)
+		band = &(*band)->nextBand;
+
+	*band = Entry->nextBand;
+
+	--mipCacheCount;
+	mipCacheMemory -= Entry->memory;
+
+	if (Entry->loaderOwned)
+		FreeImage(Entry->channel0Data);
+	else
+		delete[] Entry->channel0Data;
+
+	delete[] Entry->channel1Data;
+	delete Entry;
+}
+
+// Evicts the least recently used entries until the cache is back under budget.
+void TrimMipCache()
+{
+	std::unique_lock<std::mutex> lock(mipCacheLock);
+
+	while (mipCacheMemory > maxMipCacheMemory || mipCacheCount > maxMipCacheSize)
+	{
+		vsMipCacheEntry* oldest = NULL;
+
+		for (vsMipCacheEntry* entry = mipCacheHead; entry; entry = entry->next)
+		{
+			if (entry->pinCount == 0 && !entry->image->building && (oldest == NULL || entry->lastUse < oldest->lastUse))
+				oldest = entry;
+		}
+
+		if (oldest == NULL)
+			break;
+
+		RemoveMipCacheEntry(oldest);
+		++mipCacheEvictCount;
+	}
+}
+
+// Channel 0 holds the bc pixels and takes normal x as alpha, channel 1 is metal, roughness, unused and normal y.
+void PackSourceChannels(u8* Channel0, u8* Channel1, u8* NmData, u8* MrData, i32 TexelCount)
+{
+	for (i32 t = 0; t < TexelCount; ++t)
+	{
+		Channel0[t * 4 + 3] = NmData[t * 4 + 0];
+
+		Channel1[t * 4 + 0] = MrData[t * 4 + 0];
+		Channel1[t * 4 + 1] = MrData[t * 4 + 1];
+		Channel1[t * 4 + 2] = 0;
+		Channel1[t * 4 + 3] = NmData[t * 4 + 1];
+	}
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Streamed sources.
+//-----------------------------------------------------------------------------------------------------------
+// NOTE: Spill files hold one mip level of a streamed image, the channel 0 plane followed by the channel 1 plane.
+void GetPageFilePath(const char* Name, char* Path)
+{
+#ifdef _WIN32
+	sprintf(Path, "%s\\%s", pageOutputDirectory, Name);
+#else
+	sprintf(Path, "%s/%s", pageOutputDirectory, Name);
+#endif
+}
+
+void GetSpillFileName(vsImageDef* Image, i32 MipLevel, char* FileName)
+{
+	char name[64];
+	sprintf(name, "spill_%d_%d.raw", (i32)(Image - images), MipLevel);
+	GetPageFilePath(name, FileName);
+}
+
+void WriteSpillRows(FILE* File, i32 Width, i32 Height, i32 Y, i32 RowCount, u8* Channel0, u8* Channel1)
+{
+	i64 planeSize = (i64)Width * Height * 4;
+	i64 rowOffset = (i64)Y * Width * 4;
+
+	_fseeki64(File, rowOffset, SEEK_SET);
+	fwrite(Channel0, Width * RowCount * 4, 1, File);
+	_fseeki64(File, planeSize + rowOffset, SEEK_SET);
+	fwrite(Channel1, Width * RowCount * 4, 1, File);
+}
+
+void ReadSpillRows(FILE* File, i32 Width, i32 Height, i32 Y, i32 RowCount, u8* Channel0, u8* Channel1)
+{
+	i64 planeSize = (i64)Width * Height * 4;
+	i64 rowOffset = (i64)Y * Width * 4;
+
+	_fseeki64(File, rowOffset, SEEK_SET);
+	size_t readCount = fread(Channel0, Width * RowCount * 4, 1, File);
+	_fseeki64(File, planeSize + rowOffset, SEEK_SET);
+	readCount += fread(Channel1, Width * RowCount * 4, 1, File);
+	assert(readCount == 2);
+}
+
+void ProbeSourceImage(vsImageDef* Image)
+{
+	vsHdpImageReader* reader = HdpOpenImageReader(Image->bcFileName, &Image->width, &Image->height);
+	assert(reader);
+	HdpCloseImageReader(reader);
+
+	Image->streamed = ((i64)Image->width * Image->height > maxInMemorySourcePixels);
+	Image->probed = true;
+}
+
+// Decodes the sources a band at a time and spills the packed level 0.
+void SpillSourceImage(vsImageDef* Image)
+{
+	std::cout << "Streaming image data: " << Image->bcFileName << " " << Image->nmFileName << "\n";
+
+	i32 width = Image->width;
+	i32 height = Image->height;
+	i32 nmWidth, nmHeight, mrWidth, mrHeight;
+
+	vsHdpImageReader* bcReader = HdpOpenImageReader(Image->bcFileName, NULL, NULL);
+	vsHdpImageReader* nmReader = HdpOpenImageReader(Image->nmFileName, &nmWidth, &nmHeight);
+	vsHdpImageReader* mrReader = HdpOpenImageReader(Image->mrFileName, &mrWidth, &mrHeight);
+	assert(bcReader && nmReader && mrReader);
+
+	// NOTE: Shared maps like blank4k_nm can be bigger than the bc, the top left of them is used.
+	assert(nmWidth >= width && nmHeight >= height && mrWidth >= width && mrHeight >= height);
+
+	u8* channel0 = new u8[width * spillBandRows * 4];
+	u8* channel1 = new u8[width * spillBandRows * 4];
+	u8* nmData = new u8[nmWidth * spillBandRows * 4];
+	u8* mrData = new u8[mrWidth * spillBandRows * 4];
+
+	char fileName[512];
+	GetSpillFileName(Image, 0, fileName);
+	FILE* file = fopen(fileName, "wb");
+	assert(file);
+
+	for (i32 y = 0; y < height; y += spillBandRows)
+	{
+		i32 rows = GetMin(spillBandRows, height - y);
+
+		HdpReadImageRows(bcReader, y, rows, channel0);
+		HdpReadImageRows(nmReader, y, rows, nmData);
+		HdpReadImageRows(mrReader, y, rows, mrData);
+
+		for (i32 r = 0; r < rows; ++r)
+			PackSourceChannels(channel0 + r * width * 4, channel1 + r * width * 4, nmData + r * nmWidth * 4, mrData + r * mrWidth * 4, width);
+
+		WriteSpillRows(file, width, height, y, rows, channel0, channel1);
+	}
+
+	fclose(file);
+
+	HdpCloseImageReader(bcReader);
+	HdpCloseImageReader(nmReader);
+	HdpCloseImageReader(mrReader);
+
+	delete[] channel0;
+	delete[] channel1;
+	delete[] nmData;
+	delete[] mrData;
+
+	std::unique_lock<std::mutex> lock(mipCacheLock);
+	++mipCacheLoadCount;
+}
+
+// Spills the next level from the previous one a band at a time, the previous level is deleted after.
+void SpillMipLevel(vsImageDef* Image, i32 MipLevel)
+{
+	i32 srcWidth = Image->width >> (MipLevel - 1);
+	i32 srcHeight = Image->height >> (MipLevel - 1);
+	i32 width = srcWidth / 2;
+	i32 height = srcHeight / 2;
+
+	i32 srcBandRows = spillBandRows * 2 + MIP_FILTER_MARGIN_ROWS * 2;
+	u8* srcChannel0 = new u8[srcWidth * srcBandRows * 4];
+	u8* srcChannel1 = new u8[srcWidth * srcBandRows * 4];
+	u8* channel0 = new u8[width * spillBandRows * 4];
+	u8* channel1 = new u8[width * spillBandRows * 4];
+
+	char srcFileName[512];
+	char fileName[512];
+	GetSpillFileName(Image, MipLevel - 1, srcFileName);
+	GetSpillFileName(Image, MipLevel, fileName);
+
+	FILE* srcFile = fopen(srcFileName, "rb");
+	FILE* file = fopen(fileName, "wb");
+	assert(srcFile && file);
+
+	for (i32 y = 0; y < height; y += spillBandRows)
+	{
+		i32 rows = GetMin(spillBandRows, height - y);
+
+		// Source rows under the band plus whatever the filter reads around them.
+		i32 srcY = GetMax(y * 2 - MIP_FILTER_MARGIN_ROWS, 0);
+		i32 srcEY = GetMin((y + rows) * 2 + MIP_FILTER_MARGIN_ROWS, srcHeight);
+
+		ReadSpillRows(srcFile, srcWidth, srcHeight, srcY, srcEY - srcY, srcChannel0, srcChannel1);
+		MipReduceRowsRGBA8(srcChannel0, srcWidth, srcHeight, srcY, channel0, y, rows, pageMipFilter, true);
+		MipReduceRowsRGBA8(srcChannel1, srcWidth, srcHeight, srcY, channel1, y, rows, pageMipFilter, false);
+		WriteSpillRows(file, width, height, y, rows, channel0, channel1);
+	}
+
+	fclose(srcFile);
+	fclose(file);
+	remove(srcFileName);
+
+	delete[] srcChannel0;
+	delete[] srcChannel1;
+	delete[] channel0;
+	delete[] channel1;
+}
+
+// NOTE: Caller must hold the image lock with building set.
+vsMipCacheEntry* GetMipBand(vsImageDef* Image, i32 MipLevel, i32 Row)
+{
+	// Levels are only ever requested in order, so the spill only moves forward.
+	assert(Image->spillLevel <= MipLevel);
+
+	if (Image->spillLevel == -1)
+	{
+		SpillSourceImage(Image);
+		Image->spillLevel = 0;
+	}
+
+	while (Image->spillLevel < MipLevel)
+	{
+		SpillMipLevel(Image, Image->spillLevel + 1);
+		++Image->spillLevel;
+	}
+
+	vsMipCacheEntry* mipEntry = new vsMipCacheEntry();
+	mipEntry->image = Image;
+	mipEntry->mipLevel = MipLevel;
+	mipEntry->imgWidth = Image->width >> MipLevel;
+	mipEntry->imgHeight = Image->height >> MipLevel;
+	mipEntry->bandY = (Row / mipBandRows) * mipBandRows;
+	mipEntry->bandHeight = GetMin(mipBandRows, mipEntry->imgHeight - mipEntry->bandY);
+	mipEntry->channel0Data = new u8[mipEntry->imgWidth * mipEntry->bandHeight * 4];
+	mipEntry->channel1Data = new u8[mipEntry->imgWidth * mipEntry->bandHeight * 4];
+
+	char fileName[512];
+	GetSpillFileName(Image, MipLevel, fileName);
+	FILE* file = fopen(fileName, "rb");
+	assert(file);
+	ReadSpillRows(file, mipEntry->imgWidth, mipEntry->imgHeight, mipEntry->bandY, mipEntry->bandHeight, mipEntry->channel0Data, mipEntry->channel1Data);
+	fclose(file);
+
+	AddMipCacheEntry(mipEntry);
+
+	return mipEntry;
+}
+
+void RemoveSpillFiles()
+{
+	for (i32 i = 0; i < imageCount; ++i)
+	{
+		if (images[i].spillLevel == -1)
+			continue;
+
+		char fileName[512];
+		GetSpillFileName(&images[i], images[i].spillLevel, fileName);
+		remove(fileName);
+		images[i].spillLevel = -1;
+	}
+}
+
+// NOTE: Caller must hold mipCacheLock.
+vsMipCacheEntry* FindMipBand(vsImageDef* Image, i32 MipLevel, i32 Row)
+{
+	for (vsMipCacheEntry* entry = Image->mipCache[MipLevel]; entry; entry = entry->nextBand)
+	{
+		if (Row >= entry->bandY && Row < entry->bandY + entry->bandHeight)
+			return entry;
+	}
 
-	images[imageCount++] = image;
+	return NULL;
 }
 
+//-----------------------------------------------------------------------------------------------------------
+// In memory sources.
+//-----------------------------------------------------------------------------------------------------------
+// NOTE: Caller must hold the image lock with building set.
 vsMipCacheEntry* GetMip(vsTextureDef* Tex, i32 MipLevel)
 {
 	// NOTE: Mip7 is 1x1 for a 128x128 tile.
@@ -112,33 +710,23 @@ vsMipCacheEntry* GetMip(vsTextureDef* Tex, i32 MipLevel)
 		std::cout << "Building image data: " << Tex->image->bcFileName << " " << Tex->image->nmFileName << "\n";
 		
 		mipEntry = new vsMipCacheEntry();
-		mipEntry->texture = Tex;
+		mipEntry->image = Tex->image;
 		mipEntry->mipLevel = 0;
 
 		mipEntry->channel0Data = CreateImageFromFile(Tex->image->bcFileName, &mipEntry->imgWidth, &mipEntry->imgHeight);
 		mipEntry->channel1Data = new u8[mipEntry->imgWidth * mipEntry->imgHeight * 4];		
-		memset(mipEntry->channel1Data, 0, mipEntry->imgWidth * mipEntry->imgHeight * 4);
+		mipEntry->bandHeight = mipEntry->imgHeight;
+		mipEntry->loaderOwned = true;
 
 		u8* nmData = CreateImageFromFile(Tex->image->nmFileName, NULL, NULL);
 		u8* mrData = CreateImageFromFile(Tex->image->mrFileName, NULL, NULL);
 
-		i32 texelCount = mipEntry->imgWidth * mipEntry->imgHeight;
-		for (i32 t = 0; t < texelCount; ++t)
-		{
-			mipEntry->channel0Data[t * 4 + 3] = nmData[t * 4 + 0];
-			mipEntry->channel1Data[t * 4 + 3] = nmData[t * 4 + 1];
-
-			mipEntry->channel1Data[t * 4 + 0] = mrData[t * 4 + 0];
-			mipEntry->channel1Data[t * 4 + 1] = mrData[t * 4 + 1];
-		}
+		PackSourceChannels(mipEntry->channel0Data, mipEntry->channel1Data, nmData, mrData, mipEntry->imgWidth * mipEntry->imgHeight);
 		
 		FreeImage(nmData);
 		FreeImage(mrData);
 
-		mipEntry->next = mipCacheHead;
-		mipCacheHead = mipEntry;
-		mipCacheMemory += mipEntry->imgWidth * mipEntry->imgHeight * 8;
-		Tex->image->mipCache[0] = mipEntry;
+		AddMipCacheEntry(mipEntry);
 
 		closestMip = 0;
 	}
@@ -155,20 +743,18 @@ vsMipCacheEntry* GetMip(vsTextureDef* Tex, i32 MipLevel)
 		vsMipCacheEntry* mipSrc = Tex->image->mipCache[closestMip + i];
 
 		mipEntry = new vsMipCacheEntry();
-		mipEntry->texture = Tex;
+		mipEntry->image = Tex->image;
 		mipEntry->mipLevel = closestMip + i + 1;
 		mipEntry->channel0Data = new u8[mipSrc->imgWidth / 2 * mipSrc->imgHeight / 2 * 4];
 		mipEntry->channel1Data = new u8[mipSrc->imgWidth / 2 * mipSrc->imgHeight / 2 * 4];
 		mipEntry->imgWidth = mipSrc->imgWidth / 2;
 		mipEntry->imgHeight = mipSrc->imgHeight / 2;
+		mipEntry->bandHeight = mipEntry->imgHeight;
 		
-		stbir_resize_uint8(mipSrc->channel0Data, mipSrc->imgWidth, mipSrc->imgHeight, 0, mipEntry->channel0Data, mipSrc->imgWidth / 2, mipSrc->imgHeight / 2, 0, 4);
-		stbir_resize_uint8(mipSrc->channel1Data, mipSrc->imgWidth, mipSrc->imgHeight, 0, mipEntry->channel1Data, mipSrc->imgWidth / 2, mipSrc->imgHeight / 2, 0, 4);
+		MipReduceRGBA8(mipSrc->channel0Data, mipSrc->imgWidth, mipSrc->imgHeight, mipEntry->channel0Data, pageMipFilter, true);
+		MipReduceRGBA8(mipSrc->channel1Data, mipSrc->imgWidth, mipSrc->imgHeight, mipEntry->channel1Data, pageMipFilter, false);
 		
-		mipCacheMemory += mipEntry->imgWidth * mipEntry->imgHeight * 4;
-		mipEntry->next = mipCacheHead;
-		mipCacheHead = mipEntry;
-		Tex->image->mipCache[closestMip + i + 1] = mipEntry;
+		AddMipCacheEntry(mipEntry);
 	}
 
 	assert(mipEntry->mipLevel == MipLevel);
@@ -176,6 +762,88 @@ vsMipCacheEntry* GetMip(vsTextureDef* Tex, i32 MipLevel)
 	return mipEntry;
 }
 
+// Returns the band of the mip holding Row pinned in the cache, loading or regenerating it if it was never built or has been evicted.
+// NOTE: Thread safe, every acquire needs a ReleaseMip. Rows past the end of the image return the last band.
+vsMipCacheEntry* AcquireMip(vsTextureDef* Tex, i32 MipLevel, i32 Row)
+{
+	vsImageDef* image = Tex->image;
+	vsMipCacheEntry* entry;
+
+	{
+		std::unique_lock<std::mutex> lock(mipCacheLock);
+		entry = FindMipBand(image, MipLevel, Row);
+
+		if (entry)
+		{
+			++entry->pinCount;
+			entry->lastUse = ++mipCacheUseCounter;
+			return entry;
+		}
+	}
+
+	std::unique_lock<std::mutex> imageLock(image->lock);
+
+	if (!image->probed)
+		ProbeSourceImage(image);
+
+	Row = GetMin(Row, (image->height >> MipLevel) - 1);
+
+	{
+		// Another worker may have built it while we waited.
+		std::unique_lock<std::mutex> lock(mipCacheLock);
+		entry = FindMipBand(image, MipLevel, Row);
+
+		if (entry)
+		{
+			++entry->pinCount;
+			entry->lastUse = ++mipCacheUseCounter;
+			return entry;
+		}
+
+		image->building = true;
+	}
+
+	if (image->streamed)
+		entry = GetMipBand(image, MipLevel, Row);
+	else
+		entry = GetMip(Tex, MipLevel);
+
+	{
+		std::unique_lock<std::mutex> lock(mipCacheLock);
+
+		// NOTE: Levels are built in order, so finer levels are never needed again once a coarser one exists.
+		for (i32 i = 0; i < MipLevel; ++i)
+		{
+			vsMipCacheEntry* band = image->mipCache[i];
+
+			while (band)
+			{
+				vsMipCacheEntry* nextBand = band->nextBand;
+
+				if (band->pinCount == 0)
+					RemoveMipCacheEntry(band);
+
+				band = nextBand;
+			}
+		}
+
+		++entry->pinCount;
+		entry->lastUse = ++mipCacheUseCounter;
+		image->building = false;
+	}
+
+	imageLock.unlock();
+	TrimMipCache();
+
+	return entry;
+}
+
+void ReleaseMip(vsMipCacheEntry* Entry)
+{
+	std::unique_lock<std::mutex> lock(mipCacheLock);
+	--Entry->pinCount;
+}
+
 void CopyImageData(u8* SrcData, i32 SrcX, i32 SrcY, i32 SrcWidth, u8* DstData, i32 DstX, i32 DstY, i32 DstWidth, i32 CopyWidth, i32 CopyHeight)
 {
 	for (i32 r = 0; r < CopyHeight; ++r)
@@ -206,7 +874,7 @@ void WritePage(FILE* IndexFile, FILE* PageFile, i64* PageFileOffset, u8* Channel
 	};
 
 	i32 payloadSize = (Channel0Size - XR_META_SIZE) + (Channel1Size - XR_META_SIZE) + sizeof(i32) * 7;
-	assert(payloadSize <= 0xFFFF);
+	assert(payloadSize < PAGE_INDEX_SIZE_CONSTANT);
 	
 	i64 indexData = *PageFileOffset | ((i64)payloadSize << 48);
 	fwrite(&indexData, sizeof(i64), 1, IndexFile);
@@ -218,259 +886,1584 @@ void WritePage(FILE* IndexFile, FILE* PageFile, i64* PageFileOffset, u8* Channel
 	*PageFileOffset += payloadSize;
 }
 
-void BuildPages()
-{	
-	double startTime = GetTime();
-
-	AddImage("rawTextures\\baron_bc.png", "rawTextures\\baron_nm.png", "rawTextures\\baron_mr.png");
-	AddImage("rawTextures\\radarDome_bc.png", "rawTextures\\blank4k_nm.png", "rawTextures\\radarDome_mr.png");
-	AddImage("rawTextures\\connector_bc.png", "rawTextures\\blank4k_nm.png", "rawTextures\\baron_mr.png");
-	AddImage("rawTextures\\capsule_bc.png", "rawTextures\\blank4k_nm.png", "rawTextures\\capsule_mr.png");
+// Copies an unchanged page's meta and bodies from the previous page file.
+void CopyPreviousPage(vsPageWriter* Writer, i64 PreviousIndexData, u8* CopyBuffer)
+{
+	i64 offset = PreviousIndexData & 0xFFFFFFFFFFFFLL;
+	i32 payloadSize = (i32)((u64)PreviousIndexData >> 48);
+
+	_fseeki64(Writer->previous->pageFile, offset, SEEK_SET);
+	size_t readSize = fread(CopyBuffer, payloadSize, 1, Writer->previous->pageFile);
+	assert(readSize == 1);
+
+	i64 indexData = Writer->pageFileOffset | ((i64)payloadSize << 48);
+	fwrite(&indexData, sizeof(i64), 1, Writer->indexFile);
+	fwrite(CopyBuffer, payloadSize, 1, Writer->pageFile);
+	Writer->pageFileOffset += payloadSize;
+
+	// NOTE: The header of the page is the shared one with its channel 0 meta patched back in, same as the loader does.
+	i32* metaData = (i32*)CopyBuffer;
+	memcpy(Writer->xrHeader, Writer->previous->xrHeader, XR_META_SIZE);
+	*(i32*)(Writer->xrHeader + XR_META_RGB_SIZE) = metaData[1];
+	*(i32*)(Writer->xrHeader + XR_META_ALPHA_OFFSET) = metaData[2];
+	*(i32*)(Writer->xrHeader + XR_META_ALPHA_SIZE) = metaData[3];
+}
 
-	/*
-	for (i32 iX = 0; iX < 16; ++iX)
-		for (i32 iY = 0; iY < 16; ++iY)
-		{
-			AddTexture(iX * 4096, iY * 4096, 4096, 4096, &images[2]);
-		}
-	//*/
+u64 HashPagePayload(u64 Hash, u8* Data, i32 Size)
+{
+	// FNV-1a, 8 bytes at a time.
+	for (i32 i = 0; i < Size; i += 8)
+	{
+		Hash ^= *(u64*)(Data + i);
+		Hash *= 0x100000001B3ULL;
+	}
 
-	AddTexture(4096 * 16, 0, 4096, 4096, &images[0]);
-	//AddTexture(4096 * 17, 0, 4096, 4096, &images[2]);
-	AddTexture(4096 * 16, 4096, 4096, 4096, &images[1]);
-	AddTexture(4096 * 17, 0, 2048, 2048, &images[3]);
+	return Hash;
+}
 
-	// TODO: Check for overlaps
+bool IsPayloadConstant(u8* Data, u32* Color)
+{
+	u32* texels = (u32*)Data;
 
-	for (i32 i = 0; i < ARRAY_COUNT(textureIdTable); ++i)
+	for (i32 i = 1; i < 120 * 120; ++i)
 	{
-		textureIdTable[i] = -1;
+		if (texels[i] != texels[0])
+			return false;
 	}
-	
-	for (i32 i = 0; i < textureCount; ++i)
-	{
-		vsTextureDef* t = &textures[i];
-		
-		i32 sX = t->x;
-		i32 sY = t->y;
-		i32 eX = t->x + t->width;
-		i32 eY = t->y + t->height;
 
-		for (i32 iY = sY; iY < eY; ++iY)
-		{
-			for (i32 iX = sX; iX < eX; ++iX)
-			{
-				textureIdTable[iY * 1024 + iX] = i;
-			}
-		}
-	}
+	*Color = texels[0];
 
-	i32 mipCount = 11;
+	return true;
+}
 
-	u8* compositeChannel0 = new u8[128 * 128 * 4];
-	u8* compositeChannel1 = new u8[128 * 128 * 4];
-	
-	u8* pagePayloadChannel0 = new u8[120 * 120 * 4];
-	u8* pagePayloadChannel1 = new u8[120 * 120 * 4];
+// Composites all textures touching the page, returns false if the page is empty.
+// NOTE: PageTextures is scratch space for maxTextures indices.
+bool CompositePage(vsPageWriter* Writer, i32 IX, i32 IY, u8* CompositeChannel0, u8* CompositeChannel1, i32* PageTextures)
+{
+	i32 m = Writer->mip;
 
-	u8* pageEncodedChannel0 = new u8[120 * 120 * 4];
-	u8* pageEncodedChannel1 = new u8[120 * 120 * 4];
+	// Final levels come from the packed 1024x1024 level 7 image.
+	if (m >= 8)
+	{
+		CopyImageData(Writer->finalMipChannel0[m - 8], IX * 128, IY * 128, Writer->mipPages * 128, CompositeChannel0, 0, 0, 128, 128, 128);
+		CopyImageData(Writer->finalMipChannel1[m - 8], IX * 128, IY * 128, Writer->mipPages * 128, CompositeChannel1, 0, 0, 128, 128, 128);
 
-	FILE* pageFile = fopen("pages\\page.dat", "wb");
-	FILE* indexFile = fopen("pages\\index.dat", "wb");
+		return true;
+	}
 
-	i64 pageFileOffset = 0;
+	memset(CompositeChannel0, 0, 128 * 128 * 4);
+	memset(CompositeChannel1, 0, 128 * 128 * 4);
 
-	u8* mipTempChannel0 = new u8[1024 * 1024 * 4];
-	u8* mipTempChannel1 = new u8[1024 * 1024 * 4];
-	
-	memset(mipTempChannel0, 0, 1024 * 1024 * 4);
-	memset(mipTempChannel1, 0, 1024 * 1024 * 4);
-	
-	// Loop Mip Levels
-	for (i32 m = 0; m < 8; ++m)
+	i32 mipCoverage = 1024 / Writer->mipPages;
+
+	// Convert page to bounds over the page cells and find the textures touching it, each is copied once.
+	i32 sX = IX * mipCoverage;
+	i32 sY = IY * mipCoverage;
+	i32 eX = (IX + 1) * mipCoverage;
+	i32 eY = (IY + 1) * mipCoverage;
+
+	i32 compositeCount = QueryTextureQuadTree(textureQuadRoot, sX, sY, eX, eY, PageTextures, 0, maxTextures);
+
+	for (i32 i = 0; i < compositeCount; ++i)
 	{
-		i32 mipPages = 1 << (mipCount - m - 1);
-		i32 mipCoverage = 1024 / mipPages;
+		vsTextureDef* t = &textures[PageTextures[i]];
+
+		// NOTE: The band holding the first source row also tells us the size of the mip.
+		i32 gSY = GetMax(t->y * 128, IY * mipCoverage * 128);
+		vsMipCacheEntry* imgMip = AcquireMip(t, m, (gSY - (t->y * 128)) / mipCoverage);
+
+		// Source and destination rects in pixels.
+		i32 gSX = GetMax(t->x * 128, IX * mipCoverage * 128);
+		i32 gEX = GetMin(t->x * 128 + imgMip->imgWidth * mipCoverage, (IX + 1) * mipCoverage * 128);
+		i32 gEY = GetMin(t->y * 128 + imgMip->imgHeight * mipCoverage, (IY + 1) * mipCoverage * 128);
+
+		i32 srcSX = (gSX - (t->x * 128)) / mipCoverage;
+		i32 srcEX = (gEX - (t->x * 128)) / mipCoverage;
+		i32 srcSY = (gSY - (t->y * 128)) / mipCoverage;
+		i32 srcEY = (gEY - (t->y * 128)) / mipCoverage;
 
-		for (i32 iY = 0; iY < mipPages; ++iY)
+		i32 dstSX = (gSX - (IX * mipCoverage * 128)) / mipCoverage;
+		i32 dstSY = (gSY - (IY * mipCoverage * 128)) / mipCoverage;
+
+		// Copy section of data to page, a band at a time.
+		i32 columns = srcEX - srcSX;
+		i32 row = srcSY;
+
+		while (true)
 		{
-			for (i32 iX = 0; iX < mipPages; ++iX)
-			{
-				memset(compositeChannel0, 0, 128 * 128 * 4);
-				memset(compositeChannel1, 0, 128 * 128 * 4);
+			i32 bandEY = GetMin(srcEY, imgMip->bandY + imgMip->bandHeight);
+			i32 rows = bandEY - row;
 
-				// Convert page to bounds over texture id table.
-				i32 sX = iX * mipCoverage;
-				i32 sY = iY * mipCoverage;
-				i32 eX = (iX + 1) * mipCoverage;
-				i32 eY = (iY + 1) * mipCoverage;
+			CopyImageData(imgMip->channel0Data, srcSX, row - imgMip->bandY, imgMip->imgWidth, CompositeChannel0, dstSX, dstSY + row - srcSY, 128, columns, rows);
+			CopyImageData(imgMip->channel1Data, srcSX, row - imgMip->bandY, imgMip->imgWidth, CompositeChannel1, dstSX, dstSY + row - srcSY, 128, columns, rows);
 
-				i32 compositeCount = 0;
+			ReleaseMip(imgMip);
+			row = bandEY;
 
-				for (i32 mY = sY; mY < eY; ++mY)
-				{
-					for (i32 mX = sX; mX < eX; ++mX)
-					{
-						// Get correct mip level
-						i32 texIndex = textureIdTable[mY * 1024 + mX];
-						
-						if (texIndex == -1)
-							continue;
-
-						++compositeCount;
-
-						vsTextureDef* t = &textures[texIndex];
-						vsMipCacheEntry* imgMip = GetMip(t, m);
-
-						// Source and destination rects in pixels.
-						i32 gSX = GetMax(t->x * 128, iX * mipCoverage * 128);
-						i32 gEX = GetMin(t->x * 128 + imgMip->imgWidth * mipCoverage, (iX + 1) * mipCoverage * 128);
-						i32 gSY = GetMax(t->y * 128, iY * mipCoverage * 128);
-						i32 gEY = GetMin(t->y * 128 + imgMip->imgHeight * mipCoverage, (iY + 1) * mipCoverage * 128);
-
-						i32 srcSX = (gSX - (t->x * 128)) / mipCoverage;
-						i32 srcEX = (gEX - (t->x * 128)) / mipCoverage;
-						i32 srcSY = (gSY - (t->y * 128)) / mipCoverage;
-						i32 srcEY = (gEY - (t->y * 128)) / mipCoverage;
-
-						i32 dstSX = (gSX - (iX * mipCoverage * 128)) / mipCoverage;
-						i32 dstEX = (gEX - (iX * mipCoverage * 128)) / mipCoverage;
-						i32 dstSY = (gSY - (iY * mipCoverage * 128)) / mipCoverage;
-						i32 dstEY = (gEY - (iY * mipCoverage * 128)) / mipCoverage;
-
-						// Copy section of data to page
-						i32 rows = srcEY - srcSY;
-						i32 columns = srcEX - srcSX;
-
-						CopyImageData(imgMip->channel0Data, srcSX, srcSY, imgMip->imgWidth, compositeChannel0, dstSX, dstSY, 128, columns, rows);
-						CopyImageData(imgMip->channel1Data, srcSX, srcSY, imgMip->imgWidth, compositeChannel1, dstSX, dstSY, 128, columns, rows);
-
-						/*
-						for (i32 row = 0; row < rows; ++row)
-						{
-							i32 srcOffset = ((row + srcSY) * imgMip->imgWidth + srcSX) * 4;
-							i32 dstOffset = ((row + dstSY) * 128 + dstSX) * 4;
-							
-							assert(srcOffset >= 0 && srcOffset < (imgMip->imgWidth * imgMip->imgHeight) * 4);
-							assert(dstOffset >= 0 && dstOffset < 128 * 128 * 4);
-							memcpy(pageCompositeData + dstOffset, imgMip->imgData + srcOffset, columns * 4);
-						}
-						*/
-
-						//std::cout << "Mip: " << m << " X: " << mX << " Y: " << mY << " Cached: " << closestMip << "\n";
-					}
-				}
+			if (row >= srcEY)
+				break;
 
-				if (compositeCount)
-				{
-					// On the final level we pack the image to the 1024x1024 temp buffer too.
-					if (m == 7)
-					{
-						CopyImageData(compositeChannel0, 0, 0, 128, mipTempChannel0, iX * 128, iY * 128, 1024, 128, 128);
-						CopyImageData(compositeChannel1, 0, 0, 128, mipTempChannel1, iX * 128, iY * 128, 1024, 128, 128);
-					}
+			imgMip = AcquireMip(t, m, row);
+		}
+	}
 
-					// Shrink payload
-					stbir_resize_uint8(compositeChannel0, 128, 128, 128 * 4, pagePayloadChannel0, 120, 120, 120 * 4, 4);
-					stbir_resize_uint8(compositeChannel1, 128, 128, 128 * 4, pagePayloadChannel1, 120, 120, 120 * 4, 4);
+	return (compositeCount > 0);
+}
 
-					i32 encodedSizeChannel0 = 120 * 120 * 4;
-					HdpEncodeImageRGBA(pagePayloadChannel0, 120, 120, pageEncodedChannel0, &encodedSizeChannel0);
+// Composites a page of the current level and shrinks it to its 120x120 payloads, returns false if the page is empty.
+bool BuildPagePayload(vsPageWriter* Writer, i32 PageIndex, u8* CompositeChannel0, u8* CompositeChannel1, i32* PageTextures, u8* PayloadChannel0, u8* PayloadChannel1)
+{
+	bool filled = CompositePage(Writer, PageIndex % Writer->mipPages, PageIndex / Writer->mipPages, CompositeChannel0, CompositeChannel1, PageTextures);
 
-					i32 encodedSizeChannel1 = 120 * 120 * 4;
-					HdpEncodeImageRGBA(pagePayloadChannel1, 120, 120, pageEncodedChannel1, &encodedSizeChannel1);
+	if (!filled)
+		return false;
 
-					/*
-					char fileName[256];
-					sprintf(fileName, "pages\\page_%d_%d_%d.jxr", m, iY, iX);
-					FILE* outFile = fopen(fileName, "wb");
-					fwrite(pageEncodedChannel1, encodedSizeChannel1, 1, outFile);
-					fclose(outFile);
-					*/
-					
-					WritePage(indexFile, pageFile, &pageFileOffset, pageEncodedChannel0, encodedSizeChannel0, pageEncodedChannel1, encodedSizeChannel1);
+	stbir_resize_uint8(CompositeChannel0, 128, 128, 128 * 4, PayloadChannel0, 120, 120, 120 * 4, 4);
+	stbir_resize_uint8(CompositeChannel1, 128, 128, 128 * 4, PayloadChannel1, 120, 120, 120 * 4, 4);
 
-					//if (iX == 0)
-					std::cout << "Page encoded: " << m << " " << iY << " " << iX << "\n";
-				}
-				else
-				{
-					i64 indexData = 0;
-					fwrite(&indexData, sizeof(i64), 1, indexFile);
-				}
+	return true;
+}
+
+// True if a node with the page's hash holds the same page.
+// NOTE: The hash only finds candidates. Constant pages compare colours, unchanged pages copied from the
+// same previous page match outright, anything else composites the node's page again and compares payloads.
+bool PageNodeMatches(vsPageWriter* Writer, vsPageHashNode* Node, vsPageCandidate* Page)
+{
+	if (Node->hash != Page->hash || Node->constant != Page->constant)
+		return false;
+
+	if (Page->constant)
+		return Node->constantColors[0] == Page->colors[0] && Node->constantColors[1] == Page->colors[1];
+
+	if (Page->previousIndexData && Node->previousIndexData == Page->previousIndexData)
+		return true;
+
+	// NOTE: Earlier levels can't be composited again, their sources are gone.
+	if (Node->mip != Writer->mip)
+		return false;
+
+	if (!Page->payloadReady)
+	{
+		BuildPagePayload(Writer, Page->pageIndex, Page->compositeChannel0, Page->compositeChannel1, Page->pageTextures, Page->payloadChannel0, Page->payloadChannel1);
+		Page->payloadReady = true;
+	}
+
+	BuildPagePayload(Writer, Node->pageIndex, Page->compositeChannel0, Page->compositeChannel1, Page->pageTextures, Page->checkChannel0, Page->checkChannel1);
+
+	return memcmp(Page->payloadChannel0, Page->checkChannel0, 120 * 120 * 4) == 0
+		&& memcmp(Page->payloadChannel1, Page->checkChannel1, 120 * 120 * 4) == 0;
+}
+
+// Returns the node holding the same page, Owner is set if this call created it.
+// NOTE: Matches are checked outside the lock. Nodes are only ever pushed on the front of a bucket, so the
+// node is created once every node in front of the last checked one has been ruled out under the lock.
+vsPageHashNode* AddPageNode(vsPageWriter* Writer, vsPageCandidate* Page, bool* Owner)
+{
+	vsPageHashNode** bucket = &Writer->pageHashMap[Page->hash % pageHashBucketCount];
+	vsPageHashNode* checked = NULL;
+
+	while (true)
+	{
+		vsPageHashNode* head;
+
+		{
+			std::unique_lock<std::mutex> lock(Writer->lock);
+			head = *bucket;
+
+			if (head == checked)
+			{
+				vsPageHashNode* node = new vsPageHashNode();
+				node->hash = Page->hash;
+				node->constant = Page->constant;
+				node->constantColors[0] = Page->colors[0];
+				node->constantColors[1] = Page->colors[1];
+				node->previousIndexData = Page->previousIndexData;
+				node->encoded = (Page->previousIndexData != 0);
+				node->mip = Writer->mip;
+				node->pageIndex = Page->pageIndex;
+				node->next = *bucket;
+				*bucket = node;
+				*Owner = true;
+
+				return node;
+			}
+		}
+
+		for (vsPageHashNode* node = head; node != checked; node = node->next)
+		{
+			if (PageNodeMatches(Writer, node, Page))
+			{
+				*Owner = false;
+				return node;
 			}
 		}
+
+		checked = head;
 	}
+}
 
-	// Finish the remaining mip levels.
-	std::cout << "Preparing final mips\n";
+// Takes a page that no changed texture touches straight from the previous build.
+bool ReusePreviousPage(vsPageWriter* Writer, vsPageCandidate* Page, vsPageHashNode** Node)
+{
+	vsPreviousBuild* previous = Writer->previous;
+	i64 indexData = previous->indexEntries[Writer->pageBase + Page->pageIndex];
+	i64 size = (u64)indexData >> 48;
+
+	if (size == PAGE_INDEX_SIZE_EMPTY)
+		return false;
 
-	u8* mipImgChannel0[] = 
+	Page->hash = previous->pageHashes[Writer->pageBase + Page->pageIndex];
+	Page->constant = (size == PAGE_INDEX_SIZE_CONSTANT);
+	Page->colors[0] = 0;
+	Page->colors[1] = 0;
+	Page->previousIndexData = Page->constant ? 0 : indexData;
+
+	if (Page->constant)
 	{
-		new u8[512 * 512 * 4],
-		new u8[256 * 256 * 4],
-		new u8[128 * 128 * 4],
-	};
+		i64 constantIndex = indexData & 0xFFFFFFFFFFFFLL;
+		assert(constantIndex < previous->constantCount);
+		Page->colors[0] = previous->constantColors[constantIndex * 2 + 0];
+		Page->colors[1] = previous->constantColors[constantIndex * 2 + 1];
+	}
+
+	bool owner;
+	*Node = AddPageNode(Writer, Page, &owner);
 
-	u8* mipImgChannel1[] =
+	return true;
+}
+
+void PageWorkerThreadProc(vsPageWriter* Writer)
+{
+	u8* compositeChannel0 = new u8[128 * 128 * 4];
+	u8* compositeChannel1 = new u8[128 * 128 * 4];
+	i32* pageTextures = new i32[maxTextures];
+	u8* payloadChannel0 = new u8[120 * 120 * 4];
+	u8* payloadChannel1 = new u8[120 * 120 * 4];
+	u8* encodedChannel0 = new u8[120 * 120 * 4];
+	u8* encodedChannel1 = new u8[120 * 120 * 4];
+	u8* checkChannel0 = new u8[120 * 120 * 4];
+	u8* checkChannel1 = new u8[120 * 120 * 4];
+
+	while (true)
 	{
-		new u8[512 * 512 * 4],
-		new u8[256 * 256 * 4],
-		new u8[128 * 128 * 4],
-	};
+		i32 pageIndex;
 
-	stbir_resize_uint8(mipTempChannel0, 1024, 1024, 1024 * 4, mipImgChannel0[0], 512, 512, 512 * 4, 4);
-	stbir_resize_uint8(mipImgChannel0[0], 512, 512, 512 * 4, mipImgChannel0[1], 256, 256, 256 * 4, 4);
-	stbir_resize_uint8(mipImgChannel0[1], 256, 256, 256 * 4, mipImgChannel0[2], 128, 128, 128 * 4, 4);
+		{
+			std::unique_lock<std::mutex> lock(Writer->lock);
 
-	stbir_resize_uint8(mipTempChannel1, 1024, 1024, 1024 * 4, mipImgChannel1[0], 512, 512, 512 * 4, 4);
-	stbir_resize_uint8(mipImgChannel1[0], 512, 512, 512 * 4, mipImgChannel1[1], 256, 256, 256 * 4, 4);
-	stbir_resize_uint8(mipImgChannel1[1], 256, 256, 256 * 4, mipImgChannel1[2], 128, 128, 128 * 4, 4);
+			while (Writer->nextPage < Writer->pageCount && Writer->nextPage - Writer->writtenPage >= Writer->pageWindow)
+				Writer->signal.wait(lock);
 
-	std::cout << "Outputting final mips\n";
+			if (Writer->nextPage >= Writer->pageCount)
+				break;
 
-	for (i32 m = 8; m < 11; ++m)
-	{
-		i32 mipPages = 1 << (mipCount - m - 1);
+			pageIndex = Writer->nextPage++;
+		}
 
-		for (i32 iY = 0; iY < mipPages; ++iY)
+		vsPageHashNode* node = NULL;
+		bool dirty = (Writer->dirtyPages[pageIndex] != 0);
+		bool filled;
+
+		vsPageCandidate page = {};
+		page.pageIndex = pageIndex;
+		page.payloadChannel0 = payloadChannel0;
+		page.payloadChannel1 = payloadChannel1;
+		page.compositeChannel0 = compositeChannel0;
+		page.compositeChannel1 = compositeChannel1;
+		page.pageTextures = pageTextures;
+		page.checkChannel0 = checkChannel0;
+		page.checkChannel1 = checkChannel1;
+
+		if (dirty)
 		{
-			for (i32 iX = 0; iX < mipPages; ++iX)
+			filled = BuildPagePayload(Writer, pageIndex, compositeChannel0, compositeChannel1, pageTextures, payloadChannel0, payloadChannel1);
+			page.payloadReady = true;
+
+			// On the final level we pack the image to the 1024x1024 temp buffer too, pages never overlap there.
+			// NOTE: Empty pages are packed as well so a rebuild clears pages a removed texture used to cover.
+			if (Writer->mip == 7)
 			{
-				CopyImageData(mipImgChannel0[m - 8], iX * 128, iY * 128, mipPages * 128, compositeChannel0, 0, 0, 128, 128, 128);
-				CopyImageData(mipImgChannel1[m - 8], iX * 128, iY * 128, mipPages * 128, compositeChannel1, 0, 0, 128, 128, 128);
+				i32 iX = pageIndex % Writer->mipPages;
+				i32 iY = pageIndex / Writer->mipPages;
+				CopyImageData(compositeChannel0, 0, 0, 128, Writer->mipTempChannel0, iX * 128, iY * 128, 1024, 128, 128);
+				CopyImageData(compositeChannel1, 0, 0, 128, Writer->mipTempChannel1, iX * 128, iY * 128, 1024, 128, 128);
+			}
+		}
+		else
+		{
+			filled = ReusePreviousPage(Writer, &page, &node);
+		}
+
+		if (dirty && filled)
+		{
+			page.hash = HashPagePayload(0xCBF29CE484222325ULL, payloadChannel0, 120 * 120 * 4);
+			page.hash = HashPagePayload(page.hash, payloadChannel1, 120 * 120 * 4);
+			page.constant = IsPayloadConstant(payloadChannel0, &page.colors[0]) && IsPayloadConstant(payloadChannel1, &page.colors[1]);
 
-				stbir_resize_uint8(compositeChannel0, 128, 128, 128 * 4, pagePayloadChannel0, 120, 120, 120 * 4, 4);
-				stbir_resize_uint8(compositeChannel1, 128, 128, 128 * 4, pagePayloadChannel1, 120, 120, 120 * 4, 4);
+			bool owner;
+			node = AddPageNode(Writer, &page, &owner);
 
+			if (owner && !page.constant)
+			{
 				i32 encodedSizeChannel0 = 120 * 120 * 4;
-				HdpEncodeImageRGBA(pagePayloadChannel0, 120, 120, pageEncodedChannel0, &encodedSizeChannel0);
+				HdpEncodeImageRGBA(payloadChannel0, 120, 120, encodedChannel0, &encodedSizeChannel0);
 
 				i32 encodedSizeChannel1 = 120 * 120 * 4;
-				HdpEncodeImageRGBA(pagePayloadChannel1, 120, 120, pageEncodedChannel1, &encodedSizeChannel1);
+				HdpEncodeImageRGBA(payloadChannel1, 120, 120, encodedChannel1, &encodedSizeChannel1);
+
+				u8* nodeChannel0 = new u8[encodedSizeChannel0];
+				u8* nodeChannel1 = new u8[encodedSizeChannel1];
+				memcpy(nodeChannel0, encodedChannel0, encodedSizeChannel0);
+				memcpy(nodeChannel1, encodedChannel1, encodedSizeChannel1);
+
+				std::unique_lock<std::mutex> lock(Writer->lock);
+				node->encodedChannel0 = nodeChannel0;
+				node->encodedChannel1 = nodeChannel1;
+				node->encodedSizeChannel0 = encodedSizeChannel0;
+				node->encodedSizeChannel1 = encodedSizeChannel1;
+				node->encoded = true;
+			}
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(Writer->lock);
+			Writer->results[pageIndex].node = node;
+			Writer->results[pageIndex].empty = !filled;
+			Writer->results[pageIndex].ready = true;
+		}
 
-				WritePage(indexFile, pageFile, &pageFileOffset, pageEncodedChannel0, encodedSizeChannel0, pageEncodedChannel1, encodedSizeChannel1);
+		Writer->signal.notify_all();
+	}
 
-				//if (iX == 0)
-				std::cout << "Page encoded: " << m << " " << iY << " " << iX << "\n";
-			}
+	HdpReleaseThreadContext();
+
+	delete[] compositeChannel0;
+	delete[] compositeChannel1;
+	delete[] pageTextures;
+	delete[] payloadChannel0;
+	delete[] payloadChannel1;
+	delete[] encodedChannel0;
+	delete[] encodedChannel1;
+	delete[] checkChannel0;
+	delete[] checkChannel1;
+}
+
+// Builds every page of a mip level on the worker pool and writes them in row order from this thread.
+// NOTE: Output is identical to building the pages serially, whichever worker finishes first.
+void BuildMipLevel(vsPageWriter* Writer, i32 Mip, i32 MipPages, i32 WorkerCount)
+{
+	double levelTime = GetTime();
+	i64 levelStartOffset = Writer->pageFileOffset;
+
+	Writer->mip = Mip;
+	Writer->mipPages = MipPages;
+	Writer->pageCount = MipPages * MipPages;
+	Writer->nextPage = 0;
+	Writer->writtenPage = 0;
+	Writer->pageWindow = WorkerCount * pageWindowPerWorker;
+	Writer->results = new vsPageResult[Writer->pageCount];
+	memset(Writer->results, 0, sizeof(vsPageResult) * Writer->pageCount);
+
+	std::thread* workers = new std::thread[WorkerCount];
+
+	for (i32 i = 0; i < WorkerCount; ++i)
+		workers[i] = std::thread(PageWorkerThreadProc, Writer);
+
+	i32 levelPageCount = 0;
+	i32 levelDirtyCount = 0;
+	u8* copyBuffer = new u8[PAGE_INDEX_SIZE_CONSTANT];
+
+	for (i32 i = 0; i < Writer->pageCount; ++i)
+	{
+		vsPageResult result;
+
+		{
+			std::unique_lock<std::mutex> lock(Writer->lock);
+
+			while (!Writer->results[i].ready)
+				Writer->signal.wait(lock);
+
+			result = Writer->results[i];
+
+			// The first page in order with a hash writes it, even if a later page did the encode.
+			while (!result.empty && !result.node->written && !result.node->constant && !result.node->encoded)
+				Writer->signal.wait(lock);
+		}
+
+		vsPageHashNode* node = result.node;
+		Writer->pageHashes[Writer->pageBase + i] = result.empty ? 0 : node->hash;
+
+		if (!result.empty && Writer->dirtyPages[i])
+			++levelDirtyCount;
+
+		if (result.empty)
+		{
+			i64 indexData = 0;
+			fwrite(&indexData, sizeof(i64), 1, Writer->indexFile);
+		}
+		else if (node->written)
+		{
+			fwrite(&node->indexData, sizeof(i64), 1, Writer->indexFile);
+			++Writer->duplicatePageCount;
+		}
+		else if (node->constant)
+		{
+			assert(Writer->constantCount < maxPages);
+			Writer->constantColors[Writer->constantCount * 2 + 0] = node->constantColors[0];
+			Writer->constantColors[Writer->constantCount * 2 + 1] = node->constantColors[1];
+
+			node->indexData = (i64)Writer->constantCount | ((i64)PAGE_INDEX_SIZE_CONSTANT << 48);
+			fwrite(&node->indexData, sizeof(i64), 1, Writer->indexFile);
+
+			++Writer->constantCount;
+			++Writer->constantPageCount;
+		}
+		else if (node->previousIndexData)
+		{
+			i64 pageOffset = Writer->pageFileOffset;
+			CopyPreviousPage(Writer, node->previousIndexData, copyBuffer);
+			node->indexData = pageOffset | ((Writer->pageFileOffset - pageOffset) << 48);
+
+			++Writer->reusedPageCount;
+		}
+		else
+		{
+			i64 pageOffset = Writer->pageFileOffset;
+			WritePage(Writer->indexFile, Writer->pageFile, &Writer->pageFileOffset, node->encodedChannel0, node->encodedSizeChannel0, node->encodedChannel1, node->encodedSizeChannel1);
+			node->indexData = pageOffset | ((Writer->pageFileOffset - pageOffset) << 48);
+
+			// NOTE: Header for the index comes from the last page written.
+			memcpy(Writer->xrHeader, node->encodedChannel0, XR_META_SIZE);
+
+			delete[] node->encodedChannel0;
+			delete[] node->encodedChannel1;
+			node->encodedChannel0 = NULL;
+			node->encodedChannel1 = NULL;
+
+			++Writer->encodedPageCount;
+		}
+
+		if (!result.empty)
+		{
+			node->written = true;
+			++levelPageCount;
+		}
+
+		{
+			std::unique_lock<std::mutex> lock(Writer->lock);
+			Writer->writtenPage = i + 1;
 		}
+
+		Writer->signal.notify_all();
 	}
 
-	i32 metaDataSize = XR_META_SIZE;
-	fwrite(&metaDataSize, sizeof(i32), 1, indexFile);
-	fwrite(pageEncodedChannel0, XR_META_SIZE, 1, indexFile);
+	for (i32 i = 0; i < WorkerCount; ++i)
+		workers[i].join();
+
+	delete[] workers;
+	delete[] copyBuffer;
+	delete[] Writer->results;
+	Writer->results = NULL;
+	Writer->pageBase += Writer->pageCount;
+
+	levelTime = GetTime() - levelTime;
+
+	double levelMegabytes = (double)(Writer->pageFileOffset - levelStartOffset) / 1024.0 / 1024.0;
+
+	std::cout << "Mip " << Mip << ": " << levelPageCount << " pages (" << levelDirtyCount << " rebuilt) in " << levelTime << "s, " << (levelTime > 0.0 ? levelPageCount / levelTime : 0.0) << " pages/s, " << levelMegabytes << "mb written at " << (levelTime > 0.0 ? levelMegabytes / levelTime : 0.0) << "mb/s\n";
+}
+
+u64 HashSourceFile(const char* FileName)
+{
+	FILE* file = fopen(FileName, "rb");
+
+	if (!file)
+		return 0;
+
+	const i32 bufferSize = 1024 * 1024;
+	u8* buffer = new u8[bufferSize];
+	u64 hash = 0xCBF29CE484222325ULL;
+	size_t readSize;
+
+	while ((readSize = fread(buffer, 1, bufferSize, file)) > 0)
+	{
+		for (size_t i = 0; i < readSize; ++i)
+		{
+			hash ^= buffer[i];
+			hash *= 0x100000001B3ULL;
+		}
+	}
+
+	delete[] buffer;
+	fclose(file);
+
+	return hash;
+}
+
+i32 MarkDirtyCells(u8* DirtyCells, i32 X, i32 Y, i32 Width, i32 Height)
+{
+	for (i32 iY = Y; iY < Y + Height; ++iY)
+	{
+		for (i32 iX = X; iX < X + Width; ++iX)
+			DirtyCells[iY * 1024 + iX] = 1;
+	}
+
+	return Width * Height;
+}
+
+// Compares the textures against the manifest of the last build and marks the cells of any texture added, moved, changed or removed.
+// Returns false if there is no usable previous build.
+bool LoadManifest(vsPageWriter* Writer, vsManifestTexture* Textures, i32 TextureCount, i32* DirtyCellCount)
+{
+	char fileName[512];
+	GetPageFilePath("manifest.dat", fileName);
+
+	FILE* file = fopen(fileName, "rb");
+
+	if (!file)
+		return false;
+
+	u32 header[3] = {};
+	fread(header, sizeof(header), 1, file);
+
+	if (header[0] != PAGE_MANIFEST_MAGIC || header[1] != PAGE_MANIFEST_VERSION)
+	{
+		std::cout << "Page manifest is out of date\n";
+		fclose(file);
+		return false;
+	}
+
+	i32 previousTextureCount = header[2];
+	vsManifestTexture* previousTextures = new vsManifestTexture[previousTextureCount];
+	fread(previousTextures, sizeof(vsManifestTexture), previousTextureCount, file);
+
+	i32 pageCount = 0;
+	fread(&pageCount, sizeof(i32), 1, file);
+
+	vsPreviousBuild* previous = new vsPreviousBuild();
+	previous->pageHashes = new u64[maxPages];
+
+	bool valid = (pageCount == maxPages)
+		&& fread(previous->pageHashes, sizeof(u64), maxPages, file) == maxPages
+		&& fread(Writer->mipTempChannel0, 1024 * 1024 * 4, 1, file) == 1
+		&& fread(Writer->mipTempChannel1, 1024 * 1024 * 4, 1, file) == 1;
+
+	fclose(file);
+
+	if (!valid)
+	{
+		std::cout << "Page manifest is incomplete\n";
+		delete[] previous->pageHashes;
+		delete previous;
+		delete[] previousTextures;
+		return false;
+	}
+
+	// NOTE: Textures never overlap, so a texture is unchanged if the previous one at its origin matches exactly.
+	i32* previousIdTable = new i32[1024 * 1024];
+	bool* previousMatched = new bool[previousTextureCount];
+
+	for (i32 i = 0; i < 1024 * 1024; ++i)
+		previousIdTable[i] = -1;
+
+	for (i32 i = 0; i < previousTextureCount; ++i)
+	{
+		previousIdTable[previousTextures[i].y * 1024 + previousTextures[i].x] = i;
+		previousMatched[i] = false;
+	}
+
+	i32 dirtyCount = 0;
+
+	for (i32 i = 0; i < TextureCount; ++i)
+	{
+		vsManifestTexture* t = &Textures[i];
+		i32 previousIndex = previousIdTable[t->y * 1024 + t->x];
+
+		if (previousIndex != -1 && memcmp(t, &previousTextures[previousIndex], sizeof(vsManifestTexture)) == 0)
+			previousMatched[previousIndex] = true;
+		else
+			dirtyCount += MarkDirtyCells(Writer->dirtyCells, t->x, t->y, t->width, t->height);
+	}
+
+	for (i32 i = 0; i < previousTextureCount; ++i)
+	{
+		vsManifestTexture* t = &previousTextures[i];
+
+		if (!previousMatched[i])
+			dirtyCount += MarkDirtyCells(Writer->dirtyCells, t->x, t->y, t->width, t->height);
+	}
+
+	delete[] previousIdTable;
+	delete[] previousMatched;
+	delete[] previousTextures;
+
+	Writer->previous = previous;
+	*DirtyCellCount = dirtyCount;
+
+	return true;
+}
+
+// Moves the last build aside so unchanged pages can be copied from it into the new files.
+bool OpenPreviousBuild(vsPreviousBuild* Previous)
+{
+	char pageFileName[512];
+	char indexFileName[512];
+	char prevPageFileName[512];
+	char prevIndexFileName[512];
+	GetPageFilePath("page.dat", pageFileName);
+	GetPageFilePath("index.dat", indexFileName);
+	GetPageFilePath("page.prev.dat", prevPageFileName);
+	GetPageFilePath("index.prev.dat", prevIndexFileName);
+
+	remove(prevPageFileName);
+	remove(prevIndexFileName);
+
+	if (rename(pageFileName, prevPageFileName) != 0 || rename(indexFileName, prevIndexFileName) != 0)
+		return false;
+
+	FILE* indexFile = fopen(prevIndexFileName, "rb");
+	Previous->pageFile = fopen(prevPageFileName, "rb");
+
+	if (!indexFile || !Previous->pageFile)
+		return false;
+
+	Previous->indexEntries = new i64[maxPages];
+	i32 metaDataSize = 0;
+
+	bool valid = fread(Previous->indexEntries, sizeof(i64), maxPages, indexFile) == maxPages
+		&& fread(&metaDataSize, sizeof(i32), 1, indexFile) == 1
+		&& metaDataSize == XR_META_SIZE
+		&& fread(Previous->xrHeader, XR_META_SIZE, 1, indexFile) == 1
+		&& fread(&Previous->constantCount, sizeof(i32), 1, indexFile) == 1;
+
+	if (valid)
+	{
+		Previous->constantColors = new u32[Previous->constantCount * 2];
+		valid = fread(Previous->constantColors, sizeof(u32) * 2, Previous->constantCount, indexFile) == (size_t)Previous->constantCount;
+	}
 
 	fclose(indexFile);
-	fclose(pageFile);
 
-	HdpEncodeImageRGBA("pages\\usageMap.jxr", mipTempChannel0, 1024, 1024);
+	return valid;
+}
 
-	std::cout << "Page Builder Complete\n";
-	std::cout << "Mip Memory Usage: " << ((double)mipCacheMemory / 1024.0 / 1024.0) << "mb\n";
+void FreePreviousBuild(vsPreviousBuild* Previous)
+{
+	if (Previous->pageFile)
+		fclose(Previous->pageFile);
+
+	delete[] Previous->indexEntries;
+	delete[] Previous->pageHashes;
+	delete[] Previous->constantColors;
+	delete Previous;
+}
+
+void SaveManifest(vsPageWriter* Writer)
+{
+	char fileName[512];
+	GetPageFilePath("manifest.dat", fileName);
+
+	FILE* file = fopen(fileName, "wb");
+
+	u32 header[3] = { PAGE_MANIFEST_MAGIC, PAGE_MANIFEST_VERSION, (u32)textureCount };
+	fwrite(header, sizeof(header), 1, file);
+
+	for (i32 i = 0; i < textureCount; ++i)
+	{
+		vsManifestTexture entry = {};
+		entry.x = textures[i].x;
+		entry.y = textures[i].y;
+		entry.width = textures[i].width;
+		entry.height = textures[i].height;
+		memcpy(entry.sourceHash, textures[i].image->sourceHash, sizeof(entry.sourceHash));
+		fwrite(&entry, sizeof(entry), 1, file);
+	}
+
+	fwrite(&maxPages, sizeof(i32), 1, file);
+	fwrite(Writer->pageHashes, sizeof(u64), maxPages, file);
+
+	// NOTE: The packed level 7 image, a rebuild only recomposites its dirty pages into it.
+	fwrite(Writer->mipTempChannel0, 1024 * 1024 * 4, 1, file);
+	fwrite(Writer->mipTempChannel1, 1024 * 1024 * 4, 1, file);
+
+	fclose(file);
+}
+
+void MarkDirtyPages(vsPageWriter* Writer, i32 MipPages)
+{
+	i32 mipCoverage = 1024 / MipPages;
+
+	for (i32 iY = 0; iY < MipPages; ++iY)
+	{
+		for (i32 iX = 0; iX < MipPages; ++iX)
+		{
+			u8 dirty = 0;
+
+			for (i32 cY = iY * mipCoverage; cY < (iY + 1) * mipCoverage && !dirty; ++cY)
+			{
+				for (i32 cX = iX * mipCoverage; cX < (iX + 1) * mipCoverage; ++cX)
+				{
+					if (Writer->dirtyCells[cY * 1024 + cX])
+					{
+						dirty = 1;
+						break;
+					}
+				}
+			}
+
+			Writer->dirtyPages[iY * MipPages + iX] = dirty;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Benchmarks.
+//-----------------------------------------------------------------------------------------------------------
+void BenchmarkMipReduce(i32 Size)
+{
+	std::cout << "Benchmarking mip reduction on " << Size << "x" << Size << "...\n";
+
+	// NOTE: Smooth gradients with noise on top, flat colour would flatter every filter.
+	u8* src = new u8[(i64)Size * Size * 4];
+	u32 seed = 0x12345678;
+
+	for (i64 y = 0; y < Size; ++y)
+	{
+		for (i64 x = 0; x < Size; ++x)
+		{
+			seed = seed * 1664525 + 1013904223;
+			u8* p = src + (y * Size + x) * 4;
+			p[0] = (u8)((x * 255) / Size + ((seed >> 24) & 15));
+			p[1] = (u8)((y * 255) / Size + ((seed >> 16) & 15));
+			p[2] = (u8)(((x + y) * 127) / Size + ((seed >> 8) & 15));
+			p[3] = (u8)(seed & 0xFF);
+		}
+	}
+
+	i32 dstSize = Size / 2;
+	i64 dstBytes = (i64)dstSize * dstSize * 4;
+	u8* reference = new u8[dstBytes];
+	u8* dst = new u8[dstBytes];
+
+	double time = GetTime();
+	stbir_resize_uint8(src, Size, Size, 0, reference, dstSize, dstSize, 0, 4);
+	time = GetTime() - time;
+
+	double megaPixels = (double)Size * Size / 1000000.0;
+	std::cout << "stbir: " << (time * 1000.0) << "ms, " << (megaPixels / time) << " MP/s\n";
+
+	i32 threadCounts[] = { 1, GetMax((i32)std::thread::hardware_concurrency(), 1) };
+	i32 threadRuns = (threadCounts[1] > 1) ? 2 : 1;
+
+	for (i32 filter = MIP_FILTER_BOX; filter <= MIP_FILTER_KAISER; ++filter)
+	{
+		for (i32 srgb = 0; srgb < 2; ++srgb)
+		{
+			for (i32 run = 0; run < threadRuns; ++run)
+			{
+				i32 threads = threadCounts[run];
+				time = GetTime();
+				MipReduceRGBA8(src, Size, Size, dst, (vsMipFilter)filter, srgb != 0, threads);
+				time = GetTime() - time;
+
+				// Difference from stbir, only as a sanity check since the filters differ.
+				double error = 0.0;
+
+				for (i64 i = 0; i < dstBytes; ++i)
+				{
+					i32 d = (i32)dst[i] - (i32)reference[i];
+					error += d * d;
+				}
 
-	startTime = GetTime() - startTime;
+				double mse = error / dstBytes;
+				double psnr = (mse > 0.0) ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
 
-	std::cout << "Seconds: " << startTime << "\n";
-}
\ No newline at end of file
+				std::cout << MipGetFilterName((vsMipFilter)filter) << (srgb ? " sRGB" : " linear") << " " << threads << " threads: " << (time * 1000.0) << "ms, " << (megaPixels / time) << " MP/s, PSNR vs stbir " << psnr << "\n";
+			}
+		}
+	}
+
+	delete[] src;
+	delete[] reference;
+	delete[] dst;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Placement.
+//-----------------------------------------------------------------------------------------------------------
+// NOTE: Images are packed into the page space as a buddy quadtree. Each one starts on a power of two block
+// aligned to its own size, so it shares no pages with other images until the mip where it is a single page.
+// Only the pages an image covers are marked used, so the rest of its block stays free for smaller images.
+struct vsPlacementTree
+{
+	// Used pages under each node, level k has nodes of 1 << k pages.
+	i32*	usedCount[11];
+	// Nodes before this in Morton order are never free again.
+	i32		nextFree[11];
+};
+
+void MarkPlacementPages(vsPlacementTree* Tree, i32 X, i32 Y, i32 Width, i32 Height)
+{
+	for (i32 iY = Y; iY < Y + Height; ++iY)
+	{
+		for (i32 iX = X; iX < X + Width; ++iX)
+		{
+			for (i32 k = 0; k < 11; ++k)
+				++Tree->usedCount[k][(iY >> k) * (1024 >> k) + (iX >> k)];
+		}
+	}
+}
+
+// Finds the first free node of the level in Morton order, returns false if the level is full.
+bool FindFreePlacementNode(vsPlacementTree* Tree, i32 Level, i32* NodeX, i32* NodeY)
+{
+	i32 gridSize = 1024 >> Level;
+
+	for (i32 i = Tree->nextFree[Level]; i < gridSize * gridSize; ++i)
+	{
+		i32 x = 0;
+		i32 y = 0;
+
+		for (i32 b = 0; b < 10; ++b)
+		{
+			x |= ((i >> (b * 2 + 0)) & 1) << b;
+			y |= ((i >> (b * 2 + 1)) & 1) << b;
+		}
+
+		if (Tree->usedCount[Level][y * gridSize + x] == 0)
+		{
+			Tree->nextFree[Level] = i;
+			*NodeX = x;
+			*NodeY = y;
+			return true;
+		}
+	}
+
+	Tree->nextFree[Level] = gridSize * gridSize;
+
+	return false;
+}
+
+// Places every image as one texture, largest first. Textures added by hand before this are packed around.
+void PlaceImages(vsImageDef** Images, i32 Count)
+{
+	vsPlacementTree tree = {};
+
+	for (i32 k = 0; k < 11; ++k)
+	{
+		i32 gridSize = 1024 >> k;
+		tree.usedCount[k] = new i32[gridSize * gridSize];
+		memset(tree.usedCount[k], 0, sizeof(i32) * gridSize * gridSize);
+	}
+
+	for (i32 i = 0; i < textureCount; ++i)
+		MarkPlacementPages(&tree, textures[i].x, textures[i].y, textures[i].width, textures[i].height);
+
+	i32* levels = new i32[Count];
+
+	for (i32 i = 0; i < Count; ++i)
+	{
+		ProbeSourceImage(Images[i]);
+
+		i32 pages = GetMax((Images[i]->width + 127) / 128, (Images[i]->height + 127) / 128);
+		levels[i] = 0;
+
+		while ((1 << levels[i]) < pages)
+			++levels[i];
+	}
+
+	// NOTE: Stable insertion sort, the same image list always packs the same way so incremental builds stay valid.
+	for (i32 i = 1; i < Count; ++i)
+	{
+		for (i32 j = i; j > 0 && levels[j - 1] < levels[j]; --j)
+		{
+			i32 level = levels[j];
+			levels[j] = levels[j - 1];
+			levels[j - 1] = level;
+
+			vsImageDef* image = Images[j];
+			Images[j] = Images[j - 1];
+			Images[j - 1] = image;
+		}
+	}
+
+	i32 usedPages = 0;
+	i32 boundsX = 0;
+	i32 boundsY = 0;
+
+	for (i32 i = 0; i < Count; ++i)
+	{
+		vsImageDef* image = Images[i];
+		i32 nodeX, nodeY;
+
+		if (levels[i] > 10 || !FindFreePlacementNode(&tree, levels[i], &nodeX, &nodeY))
+		{
+			std::cout << "No space to place " << image->name << "\n";
+			continue;
+		}
+
+		i32 x = nodeX << levels[i];
+		i32 y = nodeY << levels[i];
+		i32 width = (image->width + 127) / 128;
+		i32 height = (image->height + 127) / 128;
+
+		AddTexture(x * 128, y * 128, image->width, image->height, image);
+		MarkPlacementPages(&tree, x, y, width, height);
+
+		usedPages += width * height;
+		boundsX = GetMax(boundsX, x + width);
+		boundsY = GetMax(boundsY, y + height);
+	}
+
+	std::cout << "Placed " << Count << " images in " << boundsX << "x" << boundsY << " pages, " << usedPages << " used\n";
+
+	for (i32 k = 0; k < 11; ++k)
+		delete[] tree.usedCount[k];
+
+	delete[] levels;
+}
+
+// Texel rects of every texture, the runtime turns these into the UV scale and bias of the meshes using them.
+void SavePlacementManifest()
+{
+	char fileName[512];
+	GetPageFilePath("placement.txt", fileName);
+
+	FILE* file = fopen(fileName, "w");
+
+	for (i32 i = 0; i < textureCount; ++i)
+	{
+		vsTextureDef* t = &textures[i];
+		fprintf(file, "%s %d %d %d %d\n", t->image->name, t->x * 128, t->y * 128, t->texelWidth, t->texelHeight);
+	}
+
+	fclose(file);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Page file layout.
+//-----------------------------------------------------------------------------------------------------------
+struct vsPageRelayout
+{
+	i64*	indexEntries;
+	FILE*	srcFile;
+	FILE*	dstFile;
+	i64		dstOffset;
+	// NOTE: Open addressed map from source page offsets to their new offsets, duplicates share one copy.
+	i64*	mapKeys;
+	i64*	mapValues;
+	i32		mapBits;
+	u8*		copyBuffer;
+	i32		copiedPageCount;
+};
+
+i64 RelayoutPage(vsPageRelayout* Relayout, i64 Entry)
+{
+	i32 size = (i32)((u64)Entry >> 48);
+	i64 offset = Entry & 0x0000FFFFFFFFFFFF;
+
+	if (size == PAGE_INDEX_SIZE_EMPTY || size == PAGE_INDEX_SIZE_CONSTANT)
+		return Entry;
+
+	i64 mapMask = (1LL << Relayout->mapBits) - 1;
+	i64 slot = (i64)(((u64)offset * 0x9E3779B97F4A7C15ULL) >> (64 - Relayout->mapBits));
+
+	while (Relayout->mapKeys[slot] != -1 && Relayout->mapKeys[slot] != offset)
+		slot = (slot + 1) & mapMask;
+
+	if (Relayout->mapKeys[slot] == -1)
+	{
+		_fseeki64(Relayout->srcFile, offset, SEEK_SET);
+		fread(Relayout->copyBuffer, size, 1, Relayout->srcFile);
+		fwrite(Relayout->copyBuffer, size, 1, Relayout->dstFile);
+
+		Relayout->mapKeys[slot] = offset;
+		Relayout->mapValues[slot] = Relayout->dstOffset;
+		Relayout->dstOffset += size;
+		++Relayout->copiedPageCount;
+	}
+
+	return Relayout->mapValues[slot] | ((i64)size << 48);
+}
+
+// Visits the page and then its four children in Z order.
+void RelayoutPageTree(vsPageRelayout* Relayout, i32 Mip, i32 X, i32 Y)
+{
+	i32 mipPages = 1024 >> Mip;
+	i64 mipBase = 0;
+
+	for (i32 m = 0; m < Mip; ++m)
+		mipBase += (i64)(1024 >> m) * (1024 >> m);
+
+	i64* entry = &Relayout->indexEntries[mipBase + Y * mipPages + X];
+	*entry = RelayoutPage(Relayout, *entry);
+
+	if (Mip == 0)
+		return;
+
+	for (i32 i = 0; i < 4; ++i)
+		RelayoutPageTree(Relayout, Mip - 1, X * 2 + (i & 1), Y * 2 + (i >> 1));
+}
+
+// Reads the layout stored at the end of index.dat. Returns false for index files written without one.
+bool ReadPageFileLayout(i32* Layout)
+{
+	char indexFileName[512];
+	GetPageFilePath("index.dat", indexFileName);
+
+	FILE* indexFile = fopen(indexFileName, "rb");
+
+	if (!indexFile)
+		return false;
+
+	i32 metaDataSize = 0;
+	i32 constantCount = 0;
+
+	bool valid = _fseeki64(indexFile, (i64)maxPages * sizeof(i64), SEEK_SET) == 0
+		&& fread(&metaDataSize, sizeof(i32), 1, indexFile) == 1
+		&& metaDataSize == XR_META_SIZE
+		&& _fseeki64(indexFile, XR_META_SIZE, SEEK_CUR) == 0
+		&& fread(&constantCount, sizeof(i32), 1, indexFile) == 1
+		&& _fseeki64(indexFile, (i64)constantCount * sizeof(u32) * 2, SEEK_CUR) == 0
+		&& fread(Layout, sizeof(i32), 1, indexFile) == 1;
+
+	fclose(indexFile);
+
+	return valid;
+}
+
+// Rewrites page.dat from CurrentLayout in the given layout and patches index.dat to match.
+// NOTE: Build order is row layout, so a fresh build only needs the extra pass over the page file for other layouts.
+// The old page file is kept aside until the new one is in place, and the index is only patched after that, so
+// a failure leaves the old pair intact.
+bool LayoutPageFile(i32 Layout, i32 CurrentLayout)
+{
+	if (Layout == CurrentLayout)
+		return true;
+
+	double layoutTime = GetTime();
+
+	char indexFileName[512];
+	char pageFileName[512];
+	char layoutFileName[512];
+	char backupFileName[512];
+	GetPageFilePath("index.dat", indexFileName);
+	GetPageFilePath("page.dat", pageFileName);
+	GetPageFilePath("page.layout.dat", layoutFileName);
+	GetPageFilePath("page.backup.dat", backupFileName);
+
+	vsPageRelayout relayout = {};
+	FILE* indexFile = fopen(indexFileName, "rb");
+	relayout.srcFile = fopen(pageFileName, "rb");
+	relayout.dstFile = fopen(layoutFileName, "wb");
+
+	if (!indexFile || !relayout.srcFile || !relayout.dstFile)
+	{
+		std::cout << "Can't open page files for layout\n";
+
+		if (indexFile)
+			fclose(indexFile);
+
+		if (relayout.srcFile)
+			fclose(relayout.srcFile);
+
+		if (relayout.dstFile)
+		{
+			fclose(relayout.dstFile);
+			remove(layoutFileName);
+		}
+
+		return false;
+	}
+
+	relayout.indexEntries = new i64[maxPages];
+	fread(relayout.indexEntries, sizeof(i64), maxPages, indexFile);
+	fclose(indexFile);
+
+	relayout.mapBits = 1;
+
+	while ((1LL << relayout.mapBits) < (i64)maxPages * 2)
+		++relayout.mapBits;
+
+	relayout.mapKeys = new i64[1LL << relayout.mapBits];
+	relayout.mapValues = new i64[1LL << relayout.mapBits];
+	memset(relayout.mapKeys, 0xFF, sizeof(i64) << relayout.mapBits);
+	relayout.copyBuffer = new u8[PAGE_INDEX_SIZE_CONSTANT];
+
+	if (Layout == PAGE_LAYOUT_MORTON)
+	{
+		RelayoutPageTree(&relayout, 10, 0, 0);
+	}
+	else
+	{
+		// Index order is build order.
+		for (i32 i = 0; i < maxPages; ++i)
+			relayout.indexEntries[i] = RelayoutPage(&relayout, relayout.indexEntries[i]);
+	}
+
+	fclose(relayout.srcFile);
+	fclose(relayout.dstFile);
+
+	delete[] relayout.mapKeys;
+	delete[] relayout.mapValues;
+	delete[] relayout.copyBuffer;
+
+	remove(backupFileName);
+	bool swapped = (rename(pageFileName, backupFileName) == 0);
+
+	if (swapped && rename(layoutFileName, pageFileName) != 0)
+	{
+		rename(backupFileName, pageFileName);
+		swapped = false;
+	}
+
+	indexFile = swapped ? fopen(indexFileName, "r+b") : NULL;
+
+	if (!indexFile)
+	{
+		std::cout << "Can't replace " << pageFileName << "\n";
+
+		if (swapped)
+		{
+			remove(pageFileName);
+			rename(backupFileName, pageFileName);
+		}
+		else
+		{
+			remove(layoutFileName);
+		}
+
+		delete[] relayout.indexEntries;
+
+		return false;
+	}
+
+	fwrite(relayout.indexEntries, sizeof(i64), maxPages, indexFile);
+
+	// NOTE: The layout is the last field of the index.
+	_fseeki64(indexFile, -(i64)sizeof(i32), SEEK_END);
+	fwrite(&Layout, sizeof(i32), 1, indexFile);
+	fclose(indexFile);
+
+	delete[] relayout.indexEntries;
+
+	remove(backupFileName);
+
+	layoutTime = GetTime() - layoutTime;
+	std::cout << "Laid out " << relayout.copiedPageCount << " pages in " << (Layout == PAGE_LAYOUT_MORTON ? "Z" : "row") << " order in " << layoutTime << "s\n";
+
+	return true;
+}
+
+// Writes index.vti from the finished index.dat, the renderer loads the compact index when it's there.
+bool WriteCompactPageIndex()
+{
+	char indexFileName[512];
+	char compactFileName[512];
+	GetPageFilePath("index.dat", indexFileName);
+	GetPageFilePath("index.vti", compactFileName);
+
+	vsPageIndex index;
+
+	if (!PageIndexLoadLegacy(&index, indexFileName, 11))
+	{
+		std::cout << "Can't read " << indexFileName << "\n";
+		return false;
+	}
+
+	bool saved = PageIndexSave(&index, compactFileName);
+
+	if (saved)
+		std::cout << "Compact page index: " << index.header->blockCount << " blocks, " << (index.header->fileSize / 1024) << "kb\n";
+	else
+		std::cout << "Can't write " << compactFileName << "\n";
+
+	PageIndexFree(&index);
+
+	return saved;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Build manifest.
+//-----------------------------------------------------------------------------------------------------------
+char* CopyManifestString(const char* String)
+{
+	char* result = new char[strlen(String) + 1];
+	strcpy(result, String);
+
+	return result;
+}
+
+// Text manifest, one whitespace separated entry per line, # starts a comment:
+//   image <name> <bc file> <nm file> <mr file>
+//   place <name> <x> <y>
+// Place pins an image at a texel position on the page grid, every other image is packed.
+bool LoadPageBuildManifest(const char* FileName)
+{
+	FILE* file = fopen(FileName, "r");
+
+	if (!file)
+	{
+		std::cout << "Can't open build manifest " << FileName << "\n";
+		return false;
+	}
+
+	bool* placed = new bool[maxImages];
+	memset(placed, 0, sizeof(bool) * maxImages);
+
+	bool valid = true;
+	char line[1024];
+	i32 lineNumber = 0;
+
+	while (fgets(line, sizeof(line), file))
+	{
+		++lineNumber;
+
+		char keyword[16];
+		char name[64];
+		char bcFileName[256];
+		char nmFileName[256];
+		char mrFileName[256];
+		i32 x, y;
+
+		if (sscanf(line, "%15s", keyword) != 1 || keyword[0] == '#')
+			continue;
+
+		if (strcmp(keyword, "image") == 0 && sscanf(line, "%*s %63s %255s %255s %255s", name, bcFileName, nmFileName, mrFileName) == 4)
+		{
+			AddImage(CopyManifestString(name), CopyManifestString(bcFileName), CopyManifestString(nmFileName), CopyManifestString(mrFileName));
+		}
+		else if (strcmp(keyword, "place") == 0 && sscanf(line, "%*s %63s %d %d", name, &x, &y) == 3)
+		{
+			i32 imageIndex = -1;
+
+			for (i32 i = 0; i < imageCount && imageIndex == -1; ++i)
+			{
+				if (strcmp(images[i].name, name) == 0)
+					imageIndex = i;
+			}
+
+			if (imageIndex == -1 || placed[imageIndex] || (x % 128) != 0 || (y % 128) != 0)
+			{
+				std::cout << FileName << "(" << lineNumber << "): Can't place " << name << ", it must be a declared image placed once on a 128 texel boundary\n";
+				valid = false;
+				continue;
+			}
+
+			vsImageDef* image = &images[imageIndex];
+			ProbeSourceImage(image);
+			AddTexture(x, y, image->width, image->height, image);
+			placed[imageIndex] = true;
+		}
+		else
+		{
+			std::cout << FileName << "(" << lineNumber << "): Can't parse " << line;
+			valid = false;
+		}
+	}
+
+	fclose(file);
+
+	vsImageDef** placeImages = new vsImageDef*[imageCount];
+	i32 placeCount = 0;
+
+	for (i32 i = 0; i < imageCount; ++i)
+	{
+		if (!placed[i])
+			placeImages[placeCount++] = &images[i];
+	}
+
+	if (valid && placeCount > 0)
+		PlaceImages(placeImages, placeCount);
+
+	delete[] placeImages;
+	delete[] placed;
+
+	return valid;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Page build.
+//-----------------------------------------------------------------------------------------------------------
+void FreePageWriter(vsPageWriter* Writer)
+{
+	for (i32 i = 0; i < pageHashBucketCount; ++i)
+	{
+		vsPageHashNode* node = Writer->pageHashMap[i];
+
+		while (node)
+		{
+			vsPageHashNode* next = node->next;
+			delete[] node->encodedChannel0;
+			delete[] node->encodedChannel1;
+			delete node;
+			node = next;
+		}
+	}
+
+	if (Writer->previous)
+		FreePreviousBuild(Writer->previous);
+
+	for (i32 i = 0; i < 3; ++i)
+	{
+		delete[] Writer->finalMipChannel0[i];
+		delete[] Writer->finalMipChannel1[i];
+	}
+
+	delete[] Writer->constantColors;
+	delete[] Writer->pageHashes;
+	delete[] Writer->dirtyCells;
+	delete[] Writer->dirtyPages;
+	delete[] Writer->mipTempChannel0;
+	delete[] Writer->mipTempChannel1;
+	delete Writer;
+}
+
+// Builds the page and index files for every texture added so far, rebuilding only pages over changed textures
+// when a previous build and manifest exist. Returns false if the output files can't be written.
+// NOTE: Pass FullRebuild to ignore the previous build.
+bool BuildPageFiles(bool FullRebuild, i32 Layout, double StartTime)
+{
+	i32 mipCount = 11;
+	i32 workerCount = GetMax((i32)std::thread::hardware_concurrency(), 1);
+	std::cout << "Page builder workers: " << workerCount << "\n";
+
+	vsPageWriter* writer = new vsPageWriter();
+	writer->constantColors = new u32[maxPages * 2];
+	writer->pageHashes = new u64[maxPages];
+	writer->dirtyCells = new u8[1024 * 1024];
+	writer->dirtyPages = new u8[1024 * 1024];
+
+	writer->mipTempChannel0 = new u8[1024 * 1024 * 4];
+	writer->mipTempChannel1 = new u8[1024 * 1024 * 4];
+	
+	memset(writer->mipTempChannel0, 0, 1024 * 1024 * 4);
+	memset(writer->mipTempChannel1, 0, 1024 * 1024 * 4);
+	memset(writer->dirtyCells, 0, 1024 * 1024);
+
+	// Content hashes decide which textures changed since the last build.
+	for (i32 i = 0; i < imageCount; ++i)
+	{
+		images[i].sourceHash[0] = HashSourceFile(images[i].bcFileName);
+		images[i].sourceHash[1] = HashSourceFile(images[i].nmFileName);
+		images[i].sourceHash[2] = HashSourceFile(images[i].mrFileName);
+	}
+
+	vsManifestTexture* manifestTextures = new vsManifestTexture[textureCount];
+
+	for (i32 i = 0; i < textureCount; ++i)
+	{
+		vsManifestTexture* entry = &manifestTextures[i];
+		memset(entry, 0, sizeof(vsManifestTexture));
+		entry->x = textures[i].x;
+		entry->y = textures[i].y;
+		entry->width = textures[i].width;
+		entry->height = textures[i].height;
+		memcpy(entry->sourceHash, textures[i].image->sourceHash, sizeof(entry->sourceHash));
+	}
+
+	i32 dirtyCellCount = 0;
+	bool loadedManifest = !FullRebuild && LoadManifest(writer, manifestTextures, textureCount, &dirtyCellCount);
+	delete[] manifestTextures;
+
+	if (loadedManifest && dirtyCellCount == 0)
+	{
+		i32 previousLayout = PAGE_LAYOUT_ROW;
+
+		// NOTE: The pages are current but may still need to move to the requested layout.
+		if (ReadPageFileLayout(&previousLayout))
+		{
+			std::cout << "No textures changed, pages are up to date\n";
+			FreePageWriter(writer);
+
+			return LayoutPageFile(Layout, previousLayout) && WriteCompactPageIndex();
+		}
+
+		std::cout << "Page index is unreadable, rebuilding everything\n";
+		FreePreviousBuild(writer->previous);
+		writer->previous = NULL;
+	}
+	else if (loadedManifest)
+	{
+		std::cout << "Incremental page build, " << dirtyCellCount << " dirty cells\n";
+
+		if (!OpenPreviousBuild(writer->previous))
+		{
+			std::cout << "Previous page build is unreadable, rebuilding everything\n";
+			FreePreviousBuild(writer->previous);
+			writer->previous = NULL;
+		}
+	}
+
+	if (writer->previous == NULL)
+	{
+		memset(writer->mipTempChannel0, 0, 1024 * 1024 * 4);
+		memset(writer->mipTempChannel1, 0, 1024 * 1024 * 4);
+		memset(writer->dirtyCells, 1, 1024 * 1024);
+	}
+
+	char fileName[512];
+	GetPageFilePath("page.dat", fileName);
+	writer->pageFile = fopen(fileName, "wb");
+	GetPageFilePath("index.dat", fileName);
+	writer->indexFile = fopen(fileName, "wb");
+
+	if (!writer->pageFile || !writer->indexFile)
+	{
+		std::cout << "Can't create page files in " << pageOutputDirectory << "\n";
+
+		if (writer->pageFile)
+			fclose(writer->pageFile);
+
+		if (writer->indexFile)
+			fclose(writer->indexFile);
+
+		FreePageWriter(writer);
+
+		return false;
+	}
+	
+	// Loop Mip Levels
+	for (i32 m = 0; m < 8; ++m)
+	{
+		i32 mipPages = 1 << (mipCount - m - 1);
+		MarkDirtyPages(writer, mipPages);
+
+		// NOTE: Workers pull mips through the cache as pages need them, so only textures under dirty pages are loaded.
+		BuildMipLevel(writer, m, mipPages, workerCount);
+	}
+
+	// Finish the remaining mip levels.
+	std::cout << "Preparing final mips\n";
+
+	for (i32 i = 0; i < 3; ++i)
+	{
+		i32 mipWidth = 512 >> i;
+		writer->finalMipChannel0[i] = new u8[mipWidth * mipWidth * 4];
+		writer->finalMipChannel1[i] = new u8[mipWidth * mipWidth * 4];
+	}
+
+	MipReduceRGBA8(writer->mipTempChannel0, 1024, 1024, writer->finalMipChannel0[0], pageMipFilter, true);
+	MipReduceRGBA8(writer->finalMipChannel0[0], 512, 512, writer->finalMipChannel0[1], pageMipFilter, true);
+	MipReduceRGBA8(writer->finalMipChannel0[1], 256, 256, writer->finalMipChannel0[2], pageMipFilter, true);
+
+	MipReduceRGBA8(writer->mipTempChannel1, 1024, 1024, writer->finalMipChannel1[0], pageMipFilter, false);
+	MipReduceRGBA8(writer->finalMipChannel1[0], 512, 512, writer->finalMipChannel1[1], pageMipFilter, false);
+	MipReduceRGBA8(writer->finalMipChannel1[1], 256, 256, writer->finalMipChannel1[2], pageMipFilter, false);
+
+	std::cout << "Outputting final mips\n";
+
+	// NOTE: The final levels filter across the whole packed image, so they are always rebuilt.
+	memset(writer->dirtyPages, 1, 1024 * 1024);
+
+	for (i32 m = 8; m < 11; ++m)
+		BuildMipLevel(writer, m, 1 << (mipCount - m - 1), workerCount);
+
+	// NOTE: Header comes from the last page written, so at least one page must have been encoded or copied.
+	assert(writer->encodedPageCount + writer->reusedPageCount > 0);
+
+	i32 metaDataSize = XR_META_SIZE;
+	fwrite(&metaDataSize, sizeof(i32), 1, writer->indexFile);
+	fwrite(writer->xrHeader, XR_META_SIZE, 1, writer->indexFile);
+
+	// Constant page colours.
+	fwrite(&writer->constantCount, sizeof(i32), 1, writer->indexFile);
+	fwrite(writer->constantColors, sizeof(u32) * 2, writer->constantCount, writer->indexFile);
+
+	fwrite(&Layout, sizeof(i32), 1, writer->indexFile);
+
+	fclose(writer->indexFile);
+	fclose(writer->pageFile);
+
+	if (!LayoutPageFile(Layout, PAGE_LAYOUT_ROW) || !WriteCompactPageIndex())
+	{
+		FreePageWriter(writer);
+		return false;
+	}
+
+	SaveManifest(writer);
+	SavePlacementManifest();
+	RemoveSpillFiles();
+
+	if (writer->previous)
+	{
+		fclose(writer->previous->pageFile);
+		writer->previous->pageFile = NULL;
+		GetPageFilePath("page.prev.dat", fileName);
+		remove(fileName);
+		GetPageFilePath("index.prev.dat", fileName);
+		remove(fileName);
+	}
+
+	i32 totalPageCount = writer->encodedPageCount + writer->constantPageCount + writer->duplicatePageCount + writer->reusedPageCount;
+	std::cout << "Pages encoded: " << writer->encodedPageCount << " constant: " << writer->constantPageCount << " duplicate: " << writer->duplicatePageCount << " reused: " << writer->reusedPageCount << "\n";
+
+	GetPageFilePath("usageMap.jxr", fileName);
+	HdpEncodeImageRGBA(fileName, writer->mipTempChannel0, 1024, 1024);
+
+	std::cout << "Page Builder Complete\n";
+	std::cout << "Mip cache peak: " << ((double)mipCachePeakMemory / 1024.0 / 1024.0) << "mb, loads: " << mipCacheLoadCount << " evictions: " << mipCacheEvictCount << "\n";
+
+	double seconds = GetTime() - StartTime;
+
+	std::cout << "Seconds: " << seconds << ", " << (totalPageCount / seconds) << " pages/s\n";
+
+	FreePageWriter(writer);
+
+	return true;
+}
+
+// Builds the demo scene's textures.
+void BuildPages(bool FullRebuild)
+{	
+	double startTime = GetTime();
+
+	ClearTextureQuadTree();
+
+	AddImage("baron", "rawTextures\\baron_bc.png", "rawTextures\\baron_nm.png", "rawTextures\\baron_mr.png");
+	AddImage("radarDome", "rawTextures\\radarDome_bc.png", "rawTextures\\blank4k_nm.png", "rawTextures\\radarDome_mr.png");
+	AddImage("connector", "rawTextures\\connector_bc.png", "rawTextures\\blank4k_nm.png", "rawTextures\\baron_mr.png");
+	AddImage("capsule", "rawTextures\\capsule_bc.png", "rawTextures\\blank4k_nm.png", "rawTextures\\capsule_mr.png");
+
+	/*
+	for (i32 iX = 0; iX < 16; ++iX)
+		for (i32 iY = 0; iY < 16; ++iY)
+		{
+			AddTexture(iX * 4096, iY * 4096, 4096, 4096, &images[2]);
+		}
+	//*/
+
+	// NOTE: Textures can still be placed by hand with AddTexture before packing, overlaps are rejected.
+	//AddTexture(4096 * 16, 0, 4096, 4096, &images[0]);
+
+	vsImageDef* placeImages[] = { &images[0], &images[1], &images[3] };
+	PlaceImages(placeImages, ARRAY_COUNT(placeImages));
+
+	BuildPageFiles(FullRebuild, PAGE_LAYOUT_MORTON, startTime);
+}
+
+bool BuildPagesFromManifest(const char* ManifestFileName, const char* OutputDirectory, bool FullRebuild, i32 Layout)
+{
+	double startTime = GetTime();
+
+	ClearTextureQuadTree();
+
+	if (strlen(OutputDirectory) >= sizeof(pageOutputDirectory))
+	{
+		std::cout << "Output directory name is too long\n";
+		return false;
+	}
+
+	strcpy(pageOutputDirectory, OutputDirectory);
+
+	if (!LoadPageBuildManifest(ManifestFileName))
+		return false;
+
+	if (textureCount == 0)
+	{
+		std::cout << "Build manifest " << ManifestFileName << " has no textures\n";
+		return false;
+	}
+
+	return BuildPageFiles(FullRebuild, Layout, startTime);
+}
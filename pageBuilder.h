@@ -2,4 +2,11 @@
 
 #include "shared.h"
 
-void BuildPages();
\ No newline at end of file
+// Builds the demo scene's textures into pages.
+void BuildPages(bool FullRebuild = false);
+// Builds the images listed in a text manifest into OutputDirectory, see LoadPageBuildManifest for the format.
+// NOTE: Needs no window or GL context, the vtbuild tool is a thin wrapper around this.
+// Layout is one of PAGE_LAYOUT_*.
+bool BuildPagesFromManifest(const char* ManifestFileName, const char* OutputDirectory, bool FullRebuild = false, i32 Layout = PAGE_LAYOUT_MORTON);
+// Times the builder's mip reduction against stbir on a Size x Size image.
+void BenchmarkMipReduce(i32 Size);
@@ -0,0 +1,280 @@
+#include "pageIndex.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#endif
+
+//-----------------------------------------------------------------------------------------------------------
+// Layout.
+//-----------------------------------------------------------------------------------------------------------
+static i64 PageIndexAlign(i64 Offset)
+{
+	return (Offset + 7) & ~7LL;
+}
+
+// Points the index at a complete file image, returns false if it isn't a valid index.
+static bool PageIndexAttach(vsPageIndex* Index, u8* Data, i64 DataSize)
+{
+	vsPageIndexHeader* header = (vsPageIndexHeader*)Data;
+
+	if (DataSize < (i64)sizeof(vsPageIndexHeader) || header->magic != PAGE_INDEX_MAGIC || header->version != PAGE_INDEX_VERSION
+		|| header->mipCount > PAGE_INDEX_MAX_MIPS || header->fileSize != DataSize)
+	{
+		return false;
+	}
+
+	Index->data = Data;
+	Index->header = header;
+
+	for (i32 m = 0; m < header->mipCount; ++m)
+		Index->blockTables[m] = (u32*)(Data + header->blockTableOffset[m]);
+
+	Index->blocks = (i64*)(Data + header->blocksOffset);
+	Index->xrHeader = Data + header->xrHeaderOffset;
+	Index->constantColors = (u32*)(Data + header->constantsOffset);
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Entry points.
+//-----------------------------------------------------------------------------------------------------------
+void PageIndexCreate(vsPageIndex* Index, i64* Entries, i32 MipCount, i32 Layout, u8* XrHeader, i32 XrHeaderSize, u32* ConstantColors, i32 ConstantCount)
+{
+	assert(MipCount <= PAGE_INDEX_MAX_MIPS);
+
+	vsPageIndexHeader header = {};
+	header.magic = PAGE_INDEX_MAGIC;
+	header.version = PAGE_INDEX_VERSION;
+	header.mipCount = MipCount;
+	header.layout = Layout;
+	header.xrHeaderSize = XrHeaderSize;
+	header.constantCount = ConstantCount;
+
+	// Count the blocks holding at least one page.
+	i64 offset = sizeof(vsPageIndexHeader);
+	i64* mipEntries = Entries;
+
+	for (i32 m = 0; m < MipCount; ++m)
+	{
+		i32 mipPages = 1 << (MipCount - m - 1);
+		i32 blocksWide = (mipPages + PAGE_INDEX_BLOCK_SIZE - 1) / PAGE_INDEX_BLOCK_SIZE;
+
+		header.blocksWide[m] = blocksWide;
+		header.blockTableOffset[m] = offset;
+		offset += (i64)blocksWide * blocksWide * sizeof(u32);
+
+		for (i32 bY = 0; bY < blocksWide; ++bY)
+		{
+			for (i32 bX = 0; bX < blocksWide; ++bX)
+			{
+				bool used = false;
+
+				for (i32 y = bY * PAGE_INDEX_BLOCK_SIZE; y < GetMin((bY + 1) * PAGE_INDEX_BLOCK_SIZE, mipPages) && !used; ++y)
+				{
+					for (i32 x = bX * PAGE_INDEX_BLOCK_SIZE; x < GetMin((bX + 1) * PAGE_INDEX_BLOCK_SIZE, mipPages); ++x)
+					{
+						if (mipEntries[y * mipPages + x] != 0)
+						{
+							used = true;
+							break;
+						}
+					}
+				}
+
+				if (used)
+					++header.blockCount;
+			}
+		}
+
+		mipEntries += (i64)mipPages * mipPages;
+	}
+
+	header.blocksOffset = PageIndexAlign(offset);
+	header.xrHeaderOffset = header.blocksOffset + (i64)header.blockCount * PAGE_INDEX_BLOCK_SIZE * PAGE_INDEX_BLOCK_SIZE * sizeof(i64);
+	header.constantsOffset = PageIndexAlign(header.xrHeaderOffset + XrHeaderSize);
+	header.fileSize = header.constantsOffset + (i64)ConstantCount * sizeof(u32) * 2;
+
+	u8* data = new u8[header.fileSize];
+	memset(data, 0, header.fileSize);
+	memcpy(data, &header, sizeof(vsPageIndexHeader));
+
+	*Index = {};
+	PageIndexAttach(Index, data, header.fileSize);
+
+	// Fill the tables and blocks in the same order they were counted.
+	u32 blockCount = 0;
+	mipEntries = Entries;
+
+	for (i32 m = 0; m < MipCount; ++m)
+	{
+		i32 mipPages = 1 << (MipCount - m - 1);
+		i32 blocksWide = header.blocksWide[m];
+
+		for (i32 bY = 0; bY < blocksWide; ++bY)
+		{
+			for (i32 bX = 0; bX < blocksWide; ++bX)
+			{
+				i64* block = Index->blocks + (i64)blockCount * PAGE_INDEX_BLOCK_SIZE * PAGE_INDEX_BLOCK_SIZE;
+				bool used = false;
+
+				for (i32 y = bY * PAGE_INDEX_BLOCK_SIZE; y < GetMin((bY + 1) * PAGE_INDEX_BLOCK_SIZE, mipPages); ++y)
+				{
+					for (i32 x = bX * PAGE_INDEX_BLOCK_SIZE; x < GetMin((bX + 1) * PAGE_INDEX_BLOCK_SIZE, mipPages); ++x)
+					{
+						i64 entry = mipEntries[y * mipPages + x];
+						used |= (entry != 0);
+						block[(y % PAGE_INDEX_BLOCK_SIZE) * PAGE_INDEX_BLOCK_SIZE + (x % PAGE_INDEX_BLOCK_SIZE)] = entry;
+					}
+				}
+
+				if (used)
+					Index->blockTables[m][bY * blocksWide + bX] = ++blockCount;
+			}
+		}
+
+		mipEntries += (i64)mipPages * mipPages;
+	}
+
+	assert(blockCount == (u32)header.blockCount);
+
+	memcpy(Index->xrHeader, XrHeader, XrHeaderSize);
+
+	if (ConstantCount > 0)
+		memcpy(Index->constantColors, ConstantColors, (size_t)ConstantCount * sizeof(u32) * 2);
+}
+
+bool PageIndexSave(vsPageIndex* Index, const char* FileName)
+{
+	FILE* file = fopen(FileName, "wb");
+
+	if (!file)
+		return false;
+
+	bool written = fwrite(Index->data, (size_t)Index->header->fileSize, 1, file) == 1;
+	fclose(file);
+
+	return written;
+}
+
+bool PageIndexLoad(vsPageIndex* Index, const char* FileName)
+{
+	*Index = {};
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(file, &fileSize);
+
+	// NOTE: The mapping keeps the file open, our handle isn't needed past this point.
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+
+	if (mapping == NULL)
+		return false;
+
+	u8* data = (u8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if (data == NULL || !PageIndexAttach(Index, data, fileSize.QuadPart))
+	{
+		if (data)
+			UnmapViewOfFile(data);
+
+		CloseHandle(mapping);
+		*Index = {};
+		return false;
+	}
+
+	Index->mapping = mapping;
+#else
+	FILE* file = fopen(FileName, "rb");
+
+	if (!file)
+		return false;
+
+	fseek(file, 0, SEEK_END);
+	i64 fileSize = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	u8* data = new u8[fileSize];
+	bool read = fread(data, (size_t)fileSize, 1, file) == 1;
+	fclose(file);
+
+	if (!read || !PageIndexAttach(Index, data, fileSize))
+	{
+		delete[] data;
+		*Index = {};
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+bool PageIndexLoadLegacy(vsPageIndex* Index, const char* FileName, i32 MipCount)
+{
+	FILE* file = fopen(FileName, "rb");
+
+	if (!file)
+		return false;
+
+	i64 entryCount = 0;
+
+	for (i32 m = 0; m < MipCount; ++m)
+		entryCount += (i64)(1 << (MipCount - m - 1)) * (1 << (MipCount - m - 1));
+
+	i64* entries = new i64[entryCount];
+	i32 xrHeaderSize = 0;
+	u8 xrHeader[XR_META_SIZE];
+
+	bool valid = fread(entries, sizeof(i64), (size_t)entryCount, file) == (size_t)entryCount
+		&& fread(&xrHeaderSize, sizeof(i32), 1, file) == 1
+		&& xrHeaderSize == XR_META_SIZE
+		&& fread(xrHeader, XR_META_SIZE, 1, file) == 1;
+
+	// Constant page colours and the layout, older index files end after the header.
+	i32 constantCount = 0;
+	u32* constantColors = NULL;
+	i32 layout = PAGE_LAYOUT_ROW;
+
+	if (valid && fread(&constantCount, sizeof(i32), 1, file) == 1)
+	{
+		constantColors = new u32[constantCount * 2];
+		valid = fread(constantColors, sizeof(u32) * 2, constantCount, file) == (size_t)constantCount;
+		fread(&layout, sizeof(i32), 1, file);
+	}
+
+	fclose(file);
+
+	if (valid)
+		PageIndexCreate(Index, entries, MipCount, layout, xrHeader, xrHeaderSize, constantColors, constantCount);
+
+	delete[] entries;
+	delete[] constantColors;
+
+	return valid;
+}
+
+void PageIndexFree(vsPageIndex* Index)
+{
+#ifdef _WIN32
+	if (Index->mapping)
+	{
+		UnmapViewOfFile(Index->data);
+		CloseHandle((HANDLE)Index->mapping);
+		*Index = {};
+		return;
+	}
+#endif
+
+	delete[] Index->data;
+	*Index = {};
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "shared.h"
+
+// Compact page index, pages/index.vti. The file is loaded or mapped whole and used in place:
+//   header | per mip block tables | page blocks | JPEG XR header | constant page colours
+// Each mip is split into blocks of 8x8 pages. A block table holds one u32 per block, 0 when every page
+// in the block is empty, otherwise the block number + 1. Blocks hold the usual offset | size << 48 entries.
+#define PAGE_INDEX_MAGIC			0x58495456 // VTIX
+#define PAGE_INDEX_VERSION			1
+#define PAGE_INDEX_BLOCK_SIZE		8
+#define PAGE_INDEX_MAX_MIPS			16
+
+struct vsPageIndexHeader
+{
+	u32		magic;
+	u32		version;
+	i32		mipCount;
+	i32		layout;
+	i32		blockCount;
+	i32		xrHeaderSize;
+	i32		constantCount;
+	i32		reserved;
+	i32		blocksWide[PAGE_INDEX_MAX_MIPS];
+	i64		blockTableOffset[PAGE_INDEX_MAX_MIPS];
+	i64		blocksOffset;
+	i64		xrHeaderOffset;
+	i64		constantsOffset;
+	i64		fileSize;
+};
+
+struct vsPageIndex
+{
+	u8*					data;
+	vsPageIndexHeader*	header;
+	u32*				blockTables[PAGE_INDEX_MAX_MIPS];
+	i64*				blocks;
+	u8*					xrHeader;
+	u32*				constantColors;
+	// NOTE: Set when data is a mapped view of the file rather than a heap copy.
+	void*				mapping;
+};
+
+__forceinline i64 PageIndexGetEntry(vsPageIndex* Index, i32 X, i32 Y, i32 Mip)
+{
+	u32 block = Index->blockTables[Mip][(Y / PAGE_INDEX_BLOCK_SIZE) * Index->header->blocksWide[Mip] + (X / PAGE_INDEX_BLOCK_SIZE)];
+
+	if (block == 0)
+		return 0;
+
+	return Index->blocks[(i64)(block - 1) * PAGE_INDEX_BLOCK_SIZE * PAGE_INDEX_BLOCK_SIZE + (Y % PAGE_INDEX_BLOCK_SIZE) * PAGE_INDEX_BLOCK_SIZE + (X % PAGE_INDEX_BLOCK_SIZE)];
+}
+
+// Builds an index in memory from entries in the legacy order, each mip row by row starting at mip 0.
+void PageIndexCreate(vsPageIndex* Index, i64* Entries, i32 MipCount, i32 Layout, u8* XrHeader, i32 XrHeaderSize, u32* ConstantColors, i32 ConstantCount);
+bool PageIndexSave(vsPageIndex* Index, const char* FileName);
+// NOTE: Maps the file on Windows, other platforms read it with a single read.
+bool PageIndexLoad(vsPageIndex* Index, const char* FileName);
+// Reads a legacy index.dat, a flat table of every page followed by the JPEG XR header and constant colours.
+bool PageIndexLoadLegacy(vsPageIndex* Index, const char* FileName, i32 MipCount);
+void PageIndexFree(vsPageIndex* Index);
@@ -28,6 +28,8 @@ struct vsShaderParser
 	i32 includedFileCount;
 };
 
+static char scompDefines[1024];
+
 char* ReadFileWithNull(char* FileName, i32* DataSize)
 {
 	FILE *file = fopen(FileName, "rb");
@@ -255,7 +257,7 @@ i32 AppendText(char** Dst, i32 DstLen, char* Src, i32 SrcLen)
 	return newLen;
 }
 
-char* scompCompileShader(char* FileName, i32* DataSize, vsManagedDependency** DepList)
+static char* CompileShaderFile(char* FileName, i32* DataSize, vsManagedDependency** DepList)
 {
 	if (DepList != NULL)
 	{
@@ -341,7 +343,7 @@ char* scompCompileShader(char* FileName, i32* DataSize, vsManagedDependency** De
 					//std::cout << "Include file: " << includeFile << "\n";
 
 					i32 includeSize = 0;
-					char* includeData = scompCompileShader(includeFile, &includeSize, DepList);
+					char* includeData = CompileShaderFile(includeFile, &includeSize, DepList);
 
 					compositeDataLen = AppendText(&compositeData, compositeDataLen, shaderDataCompositePtr, (i32)(replaceStart - shaderDataCompositePtr));
 					compositeDataLen = AppendText(&compositeData, compositeDataLen, includeData, includeSize);
@@ -383,4 +385,42 @@ char* scompCompileShader(char* FileName, i32* DataSize, vsManagedDependency** De
 	delete[] shaderData;
 
 	return compositeData;
-}
\ No newline at end of file
+}
+
+void scompSetDefines(const char* Defines)
+{
+	assert(strlen(Defines) < sizeof(scompDefines));
+	strcpy(scompDefines, Defines);
+}
+
+char* scompCompileShader(char* FileName, i32* DataSize, vsManagedDependency** DepList)
+{
+	char* compositeData = CompileShaderFile(FileName, DataSize, DepList);
+
+	i32 definesLen = (i32)strlen(scompDefines);
+
+	if (compositeData == NULL || definesLen == 0)
+		return compositeData;
+
+	// NOTE: GLSL needs #version first, the defines go on the line after it.
+	char* insertAt = compositeData;
+	char* version = strstr(compositeData, "#version");
+
+	if (version != NULL)
+	{
+		insertAt = strchr(version, '\n');
+		insertAt = (insertAt != NULL) ? insertAt + 1 : compositeData + *DataSize;
+	}
+
+	i32 headLen = (i32)(insertAt - compositeData);
+	char* result = NULL;
+	i32 resultLen = 0;
+	resultLen = AppendText(&result, resultLen, compositeData, headLen);
+	resultLen = AppendText(&result, resultLen, scompDefines, definesLen);
+	resultLen = AppendText(&result, resultLen, insertAt, *DataSize + 1 - headLen);
+	*DataSize = resultLen - 1;
+
+	delete[] compositeData;
+
+	return result;
+}
@@ -2,4 +2,6 @@
 
 #include "shared.h"
 
+// Defines are added to every shader compiled after this, straight after the #version line.
+void scompSetDefines(const char* Defines);
 char* scompCompileShader(char* FileName, i32* DataSize, vsManagedDependency** DepList = NULL);
@@ -6,6 +6,11 @@
 #include <iostream>
 #include <assert.h>
 
+#ifndef _MSC_VER
+#define __forceinline inline __attribute__((always_inline))
+#define _fseeki64 fseeko
+#endif
+
 #define ARRAY_COUNT(X) (sizeof(X) / sizeof(X[0]))
 
 typedef uint8_t		u8;
@@ -29,6 +34,17 @@ typedef double		f64;
 #define XR_META_ALPHA_OFFSET		126
 #define XR_META_ALPHA_SIZE			138
 
+// NOTE: Index entries are offset | size << 48. A constant page stores the index of its colour
+// pair in the constant table instead of an offset, duplicate pages share the offset of the first copy.
+#define PAGE_INDEX_SIZE_EMPTY		0
+#define PAGE_INDEX_SIZE_CONSTANT	0xFFFF
+
+// Order of the pages in page.dat, recorded after the constant colours in index.dat. Row layout writes
+// each mip in rows, coarsest last. Morton layout walks the mip quadtree depth first in Z order, so
+// neighbouring pages are close together and each page sits just before its children.
+#define PAGE_LAYOUT_ROW				0
+#define PAGE_LAYOUT_MORTON			1
+
 struct vsManagedDependency
 {
 	char Name[128];
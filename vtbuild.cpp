@@ -0,0 +1,118 @@
+// Headless virtual texture page builder, builds pages from a text manifest without a window or GL context.
+//
+// Usage: vtbuild <manifest> <output directory> [-full] [-rowlayout]
+//
+// Windows: build the vtbuild project in OGL.sln.
+// Linux: g++ -O2 -std=c++17 -mssse3 -D__ANSI__ -I/usr/include/jxrlib vtbuild.cpp pageBuilder.cpp pageIndex.cpp mipReduce.cpp hdp.cpp -ljxrglue -ljpegxr -lpthread -o vtbuild
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "pageBuilder.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+//-----------------------------------------------------------------------------------------------------------
+// Platform.
+//-----------------------------------------------------------------------------------------------------------
+double GetTime()
+{
+	static std::chrono::steady_clock::time_point timeStart = std::chrono::steady_clock::now();
+
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - timeStart).count();
+}
+
+i32 GetMin(i32 A, i32 B)
+{
+	if (A <= B)
+		return A;
+	else
+		return B;
+}
+
+i32 GetMax(i32 A, i32 B)
+{
+	if (A >= B)
+		return A;
+	else
+		return B;
+}
+
+u8* CreateImageFromFile(const char* FileName, i32* Width, i32* Height, i32 PixelType)
+{
+	int width, height, channels;
+
+	double imgTime = GetTime();
+	stbi_uc* data = stbi_load(FileName, &width, &height, &channels, PixelType);
+	imgTime = GetTime() - imgTime;
+
+	std::cout << "Loaded " << FileName << " in " << (imgTime * 1000) << "ms\n";
+
+	if (data == NULL)
+		return NULL;
+
+	if (Width != NULL)
+		*Width = width;
+
+	if (Height != NULL)
+		*Height = height;
+
+	return data;
+}
+
+void FreeImage(u8* ImageData)
+{
+	stbi_image_free(ImageData);
+}
+
+//-----------------------------------------------------------------------------------------------------------
+// Entry point.
+//-----------------------------------------------------------------------------------------------------------
+int main(int ArgCount, char** Args)
+{
+	if (ArgCount < 3)
+	{
+		std::cout << "Usage: vtbuild <manifest> <output directory> [-full] [-rowlayout]\n";
+		return 1;
+	}
+
+	bool fullRebuild = false;
+	i32 layout = PAGE_LAYOUT_MORTON;
+
+	for (i32 i = 3; i < ArgCount; ++i)
+	{
+		if (strcmp(Args[i], "-full") == 0)
+		{
+			fullRebuild = true;
+		}
+		else if (strcmp(Args[i], "-rowlayout") == 0)
+		{
+			layout = PAGE_LAYOUT_ROW;
+		}
+		else
+		{
+			std::cout << "Unknown option " << Args[i] << "\n";
+			return 1;
+		}
+	}
+
+	// NOTE: Fails harmlessly if the directory is already there.
+#ifdef _WIN32
+	_mkdir(Args[2]);
+#else
+	mkdir(Args[2], 0755);
+#endif
+
+	if (!BuildPagesFromManifest(Args[1], Args[2], fullRebuild, layout))
+		return 1;
+
+	return 0;
+}